@@ -42,10 +42,66 @@ void DisplayWindow::Initialize() {
   timing.prev_cycles = timer.GetCurrentCycles();
   
 
-  gpu = new emulation::psx::GpuMiniVE();
+  if (strstr(GetCommandLine(),"-gpu=soft") != nullptr) {
+    auto soft = new emulation::psx::GpuSoft();
+    soft->set_threaded(strstr(GetCommandLine(),"-gpu-thread") != nullptr);
+    const char* render_threads = strstr(GetCommandLine(),"-gpu-tiles=");
+    if (render_threads != nullptr)
+      soft->set_render_threads(atoi(render_threads + strlen("-gpu-tiles=")));
+    const char* scale = strstr(GetCommandLine(),"-gpu-scale=");
+    if (scale != nullptr)
+      soft->set_resolution_scale(atoi(scale + strlen("-gpu-scale=")));
+    gpu = soft;
+  } else
+    gpu = new emulation::psx::GpuMiniVE();
+  //-gpu-record=<dump> [-gpu-record-frames=first,count] dumps the GPU command stream
+  const char* record = strstr(GetCommandLine(),"-gpu-record=");
+  if (record != nullptr) {
+    char filename[MAX_PATH];
+    int first_frame = 0, frame_count = 60;
+    sscanf(record + strlen("-gpu-record="),"%259s",filename);
+    const char* frames = strstr(GetCommandLine(),"-gpu-record-frames=");
+    if (frames != nullptr)
+      sscanf(frames + strlen("-gpu-record-frames="),"%d,%d",&first_frame,&frame_count);
+    gpu = new emulation::psx::GpuRecorder(gpu,filename,first_frame,frame_count);
+  }
   gpu->set_handle(handle());
+  //-audio-wav=<file> writes the sound to a WAV file, without it or when the file
+  //can't be created the sound is dropped
+  audio_sink = nullptr;
+  const char* wav = strstr(GetCommandLine(),"-audio-wav=");
+  if (wav != nullptr) {
+    char filename[MAX_PATH];
+    sscanf(wav + strlen("-audio-wav="),"%259s",filename);
+    auto sink = new emulation::psx::WavSink();
+    if (sink->Open(filename,emulation::psx::Spu::kSampleRate) == S_OK)
+      audio_sink = sink;
+    else
+      SafeDelete(&sink);
+  }
+  if (audio_sink == nullptr)
+    audio_sink = new emulation::psx::NullSink();
+  audio.Initialize(audio_sink,emulation::psx::Spu::kSampleRate,2048);
+  psx_sys.spu().set_output(&audio);
   psx_sys.set_gpu_core(gpu);
   psx_sys.Initialize();
+  //-cd=<cue, bin or pcd> puts a disc in the drive, -cd-compress=<pcd> also writes
+  //it as a compressed image
+  disc = nullptr;
+  const char* cd = strstr(GetCommandLine(),"-cd=");
+  if (cd != nullptr) {
+    char filename[MAX_PATH];
+    sscanf(cd + strlen("-cd="),"%259s",filename);
+    disc = emulation::psx::DiscImage::Open(filename);
+    const char* compress = strstr(GetCommandLine(),"-cd-compress=");
+    if (disc != nullptr && compress != nullptr) {
+      sscanf(compress + strlen("-cd-compress="),"%259s",filename);
+      emulation::psx::CompressedImage::Create(disc,filename);
+    }
+    if (disc != nullptr)
+      disc = new emulation::psx::PrefetchImage(disc);
+    psx_sys.cdrom().set_disc(disc);
+  }
   psx_sys.Run();
  // psx_sys.LoadPsExe("D:\\Personal\\Projects\\PsxEmu\\test\\vblank\\VBLANK.EXE");
   Show();
@@ -107,6 +163,12 @@ void DisplayWindow::Step() {
 
 }
 
+void DisplayWindow::ShowFps(double fps) {
+  char caption[256];
+  sprintf_s(caption,"FPS: %02.3f",fps);
+  SetWindowText(handle(),caption);
+}
+
 int DisplayWindow::OnCreate(WPARAM wParam,LPARAM lParam) {
   return 0;
 }
@@ -114,7 +176,10 @@ int DisplayWindow::OnCreate(WPARAM wParam,LPARAM lParam) {
 int DisplayWindow::OnDestroy(WPARAM wParam,LPARAM lParam) {
   psx_sys.Stop();
   psx_sys.Deinitialize();
+  SafeDelete(&disc);
   SafeDelete(&gpu);
+  audio.Deinitialize();
+  SafeDelete(&audio_sink);
   PostQuitMessage(0);
   return 0;
 }
@@ -37,13 +37,17 @@ class DisplayWindow: public core::windows::Window {
     ~DisplayWindow();
     void Initialize();
     void Step();
+    void ShowFps(double fps);
    protected:
     int OnCreate(WPARAM wParam,LPARAM lParam);
     int OnDestroy(WPARAM wParam,LPARAM lParam);
     int OnCommand(WPARAM wParam,LPARAM lParam);
   private:
     emulation::psx::System psx_sys;
-    emulation::psx::GpuMiniVE* gpu;
+    emulation::psx::GpuCore* gpu;
+    emulation::psx::AudioOutput audio;
+    emulation::psx::AudioSink* audio_sink;
+    emulation::psx::DiscImage* disc;
     utilities::Timer timer;
     struct {
       uint64_t extra_cycles;
@@ -0,0 +1,240 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+namespace emulation {
+namespace psx {
+
+WavSink::WavSink() : fp_(nullptr),sample_rate_(0),data_size_(0) {
+
+}
+
+WavSink::~WavSink() {
+  Close();
+}
+
+int WavSink::Open(const char* filename,int sample_rate) {
+  Close();
+  fp_ = fopen(filename,"wb");
+  if (fp_ == nullptr)
+    return E_FAIL;
+  sample_rate_ = sample_rate;
+  data_size_ = 0;
+  WriteHeader();
+  return S_OK;
+}
+
+void WavSink::Close() {
+  if (fp_ == nullptr)
+    return;
+  fseek(fp_,0,SEEK_SET);
+  WriteHeader();
+  fclose(fp_);
+  fp_ = nullptr;
+}
+
+void WavSink::Write(const int16_t* samples,int count) {
+  if (fp_ == nullptr)
+    return;
+  fwrite(samples,sizeof(int16_t)*2,count,fp_);
+  data_size_ += count * sizeof(int16_t) * 2;
+}
+
+void WavSink::WriteHeader() {
+  struct {
+    char riff[4];
+    uint32_t riff_size;
+    char wave[4];
+    char fmt[4];
+    uint32_t fmt_size;
+    uint16_t format;
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint32_t byte_rate;
+    uint16_t block_align;
+    uint16_t bits;
+    char data[4];
+    uint32_t data_size;
+  } header;
+  memcpy(header.riff,"RIFF",4);
+  header.riff_size = 36 + data_size_;
+  memcpy(header.wave,"WAVE",4);
+  memcpy(header.fmt,"fmt ",4);
+  header.fmt_size = 16;
+  header.format = 1;
+  header.channels = 2;
+  header.sample_rate = sample_rate_;
+  header.byte_rate = sample_rate_ * 4;
+  header.block_align = 4;
+  header.bits = 16;
+  memcpy(header.data,"data",4);
+  header.data_size = data_size_;
+  fwrite(&header,sizeof(header),1,fp_);
+}
+
+AudioOutput::AudioOutput() : sink_(nullptr),realtime_(true),sample_rate_(0),target_fill_(0),phase_(0),average_error_(0),
+  starved_(true),thread_(nullptr) {
+  frames_[0] = frames_[1] = 0;
+  correction_ = 0;
+  underruns_ = 0;
+  dropped_ = 0;
+  written_ = 0;
+  exit_ = false;
+}
+
+AudioOutput::~AudioOutput() {
+  Deinitialize();
+}
+
+int AudioOutput::Initialize(AudioSink* sink,int sample_rate,uint32_t target_fill) {
+  Deinitialize();
+  sink_ = sink;
+  realtime_ = sink->realtime();
+  sample_rate_ = sample_rate;
+  target_fill_ = target_fill < kRingSize / 2 ? target_fill : kRingSize / 2;
+  ring_.Consume(ring_.size());
+  frames_[0] = frames_[1] = 0;
+  phase_ = 0;
+  average_error_ = 0;
+  starved_ = true;
+  correction_ = 0;
+  underruns_ = 0;
+  dropped_ = 0;
+  written_ = 0;
+  exit_ = false;
+  if (realtime_)
+    thread_ = new std::thread(AudioOutput::thread_func,this);
+  return S_OK;
+}
+
+int AudioOutput::Deinitialize() {
+  if (thread_ != nullptr) {
+    exit_ = true;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wake_.notify_one();
+    }
+    thread_->join();
+    SafeDelete(&thread_);
+  }
+  return S_OK;
+}
+
+void AudioOutput::Push(const int16_t* samples,int count) {
+  if (!realtime_) {
+    sink_->Write(samples,count);
+    written_.fetch_add(count,std::memory_order_relaxed);
+    return;
+  }
+  uint32_t frames[256];
+  while (count > 0) {
+    int n = count < 256 ? count : 256;
+    for (int i=0;i<n;++i)
+      frames[i] = (uint16_t)samples[i*2] | ((uint32_t)(uint16_t)samples[i*2+1] << 16);
+    uint32_t pushed = ring_.Push(frames,n);
+    if (pushed != (uint32_t)n)
+      dropped_.fetch_add(n - pushed,std::memory_order_relaxed);
+    samples += n * 2;
+    count -= n;
+  }
+}
+
+/*
+  The fill error is averaged over a few periods so the ratio follows the drift
+  between the emulation and the sink, not the burst of every emulated frame.
+*/
+void AudioOutput::UpdateRatio() {
+  double error = ((double)ring_.size() - target_fill_) / target_fill_;
+  average_error_ += (error - average_error_) * 0.1;
+  double correction = average_error_ * kMaxCorrection;
+  correction = correction < -kMaxCorrection ? -kMaxCorrection : (correction > kMaxCorrection ? kMaxCorrection : correction);
+  correction_.store((int32_t)correction,std::memory_order_relaxed);
+}
+
+bool AudioOutput::PopFrame(uint32_t* frame) {
+  const uint32_t* items;
+  if (ring_.Peek(&items) == 0)
+    return false;
+  *frame = items[0];
+  ring_.Consume(1);
+  return true;
+}
+
+//linear interpolation between the two current input frames
+void AudioOutput::Resample(int16_t* samples,int count) {
+  double step = ratio();
+  for (int i=0;i<count;++i) {
+    if (starved_) {
+      if (ring_.size() < target_fill_) {
+        samples[i*2] = samples[i*2+1] = 0;
+        continue;
+      }
+      starved_ = false;
+      PopFrame(&frames_[0]);
+      PopFrame(&frames_[1]);
+      phase_ = 0;
+    }
+    for (int side=0;side<2;++side) {
+      int32_t s0 = (int16_t)(frames_[0] >> (side * 16));
+      int32_t s1 = (int16_t)(frames_[1] >> (side * 16));
+      samples[i*2+side] = (int16_t)(s0 + (int32_t)((s1 - s0) * phase_));
+    }
+    phase_ += step;
+    while (phase_ >= 1.0) {
+      phase_ -= 1.0;
+      frames_[0] = frames_[1];
+      if (!PopFrame(&frames_[1])) {
+        starved_ = true;
+        underruns_.fetch_add(1,std::memory_order_relaxed);
+        break;
+      }
+    }
+  }
+}
+
+/*
+  Periods are due at fixed times from the start, a thread that falls more than a
+  second behind starts counting again from now instead of catching up.
+*/
+void AudioOutput::thread_func(AudioOutput* output) {
+  int16_t samples[kPeriod*2];
+  auto start = std::chrono::steady_clock::now();
+  uint64_t periods = 0;
+  while (!output->exit_) {
+    auto now = std::chrono::steady_clock::now();
+    auto due = start + std::chrono::microseconds((periods + 1) * kPeriod * 1000000 / output->sample_rate_);
+    if (now < due) {
+      std::unique_lock<std::mutex> lock(output->mutex_);
+      output->wake_.wait_until(lock,due);
+      continue;
+    }
+    if (now - due > std::chrono::seconds(1)) {
+      start = now;
+      periods = 0;
+    }
+    output->UpdateRatio();
+    output->Resample(samples,kPeriod);
+    output->sink_->Write(samples,kPeriod);
+    output->written_.fetch_add(kPeriod,std::memory_order_relaxed);
+    ++periods;
+  }
+}
+
+}
+}
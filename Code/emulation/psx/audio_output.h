@@ -0,0 +1,121 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  Where the audio goes, count stereo frames of 16bit samples with left first.
+  Write is called from the output thread for a real-time sink and from Push on
+  the emulation thread for an offline one.
+*/
+class AudioSink {
+ public:
+  virtual ~AudioSink() {}
+  //false for sinks without a clock of their own, they get the pushed frames as they are
+  virtual bool realtime() const { return true; }
+  virtual void Write(const int16_t* samples,int count) = 0;
+};
+
+//drops everything, for running without a sound device
+class NullSink : public AudioSink {
+ public:
+  NullSink() : frames_(0) {}
+  bool realtime() const { return false; }
+  void Write(const int16_t* samples,int count) { frames_ += count; }
+  uint64_t frames() const { return frames_; }
+ private:
+  uint64_t frames_;
+};
+
+//16bit stereo PCM WAV file, the sizes in the header are written by Close
+class WavSink : public AudioSink {
+ public:
+  WavSink();
+  ~WavSink();
+  int Open(const char* filename,int sample_rate);
+  void Close();
+  //a capture is the emulated output sample for sample
+  bool realtime() const { return false; }
+  void Write(const int16_t* samples,int count);
+ private:
+  void WriteHeader();
+  FILE* fp_;
+  int sample_rate_;
+  uint32_t data_size_;
+};
+
+/*
+  Takes the SPU output on the emulation thread and plays it on an output thread.
+  Push never blocks, it puts the frames in a lock free ring and drops what doesn't
+  fit. The output thread writes a period to the sink every 10ms of wall time,
+  resampling the ring by up to 0.5% faster or slower to keep it at the target fill,
+  so the emulation speed doesn't have to follow the sink clock exactly. When the
+  ring runs dry the thread plays silence until it is at the target fill again.
+  An offline sink has no output thread, Push writes the frames to it unmodified.
+*/
+class AudioOutput {
+ public:
+  //in stereo frames
+  static const uint32_t kRingSize = 8192;
+  static const int kPeriod = 441;
+  //largest resampling correction, in millionths
+  static const int32_t kMaxCorrection = 5000;
+  AudioOutput();
+  ~AudioOutput();
+  int Initialize(AudioSink* sink,int sample_rate,uint32_t target_fill);
+  int Deinitialize();
+  //emulation thread side
+  void Push(const int16_t* samples,int count);
+  //telemetry, readable from any thread
+  uint32_t fill() const { return ring_.size(); }
+  uint32_t target_fill() const { return target_fill_; }
+  uint64_t underruns() const { return underruns_.load(std::memory_order_relaxed); }
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+  uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+  //input frames consumed per output frame
+  double ratio() const { return 1.0 + correction_.load(std::memory_order_relaxed) / 1000000.0; }
+ private:
+  static void thread_func(AudioOutput* output);
+  void UpdateRatio();
+  void Resample(int16_t* samples,int count);
+  bool PopFrame(uint32_t* frame);
+  SpscRing<uint32_t,kRingSize> ring_;
+  AudioSink* sink_;
+  bool realtime_;
+  int sample_rate_;
+  uint32_t target_fill_;
+  //output thread state, the two frames being interpolated and the position between them
+  uint32_t frames_[2];
+  double phase_;
+  double average_error_;
+  bool starved_;
+  std::atomic<int32_t> correction_;
+  std::atomic<uint64_t> underruns_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> written_;
+  std::thread* thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::atomic<bool> exit_;
+};
+
+}
+}
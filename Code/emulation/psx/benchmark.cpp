@@ -0,0 +1,617 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+namespace emulation {
+namespace psx {
+
+static void Report(const char* name,const LARGE_INTEGER& start,const LARGE_INTEGER& end,int count) {
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  double ns = double(end.QuadPart - start.QuadPart) * 1000000000.0 / double(freq.QuadPart) / count;
+  char debug_str[256];
+  sprintf(debug_str,"%-32s %8.2f ns/op\n",name,ns);
+  OutputDebugString(debug_str);
+}
+
+//the hash of the output goes in the name, FAILED when it differs from the reference run
+static void ReportHash(const char* name,uint32_t hash,uint32_t reference,const LARGE_INTEGER& start,
+                       const LARGE_INTEGER& end,int count) {
+  char hashed[96];
+  sprintf(hashed,"%s %08x%s",name,hash,hash != reference ? " FAILED" : "");
+  Report(hashed,start,end,count);
+}
+
+void RunBenchmarks() {
+  BenchmarkGte();
+  BenchmarkGpuSoft();
+  BenchmarkScanout();
+  BenchmarkSpu();
+  BenchmarkSpuReverb();
+  BenchmarkDiscLz();
+}
+
+/*
+  Each command is checked against the scalar result, then timed once per SIMD
+  level, with and without a CFC2 FLAG read after every command (the read is
+  what materialises the lazy FLAG).
+*/
+void BenchmarkGte() {
+  static const struct {
+    const char* name;
+    uint32_t code;
+  } commands[] = {
+    { "RTPS",  0x4A180001 },
+    { "RTPT",  0x4A280030 },
+    { "MVMVA", 0x4A486012 },
+    { "NCDS",  0x4AE80413 },
+    { "NCDT",  0x4AF80416 },
+    { "NCCT",  0x4B08043F },
+    { "AVSZ3", 0x4B58002D },
+  };
+  static const char* levels[] = { "scalar", "sse4.1", "avx2" };
+  const int count = 1000000;
+  char name[64];
+  LARGE_INTEGER pc1,pc2;
+
+  GTE gte;
+  gte.Initialize();
+  SimdLevel support = gte.simd_level();
+
+  //identity-ish rotation, light and color matrices with a translated model
+  const uint32_t control[32] = {
+    0x00000FA0, 0x00000000, 0x0FA00000, 0x00000000, 0x00000FA0,
+    0x00000040, 0xFFFFFF80, 0x00000C00,
+    0x08000800, 0x00000800, 0x08000800, 0x00000800, 0x00000800,
+    0x00000100, 0x00000080, 0x00000040,
+    0x10000C00, 0x08000000, 0x00000C00, 0x0C000000, 0x00001000,
+    0x00000800, 0x00000400, 0x00000200,
+    0x01400000, 0x00F00000, 0x00000200, 0xFFFFFF00, 0x01400000,
+    0x00000155, 0x00000100, 0
+  };
+  const uint32_t data[12] = {
+    0x00400020, 0xFFE0, 0xFFC00040, 0x0030, 0x00200010, 0x0060,
+    0x30808080, 0, 0x800, 0x100, 0x200, 0x300
+  };
+
+  uint32_t reference[sizeof(commands)/sizeof(commands[0])];
+  for (int level=kSimdNone;level<=support;++level) {
+    gte.set_simd_level((SimdLevel)level);
+    for (size_t i=0;i<sizeof(commands)/sizeof(commands[0]);++i) {
+      for (int r=0;r<31;++r)
+        gte.WriteControl(r,control[r]);
+      //the screen xy, z and color fifos carry over from the previous run
+      for (int r=12;r<28;++r)
+        if (r != 15)
+          gte.WriteData(r,0);
+      for (int r=0;r<12;++r)
+        gte.WriteData(r,data[r]);
+      //one run from the inputs, the data registers and FLAG have to match the scalar ones
+      gte.ExecuteCommand(commands[i].code);
+      uint32_t hash = 0;
+      for (int r=0;r<32;++r)
+        hash = hash * 31 + gte.ReadData(r);
+      hash = hash * 31 + gte.ReadControl(31);
+      if (level == kSimdNone)
+        reference[i] = hash;
+
+      QueryPerformanceCounter(&pc1);
+      for (int n=0;n<count;++n)
+        gte.ExecuteCommand(commands[i].code);
+      QueryPerformanceCounter(&pc2);
+      sprintf(name,"gte %s %s",commands[i].name,levels[level]);
+      ReportHash(name,hash,reference[i],pc1,pc2,count);
+
+      uint32_t flags = 0;
+      QueryPerformanceCounter(&pc1);
+      for (int n=0;n<count;++n) {
+        gte.ExecuteCommand(commands[i].code);
+        flags |= gte.ReadControl(31);
+      }
+      QueryPerformanceCounter(&pc2);
+      sprintf(name,"gte %s %s +flag(%08X)",commands[i].name,levels[level],flags);
+      Report(name,pc1,pc2,count);
+    }
+  }
+  gte.Deinitialize();
+}
+
+/*
+  Draws a fixed batch of primitives into a 320x240 area per SIMD level,
+  timed per primitive including GP0 parsing, then through the worker thread and
+  the tile binned renderer.
+*/
+void BenchmarkGpuSoft() {
+  static const struct {
+    const char* name;
+    int size;
+    uint32_t words[12];
+  } primitives[] = {
+    { "flat tri",      4,  { 0x20FF8040, 0x00100010, 0x00D00030, 0x00600130 } },
+    { "gouraud tri",   6,  { 0x30FF0000, 0x00100010, 0x0000FF00, 0x00D00030, 0x000000FF, 0x00600130 } },
+    { "textured quad", 9,  { 0x2C808080, 0x00100010, 0x78000000, 0x00100110, 0x008800FF, 0x00E00010, 0x0000FF00, 0x00E00110, 0x0000FFFF } },
+    { "gouraud tex tri", 9, { 0x34FF8080, 0x00100010, 0x78000000, 0x0088FF80, 0x00D00030, 0x000000FF, 0x008080FF, 0x00600130, 0x0000FF00 } },
+    { "semi rect",     3,  { 0x62804020, 0x00200020, 0x00C00100 } },
+    { "gouraud line",  4,  { 0x50FF0000, 0x00000000, 0x000000FF, 0x00EF013F } },
+  };
+  static const char* levels[] = { "scalar", "sse4.1", "avx2" };
+  const int count = 2000;
+  char name[64];
+  LARGE_INTEGER pc1,pc2;
+
+  GpuSoft gpu;
+  gpu.Initialize();
+  SimdLevel support = gpu.simd_level();
+  //8bpp texture page at 512,0 filled with a pattern, CLUT at 0,480
+  gpu.WriteData(0xA0000000);
+  gpu.WriteData(0x00000200);
+  gpu.WriteData(0x01000040);
+  for (int i=0;i<0x40*0x100/2;++i)
+    gpu.WriteData(0x01010101 * (i & 0xFF));
+  gpu.WriteData(0xA0000000);
+  gpu.WriteData(0x01E00000);
+  gpu.WriteData(0x00010100);
+  for (int i=0;i<0x80;++i)
+    gpu.WriteData(0x80008000 | ((i*2) & 0x7FFF) | (((i*2+1) & 0x7FFF) << 16));
+  gpu.WriteData(0xE1000288);
+  gpu.WriteData(0xE3000000);
+  gpu.WriteData(0xE4000000 | 319 | (239 << 10));
+  gpu.WriteData(0xE5000000);
+
+  for (int level=kSimdNone;level<=support;++level) {
+    gpu.set_simd_level((SimdLevel)level);
+    for (size_t i=0;i<sizeof(primitives)/sizeof(primitives[0]);++i) {
+      QueryPerformanceCounter(&pc1);
+      for (int n=0;n<count;++n)
+        for (int w=0;w<primitives[i].size;++w)
+          gpu.WriteData(primitives[i].words[w]);
+      QueryPerformanceCounter(&pc2);
+      sprintf(name,"gpu %s %s",primitives[i].name,levels[level]);
+      Report(name,pc1,pc2,count);
+    }
+  }
+
+  //producer side cost on the CPU thread and the total including the final sync
+  gpu.set_threaded(true);
+  for (size_t i=0;i<sizeof(primitives)/sizeof(primitives[0]);++i) {
+    LARGE_INTEGER pc3;
+    QueryPerformanceCounter(&pc1);
+    for (int n=0;n<count;++n)
+      for (int w=0;w<primitives[i].size;++w)
+        gpu.WriteData(primitives[i].words[w]);
+    QueryPerformanceCounter(&pc2);
+    gpu.Sync();
+    QueryPerformanceCounter(&pc3);
+    sprintf(name,"gpu %s threaded submit",primitives[i].name);
+    Report(name,pc1,pc2,count);
+    sprintf(name,"gpu %s threaded total",primitives[i].name);
+    Report(name,pc1,pc3,count);
+  }
+  gpu.set_threaded(false);
+
+  //tile binned rendering, including the flush
+  for (int threads=2;threads<=8;threads*=2) {
+    gpu.set_render_threads(threads);
+    for (size_t i=0;i<sizeof(primitives)/sizeof(primitives[0]);++i) {
+      QueryPerformanceCounter(&pc1);
+      for (int n=0;n<count;++n)
+        for (int w=0;w<primitives[i].size;++w)
+          gpu.WriteData(primitives[i].words[w]);
+      gpu.Sync();
+      QueryPerformanceCounter(&pc2);
+      sprintf(name,"gpu %s binned x%d",primitives[i].name,threads);
+      Report(name,pc1,pc2,count);
+    }
+  }
+  gpu.set_render_threads(1);
+
+  //256x256 texture upload as a DMA block transfer would send it, word by word and as one span
+  const int upload_count = 50;
+  std::vector<uint32_t> upload(3 + 256*256/2);
+  upload[0] = 0xA0000000;
+  upload[1] = 0x00000200;
+  upload[2] = 0x01000100;
+  for (size_t i=3;i<upload.size();++i)
+    upload[i] = (uint32_t)i * 0x00010001;
+  QueryPerformanceCounter(&pc1);
+  for (int n=0;n<upload_count;++n)
+    for (size_t w=0;w<upload.size();++w)
+      gpu.WriteData(upload[w]);
+  QueryPerformanceCounter(&pc2);
+  Report("gpu upload 256x256 words",pc1,pc2,upload_count);
+  QueryPerformanceCounter(&pc1);
+  for (int n=0;n<upload_count;++n)
+    gpu.WriteDataSpan(upload.data(),upload.size());
+  QueryPerformanceCounter(&pc2);
+  Report("gpu upload 256x256 span",pc1,pc2,upload_count);
+  gpu.Deinitialize();
+}
+
+void BenchmarkScanout() {
+  static const struct {
+    const char* name;
+    uint32_t mode;
+    uint32_t range_x;
+    uint32_t range_y;
+  } modes[] = {
+    { "320x240 15bit", 0x08000001, 0x06000000 | 0x260 | ((0x260 + 320*8) << 12), 0x07000000 | 0x10 | ((0x10 + 240) << 10) },
+    { "640x480 15bit", 0x08000027, 0x06000000 | 0x260 | ((0x260 + 640*4) << 12), 0x07000000 | 0x10 | ((0x10 + 240) << 10) },
+    { "320x240 24bit", 0x08000011, 0x06000000 | 0x260 | ((0x260 + 320*8) << 12), 0x07000000 | 0x10 | ((0x10 + 240) << 10) },
+  };
+  static const char* levels[] = { "scalar", "sse4.1", "avx2" };
+  const int count = 200;
+  char name[64];
+  LARGE_INTEGER pc1,pc2;
+
+  GpuSoft gpu;
+  gpu.Initialize();
+  SimdLevel support = gpu.simd_level();
+  for (int i=0;i<GpuSoft::kVramWidth*GpuSoft::kVramHeight;++i)
+    gpu.vram()[i] = (uint16_t)(i * 0x9E37);
+  std::vector<uint32_t> pixels(640*480);
+  gpu.WriteStatus(0x03000000);
+  for (size_t i=0;i<sizeof(modes)/sizeof(modes[0]);++i) {
+    gpu.WriteStatus(modes[i].mode);
+    gpu.WriteStatus(modes[i].range_x);
+    gpu.WriteStatus(modes[i].range_y);
+    for (int level=kSimdNone;level<=support;++level) {
+      gpu.set_simd_level((SimdLevel)level);
+      QueryPerformanceCounter(&pc1);
+      for (int n=0;n<count;++n) {
+        gpu.InvalidateScanout();
+        gpu.Scanout(pixels.data(),640);
+      }
+      QueryPerformanceCounter(&pc2);
+      sprintf(name,"scanout %s %s",modes[i].name,levels[level]);
+      Report(name,pc1,pc2,count);
+    }
+    //nothing written since the last frame
+    QueryPerformanceCounter(&pc1);
+    for (int n=0;n<count;++n)
+      gpu.Scanout(pixels.data(),640);
+    QueryPerformanceCounter(&pc2);
+    sprintf(name,"scanout %s unchanged",modes[i].name);
+    Report(name,pc1,pc2,count);
+  }
+  //double buffered static picture, the display start flips between two equal halves
+  gpu.WriteStatus(modes[0].mode);
+  gpu.WriteStatus(modes[0].range_x);
+  gpu.WriteStatus(modes[0].range_y);
+  gpu.WriteData(0x80000000);
+  gpu.WriteData(0);
+  gpu.WriteData(256 << 16);
+  gpu.WriteData(320 | (240 << 16));
+  QueryPerformanceCounter(&pc1);
+  for (int n=0;n<count;++n) {
+    gpu.WriteStatus(0x05000000 | ((n & 1) << 18));
+    gpu.Scanout(pixels.data(),640);
+  }
+  QueryPerformanceCounter(&pc2);
+  Report("scanout 320x240 15bit flipped",pc1,pc2,count);
+  gpu.Deinitialize();
+}
+
+//reverb registers from 1F801DC0h for a small room, the work area starts at FB28h
+static const uint16_t kReverbRoom[32] = {
+  0x007D, 0x005B, 0x6D80, 0x54B8, 0xBED0, 0x0000, 0x0000, 0xBA80, 0x5800, 0x5300, 0x04D6, 0x0333,
+  0x03F0, 0x0227, 0x0374, 0x01EF, 0x0334, 0x01B5, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+  0x0000, 0x0000, 0x01B4, 0x0136, 0x00B8, 0x005C, 0x8000, 0x8000
+};
+
+/*
+  All 24 voices playing looped ADPCM at different pitches, a few of them with
+  sweeping volumes, FM or noise, half of them through the reverb. One op is one
+  emulated second of output, the hash of the output is in the name. The scalar
+  run without the decoded block cache is the reference, any level or cached run
+  that differs is FAILED.
+*/
+void BenchmarkSpu() {
+  static const char* levels[] = { "scalar", "sse4.1", "avx2" };
+  const int seconds = 2;
+  char name[64];
+  LARGE_INTEGER pc1,pc2;
+
+  Spu spu;
+  spu.Initialize();
+  SimdLevel support = spu.simd_level();
+  std::vector<int16_t> samples(Spu::kSampleRate*2*seconds);
+  uint32_t reference = 0;
+  for (int run=0;run<=support+2;++run) {
+    //scalar without the cache first, then every level with the cache and the
+    //best one without it
+    int level = run == 0 ? kSimdNone : (run <= support + 1 ? run - 1 : support);
+    bool cached = run != 0 && run <= support + 1;
+    spu.Deinitialize();
+    spu.Initialize();
+    spu.set_simd_level((SimdLevel)level);
+    spu.set_block_cache_size(cached ? Spu::kBlockCacheSize : 0);
+    //8 looping 16 block samples with different filters
+    uint8_t* ram = spu.sound_ram();
+    uint32_t seed = 1;
+    for (int block=0;block<128;++block) {
+      uint8_t* data = &ram[0x1000 + block*16];
+      data[0] = (uint8_t)(((block >> 1) % 5) << 4 | (block % 10 + 2));
+      data[1] = (block & 15) == 0 ? 0x4 : ((block & 15) == 15 ? 0x3 : 0);
+      for (int i=2;i<16;++i) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+      }
+    }
+    spu.WriteRegister(0x1F801DAA,0xC080);
+    for (int i=0;i<32;++i)
+      spu.WriteRegister(0x1F801DC0 + i*2,kReverbRoom[i]);
+    spu.WriteRegister(0x1F801DA2,0xFB28);
+    spu.WriteRegister(0x1F801D84,0x2000);
+    spu.WriteRegister(0x1F801D86,0x2000);
+    spu.WriteRegister(0x1F801D98,0x5555);
+    spu.WriteRegister(0x1F801D9A,0x0055);
+    spu.WriteRegister(0x1F801D80,0x3FFF);
+    spu.WriteRegister(0x1F801D82,0x3FFF);
+    for (int v=0;v<Spu::kVoiceCount;++v) {
+      uint32_t base = 0x1F801C00 + v*16;
+      spu.WriteRegister(base + 0x0,v % 6 == 5 ? 0xC000 | (v * 3) : 0x1000 + v * 0x100);
+      spu.WriteRegister(base + 0x2,v % 7 == 3 ? 0xA000 | (v * 2) : 0x2800 - v * 0x80);
+      spu.WriteRegister(base + 0x4,0x400 + v * 0x1A3);
+      spu.WriteRegister(base + 0x6,(0x1000 + (v & 7) * 256) >> 3);
+      spu.WriteRegister(base + 0x8,(uint16_t)(((v * 5) & 0x7F) << 8 | ((v & 3) + 4) << 4 | (v & 0xF)));
+      spu.WriteRegister(base + 0xA,(uint16_t)(0x4000 | (v & 1) << 15 | ((v * 3 + 40) & 0x7F) << 6 | 0x20 | (v & 0x1F)));
+    }
+    spu.WriteRegister(0x1F801D90,0x0A20);
+    spu.WriteRegister(0x1F801D94,0x8001);
+    spu.WriteRegister(0x1F801D96,0x0010);
+    spu.WriteRegister(0x1F801D88,0xFFFF);
+    spu.WriteRegister(0x1F801D8A,0x00FF);
+    uint32_t hash = 0;
+    QueryPerformanceCounter(&pc1);
+    for (int n=0;n<seconds;++n) {
+      if (n == seconds - 1) {
+        spu.WriteRegister(0x1F801D8C,0xF0F0);
+        spu.WriteRegister(0x1F801D8E,0x00F0);
+      }
+      spu.Mix(&samples[n*Spu::kSampleRate*2],Spu::kSampleRate);
+    }
+    QueryPerformanceCounter(&pc2);
+    for (size_t i=0;i<samples.size();++i)
+      hash = hash * 31 + (uint16_t)samples[i];
+    if (run == 0)
+      reference = hash;
+    sprintf(name,"spu 24 voices %s%s",levels[level],cached ? "" : " uncached");
+    ReportHash(name,hash,reference,pc1,pc2,seconds);
+    if (cached && level == support) {
+      const Spu::BlockCacheStats& stats = spu.block_cache_stats();
+      sprintf(name,"spu block cache hits %.1f%%\n",100.0 * stats.hits / (stats.hits + stats.misses));
+      OutputDebugString(name);
+    }
+  }
+  //a sample bank upload of 256KB through DMA channel 4
+  std::vector<uint32_t> bank(0x10000,0x12345678);
+  const int uploads = 100;
+  QueryPerformanceCounter(&pc1);
+  for (int n=0;n<uploads;++n) {
+    spu.WriteRegister(0x1F801DA6,0x0200);
+    spu.DmaWrite(bank.data(),(uint32_t)bank.size());
+  }
+  QueryPerformanceCounter(&pc2);
+  Report("spu dma upload 256KB",pc1,pc2,uploads);
+  spu.Deinitialize();
+}
+
+/*
+  The reverb unit alone on noise with a small room setting, one op is one
+  emulated second. Levels above SSE4.1 run the SSE4.1 code, its hash has to
+  match the scalar one of the same quality.
+*/
+void BenchmarkSpuReverb() {
+  static const char* levels[] = { "scalar", "sse4.1" };
+  static const char* qualities[] = { "accurate", "fast" };
+  const int seconds = 2;
+  char name[64];
+  LARGE_INTEGER pc1,pc2;
+
+  Spu spu;
+  spu.Initialize();
+  SimdLevel support = spu.reverb().simd_level() < kSimdSSE41 ? spu.reverb().simd_level() : kSimdSSE41;
+  for (int i=0;i<32;++i)
+    spu.WriteRegister(0x1F801DC0 + i*2,kReverbRoom[i]);
+  spu.WriteRegister(0x1F801DA2,0xFB28);
+  spu.WriteRegister(0x1F801D84,0x3000);
+  spu.WriteRegister(0x1F801D86,0x3000);
+  spu.WriteRegister(0x1F801DAA,0xC080);
+  std::vector<int16_t> input(Spu::kSampleRate*2);
+  uint32_t seed = 1;
+  for (size_t i=0;i<input.size();++i) {
+    seed = seed * 1103515245 + 12345;
+    input[i] = (int16_t)(seed >> 16) >> 2;
+  }
+  for (int quality=SpuReverb::kQualityAccurate;quality<=SpuReverb::kQualityFast;++quality) {
+    uint32_t reference = 0;
+    for (int level=kSimdNone;level<=support;++level) {
+      SpuReverb& reverb = spu.reverb();
+      memset(spu.sound_ram(),0,Spu::kSoundRamSize);
+      reverb.Reset();
+      reverb.set_quality((SpuReverb::Quality)quality);
+      reverb.set_simd_level((SimdLevel)level);
+      uint32_t hash = 0;
+      QueryPerformanceCounter(&pc1);
+      for (int n=0;n<seconds;++n) {
+        for (int i=0;i<Spu::kSampleRate;++i) {
+          int32_t left, right;
+          reverb.Process(input[i*2],input[i*2+1],true,&left,&right);
+          hash = (hash * 31 + (uint16_t)left) * 31 + (uint16_t)right;
+        }
+      }
+      QueryPerformanceCounter(&pc2);
+      if (level == kSimdNone)
+        reference = hash;
+      sprintf(name,"spu reverb %s %s",qualities[quality],levels[level]);
+      ReportHash(name,hash,reference,pc1,pc2,seconds);
+    }
+  }
+  spu.Deinitialize();
+}
+
+/*
+  The LZ codec of compressed disc images on one hunk of mode 2 sectors, the
+  user data half repeating records and half noise. One op is one hunk.
+*/
+void BenchmarkDiscLz() {
+  const size_t size = CompressedImage::kHunkSectors * DiscImage::kSectorSize;
+  const int count = 2000;
+  char name[64];
+  LARGE_INTEGER pc1,pc2;
+  std::vector<uint8_t> hunk(size,0), packed(LzBound(size)), unpacked(size);
+  uint32_t seed = 1;
+  for (uint32_t i=0;i<CompressedImage::kHunkSectors;++i) {
+    uint8_t* sector = &hunk[i * DiscImage::kSectorSize];
+    memset(sector + 1,0xFF,10);
+    sector[14] = (uint8_t)i;
+    sector[15] = 2;
+    sector[18] = sector[22] = 8;
+    for (int n=0;n<2048;++n) {
+      seed = seed * 1103515245 + 12345;
+      sector[24 + n] = n < 1024 ? (uint8_t)("FILE0001.DAT;1 "[n % 15] + (n >> 6)) : (uint8_t)(seed >> 16);
+    }
+  }
+  size_t packed_size = 0;
+  QueryPerformanceCounter(&pc1);
+  for (int n=0;n<count;++n)
+    packed_size = LzCompress(hunk.data(),size,packed.data());
+  QueryPerformanceCounter(&pc2);
+  sprintf(name,"disc lz compress hunk %.1f%%",100.0 * packed_size / size);
+  Report(name,pc1,pc2,count);
+  bool ok = true;
+  QueryPerformanceCounter(&pc1);
+  for (int n=0;n<count;++n)
+    ok &= LzDecompress(packed.data(),packed_size,unpacked.data(),size);
+  QueryPerformanceCounter(&pc2);
+  ok &= unpacked == hunk;
+  Report(ok ? "disc lz decompress hunk" : "disc lz decompress hunk FAILED",pc1,pc2,count);
+}
+
+/*
+  Replays a GPU dump on the software core in each configuration, the first one
+  is the reference for the per frame VRAM hashes. Upscaled runs draw every frame
+  a second time at the higher resolution, their native VRAM has to stay the same.
+*/
+void BenchmarkGpuReplay(const char* filename) {
+  static const struct {
+    const char* name;
+    SimdLevel level;
+    bool threaded;
+    int render_threads;
+    int scale;
+  } configs[] = {
+    { "avx2",          kSimdAVX2,  false, 1, 1 },
+    { "scalar",        kSimdNone,  false, 1, 1 },
+    { "sse4.1",        kSimdSSE41, false, 1, 1 },
+    { "avx2 threaded", kSimdAVX2,  true,  1, 1 },
+    { "avx2 binned x4", kSimdAVX2, false, 4, 1 },
+    { "avx2 2x",       kSimdAVX2,  false, 1, 2 },
+    { "avx2 4x",       kSimdAVX2,  false, 1, 4 },
+    { "avx2 4x x8",    kSimdAVX2,  true,  8, 4 },
+  };
+  char debug_str[256];
+  GpuReplay replay;
+  if (replay.Load(filename) != S_OK) {
+    sprintf(debug_str,"replay: can't load %s\n",filename);
+    OutputDebugString(debug_str);
+    return;
+  }
+  std::vector<uint32_t> reference;
+  for (size_t i=0;i<sizeof(configs)/sizeof(configs[0]);++i) {
+    GpuSoft gpu;
+    gpu.set_threaded(configs[i].threaded);
+    gpu.set_render_threads(configs[i].render_threads);
+    gpu.Initialize();
+    gpu.set_simd_level(configs[i].level);
+    gpu.set_resolution_scale(configs[i].scale);
+    GpuReplayResult result;
+    if (replay.Run(&gpu,&result) != S_OK) {
+      sprintf(debug_str,"replay %s: corrupt dump\n",configs[i].name);
+      OutputDebugString(debug_str);
+      return;
+    }
+    gpu.Deinitialize();
+    double seconds = result.seconds > 0 ? result.seconds : 1e-9;
+    sprintf(debug_str,"replay %-16s %d frames %8.2f fps %10.0f prims/s %12.0f pixels/s\n",configs[i].name,
+      result.frames,result.frames / seconds,result.stats.primitives / seconds,result.stats.pixels / seconds);
+    OutputDebugString(debug_str);
+    if (i == 0) {
+      reference = result.frame_hashes;
+      for (size_t f=0;f<reference.size();++f) {
+        sprintf(debug_str,"replay frame %d hash %08X\n",(int)f,reference[f]);
+        OutputDebugString(debug_str);
+      }
+      continue;
+    }
+    for (size_t f=0;f<result.frame_hashes.size();++f) {
+      if (f >= reference.size() || result.frame_hashes[f] != reference[f]) {
+        sprintf(debug_str,"replay %s: VRAM differs from %s at frame %d\n",configs[i].name,configs[0].name,(int)f);
+        OutputDebugString(debug_str);
+        break;
+      }
+    }
+  }
+}
+
+/*
+  Building the filesystem index of a disc against loading it from the sidecar,
+  and the lookup of the boot executable fast boot does.
+*/
+void BenchmarkIsoIndex(const char* filename) {
+  char name[MAX_PATH + 32];
+  LARGE_INTEGER pc1,pc2;
+  DiscImage* disc = DiscImage::Open(filename);
+  if (disc == nullptr)
+    return;
+  std::string sidecar = std::string(filename) + ".idx";
+  IsoIndex index;
+  const int count = 20;
+  int result = S_OK;
+  QueryPerformanceCounter(&pc1);
+  for (int n=0;n<count;++n)
+    result |= index.Build(disc);
+  QueryPerformanceCounter(&pc2);
+  if (result != S_OK) {
+    OutputDebugString("iso index: no ISO9660 volume\n");
+    delete disc;
+    return;
+  }
+  sprintf(name,"iso index build %u entries",(uint32_t)index.entry_count());
+  Report(name,pc1,pc2,count);
+  index.Save(sidecar.c_str());
+  QueryPerformanceCounter(&pc1);
+  for (int n=0;n<count;++n)
+    result |= index.Load(sidecar.c_str(),disc);
+  QueryPerformanceCounter(&pc2);
+  Report(result == S_OK ? "iso index sidecar load" : "iso index sidecar load FAILED",pc1,pc2,count);
+  const int lookups = 100000;
+  int found = 0;
+  QueryPerformanceCounter(&pc1);
+  for (int n=0;n<lookups;++n)
+    found += index.Find(n & 1 ? "cdrom:\\SYSTEM.CNF;1" : "SYSTEM.CNF") != nullptr;
+  QueryPerformanceCounter(&pc2);
+  Report(found == lookups ? "iso index find SYSTEM.CNF" : "iso index find SYSTEM.CNF missing",pc1,pc2,lookups);
+  sprintf(name,"iso index boot %s\n",index.boot() != nullptr ? index.path(*index.boot()) : "none");
+  OutputDebugString(name);
+  delete disc;
+}
+
+}
+}
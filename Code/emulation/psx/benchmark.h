@@ -0,0 +1,41 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  Micro-benchmarks of the hot emulation paths. WinMain runs them instead of the
+  emulator when the project is built with PSX_BENCHMARK, results go to OutputDebugString.
+  -gpu-replay=<dump> replays a GPU dump written with -gpu-record instead,
+  -cd-index=<image> times the filesystem index of a disc image.
+*/
+void RunBenchmarks();
+void BenchmarkGte();
+void BenchmarkGpuSoft();
+void BenchmarkScanout();
+void BenchmarkSpu();
+void BenchmarkSpuReverb();
+void BenchmarkDiscLz();
+void BenchmarkGpuReplay(const char* filename);
+void BenchmarkIsoIndex(const char* filename);
+
+}
+}
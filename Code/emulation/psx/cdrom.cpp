@@ -0,0 +1,548 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+namespace emulation {
+namespace psx {
+
+//CPU cycles from a command write to its first response
+static const uint32_t kAckCycles = 25000;
+//from a command to its second response when there is no mechanical work
+static const uint32_t kSecondCycles = 50000;
+static const uint32_t kSeekCycles = 100000;
+static const uint32_t kTocCycles = 33868800 / 2;
+//from an acknowledge to the delivery of the next queued interrupt
+static const uint32_t kDeliverCycles = 1000;
+
+static uint8_t ToBcd(uint32_t value) {
+  return (uint8_t)(((value / 10) << 4) | (value % 10));
+}
+
+static uint32_t FromBcd(uint8_t value) {
+  return (value >> 4) * 10 + (value & 15);
+}
+
+static void ToMsf(uint32_t sectors,uint8_t* msf) {
+  msf[0] = ToBcd(sectors / (60 * 75));
+  msf[1] = ToBcd(sectors / 75 % 60);
+  msf[2] = ToBcd(sectors % 75);
+}
+
+Cdrom::Cdrom() : disc_(nullptr) {
+  Initialize();
+}
+
+Cdrom::~Cdrom() {
+
+}
+
+int Cdrom::Initialize() {
+  index_ = 0;
+  interrupt_enable_ = interrupt_flag_ = 0;
+  mode_ = 0;
+  filter_file_ = filter_channel_ = 0;
+  state_ = kStateIdle;
+  motor_ = disc_ != nullptr;
+  param_count_ = command_param_count_ = 0;
+  command_ = 0;
+  response_size_ = response_pos_ = 0;
+  queue_head_ = queue_count_ = 0;
+  memset(&second_,0,sizeof(second_));
+  sector_ = data_ = nullptr;
+  data_size_ = data_pos_ = 0;
+  position_ = seek_target_ = 0;
+  seek_pending_ = false;
+  cycles_ = 0;
+  command_event_ = second_event_ = sector_event_ = deliver_event_ = next_event_ = kNever;
+  if (system_ != nullptr)
+    MapPorts();
+  return 0;
+}
+
+int Cdrom::Deinitialize() {
+  return 0;
+}
+
+void Cdrom::set_disc(DiscImage* disc) {
+  disc_ = disc;
+  state_ = kStateIdle;
+  motor_ = disc != nullptr;
+  sector_ = data_ = nullptr;
+  data_size_ = data_pos_ = 0;
+  position_ = seek_target_ = 0;
+  seek_pending_ = false;
+  sector_event_ = kNever;
+  UpdateNextEvent();
+}
+
+uint32_t Cdrom::ReadPort(void* param,uint32_t address) {
+  Cdrom* cdrom = (Cdrom*)param;
+  cdrom->Run(cdrom->system_->cpu().context()->cycles);
+  return cdrom->ReadRegister(address);
+}
+
+void Cdrom::WritePort(void* param,uint32_t address,uint32_t data) {
+  Cdrom* cdrom = (Cdrom*)param;
+  cdrom->Run(cdrom->system_->cpu().context()->cycles);
+  cdrom->WriteRegister(address,(uint8_t)data);
+}
+
+void Cdrom::MapPorts() {
+  auto& io = system_->io();
+  for (uint32_t address=0x1F801800;address<0x1F801804;++address)
+    io.MapPort(kM8,address,this,ReadPort,WritePort);
+}
+
+uint8_t Cdrom::stat() const {
+  uint8_t result = disc_ == nullptr ? kStatShellOpen : 0;
+  if (motor_)
+    result |= kStatMotor;
+  if (state_ == kStateRead)
+    result |= kStatRead;
+  else if (state_ == kStatePlay)
+    result |= kStatPlay;
+  return result;
+}
+
+uint8_t Cdrom::ReadRegister(uint32_t address) {
+  switch (address & 3) {
+    case 0: {
+      uint8_t status = index_;
+      if (param_count_ == 0)
+        status |= 0x08;
+      if (param_count_ < kParamSize)
+        status |= 0x10;
+      if (response_pos_ < response_size_)
+        status |= 0x20;
+      if (data_pos_ < data_size_)
+        status |= 0x40;
+      if (command_event_ != kNever)
+        status |= 0x80;
+      return status;
+    }
+    case 1:
+      return response_pos_ < response_size_ ? response_[response_pos_++] : 0;
+    case 2:
+      return data_pos_ < data_size_ ? data_[data_pos_++] : 0;
+    default:
+      return (index_ & 1 ? interrupt_flag_ : interrupt_enable_) | 0xE0;
+  }
+}
+
+//the audio volume registers of index 2 and 3 are not emulated
+void Cdrom::WriteRegister(uint32_t address,uint8_t data) {
+  int reg = address & 3;
+  if (reg == 0) {
+    index_ = data & 3;
+    return;
+  }
+  if (reg == 1 && index_ == 0) {
+    command_ = data;
+    memcpy(command_params_,params_,param_count_);
+    command_param_count_ = param_count_;
+    param_count_ = 0;
+    command_event_ = cycles_ + kAckCycles;
+  } else if (reg == 2 && index_ == 0) {
+    if (param_count_ < kParamSize)
+      params_[param_count_++] = data;
+  } else if (reg == 2 && index_ == 1) {
+    interrupt_enable_ = data & 0x1F;
+  } else if (reg == 3 && index_ == 0) {
+    //BFRD makes the sector of the last INT1 readable, clearing it drops the data
+    if (data & 0x80) {
+      if (sector_ != nullptr && data_pos_ >= data_size_) {
+        data_ = mode_ & 0x20 ? sector_ + 12 : sector_ + 24;
+        data_size_ = mode_ & 0x20 ? 0x924 : 0x800;
+        data_pos_ = 0;
+      }
+    } else
+      data_size_ = data_pos_ = 0;
+  } else if (reg == 3 && index_ == 1) {
+    interrupt_flag_ &= ~(data & 0x1F);
+    if (data & 0x40)
+      param_count_ = 0;
+    if (interrupt_flag_ == 0 && queue_count_ != 0 && deliver_event_ == kNever)
+      deliver_event_ = cycles_ + kDeliverCycles;
+  }
+  UpdateNextEvent();
+}
+
+void Cdrom::UpdateNextEvent() {
+  uint64_t next = command_event_;
+  next = second_event_ < next ? second_event_ : next;
+  next = sector_event_ < next ? sector_event_ : next;
+  next = deliver_event_ < next ? deliver_event_ : next;
+  next_event_ = next;
+}
+
+void Cdrom::Run(uint64_t cycles) {
+  while (next_event_ <= cycles) {
+    cycles_ = next_event_;
+    if (command_event_ == cycles_) {
+      command_event_ = kNever;
+      ExecuteCommand();
+    } else if (second_event_ == cycles_) {
+      second_event_ = kNever;
+      QueueResponse(second_.interrupt,second_.data,second_.size);
+    } else if (sector_event_ == cycles_) {
+      sector_event_ = cycles_ + sector_cycles();
+      ReadNextSector();
+    } else {
+      deliver_event_ = kNever;
+      Deliver();
+    }
+    UpdateNextEvent();
+  }
+  if (cycles > cycles_)
+    cycles_ = cycles;
+}
+
+void Cdrom::QueueResponse(uint8_t interrupt,const uint8_t* data,int size) {
+  if (queue_count_ == kQueueSize)
+    return;
+  Response& response = queue_[(queue_head_ + queue_count_) % kQueueSize];
+  response.interrupt = interrupt;
+  response.size = (uint8_t)size;
+  memcpy(response.data,data,size);
+  response.lba = position_;
+  ++queue_count_;
+  if (interrupt_flag_ == 0 && deliver_event_ == kNever)
+    deliver_event_ = cycles_;
+}
+
+void Cdrom::QueueStat(uint8_t interrupt) {
+  uint8_t status = stat();
+  QueueResponse(interrupt,&status,1);
+}
+
+void Cdrom::QueueError(uint8_t code) {
+  uint8_t data[2] = { (uint8_t)(stat() | kStatError), code };
+  QueueResponse(5,data,2);
+}
+
+void Cdrom::SecondResponse(uint8_t interrupt,const uint8_t* data,int size,uint32_t delay) {
+  second_.interrupt = interrupt;
+  second_.size = (uint8_t)size;
+  memcpy(second_.data,data,size);
+  second_event_ = cycles_ + delay;
+}
+
+/*
+  Puts the oldest queued interrupt in the flag register. INT1 reads its sector from
+  the image. With XA-ADPCM enabled in the mode, audio sectors never reach the data
+  FIFO: they are for the (not emulated) decoder, the filter only picks which of
+  them it would play. The next interrupt is tried instead.
+*/
+void Cdrom::Deliver() {
+  while (interrupt_flag_ == 0 && queue_count_ != 0) {
+    const Response& response = queue_[queue_head_];
+    queue_head_ = (queue_head_ + 1) % kQueueSize;
+    --queue_count_;
+    if (response.interrupt == 1) {
+      sector_ = disc_ != nullptr ? disc_->ReadSector(response.lba) : nullptr;
+      data_size_ = data_pos_ = 0;
+      if (sector_ == nullptr)
+        continue;
+      if ((mode_ & 0x40) && sector_[15] == 2 && (sector_[18] & 0x04))
+        continue;
+    }
+    memcpy(response_,response.data,response.size);
+    response_size_ = response.size;
+    response_pos_ = 0;
+    interrupt_flag_ = response.interrupt;
+    if ((interrupt_flag_ & interrupt_enable_) && system_ != nullptr)
+      system_->io().SetInterrupt(kInterruptCDROM);
+  }
+}
+
+/*
+  One sector time passed. Reading queues an INT1 for the sector under the head,
+  a game that falls behind only gets the newest one: an INT1 still in the queue
+  is moved to the new sector instead of adding another.
+*/
+void Cdrom::ReadNextSector() {
+  if (disc_ == nullptr || position_ >= disc_->sector_count()) {
+    state_ = kStateIdle;
+    sector_event_ = kNever;
+    QueueStat(4);
+    return;
+  }
+  if (state_ == kStateRead) {
+    uint8_t status = stat();
+    int pending = -1;
+    for (int i=0;i<queue_count_;++i) {
+      if (queue_[(queue_head_ + i) % kQueueSize].interrupt == 1)
+        pending = (queue_head_ + i) % kQueueSize;
+    }
+    if (pending >= 0) {
+      queue_[pending].data[0] = status;
+      queue_[pending].lba = position_;
+    } else
+      QueueResponse(1,&status,1);
+  }
+  ++position_;
+  if (state_ == kStateRead)
+    disc_->Hint(position_,mode_ & 0x80 ? 2 : 1);
+}
+
+void Cdrom::ExecuteCommand() {
+  const uint8_t* params = command_params_;
+  int count = command_param_count_;
+  uint8_t status;
+  switch (command_) {
+    case 0x01: //Getstat
+      QueueStat(3);
+      break;
+    case 0x02: { //Setloc
+      if (count < 3) {
+        QueueError(0x20);
+        break;
+      }
+      uint32_t msf = (FromBcd(params[0]) * 60 + FromBcd(params[1])) * 75 + FromBcd(params[2]);
+      seek_target_ = msf > DiscImage::kLeadIn ? msf - DiscImage::kLeadIn : 0;
+      seek_pending_ = true;
+      //the image can start reading there while the game gets to ReadN
+      if (disc_ != nullptr)
+        disc_->Hint(seek_target_,mode_ & 0x80 ? 2 : 1);
+      QueueStat(3);
+      break;
+    }
+    case 0x03: { //Play, no CD-DA output, the position moves on at the sector rate
+      int track = count != 0 ? (int)FromBcd(params[0]) : 0;
+      if (disc_ != nullptr && track >= 1 && track <= disc_->track_count()) {
+        position_ = disc_->track(track - 1).start;
+        seek_pending_ = false;
+      } else if (seek_pending_) {
+        position_ = seek_target_;
+        seek_pending_ = false;
+      }
+      state_ = kStatePlay;
+      motor_ = true;
+      QueueStat(3);
+      sector_event_ = cycles_ + sector_cycles();
+      break;
+    }
+    case 0x06: //ReadN
+    case 0x1B: { //ReadS
+      if (disc_ == nullptr) {
+        QueueError(0x80);
+        break;
+      }
+      uint32_t delay = sector_cycles();
+      if (seek_pending_) {
+        position_ = seek_target_;
+        seek_pending_ = false;
+        delay += kSeekCycles;
+      }
+      state_ = kStateRead;
+      motor_ = true;
+      disc_->Hint(position_,mode_ & 0x80 ? 2 : 1);
+      QueueStat(3);
+      sector_event_ = cycles_ + delay;
+      break;
+    }
+    case 0x07: //MotorOn
+      motor_ = true;
+      QueueStat(3);
+      status = stat();
+      SecondResponse(2,&status,1,kSecondCycles);
+      break;
+    case 0x08: //Stop
+      state_ = kStateIdle;
+      sector_event_ = kNever;
+      QueueStat(3);
+      motor_ = false;
+      status = stat();
+      SecondResponse(2,&status,1,kSecondCycles);
+      break;
+    case 0x09: { //Pause
+      bool busy = state_ != kStateIdle;
+      QueueStat(3);
+      state_ = kStateIdle;
+      sector_event_ = kNever;
+      status = stat();
+      SecondResponse(2,&status,1,busy ? kCyclesPerSector * 2 : kSecondCycles);
+      break;
+    }
+    case 0x0A: //Init
+      mode_ = 0x20;
+      state_ = kStateIdle;
+      sector_event_ = kNever;
+      motor_ = disc_ != nullptr;
+      QueueStat(3);
+      status = stat();
+      SecondResponse(2,&status,1,kSecondCycles);
+      break;
+    case 0x0B: //Mute
+    case 0x0C: //Demute
+      QueueStat(3);
+      break;
+    case 0x0D: //Setfilter
+      if (count >= 2) {
+        filter_file_ = params[0];
+        filter_channel_ = params[1];
+      }
+      QueueStat(3);
+      break;
+    case 0x0E: //Setmode
+      if (count >= 1)
+        mode_ = params[0];
+      QueueStat(3);
+      break;
+    case 0x0F: { //Getparam
+      uint8_t data[5] = { stat(), mode_, 0, filter_file_, filter_channel_ };
+      QueueResponse(3,data,5);
+      break;
+    }
+    case 0x10: //GetlocL, header and subheader of the last sector read
+      if (sector_ == nullptr)
+        QueueError(0x80);
+      else
+        QueueResponse(3,sector_ + 12,8);
+      break;
+    case 0x11: { //GetlocP
+      if (disc_ == nullptr || disc_->track_count() == 0) {
+        QueueError(0x80);
+        break;
+      }
+      int index = disc_->FindTrack(position_);
+      if (index < 0)
+        index = disc_->track_count() - 1;
+      const DiscImage::Track& track = disc_->track(index);
+      //index 0 in the pregap, where the relative time counts down to index 1
+      bool pregap = position_ < track.start;
+      uint8_t data[8];
+      data[0] = ToBcd(track.number);
+      data[1] = pregap ? 0 : 1;
+      ToMsf(pregap ? track.start - position_ : position_ - track.start,&data[2]);
+      ToMsf(position_ + DiscImage::kLeadIn,&data[5]);
+      QueueResponse(3,data,8);
+      break;
+    }
+    case 0x12: { //SetSession, single session images only
+      if (count < 1 || params[0] == 0) {
+        QueueError(0x10);
+        break;
+      }
+      QueueStat(3);
+      if (params[0] == 1) {
+        status = stat();
+        SecondResponse(2,&status,1,kSecondCycles);
+      } else {
+        uint8_t data[2] = { (uint8_t)(stat() | kStatError), 0x40 };
+        SecondResponse(5,data,2,kSecondCycles);
+      }
+      break;
+    }
+    case 0x13: { //GetTN
+      if (disc_ == nullptr || disc_->track_count() == 0) {
+        QueueError(0x80);
+        break;
+      }
+      uint8_t data[3] = { stat(), ToBcd(disc_->track(0).number), ToBcd(disc_->track(disc_->track_count() - 1).number) };
+      QueueResponse(3,data,3);
+      break;
+    }
+    case 0x14: { //GetTD, track 0 is the end of the disc
+      if (disc_ == nullptr) {
+        QueueError(0x80);
+        break;
+      }
+      int track = count != 0 ? (int)FromBcd(params[0]) : 0;
+      if (track > disc_->track_count()) {
+        QueueError(0x10);
+        break;
+      }
+      uint32_t lba = track == 0 ? disc_->sector_count() : disc_->track(track - 1).start;
+      uint8_t msf[3];
+      ToMsf(lba + DiscImage::kLeadIn,msf);
+      uint8_t data[3] = { stat(), msf[0], msf[1] };
+      QueueResponse(3,data,3);
+      break;
+    }
+    case 0x15: //SeekL
+    case 0x16: { //SeekP
+      state_ = kStateIdle;
+      sector_event_ = kNever;
+      if (seek_pending_)
+        position_ = seek_target_;
+      seek_pending_ = false;
+      motor_ = true;
+      uint8_t seeking = stat() | kStatSeek;
+      QueueResponse(3,&seeking,1);
+      status = stat();
+      SecondResponse(2,&status,1,kSeekCycles);
+      break;
+    }
+    case 0x19: { //Test, only the BIOS date and version
+      if (count >= 1 && params[0] == 0x20) {
+        static const uint8_t version[4] = { 0x94,0x09,0x19,0xC0 };
+        QueueResponse(3,version,4);
+      } else
+        QueueError(0x10);
+      break;
+    }
+    case 0x1A: { //GetID
+      QueueStat(3);
+      if (disc_ == nullptr) {
+        static const uint8_t no_disc[8] = { 0x08,0x40,0,0,0,0,0,0 };
+        SecondResponse(5,no_disc,8,kSecondCycles);
+      } else if (disc_->track_count() == 0 || disc_->track(0).type == DiscImage::kTrackAudio) {
+        uint8_t audio[8] = { (uint8_t)(stat() | 0x08),0x90,0,0,0,0,0,0 };
+        SecondResponse(5,audio,8,kSecondCycles);
+      } else {
+        uint8_t licensed[8] = { stat(),0x00,0x20,0x00,'S','C','E','A' };
+        SecondResponse(2,licensed,8,kSecondCycles);
+      }
+      break;
+    }
+    case 0x1C: //Reset
+      mode_ = 0;
+      state_ = kStateIdle;
+      sector_event_ = kNever;
+      second_event_ = kNever;
+      queue_count_ = 0;
+      QueueStat(3);
+      break;
+    case 0x1E: //ReadTOC
+      QueueStat(3);
+      status = stat();
+      SecondResponse(2,&status,1,kTocCycles);
+      break;
+    default:
+      QueueError(0x40);
+      break;
+  }
+}
+
+void Cdrom::DmaRead(uint32_t* words,uint32_t count) {
+  if (system_ != nullptr)
+    Run(system_->cpu().context()->cycles);
+  uint32_t size = count * 4;
+  uint32_t available = data_size_ - data_pos_;
+  uint32_t copy = available < size ? available : size;
+  if (copy != 0)
+    memcpy(words,data_ + data_pos_,copy);
+  if (copy < size)
+    memset((uint8_t*)words + copy,0,size - copy);
+  data_pos_ += copy;
+}
+
+}
+}
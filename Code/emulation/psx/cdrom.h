@@ -0,0 +1,124 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  CD-ROM controller at 0x1F801800. The 4 byte wide ports are banked by the index
+  register. Commands take parameters from a FIFO and answer with one or two
+  responses, each one an interrupt the CPU has to acknowledge before the next is
+  delivered. Like the SPU the controller is run up to the CPU cycle on every port
+  access and by IOInterface::Tick at next_event(). Sectors come from a DiscImage,
+  the data FIFO is a window into the sector the image returned.
+*/
+class Cdrom : public Component {
+ public:
+  //single speed, 75 sectors a second
+  static const int kCyclesPerSector = 33868800 / 75;
+  Cdrom();
+  ~Cdrom();
+  int Initialize();
+  int Deinitialize();
+  DiscImage* disc() { return disc_; }
+  //the image stays owned by the caller, null takes the disc out
+  void set_disc(DiscImage* disc);
+  uint8_t ReadRegister(uint32_t address);
+  void WriteRegister(uint32_t address,uint8_t data);
+  //runs the command, response and sector timers up to CPU cycle cycles
+  void Run(uint64_t cycles);
+  uint64_t next_event() const { return next_event_; }
+  //DMA channel 3 reads the data FIFO
+  void DmaRead(uint32_t* words,uint32_t count);
+ private:
+  static const uint64_t kNever = ~0ULL;
+  static const int kQueueSize = 8;
+  static const int kParamSize = 16;
+  enum Status {
+    kStatError = 0x01,
+    kStatMotor = 0x02,
+    kStatShellOpen = 0x10,
+    kStatRead = 0x20,
+    kStatSeek = 0x40,
+    kStatPlay = 0x80
+  };
+  enum State { kStateIdle, kStateRead, kStatePlay };
+  struct Response {
+    uint8_t interrupt;
+    uint8_t size;
+    uint8_t data[8];
+    //sector an INT1 loads into the data buffer
+    uint32_t lba;
+  };
+  static uint32_t ReadPort(void* param,uint32_t address);
+  static void WritePort(void* param,uint32_t address,uint32_t data);
+  void MapPorts();
+  uint8_t stat() const;
+  void ExecuteCommand();
+  void QueueResponse(uint8_t interrupt,const uint8_t* data,int size);
+  void QueueStat(uint8_t interrupt);
+  void QueueError(uint8_t code);
+  void SecondResponse(uint8_t interrupt,const uint8_t* data,int size,uint32_t delay);
+  void Deliver();
+  void ReadNextSector();
+  void UpdateNextEvent();
+  uint32_t sector_cycles() const { return mode_ & 0x80 ? kCyclesPerSector / 2 : kCyclesPerSector; }
+
+  DiscImage* disc_;
+  uint8_t index_;
+  uint8_t interrupt_enable_;
+  uint8_t interrupt_flag_;
+  uint8_t mode_;
+  uint8_t filter_file_;
+  uint8_t filter_channel_;
+  State state_;
+  bool motor_;
+  uint8_t params_[kParamSize];
+  int param_count_;
+  uint8_t command_;
+  uint8_t command_params_[kParamSize];
+  int command_param_count_;
+  //response FIFO of the delivered interrupt
+  uint8_t response_[16];
+  int response_size_;
+  int response_pos_;
+  //interrupts waiting for the one in the flag register to be acknowledged
+  Response queue_[kQueueSize];
+  int queue_head_;
+  int queue_count_;
+  Response second_;
+  //sector of the last INT1, the data FIFO is a window of it
+  const uint8_t* sector_;
+  const uint8_t* data_;
+  uint32_t data_size_;
+  uint32_t data_pos_;
+  uint32_t position_;
+  uint32_t seek_target_;
+  bool seek_pending_;
+  uint64_t cycles_;
+  uint64_t command_event_;
+  uint64_t second_event_;
+  uint64_t sector_event_;
+  uint64_t deliver_event_;
+  uint64_t next_event_;
+};
+
+}
+}
@@ -23,6 +23,7 @@ namespace psx {
 
 class Component {
  public:
+  Component() : system_(nullptr),cpu_(nullptr),io_(nullptr) {}
   System& system() { return *system_; }
   void set_system(System* system) { 
     system_ = system;
@@ -0,0 +1,398 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+namespace emulation {
+namespace psx {
+
+static const int kLzHashBits = 12;
+static const int kLzMinMatch = 4;
+
+static uint32_t Load32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value,p,4);
+  return value;
+}
+
+static uint8_t* WriteLength(uint8_t* op,size_t length) {
+  for (length-=15;length>=255;length-=255)
+    *op++ = 255;
+  *op++ = (uint8_t)length;
+  return op;
+}
+
+static uint8_t* WriteSequence(uint8_t* op,const uint8_t* literals,size_t literal_count,size_t offset,size_t length) {
+  uint8_t* token = op++;
+  *token = (uint8_t)((literal_count < 15 ? literal_count : 15) << 4);
+  if (literal_count >= 15)
+    op = WriteLength(op,literal_count);
+  memcpy(op,literals,literal_count);
+  op += literal_count;
+  if (length == 0)
+    return op;
+  length -= kLzMinMatch;
+  *token |= (uint8_t)(length < 15 ? length : 15);
+  *op++ = (uint8_t)offset;
+  *op++ = (uint8_t)(offset >> 8);
+  if (length >= 15)
+    op = WriteLength(op,length);
+  return op;
+}
+
+//greedy, one candidate per hash of the next 4 bytes
+size_t LzCompress(const uint8_t* src,size_t size,uint8_t* dst) {
+  uint32_t table[1 << kLzHashBits];
+  memset(table,0,sizeof(table));
+  uint8_t* op = dst;
+  size_t anchor = 0, ip = 0;
+  while (size >= kLzMinMatch && ip <= size - kLzMinMatch) {
+    uint32_t sequence = Load32(src + ip);
+    uint32_t hash = (sequence * 2654435761U) >> (32 - kLzHashBits);
+    size_t candidate = table[hash];
+    table[hash] = (uint32_t)ip;
+    if (candidate >= ip || ip - candidate > 0xFFFF || Load32(src + candidate) != sequence) {
+      ++ip;
+      continue;
+    }
+    size_t length = kLzMinMatch;
+    while (ip + length < size && src[candidate + length] == src[ip + length])
+      ++length;
+    op = WriteSequence(op,src + anchor,ip - anchor,ip - candidate,length);
+    ip += length;
+    anchor = ip;
+  }
+  op = WriteSequence(op,src + anchor,size - anchor,0,0);
+  return op - dst;
+}
+
+static bool ReadLength(const uint8_t** ip,const uint8_t* end,size_t* length) {
+  uint8_t byte;
+  do {
+    if (*ip >= end)
+      return false;
+    byte = *(*ip)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+bool LzDecompress(const uint8_t* src,size_t src_size,uint8_t* dst,size_t size) {
+  const uint8_t* ip = src;
+  const uint8_t* end = src + src_size;
+  uint8_t* op = dst;
+  uint8_t* op_end = dst + size;
+  while (ip < end) {
+    uint32_t token = *ip++;
+    size_t literals = token >> 4;
+    if (literals == 15 && !ReadLength(&ip,end,&literals))
+      return false;
+    if (literals > (size_t)(end - ip) || literals > (size_t)(op_end - op))
+      return false;
+    memcpy(op,ip,literals);
+    op += literals;
+    ip += literals;
+    if (ip == end)
+      break;
+    if (end - ip < 2)
+      return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    size_t length = token & 15;
+    if (length == 15 && !ReadLength(&ip,end,&length))
+      return false;
+    length += kLzMinMatch;
+    if (offset == 0 || offset > (size_t)(op - dst) || length > (size_t)(op_end - op))
+      return false;
+    const uint8_t* match = op - offset;
+    if (offset >= length)
+      memcpy(op,match,length);
+    else if (offset == 1)
+      memset(op,*match,length);
+    else
+      for (size_t i=0;i<length;++i)
+        op[i] = match[i];
+    op += length;
+  }
+  return op == op_end;
+}
+
+static HunkCache shared_cache;
+
+HunkCache::HunkCache() : next_image_(1),capacity_(kCapacity),size_(0) {
+  memset(&stats_,0,sizeof(stats_));
+}
+
+HunkCache& HunkCache::shared() {
+  return shared_cache;
+}
+
+uint32_t HunkCache::Acquire(uint32_t volume_serial,uint64_t file_index) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = files_.find(std::make_pair(volume_serial,file_index));
+  if (it == files_.end()) {
+    File file = { next_image_++, 0 };
+    it = files_.insert(std::make_pair(std::make_pair(volume_serial,file_index),file)).first;
+  }
+  ++it->second.images;
+  return it->second.image;
+}
+
+void HunkCache::set_capacity(size_t capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity_ = capacity;
+  Evict();
+}
+
+HunkCache::Hunk HunkCache::Find(uint32_t image,uint32_t hunk) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(((uint64_t)image << 32) | hunk);
+  if (it == index_.end()) {
+    ++stats_.misses;
+    return Hunk();
+  }
+  ++stats_.hits;
+  entries_.splice(entries_.begin(),entries_,it->second);
+  return it->second->data;
+}
+
+bool HunkCache::Contains(uint32_t image,uint32_t hunk) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_.count(((uint64_t)image << 32) | hunk) != 0;
+}
+
+HunkCache::Hunk HunkCache::Insert(uint32_t image,uint32_t hunk,const Hunk& data,bool read_ahead) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t key = ((uint64_t)image << 32) | hunk;
+  auto it = index_.find(key);
+  if (it != index_.end())
+    return it->second->data;
+  Entry entry = { key, data };
+  entries_.push_front(entry);
+  index_[key] = entries_.begin();
+  size_ += data->size();
+  if (read_ahead)
+    ++stats_.read_ahead;
+  Evict();
+  return data;
+}
+
+//the entry just inserted stays even when it is over the cap by itself
+void HunkCache::Evict() {
+  while (size_ > capacity_ && entries_.size() > 1) {
+    size_ -= entries_.back().data->size();
+    index_.erase(entries_.back().key);
+    entries_.pop_back();
+    ++stats_.evictions;
+  }
+}
+
+void HunkCache::Release(uint32_t image) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto file=files_.begin();file!=files_.end();++file) {
+    if (file->second.image == image) {
+      if (--file->second.images > 0)
+        return;
+      files_.erase(file);
+      break;
+    }
+  }
+  for (auto it=entries_.begin();it!=entries_.end();) {
+    if ((uint32_t)(it->key >> 32) == image) {
+      size_ -= it->data->size();
+      index_.erase(it->key);
+      it = entries_.erase(it);
+    } else
+      ++it;
+  }
+}
+
+HunkCache::Stats HunkCache::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+CompressedImage::CompressedImage(HunkCache* cache) : cache_(cache != nullptr ? cache : &HunkCache::shared()),
+  id_(0),hunks_(nullptr),hunk_sectors_(0),hunk_count_(0),current_hunk_(0),
+  thread_(nullptr),read_ahead_next_(0),read_ahead_end_(0),exit_(false) {
+}
+
+CompressedImage::~CompressedImage() {
+  Close();
+}
+
+int CompressedImage::Open(const char* filename) {
+  Close();
+  if (file_.Open(filename) != S_OK)
+    return E_FAIL;
+  const uint8_t* data = file_.data();
+  const CompressedImageHeader* header = (const CompressedImageHeader*)data;
+  uint64_t tables = sizeof(CompressedImageHeader);
+  if (file_.size() < tables || header->magic != kMagic || header->version != kVersion || header->hunk_sectors == 0) {
+    file_.Close();
+    return E_FAIL;
+  }
+  tables += (uint64_t)header->track_count * sizeof(Track) + (uint64_t)header->hunk_count * sizeof(CompressedHunk);
+  if (file_.size() < tables || (uint64_t)header->hunk_count * header->hunk_sectors < header->sector_count) {
+    file_.Close();
+    return E_FAIL;
+  }
+  const Track* tracks = (const Track*)(data + sizeof(CompressedImageHeader));
+  tracks_.assign(tracks,tracks + header->track_count);
+  hunks_ = (const CompressedHunk*)(tracks + header->track_count);
+  hunk_sectors_ = header->hunk_sectors;
+  hunk_count_ = header->hunk_count;
+  sector_count_ = header->sector_count;
+  current_.reset();
+  id_ = cache_->Acquire(file_.volume_serial(),file_.file_index());
+  read_ahead_next_ = read_ahead_end_ = 0;
+  exit_ = false;
+  thread_ = new std::thread(CompressedImage::thread_func,this);
+  return S_OK;
+}
+
+void CompressedImage::Close() {
+  if (thread_ != nullptr) {
+    exit_ = true;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wake_.notify_one();
+    }
+    thread_->join();
+    SafeDelete(&thread_);
+  }
+  current_.reset();
+  if (id_ != 0) {
+    cache_->Release(id_);
+    id_ = 0;
+  }
+  file_.Close();
+  hunks_ = nullptr;
+  hunk_count_ = 0;
+  tracks_.clear();
+  sector_count_ = 0;
+}
+
+//decompresses a hunk into the cache, both threads come here
+HunkCache::Hunk CompressedImage::Load(uint32_t hunk,bool read_ahead) {
+  const CompressedHunk& entry = hunks_[hunk];
+  size_t size = (size_t)hunk_sectors_ * kSectorSize;
+  if (entry.offset > file_.size() || entry.size > file_.size() - entry.offset)
+    return HunkCache::Hunk();
+  const uint8_t* src = file_.data() + entry.offset;
+  auto data = std::make_shared<std::vector<uint8_t>>(size);
+  if (entry.flags & kFlagStored) {
+    if (entry.size != size)
+      return HunkCache::Hunk();
+    memcpy(data->data(),src,size);
+  } else if (!LzDecompress(src,entry.size,data->data(),size))
+    return HunkCache::Hunk();
+  return cache_->Insert(id_,hunk,data,read_ahead);
+}
+
+const uint8_t* CompressedImage::ReadSector(uint32_t lba) {
+  if (lba >= sector_count_)
+    return nullptr;
+  uint32_t hunk = lba / hunk_sectors_;
+  if (current_ == nullptr || hunk != current_hunk_) {
+    bool sequential = current_ != nullptr && hunk == current_hunk_ + 1;
+    current_ = cache_->Find(id_,hunk);
+    if (current_ == nullptr)
+      current_ = Load(hunk,false);
+    current_hunk_ = hunk;
+    if (current_ == nullptr)
+      return nullptr;
+    if (sequential) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      read_ahead_next_ = hunk + 1;
+      read_ahead_end_ = hunk + 1 + kReadAheadHunks < hunk_count_ ? hunk + 1 + kReadAheadHunks : hunk_count_;
+      wake_.notify_one();
+    }
+  }
+  return current_->data() + (size_t)(lba - hunk * hunk_sectors_) * kSectorSize;
+}
+
+void CompressedImage::thread_func(CompressedImage* image) {
+  while (!image->exit_) {
+    uint32_t hunk;
+    {
+      std::unique_lock<std::mutex> lock(image->mutex_);
+      if (image->exit_)
+        break;
+      if (image->read_ahead_next_ >= image->read_ahead_end_) {
+        image->wake_.wait(lock);
+        continue;
+      }
+      hunk = image->read_ahead_next_++;
+    }
+    if (!image->cache_->Contains(image->id_,hunk))
+      image->Load(hunk,true);
+  }
+}
+
+int CompressedImage::Create(DiscImage* source,const char* filename) {
+  FILE* fp;
+  if (fopen_s(&fp,filename,"wb") != 0)
+    return E_FAIL;
+  CompressedImageHeader header;
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.hunk_sectors = kHunkSectors;
+  header.sector_count = source->sector_count();
+  header.hunk_count = (header.sector_count + kHunkSectors - 1) / kHunkSectors;
+  header.track_count = source->track_count();
+  fwrite(&header,sizeof(header),1,fp);
+  for (int i=0;i<source->track_count();++i)
+    fwrite(&source->track(i),sizeof(Track),1,fp);
+  std::vector<CompressedHunk> hunks(header.hunk_count);
+  uint64_t offset = sizeof(header) + header.track_count * sizeof(Track) + hunks.size() * sizeof(CompressedHunk);
+  if (!hunks.empty())
+    fwrite(hunks.data(),sizeof(CompressedHunk),hunks.size(),fp);
+  const size_t size = kHunkSectors * kSectorSize;
+  std::vector<uint8_t> raw(size), packed(LzBound(size));
+  for (uint32_t hunk=0;hunk<header.hunk_count;++hunk) {
+    for (uint32_t i=0;i<kHunkSectors;++i) {
+      const uint8_t* sector = source->ReadSector(hunk * kHunkSectors + i);
+      if (sector != nullptr)
+        memcpy(&raw[i * kSectorSize],sector,kSectorSize);
+      else
+        memset(&raw[i * kSectorSize],0,kSectorSize);
+    }
+    size_t packed_size = LzCompress(raw.data(),size,packed.data());
+    hunks[hunk].offset = offset;
+    if (packed_size < size) {
+      hunks[hunk].size = (uint32_t)packed_size;
+      hunks[hunk].flags = 0;
+      fwrite(packed.data(),1,packed_size,fp);
+    } else {
+      hunks[hunk].size = (uint32_t)size;
+      hunks[hunk].flags = kFlagStored;
+      fwrite(raw.data(),1,size,fp);
+    }
+    offset += hunks[hunk].size;
+  }
+  fseek(fp,sizeof(header) + header.track_count * sizeof(Track),SEEK_SET);
+  if (!hunks.empty())
+    fwrite(hunks.data(),sizeof(CompressedHunk),hunks.size(),fp);
+  int result = ferror(fp) ? E_FAIL : S_OK;
+  fclose(fp);
+  return result;
+}
+
+}
+}
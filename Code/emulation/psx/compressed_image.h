@@ -0,0 +1,151 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  Byte oriented LZ77 of the compressed disc images. A block is a run of sequences:
+  a token with the literal count in the high nibble and the match length - 4 in
+  the low one, 15 meaning more follows in bytes that add up until one is below
+  255, then the literals and a 16bit little endian match offset. The last
+  sequence has literals only.
+*/
+//worst case size of a compressed block of size bytes
+inline size_t LzBound(size_t size) { return size + size / 255 + 16; }
+size_t LzCompress(const uint8_t* src,size_t size,uint8_t* dst);
+//false when the block is corrupt or doesn't decode to exactly size bytes
+bool LzDecompress(const uint8_t* src,size_t src_size,uint8_t* dst,size_t size);
+
+/*
+  Decompressed hunks of every compressed image of the process, least recently
+  used first out once the cap is reached. Hunks are keyed by the file they come
+  from, images opened on the same file share them. Hunks are reference counted,
+  an image keeps the one it reads from alive after it is evicted.
+*/
+class HunkCache {
+ public:
+  typedef std::shared_ptr<const std::vector<uint8_t>> Hunk;
+  //default cap of the shared cache
+  static const size_t kCapacity = 64*1024*1024;
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    //hunks the read ahead threads decompressed
+    uint64_t read_ahead;
+  };
+  HunkCache();
+  static HunkCache& shared();
+  //the id of a file for the keys of its hunks, counted once per open image
+  uint32_t Acquire(uint32_t volume_serial,uint64_t file_index);
+  //the hunks of the file go when its last image releases it
+  void Release(uint32_t image);
+  size_t capacity() const { return capacity_; }
+  void set_capacity(size_t capacity);
+  size_t size() const { return size_; }
+  //counts a hit or a miss, null when the hunk is not cached
+  Hunk Find(uint32_t image,uint32_t hunk);
+  bool Contains(uint32_t image,uint32_t hunk);
+  //returns the hunk cached for the key, the one passed in unless another thread was first
+  Hunk Insert(uint32_t image,uint32_t hunk,const Hunk& data,bool read_ahead);
+  Stats stats();
+ private:
+  struct Entry {
+    uint64_t key;
+    Hunk data;
+  };
+  struct File {
+    uint32_t image;
+    int images;
+  };
+  void Evict();
+  std::mutex mutex_;
+  std::map<std::pair<uint32_t,uint64_t>,File> files_;
+  uint32_t next_image_;
+  //most recently used at the front
+  std::list<Entry> entries_;
+  std::unordered_map<uint64_t,std::list<Entry>::iterator> index_;
+  size_t capacity_;
+  size_t size_;
+  Stats stats_;
+};
+
+struct CompressedImageHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t hunk_sectors;
+  uint32_t hunk_count;
+  uint32_t sector_count;
+  uint32_t track_count;
+};
+
+struct CompressedHunk {
+  uint64_t offset;
+  uint32_t size;
+  uint32_t flags;
+};
+
+/*
+  Disc compressed in hunks of consecutive sectors. The file is the header, the
+  track table, the hunk table and the LZ compressed hunks, a hunk that doesn't
+  get smaller is stored as it is. The file is mapped into memory, hunks are
+  decompressed into a HunkCache on first use. While the reads are sequential a
+  thread decompresses the hunks after the one being read ahead of time.
+*/
+class CompressedImage : public DiscImage {
+ public:
+  static const uint32_t kMagic = 0x43585350; //PSXC
+  //2 added the pregap start to the tracks
+  static const uint32_t kVersion = 2;
+  static const uint32_t kFlagStored = 0x1;
+  static const uint32_t kHunkSectors = 8;
+  static const uint32_t kReadAheadHunks = 4;
+  //null shares HunkCache::shared() with the other images
+  explicit CompressedImage(HunkCache* cache = nullptr);
+  ~CompressedImage();
+  int Open(const char* filename);
+  void Close();
+  //null outside the disc or when the hunk is corrupt
+  const uint8_t* ReadSector(uint32_t lba);
+  //writes source as a compressed image
+  static int Create(DiscImage* source,const char* filename);
+ private:
+  static void thread_func(CompressedImage* image);
+  HunkCache::Hunk Load(uint32_t hunk,bool read_ahead);
+  HunkCache* cache_;
+  uint32_t id_;
+  MappedFile file_;
+  const CompressedHunk* hunks_;
+  uint32_t hunk_sectors_;
+  uint32_t hunk_count_;
+  HunkCache::Hunk current_;
+  uint32_t current_hunk_;
+  std::thread* thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  //hunks the thread still has to look at
+  uint32_t read_ahead_next_;
+  uint32_t read_ahead_end_;
+  std::atomic<bool> exit_;
+};
+
+}
+}
@@ -73,8 +73,8 @@ Cpu::Instruction Cpu::machine_instruction_main_[64] = {
   &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN,
   &Cpu::LB     , &Cpu::LH     , &Cpu::LWL    , &Cpu::LW     , &Cpu::LBU    , &Cpu::LHU    , &Cpu::LWR    , &Cpu::UNKNOWN,
   &Cpu::SB     , &Cpu::SH     , &Cpu::SWL    , &Cpu::SW     , &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::SWR    , &Cpu::UNKNOWN,
-  &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN,
-  &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN,
+  &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::LWC2   , &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN,
+  &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::SWC2   , &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN, &Cpu::UNKNOWN,
 };
 
 Cpu::Instruction Cpu::machine_instruction_special_[64] = {
@@ -757,8 +757,34 @@ void Cpu::COP0() {
 void Cpu::COP2() {
   if ((context_->code>>25)==0x25) {
     system_->gte().ExecuteCommand(context_->code);
+    Tick();
+    return;
   }
-  BREAKPOINT
+  switch (context_->rs()) {
+    //MFC
+    case 0x00: {
+      context_->gp.reg[rt_] = system_->gte().ReadData(rd_);
+      break;
+    }
+    //CFC
+    case 0x02: {
+      context_->gp.reg[rt_] = system_->gte().ReadControl(rd_);
+      break;
+    }
+    //MTC
+    case 0x04: {
+      system_->gte().WriteData(rd_,context_->gp.reg[rt_]);
+      break;
+    }
+    //CTC
+    case 0x06: {
+      system_->gte().WriteControl(rd_,context_->gp.reg[rt_]);
+      break;
+    }
+    default:
+      BREAKPOINT;
+  }
+  Tick();
 }
 
 void Cpu::LB() {
@@ -905,6 +931,20 @@ void Cpu::SWL() {
   Tick();
 }
 
+void Cpu::LWC2() {
+  uint32_t virtual_address = context_->gp.reg[rs_] + immediate_32bit_sign_extended_;
+  uint32_t mem = Load(kM32,virtual_address);
+  Tick();
+  system_->gte().WriteData(rt_,mem);
+  Tick();
+}
+
+void Cpu::SWC2() {
+  uint32_t virtual_address = context_->gp.reg[rs_] + immediate_32bit_sign_extended_;
+  Store(kM32,system_->gte().ReadData(rt_),virtual_address);
+  Tick();
+}
+
 void Cpu::SW() {
   uint32_t virtual_address = context_->gp.reg[rs_] + immediate_32bit_sign_extended_;
   uint32_t physical_address = AddressTranslation(virtual_address);
@@ -459,6 +459,8 @@ class Cpu : public Component {
   void SWL();
   void SW();
   void SWR();
+  void LWC2();
+  void SWC2();
   
 
   void SLL();
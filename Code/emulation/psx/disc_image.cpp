@@ -0,0 +1,269 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+namespace emulation {
+namespace psx {
+
+int DiscImage::FindTrack(uint32_t lba) const {
+  if (lba >= sector_count_)
+    return -1;
+  int index = 0;
+  for (int i=1;i<(int)tracks_.size();++i) {
+    if (tracks_[i].pregap_start <= lba)
+      index = i;
+  }
+  return index;
+}
+
+DiscImage* DiscImage::Open(const char* filename) {
+  const char* ext = strrchr(filename,'.');
+  if (ext == nullptr)
+    return nullptr;
+  if (_stricmp(ext,".cue") == 0 || _stricmp(ext,".bin") == 0 || _stricmp(ext,".img") == 0) {
+    auto image = new CueBinImage();
+    if (image->Open(filename) == S_OK)
+      return image;
+    delete image;
+  } else if (_stricmp(ext,".pcd") == 0) {
+    auto image = new CompressedImage();
+    if (image->Open(filename) == S_OK)
+      return image;
+    delete image;
+  }
+  return nullptr;
+}
+
+static uint32_t ParseMsf(const char* text) {
+  int m = 0, s = 0, f = 0;
+  sscanf(text,"%d:%d:%d",&m,&s,&f);
+  return (m * 60 + s) * 75 + f;
+}
+
+static uint32_t SectorCount(const MappedFile& file) {
+  return (uint32_t)(file.size() / DiscImage::kSectorSize);
+}
+
+CueBinImage::CueBinImage() : last_extent_(0) {
+  memset(silence_,0,sizeof(silence_));
+}
+
+CueBinImage::~CueBinImage() {
+  Close();
+}
+
+int MappedFile::Open(const char* filename) {
+  Close();
+  file_ = CreateFile(filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (file_ == INVALID_HANDLE_VALUE)
+    return E_FAIL;
+  LARGE_INTEGER size;
+  GetFileSizeEx(file_,&size);
+  size_ = size.QuadPart;
+  BY_HANDLE_FILE_INFORMATION info;
+  if (GetFileInformationByHandle(file_,&info)) {
+    volume_serial_ = info.dwVolumeSerialNumber;
+    file_index_ = (uint64_t)info.nFileIndexHigh << 32 | info.nFileIndexLow;
+  }
+  mapping_ = CreateFileMapping(file_,NULL,PAGE_READONLY,0,0,NULL);
+  if (mapping_ != NULL)
+    data_ = (const uint8_t*)MapViewOfFile(mapping_,FILE_MAP_READ,0,0,0);
+  if (data_ == nullptr) {
+    Close();
+    return E_FAIL;
+  }
+  return S_OK;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr)
+    UnmapViewOfFile(data_);
+  if (mapping_ != NULL)
+    CloseHandle(mapping_);
+  if (file_ != INVALID_HANDLE_VALUE)
+    CloseHandle(file_);
+  file_ = INVALID_HANDLE_VALUE;
+  mapping_ = NULL;
+  data_ = nullptr;
+  size_ = 0;
+  volume_serial_ = 0;
+  file_index_ = 0;
+}
+
+int CueBinImage::MapFile(const char* filename) {
+  MappedFile file;
+  if (file.Open(filename) != S_OK)
+    return E_FAIL;
+  files_.push_back(file);
+  return S_OK;
+}
+
+void CueBinImage::Close() {
+  for (size_t i=0;i<files_.size();++i)
+    files_[i].Close();
+  files_.clear();
+  extents_.clear();
+  tracks_.clear();
+  sector_count_ = 0;
+  last_extent_ = 0;
+}
+
+/*
+  Each track covers its file from index 0, or index 1 without one, to where the
+  next track of the same file starts. PREGAP sectors are not in the files and
+  move everything after them further into the disc.
+*/
+int CueBinImage::Open(const char* filename) {
+  Close();
+  const char* ext = strrchr(filename,'.');
+  if (ext == nullptr || _stricmp(ext,".cue") != 0) {
+    if (MapFile(filename) != S_OK)
+      return E_FAIL;
+    Track track = { 1, kTrackMode2, 0, 0, SectorCount(files_[0]) };
+    tracks_.push_back(track);
+    Extent extent = { 0, SectorCount(files_[0]), files_[0].data() };
+    extents_.push_back(extent);
+    sector_count_ = SectorCount(files_[0]);
+    return S_OK;
+  }
+  FILE* fp = fopen(filename,"r");
+  if (fp == nullptr)
+    return E_FAIL;
+  std::string directory(filename);
+  size_t slash = directory.find_last_of("\\/");
+  directory = slash == std::string::npos ? std::string() : directory.substr(0,slash + 1);
+  struct CueTrack {
+    int number;
+    TrackType type;
+    int file;
+    int index0;
+    int index1;
+    uint32_t pregap;
+  };
+  std::vector<CueTrack> cue_tracks;
+  char line[512];
+  int result = S_OK;
+  while (result == S_OK && fgets(line,sizeof(line),fp) != nullptr) {
+    char keyword[16] = { 0 };
+    if (sscanf(line,"%15s",keyword) != 1)
+      continue;
+    const char* args = strstr(line,keyword) + strlen(keyword);
+    if (strcmp(keyword,"FILE") == 0) {
+      const char* first = strchr(args,'"');
+      const char* last = first != nullptr ? strchr(first + 1,'"') : nullptr;
+      if (last == nullptr) {
+        result = E_FAIL;
+        break;
+      }
+      std::string name(first + 1,last);
+      bool absolute = name.find(':') != std::string::npos || name[0] == '\\' || name[0] == '/';
+      result = MapFile((absolute ? name : directory + name).c_str());
+    } else if (strcmp(keyword,"TRACK") == 0) {
+      CueTrack track = { 0, kTrackMode2, (int)files_.size() - 1, -1, -1, 0 };
+      char type[32] = { 0 };
+      sscanf(args,"%d %31s",&track.number,type);
+      track.type = strncmp(type,"AUDIO",5) == 0 ? kTrackAudio : (strncmp(type,"MODE1",5) == 0 ? kTrackMode1 : kTrackMode2);
+      if (track.file < 0 || (strstr(type,"2352") == nullptr && track.type != kTrackAudio)) {
+        result = E_FAIL;
+        break;
+      }
+      cue_tracks.push_back(track);
+    } else if (strcmp(keyword,"INDEX") == 0 && !cue_tracks.empty()) {
+      int number = 0;
+      char msf[32] = { 0 };
+      sscanf(args,"%d %31s",&number,msf);
+      if (number == 0)
+        cue_tracks.back().index0 = ParseMsf(msf);
+      else if (number == 1)
+        cue_tracks.back().index1 = ParseMsf(msf);
+    } else if (strcmp(keyword,"PREGAP") == 0 && !cue_tracks.empty()) {
+      char msf[32] = { 0 };
+      sscanf(args,"%31s",msf);
+      cue_tracks.back().pregap = ParseMsf(msf);
+    }
+  }
+  fclose(fp);
+  if (result != S_OK || cue_tracks.empty()) {
+    Close();
+    return E_FAIL;
+  }
+
+  std::vector<uint32_t> file_start(files_.size(),0);
+  for (size_t i=1;i<files_.size();++i)
+    file_start[i] = file_start[i-1] + SectorCount(files_[i-1]);
+  uint32_t shift = 0;
+  for (size_t i=0;i<cue_tracks.size();++i) {
+    const CueTrack& cue = cue_tracks[i];
+    if (cue.index1 < 0) {
+      Close();
+      return E_FAIL;
+    }
+    const MappedFile& file = files_[cue.file];
+    uint32_t first = cue.index0 >= 0 ? cue.index0 : cue.index1;
+    //the PREGAP silence comes before the index 0 sectors of the file
+    uint32_t pregap_start = file_start[cue.file] + first + shift;
+    if (cue.pregap != 0) {
+      Extent gap = { pregap_start, cue.pregap, nullptr };
+      extents_.push_back(gap);
+      shift += cue.pregap;
+    }
+    uint32_t end = SectorCount(file);
+    if (i + 1 < cue_tracks.size() && cue_tracks[i+1].file == cue.file) {
+      const CueTrack& next = cue_tracks[i+1];
+      end = next.index0 >= 0 ? next.index0 : next.index1;
+    }
+    if (end > first) {
+      Extent extent = { file_start[cue.file] + first + shift, end - first, file.data() + (size_t)first * kSectorSize };
+      extents_.push_back(extent);
+    }
+    Track track = { cue.number, cue.type, pregap_start, file_start[cue.file] + cue.index1 + shift, 0 };
+    tracks_.push_back(track);
+  }
+  sector_count_ = extents_.back().start + extents_.back().count;
+  for (size_t i=0;i<tracks_.size();++i)
+    tracks_[i].length = (i + 1 < tracks_.size() ? tracks_[i+1].pregap_start : sector_count_) - tracks_[i].start;
+  return S_OK;
+}
+
+//reads are mostly sequential so the extent of the last read is tried first
+const uint8_t* CueBinImage::ReadSector(uint32_t lba) {
+  if (extents_.empty() || lba >= sector_count_)
+    return nullptr;
+  const Extent* extent = &extents_[last_extent_];
+  if (lba < extent->start || lba >= extent->start + extent->count) {
+    size_t low = 0, high = extents_.size();
+    while (high - low > 1) {
+      size_t middle = (low + high) >> 1;
+      if (extents_[middle].start <= lba)
+        low = middle;
+      else
+        high = middle;
+    }
+    last_extent_ = low;
+    extent = &extents_[low];
+    if (lba < extent->start || lba >= extent->start + extent->count)
+      return silence_;
+  }
+  if (extent->data == nullptr)
+    return silence_;
+  return extent->data + (size_t)(lba - extent->start) * kSectorSize;
+}
+
+}
+}
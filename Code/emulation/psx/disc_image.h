@@ -0,0 +1,112 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  Sector level access to a disc. LBA 0 is the first sector of track 1, at MSF
+  00:02:00. Sectors are the raw 2352 bytes, with sync and header for data tracks
+  and plain 16bit stereo samples for audio tracks.
+*/
+class DiscImage {
+ public:
+  static const int kSectorSize = 2352;
+  //MSF addresses count the 2 seconds before LBA 0
+  static const int kLeadIn = 150;
+  enum TrackType { kTrackAudio, kTrackMode1, kTrackMode2 };
+  struct Track {
+    int number;
+    TrackType type;
+    //LBA of index 0, the first sector of the pregap, start without one
+    uint32_t pregap_start;
+    //LBA of index 1
+    uint32_t start;
+    //sectors from index 1 to the pregap of the next track
+    uint32_t length;
+  };
+  DiscImage() : sector_count_(0) {}
+  virtual ~DiscImage() {}
+  //null outside the disc, the sector stays valid until the next read from the image
+  virtual const uint8_t* ReadSector(uint32_t lba) = 0;
+  int track_count() const { return (int)tracks_.size(); }
+  //track number - 1
+  const Track& track(int index) const { return tracks_[index]; }
+  uint32_t sector_count() const { return sector_count_; }
+  //position and speed of the drive, for images that read ahead
+  virtual void Hint(uint32_t lba,int speed) {}
+  //index of the track holding lba, the pregap of a track belongs to that track
+  int FindTrack(uint32_t lba) const;
+  //opens the image type the file extension names, null when it can't be opened
+  static DiscImage* Open(const char* filename);
+ protected:
+  std::vector<Track> tracks_;
+  uint32_t sector_count_;
+};
+
+//a file mapped read only into memory whole
+class MappedFile {
+ public:
+  MappedFile() : file_(INVALID_HANDLE_VALUE),mapping_(NULL),data_(nullptr),size_(0),volume_serial_(0),file_index_(0) {}
+  int Open(const char* filename);
+  void Close();
+  const uint8_t* data() const { return data_; }
+  uint64_t size() const { return size_; }
+  //together they name the file on the machine, whatever path it was opened by
+  uint32_t volume_serial() const { return volume_serial_; }
+  uint64_t file_index() const { return file_index_; }
+ private:
+  HANDLE file_;
+  HANDLE mapping_;
+  const uint8_t* data_;
+  uint64_t size_;
+  uint32_t volume_serial_;
+  uint64_t file_index_;
+};
+
+/*
+  A CUE sheet with its BIN files, or a lone BIN taken as one mode 2 track. Every
+  BIN file is mapped into memory whole when the image is opened, reading a sector
+  is a lookup of the extent holding it and a pointer into the mapping.
+*/
+class CueBinImage : public DiscImage {
+ public:
+  CueBinImage();
+  ~CueBinImage();
+  int Open(const char* filename);
+  void Close();
+  const uint8_t* ReadSector(uint32_t lba);
+ private:
+  //sectors start to start + count - 1 of the disc, data is null for a pregap that
+  //is not in the files
+  struct Extent {
+    uint32_t start;
+    uint32_t count;
+    const uint8_t* data;
+  };
+  int MapFile(const char* filename);
+  std::vector<MappedFile> files_;
+  std::vector<Extent> extents_;
+  size_t last_extent_;
+  uint8_t silence_[kSectorSize];
+};
+
+}
+}
@@ -23,6 +23,24 @@
 namespace emulation {
 namespace psx {
 
+template<int channel>
+static uint32_t ReadChcr(void* param,uint32_t address) {
+  return ((Dma*)param)->channel(channel).chcr;
+}
+
+template<int channel>
+static void WriteChcr(void* param,uint32_t address,uint32_t data) {
+  ((Dma*)param)->WriteChannelControl(channel,data);
+}
+
+static uint32_t ReadDpcr(void* param,uint32_t address) {
+  return ((Dma*)param)->ReadControl();
+}
+
+static void WriteDpcr(void* param,uint32_t address,uint32_t data) {
+  ((Dma*)param)->WriteControl(data);
+}
+
 Dma::Dma() {
   
 }
@@ -33,8 +51,25 @@ Dma::~Dma() {
 
 int Dma::Initialize() {
   memset(channels,0,sizeof(channels));
+  memset(linked_list_visited,0,sizeof(linked_list_visited));
   dma_enable.raw = 0;
   interrupt_control.raw = 0;
+
+  auto& io = system_->io();
+  for (int i=0;i<7;++i) {
+    uint32_t base = 0x1F801080 + (i << 4);
+    io.MapPort(kM32,base+0,&channels[i].madr,IOInterface::ReadRegister32,IOInterface::WriteRegister32);
+    io.MapPort(kM32,base+4,&channels[i].bcr,IOInterface::ReadRegister32,IOInterface::WriteRegister32);
+  }
+  io.MapPort(kM32,0x1F801088,this,ReadChcr<0>,WriteChcr<0>);
+  io.MapPort(kM32,0x1F801098,this,ReadChcr<1>,WriteChcr<1>);
+  io.MapPort(kM32,0x1F8010A8,this,ReadChcr<2>,WriteChcr<2>);
+  io.MapPort(kM32,0x1F8010B8,this,ReadChcr<3>,WriteChcr<3>);
+  io.MapPort(kM32,0x1F8010C8,this,ReadChcr<4>,WriteChcr<4>);
+  io.MapPort(kM32,0x1F8010D8,this,ReadChcr<5>,WriteChcr<5>);
+  io.MapPort(kM32,0x1F8010E8,this,ReadChcr<6>,WriteChcr<6>);
+  io.MapPort(kM32,0x1F8010F0,this,ReadDpcr,WriteDpcr);
+  io.MapPort(kM32,0x1F8010F4,&interrupt_control.raw,IOInterface::ReadRegister32,IOInterface::WriteRegister32);
   return 0;
 }
 
@@ -51,247 +86,188 @@ void Dma::Tick() {
   }
 }
 
-uint32_t Dma::Read(uint32_t address) {
-	switch (address)
-	{
-   case 0x1f801080: return channels[0].madr;
-   case 0x1f801084: return channels[0].bcr;
-   case 0x1f801088:	return channels[0].chcr;
-   
-   case 0x1f801090: return channels[1].madr;
-   case 0x1f801094: return channels[1].bcr;
-   case 0x1f801098:	return channels[1].chcr;
-   
-   case 0x1f8010a0: return channels[2].madr;
-   case 0x1f8010a4: return channels[2].bcr;
-   case 0x1f8010a8:	return channels[2].chcr;
-   
-   case 0x1f8010b0: return channels[3].madr;
-   case 0x1f8010b4: return channels[3].bcr;
-   case 0x1f8010b8: return channels[3].chcr;
-
-   case 0x1f8010c0: return channels[4].madr;
-   case 0x1f8010c4: return channels[4].bcr;
-   case 0x1f8010c8:	return channels[4].chcr;
-   
-   case 0x1f8010d0: return channels[5].madr;
-   case 0x1f8010d4: return channels[5].bcr;
-   case 0x1f8010d8:	return channels[5].chcr;
-
-   case 0x1f8010e0: return channels[6].madr;
-   case 0x1f8010e4:	return channels[6].bcr;
-   case 0x1f8010e8:	return channels[6].chcr;
-   case 0x1f8010F0:	return dma_enable.raw;
-   case 0x1f8010F4:	return interrupt_control.raw;
-	   }
-	
-  BREAKPOINT
-  return 0;
-}
-
-
-void Dma::Write(uint32_t address,uint32_t data) {
-
-	switch (address)
-	{
-     case 0x1f801080:   channels[0].madr=data;  break;
-     case 0x1f801084:   channels[0].bcr=data;  break;
-     case 0x1f801088:  
-	     if (!(channels[0].chcr&0x01000000)) { //&&channels[0].enable)	   {
-		     channels[0].chcr=data;
-	       channels[0].chcr&=0xfeffffff;  
-         SetInterrupt(0);
-	     }
-	     break;
-
-     case 0x1f801090:   channels[1].madr = data;  break;
-     case 0x1f801094:   channels[1].bcr = data;  break;
-     case 0x1f801098:  
-	     if (!(channels[1].chcr&0x01000000)) {
-		    channels[1].chcr=data; 
-	      channels[1].chcr&=0xfeffffff; 
-        SetInterrupt(1);
-	     }
-     break;
-     
-     case 0x1f8010a0:   channels[2].madr=data;  break;
-     case 0x1f8010a4:   channels[2].bcr=data;  break;
-     case 0x1f8010a8:  
-      if (!(channels[2].chcr&0x01000000)) {
-        channels[2].chcr=data;
-        if (channels[2].chcr & 0x01000000) {// && channels[2].enable == true) { //dma_enable.raw & (8 << (2 * 4)))
-            #if defined(DMA_DEBUG) && defined(_DEBUG)
-            char str[255];
-            sprintf(str,",,dma 2,chcr,0x%08x,bcr,0x%08x,madr,0x%08x\n",channels[2].chcr,channels[2].bcr,channels[2].madr);
-            fprintf(system_->csvlog.fp,str);
-            #endif
-            Dma2();
-        }
-        channels[2].chcr&=0xfeffffff;  
-        SetInterrupt(2);
+void Dma::WriteChannelControl(int channel,uint32_t data) {
+  auto& ch = channels[channel];
+  if (ch.chcr&0x01000000)
+    return;
+  ch.chcr = data;
+  switch (channel) {
+    case 2:
+      if (ch.chcr & 0x01000000) {// && channels[2].enable == true) { //dma_enable.raw & (8 << (2 * 4)))
+        #if defined(DMA_DEBUG) && defined(_DEBUG)
+        char str[255];
+        sprintf(str,",,dma 2,chcr,0x%08x,bcr,0x%08x,madr,0x%08x\n",channels[2].chcr,channels[2].bcr,channels[2].madr);
+        fprintf(system_->csvlog.fp,str);
+        #endif
+        Dma2();
       }
       break;
-
-     case 0x1f8010b0:   channels[3].madr=data;  break;
-     case 0x1f8010b4:   channels[3].bcr=data;  break;
-     case 0x1f8010b8: 
-      if (!(channels[3].chcr&0x01000000)) {
-        channels[3].chcr=data;
-        channels[3].chcr&=0xfeffffff;  
-        SetInterrupt(3);
-      }
+    case 3:
+      if (ch.chcr & 0x01000000)
+        Dma3();
       break;
-  
-     case 0x1f8010c0:   channels[4].madr=data;  break;
-     case 0x1f8010c4:   channels[4].bcr=data;  break;
-     case 0x1f8010c8:   
-	     if (!(channels[4].chcr&0x01000000)) {
-	      channels[4].chcr=data;  
-	   	  //SpuDma4();
-	      channels[4].chcr&=0xfeffffff;
-	 	    SetInterrupt(4);
-	     }
-	     break;
-
-     case 0x1f8010d0:   channels[5].madr=data;  break;
-     case 0x1f8010d4:   channels[5].bcr=data;  break;
-     case 0x1f8010d8:   
-      if (!(channels[5].chcr&0x01000000))  {
-        channels[5].chcr=data;
-        channels[5].chcr&=0xfeffffff;  
-        SetInterrupt(5);
-      }
+    case 4:
+      if (ch.chcr & 0x01000000)
+        Dma4();
       break;
-
-    case 0x1f8010e0:   channels[6].madr=data;  break;
-    case 0x1f8010e4:   channels[6].bcr=data;  break;
-    case 0x1f8010e8: 
-	    if (!(channels[6].chcr&0x01000000)) {
-	      channels[6].chcr=data;
-	      if (channels[6].chcr & 0x01000000 && channels[6].enable == true) {
-	        Dma6();
-        }
-	      channels[6].chcr&=0xfeffffff;
-	    }
-	    break;
-
- 
-    case 0x1F8010F0:
-      dma_enable.raw = data;
-      channels[0].enable=(data>>3)&0x1;
-      channels[1].enable=(data>>7)&0x1;
-      channels[2].enable=(data>>11)&0x1;
-      channels[3].enable=(data>>15)&0x1;
-      channels[4].enable=(data>>19)&0x1;
-      channels[5].enable=(data>>23)&0x1;
-      channels[6].enable=(data>>27)&0x1;
-      //_cprintf("dma en:%x\n",data);
-    break;
-
-   case 0x1F8010F4: {
-    interrupt_control.raw = data;
-    //unsigned long tmp = (~data) & Parent->MC->HRam->u32[0x10f4>>2];
-    //Parent->MC->HRam->u32[0x10f4>>2] = ((tmp ^ data) & 0xffffff) ^ tmp;
-    //_ULong(REG_ICR) &= (~data)&0xff000000;
-    }
-    break;
+    case 6:
+      if (ch.chcr & 0x01000000 && ch.enable == true) {
+        Dma6();
+      }
+      ch.chcr&=0xfeffffff;
+      return;
   }
+  ch.chcr&=0xfeffffff;
+  SetInterrupt(channel);
 }
 
-static uint32_t a1=0,a2=0,a3=0;
-bool check_endless_loop(uint32_t address) {
-
-  if(address==a2) return true;
-  if(address==a3) return true;
-
-  if(address<a1) 
-    a2=address;
-  else                   
-    a3=address;
-  a1=address;
-  return false;
-};
+void Dma::WriteControl(uint32_t data) {
+  dma_enable.raw = data;
+  channels[0].enable=(data>>3)&0x1;
+  channels[1].enable=(data>>7)&0x1;
+  channels[2].enable=(data>>11)&0x1;
+  channels[3].enable=(data>>15)&0x1;
+  channels[4].enable=(data>>19)&0x1;
+  channels[5].enable=(data>>23)&0x1;
+  channels[6].enable=(data>>27)&0x1;
+  //_cprintf("dma en:%x\n",data);
+}
 
 void Dma::Dma2() {
   if ((channels[2].chcr & 0x01000401) == 0x01000401) { //chain
-    auto gpu = (GpuMiniVE*)system_->gpu_core();
-    auto& ram = system_->io().ram_buffer;
-
-    unsigned long addr = channels[2].madr&0x1fffff;
-    unsigned long dmaMem;
-    unsigned char * baseAddrB;
-    short count;unsigned int DMACommandCounter = 0;
-
-    auto baseAddrL = ram.u32;
-    //emu_->gpu.status.busy = 0;
-    a1 = a2 = a3 = 0xFFFFFF;
-    baseAddrB = (unsigned char*) baseAddrL;
-    do {
-       
-
-      if(DMACommandCounter++ > 2000000) break;
-      if(check_endless_loop(addr)) break;
-
-      count = baseAddrB[addr+3];
-
-      dmaMem=addr+4;
-
-      if(count>0) {
-        for (int i=0;i<count;++i) {
-          gpu->WriteData(baseAddrL[(dmaMem>>2)+count]);
-        }
-      }
+    DmaLinkedList2();
+  }
+  if ((channels[2].chcr & 0x01000600) == 0x01000200) { //block
+    DmaBlock2();
+  }
+}
 
+/*
+  Block mode moves bcr block size * block count words in one go, the GPU gets whole
+  runs of RAM instead of single words, split only where the address wraps.
+*/
+void Dma::DmaBlock2() {
+  auto gpu = system_->gpu_core();
+  auto& ram = system_->io().ram_buffer;
+  auto& ch = channels[2];
+  uint32_t block_size = ch.bcr & 0xFFFF;
+  if (block_size == 0)
+    block_size = 0x10000;
+  uint32_t words = block_size * (ch.bcr >> 16);
+  uint32_t addr = ch.madr & 0x1ffffc;
+  while (words != 0) {
+    uint32_t run = (0x200000 - addr) >> 2;
+    if (run > words)
+      run = words;
+    if (ch.chcr & 0x1)
+      gpu->WriteDataSpan(&ram.u32[addr>>2],run);
+    else
+      gpu->ReadDataSpan(&ram.u32[addr>>2],run);
+    addr = (addr + (run << 2)) & 0x1ffffc;
+    words -= run;
+  }
+  ch.madr = addr;
+  ch.bcr &= 0xFFFF;
+}
 
-      addr = baseAddrL[addr>>2]&0xffffff;
+/*
+  Ordering tables are walked in one pass, each node's packet goes to the GPU as a
+  span read in place. The next node is prefetched while the packet is parsed.
+  A node visited twice means the list loops and the walk stops, the visited bits
+  are cleared again over the address range the walk touched.
+*/
+void Dma::DmaLinkedList2() {
+  auto gpu = system_->gpu_core();
+  auto ram = system_->io().ram_buffer.u32;
+  const uint32_t ram_words = 0x200000 >> 2;
+  uint32_t node = (channels[2].madr & 0x1ffffc) >> 2;
+  uint32_t low = node, high = node;
+  for (;;) {
+    uint32_t bit = 1 << (node & 31);
+    if (linked_list_visited[node >> 5] & bit)
+      break;
+    linked_list_visited[node >> 5] |= bit;
+    if (node < low)
+      low = node;
+    if (node > high)
+      high = node;
+
+    uint32_t header = ram[node];
+    uint32_t next = header & 0xffffff;
+    if ((next & 0x800000) == 0)
+      _mm_prefetch((const char*)&ram[(next & 0x1ffffc) >> 2],_MM_HINT_T0);
+    uint32_t count = header >> 24;
+    uint32_t data = (node + 1) & (ram_words-1);
+    if (count != 0) {
+      uint32_t run = ram_words - data;
+      if (run > count)
+        run = count;
+      gpu->WriteDataSpan(&ram[data],run);
+      if (run < count)
+        gpu->WriteDataSpan(&ram[0],count-run);
     }
-    while (addr != 0xffffff);
-
-    /*gpu->status.busy = 0;
-
-
-    uint32_t packet_count;
-    uint32_t vaddress = channels[2].madr&0x1fffff;
-
-    a1 = a2 = a3 = 0xFFFFFF;
-    do {
-      packet_count = ((ram.u32[vaddress>>2] >> 24) & 0xff);
-      if (packet_count!=0) {
-        #if defined(DMA_DEBUG) && defined(_DEBUG)
-        char str[255];
-        sprintf(str,",,dma gpu param_count,%d\n",packet_count);
-        fprintf(system_->csvlog.fp,str);
-        #endif
-        auto mem = &ram.u32[(vaddress>>2)+1];
-        for (uint32_t i=0;i<packet_count;++i) {
-          gpu->WriteData(*mem++);
-        }
-        //if ((ram.u32[vaddress>>2]&0xffffff)==0xffffff) {
-	      //  break;
-        // }
-        vaddress=ram.u32[vaddress>>2]&0xffffff;
-      }	
-      
-      if (check_endless_loop(vaddress)) {
-        #if defined(DMA_DEBUG) && defined(_DEBUG)
-        char str[255];
-        sprintf(str,",,dma endless loop detected\n");
-        fprintf(system_->csvlog.fp,str);
-        #endif
-        break;
-      } 
-    } while (vaddress != 0xffffff);
-
-    gpu->status.busy = 1;*/
-  }
-  if ((channels[2].chcr & 0x01000201) == 0x01000201) { 
-    BREAKPOINT
+    if (next & 0x800000)
+      break;
+    node = (next & 0x1ffffc) >> 2;
   }
-  if ((channels[2].chcr & 0x01000200) == 0x01000200) { 
-    BREAKPOINT
+  memset(&linked_list_visited[low >> 5],0,((high >> 5) - (low >> 5) + 1) * sizeof(uint32_t));
+  channels[2].madr = 0x00ffffff;
+}
+
+/*
+  CD-ROM data FIFO to RAM, the words of all blocks in one run unless the address
+  wraps.
+*/
+void Dma::Dma3() {
+  auto& cdrom = system_->cdrom();
+  auto& ram = system_->io().ram_buffer;
+  auto& ch = channels[3];
+  uint32_t block_size = ch.bcr & 0xFFFF;
+  if (block_size == 0)
+    block_size = 0x10000;
+  uint32_t blocks = ch.bcr >> 16;
+  uint32_t words = block_size * (blocks != 0 ? blocks : 1);
+  uint32_t addr = ch.madr & 0x1ffffc;
+  while (words != 0) {
+    uint32_t run = (0x200000 - addr) >> 2;
+    if (run > words)
+      run = words;
+    cdrom.DmaRead(&ram.u32[addr>>2],run);
+    addr = (addr + (run << 2)) & 0x1ffffc;
+    words -= run;
   }
+  ch.madr = addr;
+  ch.bcr &= 0xFFFF;
 }
 
+/*
+  SPU transfers in block mode, sound RAM is copied to or from whole runs of RAM
+  split only where the address wraps.
+*/
+void Dma::Dma4() {
+  auto& spu = system_->spu();
+  auto& ram = system_->io().ram_buffer;
+  auto& ch = channels[4];
+  uint32_t block_size = ch.bcr & 0xFFFF;
+  if (block_size == 0)
+    block_size = 0x10000;
+  uint32_t blocks = ch.bcr >> 16;
+  uint32_t words = block_size * (blocks != 0 ? blocks : 1);
+  uint32_t addr = ch.madr & 0x1ffffc;
+  while (words != 0) {
+    uint32_t run = (0x200000 - addr) >> 2;
+    if (run > words)
+      run = words;
+    if (ch.chcr & 0x1)
+      spu.DmaWrite(&ram.u32[addr>>2],run);
+    else
+      spu.DmaRead(&ram.u32[addr>>2],run);
+    addr = (addr + (run << 2)) & 0x1ffffc;
+    words -= run;
+  }
+  ch.madr = addr;
+  ch.bcr &= 0xFFFF;
+}
 
 /*Create Empty List*/
 void Dma::Dma6() {
@@ -35,8 +35,9 @@ class Dma : public Component {
   int Initialize();
   void SetInterrupt(int channel);
   void Tick();
-  uint32_t Read(uint32_t address);
-  void Write(uint32_t address,uint32_t data);
+  void WriteChannelControl(int channel,uint32_t data);
+  uint32_t ReadControl() { return dma_enable.raw; }
+  void WriteControl(uint32_t data);
   DmaChannel& channel(int i) { return channels[i]; }
  private:
   DmaChannel channels[7];
@@ -75,7 +76,13 @@ class Dma : public Component {
     };
     uint32_t raw;
   } interrupt_control;
+  //one bit per RAM word, set for the nodes of the linked list being walked
+  uint32_t linked_list_visited[0x200000 >> 7];
   void Dma2();
+  void DmaBlock2();
+  void DmaLinkedList2();
+  void Dma3();
+  void Dma4();
   void Dma6();
 };
 
@@ -0,0 +1,105 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+namespace emulation {
+namespace psx {
+
+FramePresenter::FramePresenter() : back_(0),front_(1),published_(0),dropped_(0),thread_(nullptr) {
+  memset(frames_,0,sizeof(frames_));
+  for (int i=0;i<3;++i)
+    frames_[i].index = i;
+  memset(&pixels_,0,sizeof(pixels_));
+  ready_ = 2;
+  presented_ = 0;
+  exit_ = false;
+}
+
+FramePresenter::~FramePresenter() {
+  Deinitialize();
+}
+
+int FramePresenter::Initialize(const PresentFunc& present,int max_width,int max_height) {
+  Deinitialize();
+  present_ = present;
+  memset(frames_,0,sizeof(frames_));
+  for (int i=0;i<3;++i)
+    frames_[i].index = i;
+  if (max_width != 0) {
+    pixels_.Alloc(3*max_width*max_height*sizeof(uint32_t));
+    memset(pixels_.u8,0,3*max_width*max_height*sizeof(uint32_t));
+    for (int i=0;i<3;++i) {
+      frames_[i].pixels = &pixels_.u32[i*max_width*max_height];
+      frames_[i].pitch = max_width;
+    }
+  }
+  back_ = 0;
+  front_ = 1;
+  ready_ = 2;
+  published_ = 0;
+  dropped_ = 0;
+  presented_ = 0;
+  exit_ = false;
+  thread_ = new std::thread(FramePresenter::thread_func,this);
+  return S_OK;
+}
+
+int FramePresenter::Deinitialize() {
+  if (thread_ != nullptr) {
+    exit_ = true;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wake_.notify_one();
+    }
+    thread_->join();
+    SafeDelete(&thread_);
+  }
+  if (pixels_.u8 != nullptr)
+    pixels_.Dealloc();
+  return S_OK;
+}
+
+/*
+  The notify is not done under the mutex so a wake up can be missed, the
+  presenter then finds the frame when its wait times out.
+*/
+void FramePresenter::Publish() {
+  frames_[back_].number = ++published_;
+  uint32_t previous = ready_.exchange(back_ | kFresh,std::memory_order_acq_rel);
+  if (previous & kFresh)
+    ++dropped_;
+  back_ = previous & ~kFresh;
+  wake_.notify_one();
+}
+
+void FramePresenter::thread_func(FramePresenter* presenter) {
+  while (!presenter->exit_) {
+    if ((presenter->ready_.load(std::memory_order_acquire) & kFresh) == 0) {
+      std::unique_lock<std::mutex> lock(presenter->mutex_);
+      presenter->wake_.wait_for(lock,std::chrono::milliseconds(4));
+      continue;
+    }
+    presenter->front_ = presenter->ready_.exchange(presenter->front_,std::memory_order_acq_rel) & ~kFresh;
+    presenter->present_(presenter->frames_[presenter->front_]);
+    presenter->presented_.fetch_add(1,std::memory_order_relaxed);
+  }
+}
+
+}
+}
@@ -0,0 +1,79 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  Hands finished frames from the emulation thread to a presentation thread through
+  three buffers. The emulation thread fills the back frame and publishes it by
+  swapping it with the ready one, the presentation thread swaps the ready frame
+  with its front one when a newer one is there. Neither side ever waits on the
+  other, a frame the presenter had no time for is replaced by the next one.
+*/
+class FramePresenter {
+ public:
+  static const int kMaxWidth = 640;
+  static const int kMaxHeight = 576;
+  struct Frame {
+    //0xAABBGGRR, null for cores that present without a picture
+    uint32_t* pixels;
+    int width,height;
+    //in pixels, the maximum width given to Initialize
+    int pitch;
+    uint64_t number;
+    //which of the three frames this is, for data kept alongside each frame
+    int index;
+    //emulated frames per second, updated about once a second
+    double fps;
+  };
+  typedef std::function<void(const Frame& frame)> PresentFunc;
+  FramePresenter();
+  ~FramePresenter();
+  //frames get a max_width x max_height picture unless max_width is 0
+  int Initialize(const PresentFunc& present,int max_width,int max_height);
+  int Deinitialize();
+  //emulation thread side, back() stays valid until the next Publish
+  Frame& back() { return frames_[back_]; }
+  void Publish();
+  uint64_t published() const { return published_; }
+  uint64_t dropped() const { return dropped_; }
+  uint64_t presented() const { return presented_.load(std::memory_order_relaxed); }
+ private:
+  //ready_ holds the index of the ready frame and kFresh while it is unpresented
+  static const uint32_t kFresh = 4;
+  static void thread_func(FramePresenter* presenter);
+  Frame frames_[3];
+  Buffer pixels_;
+  int back_;
+  int front_;
+  std::atomic<uint32_t> ready_;
+  uint64_t published_;
+  uint64_t dropped_;
+  std::atomic<uint64_t> presented_;
+  PresentFunc present_;
+  std::thread* thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::atomic<bool> exit_;
+};
+
+}
+}
@@ -26,10 +26,24 @@
 #include <memory.h>
 #include <eh.h>
 #include <functional>
+#include <vector>
+#include <string>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <memory>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <intrin.h>
+#include <immintrin.h>
 #include <WinCore/timer/timer2.h>
 #include "types.h"
+#include "spsc_ring.h"
+#include "work_pool.h"
+#include "frame_presenter.h"
+#include "audio_output.h"
 #include "debug.h"
 #include "component.h"
 #include "cpu_context.h"
@@ -37,10 +51,20 @@
 #include "gte.h"
 #include "gpu_core.h"
 #include "gpu_minive.h"
+#include "gpu_soft.h"
+#include "gpu_recorder.h"
+#include "spu_reverb.h"
 #include "spu.h"
+#include "disc_image.h"
+#include "compressed_image.h"
+#include "prefetch_image.h"
+#include "../../utilities/cdrom/iso9660.h"
+#include "iso_index.h"
+#include "cdrom.h"
 #include "root_counter.h"
 #include "dma.h"
 #include "io_interface.h"
 #include "kernel.h"
 #include "mc.h"
 #include "system.h"
+#include "benchmark.h"
@@ -22,6 +22,44 @@
 namespace emulation {
 namespace psx {
 
+/*
+  GPUSTAT register layout
+*/
+union GpuStatus {
+  struct {
+    uint32_t tx:4;
+    uint32_t ty:1;
+    uint32_t abr:2;
+    uint32_t tp:2;
+    uint32_t dtd:1;
+    uint32_t dfe:1;
+    uint32_t md:1;
+    uint32_t me:1;
+    uint32_t reserved:1;
+    uint32_t revflag:1;
+    uint32_t texdisable:1;
+    uint32_t width:3;
+    uint32_t height:1;
+    uint32_t video:1;
+    uint32_t isrgb24:1;
+    uint32_t isinter:1;
+    uint32_t den:1;
+    uint32_t irq1:1;
+    uint32_t dmareq:1;
+    uint32_t busy:1;
+    uint32_t img:1;
+    uint32_t com:1;
+    uint32_t dmadir:2;
+    uint32_t lcf:1;
+  };
+  uint32_t raw;
+};
+
+struct GpuStats {
+  uint64_t primitives;
+  uint64_t pixels;
+};
+
 class GpuCore : public Component {
  public:
   GpuCore():handle_(nullptr) {}
@@ -33,10 +71,32 @@ class GpuCore : public Component {
   virtual void WriteData(uint32_t data) = 0;
   virtual void WriteStatus(uint32_t data) = 0;
   virtual int Render() = 0;
+  //bulk GP0 writes and GPUREAD reads for DMA block transfers
+  virtual void WriteDataSpan(const uint32_t* data,size_t count) {
+    for (size_t i=0;i<count;++i)
+      WriteData(data[i]);
+  }
+  virtual void ReadDataSpan(uint32_t* data,size_t count) {
+    for (size_t i=0;i<count;++i)
+      data[i] = ReadData();
+  }
+  //native 1024x512 VRAM with everything written so far drawn, null if the core has none
+  virtual const uint16_t* ReadVram() { return nullptr; }
+  //GP0 and GP1 words that bring a reset core to the current drawing and display state
+  virtual void GetStateWords(std::vector<uint32_t>* gp0,std::vector<uint32_t>* gp1) {}
+  //primitives and pixels drawn since Initialize, zero if the core doesn't count them
+  virtual void GetStats(GpuStats* stats) { stats->primitives = stats->pixels = 0; }
   HWND handle() const { return handle_; }
   void set_handle(HWND handle) { handle_ = handle; }
+  //posted to the window with the frame rate * 1000 in wParam, the UI thread sets the caption
+  static const UINT kFpsMessage = WM_APP + 1;
  protected:
   HWND handle_;
+  //never blocks, safe to call from the presenter thread while the UI thread joins it
+  void PostFps(double fps) {
+    if (handle_ != nullptr)
+      PostMessage(handle_,kFpsMessage,(WPARAM)(fps * 1000.0 + 0.5),0);
+  }
 };
 
 }
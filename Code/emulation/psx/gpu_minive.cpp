@@ -28,6 +28,16 @@ inline uint32_t SelectBits(uint32_t data,uint32_t bitno,uint32_t size) {
   return (data>>bitno) & ((1<<size)-1);
 }
 
+//11bit signed vertex coordinate
+static inline float Coordinate(uint16_t value) {
+  return (float)((int16_t)(value << 5) >> 5);
+}
+
+static inline GfxVertex MakeVertex(uint16_t x,uint16_t y,uint32_t color,uint8_t u,uint8_t v) {
+  GfxVertex vertex = { Coordinate(x),Coordinate(y),0,0xff000000|(color&0xffffff),u*0.00390625f,v*0.00390625f };
+  return vertex;
+}
+
 const uint8_t kPrimitiveSize[256]=
 {
 //0x00
@@ -155,7 +165,7 @@ GpuMiniVE::Primitive GpuMiniVE::primitives[256] =
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 //0x80
-&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
+&GpuMiniVE::PrimitiveCopy,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
@@ -165,7 +175,7 @@ GpuMiniVE::Primitive GpuMiniVE::primitives[256] =
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 //0xa0
-&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
+&GpuMiniVE::PrimitiveImageLoad,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
@@ -175,7 +185,7 @@ GpuMiniVE::Primitive GpuMiniVE::primitives[256] =
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 //0xc0
-&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
+&GpuMiniVE::PrimitiveImageStore,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
 &GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,&GpuMiniVE::PrimitiveUnknown,
@@ -197,7 +207,24 @@ GpuMiniVE::Primitive GpuMiniVE::primitives[256] =
 };
 
 
-GpuMiniVE::GpuMiniVE():GpuCore(),gfx(nullptr) {
+static uint32_t ReadGpuData(void* param,uint32_t address) {
+  return ((GpuMiniVE*)param)->GpuMiniVE::ReadData();
+}
+
+static uint32_t ReadGpuStatus(void* param,uint32_t address) {
+  return ((GpuMiniVE*)param)->GpuMiniVE::ReadStatus();
+}
+
+static void WriteGpuData(void* param,uint32_t address,uint32_t data) {
+  ((GpuMiniVE*)param)->GpuMiniVE::WriteData(data);
+}
+
+static void WriteGpuStatus(void* param,uint32_t address,uint32_t data) {
+  ((GpuMiniVE*)param)->GpuMiniVE::WriteStatus(data);
+}
+
+GpuMiniVE::GpuMiniVE():GpuCore(),image_load_words(0),image_store_words(0),gfx(nullptr),
+  null_backend(false),caption_fps(0),primitive_count(0),batches(0),vertices(0) {
   
 }
 
@@ -210,49 +237,104 @@ GpuMiniVE::~GpuMiniVE() {
 
 int GpuMiniVE::Initialize() {
   Deinitialize();
-  gfx = new minive::D3D11Context();
+  if (null_backend || handle_ == nullptr)
+    gfx = new minive::NullContext();
+  else
+    gfx = new minive::D3D11Context();
   gfx->Initialize(640,480,false,handle_,false,1,0);
+  for (int i=0;i<3;++i)
+    draw_lists[i].Reset();
+  primitive_count = batches = vertices = 0;
+  caption_fps = 0;
+  presenter.Initialize([this](const FramePresenter::Frame& frame) { Present(frame); },0,0);
  
   data = 0;
   status.raw = 0x14802000;
   memset(&command_buffer,0,sizeof(command_buffer));
   memset(&drawing,0,sizeof(drawing));
+
+  //headless users drive GP0/GP1 directly without a system
+  if (system_ != nullptr) {
+    system_->io().MapPort(kM32,0x1F801810,this,ReadGpuData,WriteGpuData);
+    system_->io().MapPort(kM32,0x1F801814,this,ReadGpuStatus,WriteGpuStatus);
+  }
   return 0;
 }
 
 int GpuMiniVE::Deinitialize() {
+  presenter.Deinitialize();
   if (gfx)
     gfx->Deinitialize();
   SafeDelete(&gfx);
   return 0;
 }
 
+//publishes the frame and returns, a vsync wait in Present never stalls emulation
 int GpuMiniVE::Render() {
-  static int counter = 0;
+  double fps = 0;
+  if (system_ != nullptr) {
+    auto& timing = system_->timing();
+    ++timing.fps_counter;
+
+    if (timing.fps_time_span >= 1000.0) {
+      timing.fps = timing.fps_counter * (1000.0/timing.fps_time_span);
+      timing.fps_counter = 0;
+      timing.fps_time_span = 0;
+    }
+    fps = timing.fps;
+  }
+  batches += draw_list().batch_count();
+  vertices += draw_list().vertex_count();
+  presenter.back().fps = fps;
+  presenter.Publish();
+  draw_list().Reset();
+  return 0;
+}
+
+void GpuMiniVE::Present(const FramePresenter::Frame& frame) {
   gfx->Clear();
-  auto result = gfx->Present();
-  auto& timing = system_->timing();
-  ++timing.fps_counter;
-
-  if (timing.fps_time_span >= 1000.0) {
-    timing.fps = timing.fps_counter * (1000.0/timing.fps_time_span);
-    timing.fps_counter = 0;
-    timing.fps_time_span = 0;
-    char caption[256];
-    //sprintf(caption,"Freq : %0.2f MHz",nes.frequency_mhz());
-    //sprintf(caption,"CPS: %llu ",nes.cycles_per_second());
-    sprintf_s(caption,"FPS: %02.3f - %d",timing.fps,counter++);
-    SetWindowText(handle(),caption);
+  gfx->Draw(draw_lists[frame.index]);
+  gfx->Present();
+  if (frame.fps != caption_fps) {
+    caption_fps = frame.fps;
+    PostFps(frame.fps);
   }
-  return result;
 }
 
 
+void GpuMiniVE::GetStats(GpuStats* stats) {
+  stats->primitives = primitive_count;
+  stats->pixels = 0;
+}
+
+/*
+  Starts a new batch only when the blend mode, texture page, clip rectangle or
+  draw offset differ from the last primitive. The offset is applied by the
+  backend so vertices stay as the GPU got them.
+*/
+void GpuMiniVE::SetDrawState(bool semi,uint32_t texpage,uint32_t clut,bool textured) {
+  minive::DrawState state;
+  memset(&state,0,sizeof(state));
+  state.blend = semi ? minive::DrawList::kBlendAverage + SelectBits(texpage,5,2) : minive::DrawList::kBlendOpaque;
+  state.texture = textured ? (texpage & 0x1ff) | (clut << 16) : minive::DrawList::kNoTexture;
+  state.clip_x1 = drawing.clip_x;
+  state.clip_y1 = drawing.clip_y;
+  state.clip_x2 = drawing.clip_w;
+  state.clip_y2 = drawing.clip_h;
+  state.offset_x = (int16_t)(drawing.offset_x << 5) >> 5;
+  state.offset_y = (int16_t)(drawing.offset_y << 5) >> 5;
+  draw_list().set_state(state);
+  ++primitive_count;
+}
+
 uint32_t GpuMiniVE::ReadData() {
-  if (status.dmadir==0x3) {
-    BREAKPOINT
+  //no VRAM to read back, stores return black
+  if (image_store_words != 0) {
+    if (--image_store_words == 0)
+      status.img = 0;
+    return 0;
   }
-  if (status.dmadir==0x0) {
+  if (status.dmadir==0x0 || status.dmadir==0x3) {
     return data;
   }
   BREAKPOINT
@@ -270,7 +352,9 @@ void GpuMiniVE::WriteData(uint32_t data) {
   
 
   if (status.dmadir==0x2) {
-    if ((system_->io().dma.channel(2).chcr & 0x401) == 0x401) {
+    //linked list and block transfers
+    if ((system_->io().dma.channel(2).chcr & 0x401) == 0x401 ||
+        (system_->io().dma.channel(2).chcr & 0x201) == 0x201) {
       FillCommandBuffer(data);
     } else {
       BREAKPOINT
@@ -285,6 +369,16 @@ void GpuMiniVE::WriteData(uint32_t data) {
   return;
 }
 
+//spans only come from DMA so the status and channel checks are done once per span
+void GpuMiniVE::WriteDataSpan(const uint32_t* data,size_t count) {
+  status.busy = 0;
+  status.com = 0;
+  for (size_t i=0;i<count;++i)
+    FillCommandBuffer(data[i]);
+  status.com = 1;
+  status.busy = 1;
+}
+
 
 void GpuMiniVE::WriteStatus(uint32_t data) {
   uint16_t command = (data & 0xFF000000) >> 24;
@@ -292,10 +386,12 @@ void GpuMiniVE::WriteStatus(uint32_t data) {
   switch (command) {
     case 0x00:
       memset(&command_buffer,0,sizeof(command_buffer));
+      image_load_words = image_store_words = 0;
       status.raw = 0x14802000;
       break;
     case 0x01:
       memset(&command_buffer,0,sizeof(command_buffer));
+      image_load_words = 0;
       break;
     case 0x02:
       status.irq1 = 0;
@@ -343,6 +439,10 @@ void GpuMiniVE::WriteStatus(uint32_t data) {
 
 void GpuMiniVE::FillCommandBuffer(uint32_t data) {
   this->data = data;
+  if (image_load_words != 0) {
+    --image_load_words;
+    return;
+  }
   if (command_buffer.param_count == 0) {
     
     command_buffer.command = (data & 0xFF000000) >> 24;
@@ -386,11 +486,38 @@ void GpuMiniVE::PrimitiveUnknown() {
   BREAKPOINT
 }
 
+static uint32_t ImageWords(uint32_t size) {
+  uint32_t w = (((size & 0xFFFF) - 1) & 0x3FF) + 1;
+  uint32_t h = (((size >> 16) - 1) & 0x1FF) + 1;
+  return (w * h + 1) / 2;
+}
+
+/*
+  The transfers have nothing to copy without a VRAM, they only keep the command
+  stream in step.
+*/
+void GpuMiniVE::PrimitiveCopy() {
+}
+
+void GpuMiniVE::PrimitiveImageLoad() {
+  image_load_words = ImageWords(command_buffer.buffer[2]);
+}
+
+void GpuMiniVE::PrimitiveImageStore() {
+  image_store_words = ImageWords(command_buffer.buffer[2]);
+  status.img = 1;
+}
+
 
 void GpuMiniVE::PrimitivePolyFT3() {
  PolyFT3 poly;
  //G2DPoly3 destpoly;
  memcpy(&poly,command_buffer.buffer,sizeof(PolyFT3));
+ SetDrawState((command_buffer.command & 2) != 0,poly.tpage,poly.clut,true);
+ GfxVertex* v = draw_list().AddTriangles(1);
+ v[0] = MakeVertex(poly.x0,poly.y0,poly.color,poly.u0,poly.v0);
+ v[1] = MakeVertex(poly.x1,poly.y1,poly.color,poly.u1,poly.v1);
+ v[2] = MakeVertex(poly.x2,poly.y2,poly.color,poly.u2,poly.v2);
  //_cprintf("PolyFT3:%d %d\n",poly.clut,poly.tpage);
  
  /*poly.color=swap_color(poly.color);
@@ -424,16 +551,17 @@ void GpuMiniVE::PrimitivePolyF4() {
  memcpy(&poly,command_buffer.buffer,sizeof(PolyF4));
  
  uint32_t color = 0xff000000|poly.color;
+ SetDrawState((command_buffer.command & 2) != 0,status.raw,0,false);
 
    emulation::psx::GfxVertex v[4] = {
-     {poly.x0,poly.y0,0,color,0,0},
-      {poly.x1,poly.y1,0,color,0,0},
-      {poly.x2,poly.y2,0,color,0,0},
-      {poly.x3,poly.y3,0,color,0,0}
+     MakeVertex(poly.x0,poly.y0,color,0,0),
+      MakeVertex(poly.x1,poly.y1,color,0,0),
+      MakeVertex(poly.x2,poly.y2,color,0,0),
+      MakeVertex(poly.x3,poly.y3,color,0,0)
     };
     
     
-    //gs->gfx->device()->DrawPrimitiveUP(D3DPT_TRIANGLESTRIP,2,v,sizeof(emulation::psx::GfxVertex));
+    draw_list().AddQuad(v);
 
 
  /*memset(&destpoly,0,sizeof(destpoly));
@@ -457,17 +585,18 @@ void GpuMiniVE::PrimitivePolyG4() {
  PolyG4 poly;
  //G2DPoly4 destpoly;
  memcpy(&poly,command_buffer.buffer,sizeof(PolyG4));
+ SetDrawState((command_buffer.command & 2) != 0,status.raw,0,false);
 
 
    emulation::psx::GfxVertex v[4] = {
-     {poly.x0,poly.y0,0,0xff000000|poly.color0,0,0},
-      {poly.x1,poly.y1,0,0xff000000|poly.color1,0,0},
-      {poly.x2,poly.y2,0,0xff000000|poly.color2,0,0},
-      {poly.x3,poly.y3,0,0xff000000|poly.color3,0,0}
+     MakeVertex(poly.x0,poly.y0,poly.color0,0,0),
+      MakeVertex(poly.x1,poly.y1,poly.color1,0,0),
+      MakeVertex(poly.x2,poly.y2,poly.color2,0,0),
+      MakeVertex(poly.x3,poly.y3,poly.color3,0,0)
     };
     
     
-   // gs->gfx->device()->DrawPrimitiveUP(D3DPT_TRIANGLESTRIP,2,v,sizeof(emulation::psx::GfxVertex));
+   draw_list().AddQuad(v);
 
 
  /*memset(&destpoly,0,sizeof(destpoly));
@@ -495,17 +624,18 @@ void GpuMiniVE::PrimitivePolyGT4() {
 
  memcpy(&poly,command_buffer.buffer,sizeof(PolyGT4));
  tp=poly.tpage;
+ SetDrawState((command_buffer.command & 2) != 0,poly.tpage,poly.clut,true);
 
 
    emulation::psx::GfxVertex v[4] = {
-     {poly.x0,poly.y0,0,0xff000000|poly.color0,0,0},
-      {poly.x1,poly.y1,0,0xff000000|poly.color1,0,0},
-      {poly.x2,poly.y2,0,0xff000000|poly.color2,0,0},
-      {poly.x3,poly.y3,0,0xff000000|poly.color3,0,0}
+     MakeVertex(poly.x0,poly.y0,poly.color0,poly.u0,poly.v0),
+      MakeVertex(poly.x1,poly.y1,poly.color1,poly.u1,poly.v1),
+      MakeVertex(poly.x2,poly.y2,poly.color2,poly.u2,poly.v2),
+      MakeVertex(poly.x3,poly.y3,poly.color3,poly.u3,poly.v3)
     };
     
     
-    //gs->gfx->device()->DrawPrimitiveUP(D3DPT_TRIANGLESTRIP,2,v,sizeof(emulation::psx::GfxVertex));
+    draw_list().AddQuad(v);
 
 
  /*
@@ -25,11 +25,7 @@ namespace psx {
 
 
 
-struct GfxVertex {
-  float x,y,z;
-  uint32_t color;
-  float u,v;
-};
+typedef minive::DrawVertex GfxVertex;
 
 typedef struct
 {
@@ -183,40 +179,22 @@ class GpuMiniVE : public GpuCore {
   uint32_t  ReadStatus();
   void WriteData(uint32_t data);
   void WriteStatus(uint32_t data);
+  void WriteDataSpan(const uint32_t* data,size_t count);
   int Render();
+  void GetStats(GpuStats* stats);
   void FillCommandBuffer(uint32_t data);
+  //draws into a NullContext instead of Direct3D, cores without a window always do
+  void set_null_backend(bool null_backend) { this->null_backend = null_backend; }
+  minive::Context* context() { return gfx; }
+  //batches and vertices handed to the backend since Initialize
+  uint64_t batch_count() const { return batches; }
+  uint64_t vertex_count() const { return vertices; }
  private:
   static Primitive primitives[256];
-  union {
-    struct {
-      uint32_t tx:4;
-      uint32_t ty:1;
-      uint32_t abr:2;
-      uint32_t tp:2;
-      uint32_t dtd:1;
-      uint32_t dfe:1;
-      uint32_t md:1;
-      uint32_t me:1;
-      uint32_t reserved:1;
-      uint32_t revflag:1;
-      uint32_t texdisable:1;
-      uint32_t width:3;
-      uint32_t height:1;
-      uint32_t video:1;
-      uint32_t isrgb24:1;
-      uint32_t isinter:1;
-      uint32_t den:1;
-      uint32_t irq1:1;
-      uint32_t dmareq:1;
-      uint32_t busy:1;
-      uint32_t img:1;
-      uint32_t com:1;
-      uint32_t dmadir:2;
-      uint32_t lcf:1;
-    };
-    uint32_t raw;
-  }status;
+  GpuStatus status;
   uint32_t data;
+  uint32_t image_load_words;
+  uint32_t image_store_words;
   struct {
     uint8_t command;
     int param_count;
@@ -231,8 +209,23 @@ class GpuMiniVE : public GpuCore {
     uint16_t offset_y;
   }drawing;
   minive::Context* gfx;
+  bool null_backend;
+  //Clear/Present run on the presenter thread, each of its
+  //frames has a draw list the primitives of that frame are batched into
+  FramePresenter presenter;
+  minive::DrawList draw_lists[3];
+  uint64_t primitive_count;
+  uint64_t batches;
+  uint64_t vertices;
+  minive::DrawList& draw_list() { return draw_lists[presenter.back().index]; }
+  void SetDrawState(bool semi,uint32_t texpage,uint32_t clut,bool textured);
+  double caption_fps;
+  void Present(const FramePresenter::Frame& frame);
   void UpdateGSSize();
   void PrimitiveUnknown();
+  void PrimitiveCopy();
+  void PrimitiveImageLoad();
+  void PrimitiveImageStore();
   void PrimitivePolyFT3();
   void PrimitivePolyF4();
   void PrimitivePolyG4();
@@ -0,0 +1,281 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+namespace emulation {
+namespace psx {
+
+static uint32_t ReadGpuData(void* param,uint32_t address) {
+  return ((GpuRecorder*)param)->ReadData();
+}
+
+static uint32_t ReadGpuStatus(void* param,uint32_t address) {
+  return ((GpuRecorder*)param)->ReadStatus();
+}
+
+static void WriteGpuData(void* param,uint32_t address,uint32_t data) {
+  ((GpuRecorder*)param)->WriteData(data);
+}
+
+static void WriteGpuStatus(void* param,uint32_t address,uint32_t data) {
+  ((GpuRecorder*)param)->WriteStatus(data);
+}
+
+GpuRecorder::GpuRecorder(GpuCore* target,const char* filename,int first_frame,int frame_count)
+  : GpuCore(),target_(target),first_frame_(first_frame),frame_count_(frame_count),frame_(0),
+    frames_recorded_(0),fp_(nullptr),record_start_(0),record_type_(-1) {
+  strcpy_s(filename_,filename);
+  memset(&header_,0,sizeof(header_));
+}
+
+GpuRecorder::~GpuRecorder() {
+  Stop();
+  SafeDelete(&target_);
+}
+
+//the core maps the GPU ports to itself, they are taken over once it is up
+int GpuRecorder::Initialize() {
+  target_->set_system(system_);
+  target_->set_handle(handle_);
+  int result = target_->Initialize();
+  if (system_ != nullptr) {
+    system_->io().MapPort(kM32,0x1F801810,this,ReadGpuData,WriteGpuData);
+    system_->io().MapPort(kM32,0x1F801814,this,ReadGpuStatus,WriteGpuStatus);
+  }
+  frame_ = 0;
+  frames_recorded_ = 0;
+  if (first_frame_ == 0)
+    Start();
+  return result;
+}
+
+int GpuRecorder::Deinitialize() {
+  Stop();
+  return target_->Deinitialize();
+}
+
+uint32_t GpuRecorder::ReadData() {
+  return target_->ReadData();
+}
+
+uint32_t GpuRecorder::ReadStatus() {
+  return target_->ReadStatus();
+}
+
+void GpuRecorder::WriteData(uint32_t data) {
+  if (fp_ != nullptr)
+    Record(kRecordGp0,&data,1);
+  target_->WriteData(data);
+}
+
+void GpuRecorder::WriteStatus(uint32_t data) {
+  if (fp_ != nullptr)
+    Record(kRecordGp1,&data,1);
+  target_->WriteStatus(data);
+}
+
+void GpuRecorder::WriteDataSpan(const uint32_t* data,size_t count) {
+  if (fp_ != nullptr)
+    Record(kRecordGp0,data,count);
+  target_->WriteDataSpan(data,count);
+}
+
+void GpuRecorder::ReadDataSpan(uint32_t* data,size_t count) {
+  target_->ReadDataSpan(data,count);
+}
+
+const uint16_t* GpuRecorder::ReadVram() {
+  return target_->ReadVram();
+}
+
+void GpuRecorder::GetStateWords(std::vector<uint32_t>* gp0,std::vector<uint32_t>* gp1) {
+  target_->GetStateWords(gp0,gp1);
+}
+
+void GpuRecorder::GetStats(GpuStats* stats) {
+  target_->GetStats(stats);
+}
+
+int GpuRecorder::Render() {
+  int result = target_->Render();
+  ++frame_;
+  if (fp_ != nullptr) {
+    Record(kRecordFrame,nullptr,0);
+    if (++frames_recorded_ == frame_count_)
+      Stop();
+  } else if (frame_ == first_frame_ && frames_recorded_ == 0) {
+    Start();
+  }
+  return result;
+}
+
+void GpuRecorder::Start() {
+  if (fopen_s(&fp_,filename_,"wb") != 0) {
+    fp_ = nullptr;
+    return;
+  }
+  header_.magic = kMagic;
+  header_.version = kVersion;
+  header_.frame_count = 0;
+  header_.flags = 0;
+  fwrite(&header_,sizeof(header_),1,fp_);
+  buffer_.clear();
+  record_type_ = -1;
+
+  std::vector<uint32_t> gp0, gp1;
+  target_->GetStateWords(&gp0,&gp1);
+  uint32_t reset = 0x00000000;
+  Record(kRecordGp1,&reset,1);
+  if (!gp1.empty())
+    Record(kRecordGp1,gp1.data(),gp1.size());
+  const uint16_t* vram = target_->ReadVram();
+  if (vram != nullptr) {
+    //unmasked upload of the whole 1024x512 VRAM
+    const uint32_t upload[4] = { 0xE6000000, 0xA0000000, 0x00000000, 0x02000400 };
+    Record(kRecordGp0,upload,4);
+    Record(kRecordGp0,(const uint32_t*)vram,GpuSoft::kVramWidth*GpuSoft::kVramHeight/2);
+    header_.flags |= kFlagVram;
+  }
+  if (!gp0.empty())
+    Record(kRecordGp0,gp0.data(),gp0.size());
+}
+
+void GpuRecorder::Stop() {
+  if (fp_ == nullptr)
+    return;
+  CloseRecord();
+  Flush();
+  header_.frame_count = frames_recorded_;
+  fseek(fp_,0,SEEK_SET);
+  fwrite(&header_,sizeof(header_),1,fp_);
+  fclose(fp_);
+  fp_ = nullptr;
+}
+
+//consecutive words of the same type share one record
+void GpuRecorder::Record(RecordType type,const uint32_t* data,size_t count) {
+  if (type == kRecordFrame) {
+    CloseRecord();
+    buffer_.push_back(kRecordFrame << 28);
+  } else {
+    if (record_type_ != type) {
+      CloseRecord();
+      record_start_ = buffer_.size();
+      buffer_.push_back(type << 28);
+      record_type_ = type;
+    }
+    buffer_.insert(buffer_.end(),data,data + count);
+  }
+  if (buffer_.size() >= kFlushSize) {
+    CloseRecord();
+    Flush();
+  }
+}
+
+void GpuRecorder::CloseRecord() {
+  if (record_type_ < 0)
+    return;
+  buffer_[record_start_] |= (uint32_t)(buffer_.size() - record_start_ - 1);
+  record_type_ = -1;
+}
+
+void GpuRecorder::Flush() {
+  if (!buffer_.empty())
+    fwrite(buffer_.data(),sizeof(uint32_t),buffer_.size(),fp_);
+  buffer_.clear();
+}
+
+GpuReplay::GpuReplay() {
+  memset(&header_,0,sizeof(header_));
+}
+
+GpuReplay::~GpuReplay() {
+}
+
+int GpuReplay::Load(const char* filename) {
+  FILE* fp;
+  if (fopen_s(&fp,filename,"rb") != 0)
+    return E_FAIL;
+  fseek(fp,0,SEEK_END);
+  long size = ftell(fp);
+  fseek(fp,0,SEEK_SET);
+  words_.clear();
+  if (size < (long)sizeof(header_) || fread(&header_,sizeof(header_),1,fp) != 1 ||
+      header_.magic != GpuRecorder::kMagic || header_.version != GpuRecorder::kVersion) {
+    fclose(fp);
+    return E_FAIL;
+  }
+  words_.resize((size - sizeof(header_)) / sizeof(uint32_t));
+  size_t read = words_.empty() ? 0 : fread(words_.data(),sizeof(uint32_t),words_.size(),fp);
+  fclose(fp);
+  return read == words_.size() ? S_OK : E_FAIL;
+}
+
+int GpuReplay::Run(GpuCore* gpu,GpuReplayResult* result) {
+  LARGE_INTEGER freq,pc1,pc2;
+  QueryPerformanceFrequency(&freq);
+  result->frames = 0;
+  result->seconds = 0;
+  result->frame_hashes.clear();
+  const uint32_t* p = words_.data();
+  const uint32_t* end = p + words_.size();
+  QueryPerformanceCounter(&pc1);
+  while (p < end) {
+    uint32_t type = *p >> 28;
+    uint32_t count = *p++ & 0x0FFFFFFF;
+    if (count > (uint32_t)(end - p))
+      return E_FAIL;
+    switch (type) {
+      case GpuRecorder::kRecordGp0:
+        gpu->WriteDataSpan(p,count);
+        break;
+      case GpuRecorder::kRecordGp1:
+        for (uint32_t i=0;i<count;++i)
+          gpu->WriteStatus(p[i]);
+        break;
+      case GpuRecorder::kRecordFrame: {
+        gpu->Render();
+        QueryPerformanceCounter(&pc2);
+        result->seconds += double(pc2.QuadPart - pc1.QuadPart) / double(freq.QuadPart);
+        const uint16_t* vram = gpu->ReadVram();
+        result->frame_hashes.push_back(vram != nullptr ? HashVram(vram) : 0);
+        ++result->frames;
+        QueryPerformanceCounter(&pc1);
+        break;
+      }
+      default:
+        return E_FAIL;
+    }
+    p += count;
+  }
+  gpu->GetStats(&result->stats);
+  return S_OK;
+}
+
+//FNV-1a over the VRAM words
+uint32_t GpuReplay::HashVram(const uint16_t* vram) {
+  const uint32_t* words = (const uint32_t*)vram;
+  uint32_t hash = 2166136261u;
+  for (int i=0;i<GpuSoft::kVramWidth*GpuSoft::kVramHeight/2;++i)
+    hash = (hash ^ words[i]) * 16777619u;
+  return hash;
+}
+
+}
+}
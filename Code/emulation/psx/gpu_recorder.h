@@ -0,0 +1,110 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  GPU command stream dumps. A dump is a small header followed by records, each
+  record is a word with the type in the top 4 bits and the word count below,
+  then the words. The first recorded frame starts with a GP1 reset, the GP1
+  display state, a full VRAM upload and the GP0 drawing state, so a replay
+  doesn't depend on anything that happened before the recording.
+*/
+struct GpuDumpHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t frame_count;
+  uint32_t flags;
+};
+
+/*
+  Sits between the system and a GPU core and writes every GP0/GP1 word of a
+  range of frames to a dump, the core is owned and driven as usual.
+*/
+class GpuRecorder : public GpuCore {
+ public:
+  static const uint32_t kMagic = 0x47585350; //PSXG
+  static const uint32_t kVersion = 1;
+  static const uint32_t kFlagVram = 0x1;
+  enum RecordType { kRecordGp0 = 0, kRecordGp1 = 1, kRecordFrame = 2 };
+  GpuRecorder(GpuCore* target,const char* filename,int first_frame,int frame_count);
+  ~GpuRecorder();
+  int Initialize();
+  int Deinitialize();
+  uint32_t  ReadData();
+  uint32_t  ReadStatus();
+  void WriteData(uint32_t data);
+  void WriteStatus(uint32_t data);
+  void WriteDataSpan(const uint32_t* data,size_t count);
+  void ReadDataSpan(uint32_t* data,size_t count);
+  const uint16_t* ReadVram();
+  void GetStateWords(std::vector<uint32_t>* gp0,std::vector<uint32_t>* gp1);
+  void GetStats(GpuStats* stats);
+  int Render();
+  GpuCore* target() { return target_; }
+  bool recording() const { return fp_ != nullptr; }
+ private:
+  static const size_t kFlushSize = 64*1024;
+  GpuCore* target_;
+  char filename_[MAX_PATH];
+  int first_frame_;
+  int frame_count_;
+  int frame_;
+  int frames_recorded_;
+  FILE* fp_;
+  GpuDumpHeader header_;
+  std::vector<uint32_t> buffer_;
+  size_t record_start_;
+  int record_type_;
+  void Start();
+  void Stop();
+  void Record(RecordType type,const uint32_t* data,size_t count);
+  void CloseRecord();
+  void Flush();
+};
+
+struct GpuReplayResult {
+  int frames;
+  double seconds;
+  GpuStats stats;
+  std::vector<uint32_t> frame_hashes;
+};
+
+/*
+  Loads a dump into memory and feeds it to a core as fast as it takes it, GP0
+  records go in as spans. The time only covers feeding and the end of frame
+  Render calls, the per frame VRAM hashes are taken outside of it.
+*/
+class GpuReplay {
+ public:
+  GpuReplay();
+  ~GpuReplay();
+  int Load(const char* filename);
+  int Run(GpuCore* gpu,GpuReplayResult* result);
+  uint32_t frame_count() const { return header_.frame_count; }
+  static uint32_t HashVram(const uint16_t* vram);
+ private:
+  GpuDumpHeader header_;
+  std::vector<uint32_t> words_;
+};
+
+}
+}
@@ -0,0 +1,2375 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+//#define GPU_DEBUG
+
+namespace emulation {
+namespace psx {
+
+//offsets added to the 8bit colors before they are truncated to 5bit
+static const int8_t kDitherTable[4][4] = {
+  { -4,  0, -3,  1 },
+  {  2, -2,  3, -1 },
+  { -3,  1, -4,  0 },
+  {  3, -1,  2, -2 },
+};
+static const int8_t kNoDither[4] = { 0, 0, 0, 0 };
+
+struct BlendState {
+  int semi_mode;      //-1 when the primitive is opaque
+  bool per_texel;     //textured primitives only blend texels with bit 15 set
+  bool check_mask;
+  uint16_t set_mask;
+};
+
+static inline int32_t Clamp(int32_t value,int32_t min,int32_t max) {
+  return value < min ? min : (value > max ? max : value);
+}
+
+static inline int32_t Min(int32_t a,int32_t b) {
+  return a < b ? a : b;
+}
+
+static inline int32_t Max(int32_t a,int32_t b) {
+  return a > b ? a : b;
+}
+
+static inline int64_t Min(int64_t a,int64_t b) {
+  return a < b ? a : b;
+}
+
+static inline int64_t Max(int64_t a,int64_t b) {
+  return a > b ? a : b;
+}
+
+static inline int32_t SignExtend11(uint32_t value) {
+  return (int32_t)(value << 21) >> 21;
+}
+
+//columns of width 1<<shift covered by [x,x+w), wrapping at the right edge of VRAM
+static inline uint32_t TileColumns(int x,int w,int shift,int columns) {
+  uint32_t mask = 0;
+  for (int column=x>>shift;column<=(x+w-1)>>shift;++column)
+    mask |= 1 << (column & (columns-1));
+  return mask;
+}
+
+static inline uint16_t BlendPixel(uint16_t back,uint16_t front,int mode) {
+  int br = back & 0x1F, bg = (back >> 5) & 0x1F, bb = (back >> 10) & 0x1F;
+  int fr = front & 0x1F, fg = (front >> 5) & 0x1F, fb = (front >> 10) & 0x1F;
+  switch (mode) {
+    case 0: br = (br + fr) >> 1; bg = (bg + fg) >> 1; bb = (bb + fb) >> 1; break;
+    case 1: br = Min(br + fr,31); bg = Min(bg + fg,31); bb = Min(bb + fb,31); break;
+    case 2: br = Max(br - fr,0); bg = Max(bg - fg,0); bb = Max(bb - fb,0); break;
+    default: br = Min(br + (fr >> 2),31); bg = Min(bg + (fg >> 2),31); bb = Min(bb + (fb >> 2),31); break;
+  }
+  return (uint16_t)(br | (bg << 5) | (bb << 10) | (front & 0x8000));
+}
+
+/*
+  Span kernels. Shading turns the interpolated 8bit color (optionally modulating a texel)
+  into 15bit with dithering, writing does the mask test, semi-transparency and mask set.
+  The scalar versions are the reference and handle the tails of the vector loops.
+*/
+static void ShadeSpanScalar(uint16_t* out,const uint16_t* texels,int count,const GpuSoft::Span& span,const int8_t* dither) {
+  int32_t r = span.r, g = span.g, b = span.b;
+  for (int i=0;i<count;++i,r+=span.dr,g+=span.dg,b+=span.db) {
+    int32_t cr = r >> 12, cg = g >> 12, cb = b >> 12;
+    uint16_t mask = 0;
+    if (texels != nullptr) {
+      uint16_t t = texels[i];
+      cr = ((t & 0x1F) * cr) >> 4;
+      cg = (((t >> 5) & 0x1F) * cg) >> 4;
+      cb = (((t >> 10) & 0x1F) * cb) >> 4;
+      mask = t & 0x8000;
+    }
+    int d = dither[i & 3];
+    cr = Clamp(cr + d,0,255) >> 3;
+    cg = Clamp(cg + d,0,255) >> 3;
+    cb = Clamp(cb + d,0,255) >> 3;
+    out[i] = (uint16_t)(cr | (cg << 5) | (cb << 10) | mask);
+  }
+}
+
+static void ShadeSpanSSE41(uint16_t* out,const uint16_t* texels,int count,const GpuSoft::Span& span,const int8_t* dither) {
+  const __m128i lane = _mm_setr_epi32(0,1,2,3);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max = _mm_set1_epi32(255);
+  const __m128i k1F = _mm_set1_epi32(0x1F);
+  const __m128i k8000 = _mm_set1_epi32(0x8000);
+  const __m128i d = _mm_setr_epi32(dither[0],dither[1],dither[2],dither[3]);
+  const __m128i step_r = _mm_set1_epi32(span.dr*4);
+  const __m128i step_g = _mm_set1_epi32(span.dg*4);
+  const __m128i step_b = _mm_set1_epi32(span.db*4);
+  __m128i r = _mm_add_epi32(_mm_set1_epi32(span.r),_mm_mullo_epi32(lane,_mm_set1_epi32(span.dr)));
+  __m128i g = _mm_add_epi32(_mm_set1_epi32(span.g),_mm_mullo_epi32(lane,_mm_set1_epi32(span.dg)));
+  __m128i b = _mm_add_epi32(_mm_set1_epi32(span.b),_mm_mullo_epi32(lane,_mm_set1_epi32(span.db)));
+  int i = 0;
+  for (;i+4<=count;i+=4) {
+    __m128i cr = _mm_srai_epi32(r,12);
+    __m128i cg = _mm_srai_epi32(g,12);
+    __m128i cb = _mm_srai_epi32(b,12);
+    __m128i mask = zero;
+    if (texels != nullptr) {
+      __m128i t = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(texels+i)));
+      cr = _mm_srai_epi32(_mm_mullo_epi32(_mm_and_si128(t,k1F),cr),4);
+      cg = _mm_srai_epi32(_mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(t,5),k1F),cg),4);
+      cb = _mm_srai_epi32(_mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(t,10),k1F),cb),4);
+      mask = _mm_and_si128(t,k8000);
+    }
+    cr = _mm_srli_epi32(_mm_min_epi32(_mm_max_epi32(_mm_add_epi32(cr,d),zero),max),3);
+    cg = _mm_srli_epi32(_mm_min_epi32(_mm_max_epi32(_mm_add_epi32(cg,d),zero),max),3);
+    cb = _mm_srli_epi32(_mm_min_epi32(_mm_max_epi32(_mm_add_epi32(cb,d),zero),max),3);
+    __m128i c = _mm_or_si128(_mm_or_si128(cr,_mm_slli_epi32(cg,5)),_mm_or_si128(_mm_slli_epi32(cb,10),mask));
+    _mm_storel_epi64((__m128i*)(out+i),_mm_packus_epi32(c,c));
+    r = _mm_add_epi32(r,step_r);
+    g = _mm_add_epi32(g,step_g);
+    b = _mm_add_epi32(b,step_b);
+  }
+  if (i < count) {
+    GpuSoft::Span tail = span;
+    tail.r += span.dr * i;
+    tail.g += span.dg * i;
+    tail.b += span.db * i;
+    ShadeSpanScalar(out+i,texels != nullptr ? texels+i : nullptr,count-i,tail,dither);
+  }
+}
+
+static void ShadeSpanAVX2(uint16_t* out,const uint16_t* texels,int count,const GpuSoft::Span& span,const int8_t* dither) {
+  const __m256i lane = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i max = _mm256_set1_epi32(255);
+  const __m256i k1F = _mm256_set1_epi32(0x1F);
+  const __m256i k8000 = _mm256_set1_epi32(0x8000);
+  const __m256i d = _mm256_setr_epi32(dither[0],dither[1],dither[2],dither[3],dither[0],dither[1],dither[2],dither[3]);
+  const __m256i step_r = _mm256_set1_epi32(span.dr*8);
+  const __m256i step_g = _mm256_set1_epi32(span.dg*8);
+  const __m256i step_b = _mm256_set1_epi32(span.db*8);
+  __m256i r = _mm256_add_epi32(_mm256_set1_epi32(span.r),_mm256_mullo_epi32(lane,_mm256_set1_epi32(span.dr)));
+  __m256i g = _mm256_add_epi32(_mm256_set1_epi32(span.g),_mm256_mullo_epi32(lane,_mm256_set1_epi32(span.dg)));
+  __m256i b = _mm256_add_epi32(_mm256_set1_epi32(span.b),_mm256_mullo_epi32(lane,_mm256_set1_epi32(span.db)));
+  int i = 0;
+  for (;i+8<=count;i+=8) {
+    __m256i cr = _mm256_srai_epi32(r,12);
+    __m256i cg = _mm256_srai_epi32(g,12);
+    __m256i cb = _mm256_srai_epi32(b,12);
+    __m256i mask = zero;
+    if (texels != nullptr) {
+      __m256i t = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(texels+i)));
+      cr = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_and_si256(t,k1F),cr),4);
+      cg = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(t,5),k1F),cg),4);
+      cb = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(t,10),k1F),cb),4);
+      mask = _mm256_and_si256(t,k8000);
+    }
+    cr = _mm256_srli_epi32(_mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(cr,d),zero),max),3);
+    cg = _mm256_srli_epi32(_mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(cg,d),zero),max),3);
+    cb = _mm256_srli_epi32(_mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(cb,d),zero),max),3);
+    __m256i c = _mm256_or_si256(_mm256_or_si256(cr,_mm256_slli_epi32(cg,5)),_mm256_or_si256(_mm256_slli_epi32(cb,10),mask));
+    //packus works per 128bit lane, gather the two low quadwords
+    c = _mm256_permute4x64_epi64(_mm256_packus_epi32(c,c),0x08);
+    _mm_storeu_si128((__m128i*)(out+i),_mm256_castsi256_si128(c));
+    r = _mm256_add_epi32(r,step_r);
+    g = _mm256_add_epi32(g,step_g);
+    b = _mm256_add_epi32(b,step_b);
+  }
+  _mm256_zeroupper();
+  if (i < count) {
+    GpuSoft::Span tail = span;
+    tail.r += span.dr * i;
+    tail.g += span.dg * i;
+    tail.b += span.db * i;
+    ShadeSpanScalar(out+i,texels != nullptr ? texels+i : nullptr,count-i,tail,dither);
+  }
+}
+
+static void WriteSpanScalar(uint16_t* dst,const uint16_t* src,const uint16_t* texels,int count,const BlendState& state) {
+  for (int i=0;i<count;++i) {
+    if (texels != nullptr && texels[i] == 0)
+      continue;
+    uint16_t back = dst[i];
+    if (state.check_mask && (back & 0x8000))
+      continue;
+    uint16_t front = src[i];
+    if (state.semi_mode >= 0 && (!state.per_texel || (front & 0x8000)))
+      front = BlendPixel(back,front,state.semi_mode);
+    dst[i] = front | state.set_mask;
+  }
+}
+
+static inline __m128i BlendSSE41(__m128i back,__m128i front,int mode) {
+  const __m128i k1F = _mm_set1_epi16(0x1F);
+  const __m128i k31 = _mm_set1_epi16(31);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i br = _mm_and_si128(back,k1F), bg = _mm_and_si128(_mm_srli_epi16(back,5),k1F), bb = _mm_and_si128(_mm_srli_epi16(back,10),k1F);
+  __m128i fr = _mm_and_si128(front,k1F), fg = _mm_and_si128(_mm_srli_epi16(front,5),k1F), fb = _mm_and_si128(_mm_srli_epi16(front,10),k1F);
+  switch (mode) {
+    case 0:
+      br = _mm_srli_epi16(_mm_add_epi16(br,fr),1);
+      bg = _mm_srli_epi16(_mm_add_epi16(bg,fg),1);
+      bb = _mm_srli_epi16(_mm_add_epi16(bb,fb),1);
+      break;
+    case 1:
+      br = _mm_min_epi16(_mm_add_epi16(br,fr),k31);
+      bg = _mm_min_epi16(_mm_add_epi16(bg,fg),k31);
+      bb = _mm_min_epi16(_mm_add_epi16(bb,fb),k31);
+      break;
+    case 2:
+      br = _mm_max_epi16(_mm_sub_epi16(br,fr),zero);
+      bg = _mm_max_epi16(_mm_sub_epi16(bg,fg),zero);
+      bb = _mm_max_epi16(_mm_sub_epi16(bb,fb),zero);
+      break;
+    default:
+      br = _mm_min_epi16(_mm_add_epi16(br,_mm_srli_epi16(fr,2)),k31);
+      bg = _mm_min_epi16(_mm_add_epi16(bg,_mm_srli_epi16(fg,2)),k31);
+      bb = _mm_min_epi16(_mm_add_epi16(bb,_mm_srli_epi16(fb,2)),k31);
+      break;
+  }
+  __m128i mask = _mm_and_si128(front,_mm_set1_epi16((short)0x8000));
+  return _mm_or_si128(_mm_or_si128(br,_mm_slli_epi16(bg,5)),_mm_or_si128(_mm_slli_epi16(bb,10),mask));
+}
+
+static void WriteSpanSSE41(uint16_t* dst,const uint16_t* src,const uint16_t* texels,int count,const BlendState& state) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_cmpeq_epi16(zero,zero);
+  const __m128i set_mask = _mm_set1_epi16((short)state.set_mask);
+  int i = 0;
+  for (;i+8<=count;i+=8) {
+    __m128i back = _mm_loadu_si128((const __m128i*)(dst+i));
+    __m128i front = _mm_loadu_si128((const __m128i*)(src+i));
+    __m128i write = ones;
+    if (texels != nullptr)
+      write = _mm_andnot_si128(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(texels+i)),zero),write);
+    if (state.check_mask)
+      write = _mm_andnot_si128(_mm_srai_epi16(back,15),write);
+    if (state.semi_mode >= 0) {
+      __m128i blend = state.per_texel ? _mm_srai_epi16(front,15) : ones;
+      front = _mm_blendv_epi8(front,BlendSSE41(back,front,state.semi_mode),blend);
+    }
+    front = _mm_or_si128(front,set_mask);
+    _mm_storeu_si128((__m128i*)(dst+i),_mm_blendv_epi8(back,front,write));
+  }
+  if (i < count)
+    WriteSpanScalar(dst+i,src+i,texels != nullptr ? texels+i : nullptr,count-i,state);
+}
+
+static inline __m256i BlendAVX2(__m256i back,__m256i front,int mode) {
+  const __m256i k1F = _mm256_set1_epi16(0x1F);
+  const __m256i k31 = _mm256_set1_epi16(31);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i br = _mm256_and_si256(back,k1F), bg = _mm256_and_si256(_mm256_srli_epi16(back,5),k1F), bb = _mm256_and_si256(_mm256_srli_epi16(back,10),k1F);
+  __m256i fr = _mm256_and_si256(front,k1F), fg = _mm256_and_si256(_mm256_srli_epi16(front,5),k1F), fb = _mm256_and_si256(_mm256_srli_epi16(front,10),k1F);
+  switch (mode) {
+    case 0:
+      br = _mm256_srli_epi16(_mm256_add_epi16(br,fr),1);
+      bg = _mm256_srli_epi16(_mm256_add_epi16(bg,fg),1);
+      bb = _mm256_srli_epi16(_mm256_add_epi16(bb,fb),1);
+      break;
+    case 1:
+      br = _mm256_min_epi16(_mm256_add_epi16(br,fr),k31);
+      bg = _mm256_min_epi16(_mm256_add_epi16(bg,fg),k31);
+      bb = _mm256_min_epi16(_mm256_add_epi16(bb,fb),k31);
+      break;
+    case 2:
+      br = _mm256_max_epi16(_mm256_sub_epi16(br,fr),zero);
+      bg = _mm256_max_epi16(_mm256_sub_epi16(bg,fg),zero);
+      bb = _mm256_max_epi16(_mm256_sub_epi16(bb,fb),zero);
+      break;
+    default:
+      br = _mm256_min_epi16(_mm256_add_epi16(br,_mm256_srli_epi16(fr,2)),k31);
+      bg = _mm256_min_epi16(_mm256_add_epi16(bg,_mm256_srli_epi16(fg,2)),k31);
+      bb = _mm256_min_epi16(_mm256_add_epi16(bb,_mm256_srli_epi16(fb,2)),k31);
+      break;
+  }
+  __m256i mask = _mm256_and_si256(front,_mm256_set1_epi16((short)0x8000));
+  return _mm256_or_si256(_mm256_or_si256(br,_mm256_slli_epi16(bg,5)),_mm256_or_si256(_mm256_slli_epi16(bb,10),mask));
+}
+
+static void WriteSpanAVX2(uint16_t* dst,const uint16_t* src,const uint16_t* texels,int count,const BlendState& state) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_cmpeq_epi16(zero,zero);
+  const __m256i set_mask = _mm256_set1_epi16((short)state.set_mask);
+  int i = 0;
+  for (;i+16<=count;i+=16) {
+    __m256i back = _mm256_loadu_si256((const __m256i*)(dst+i));
+    __m256i front = _mm256_loadu_si256((const __m256i*)(src+i));
+    __m256i write = ones;
+    if (texels != nullptr)
+      write = _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(texels+i)),zero),write);
+    if (state.check_mask)
+      write = _mm256_andnot_si256(_mm256_srai_epi16(back,15),write);
+    if (state.semi_mode >= 0) {
+      __m256i blend = state.per_texel ? _mm256_srai_epi16(front,15) : ones;
+      front = _mm256_blendv_epi8(front,BlendAVX2(back,front,state.semi_mode),blend);
+    }
+    front = _mm256_or_si256(front,set_mask);
+    _mm256_storeu_si256((__m256i*)(dst+i),_mm256_blendv_epi8(back,front,write));
+  }
+  _mm256_zeroupper();
+  if (i < count)
+    WriteSpanScalar(dst+i,src+i,texels != nullptr ? texels+i : nullptr,count-i,state);
+}
+
+/*
+  Scanout kernels, one display line of VRAM to 0xAABBGGRR host pixels. 15bit
+  expands each channel to 8 bits, 24bit unpacks the RGB byte triplets that run
+  across the 16bit VRAM words. The vector loops never read past count pixels.
+*/
+static void Scanout15Scalar(uint32_t* dst,const uint16_t* src,int count) {
+  for (int i=0;i<count;++i) {
+    uint32_t p = src[i];
+    uint32_t rgb = (p & 0x1F) | ((p << 3) & 0x1F00) | ((p << 6) & 0x1F0000);
+    dst[i] = (rgb << 3) | ((rgb >> 2) & 0x070707) | 0xFF000000;
+  }
+}
+
+static void Scanout24Scalar(uint32_t* dst,const uint8_t* src,int count) {
+  for (int i=0;i<count;++i,src+=3)
+    dst[i] = src[0] | (src[1] << 8) | (src[2] << 16) | 0xFF000000;
+}
+
+static inline __m128i Expand15SSE41(__m128i p) {
+  const __m128i k1F = _mm_set1_epi32(0x1F);
+  __m128i rgb = _mm_and_si128(p,k1F);
+  rgb = _mm_or_si128(rgb,_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(p,5),k1F),8));
+  rgb = _mm_or_si128(rgb,_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(p,10),k1F),16));
+  rgb = _mm_or_si128(_mm_slli_epi32(rgb,3),_mm_and_si128(_mm_srli_epi32(rgb,2),_mm_set1_epi32(0x070707)));
+  return _mm_or_si128(rgb,_mm_set1_epi32(0xFF000000));
+}
+
+static void Scanout15SSE41(uint32_t* dst,const uint16_t* src,int count) {
+  int i = 0;
+  for (;i+8<=count;i+=8) {
+    __m128i p = _mm_loadu_si128((const __m128i*)(src+i));
+    _mm_storeu_si128((__m128i*)(dst+i),Expand15SSE41(_mm_cvtepu16_epi32(p)));
+    _mm_storeu_si128((__m128i*)(dst+i+4),Expand15SSE41(_mm_cvtepu16_epi32(_mm_srli_si128(p,8))));
+  }
+  if (i < count)
+    Scanout15Scalar(dst+i,src+i,count-i);
+}
+
+static void Scanout24SSE41(uint32_t* dst,const uint8_t* src,int count) {
+  const __m128i shuffle = _mm_setr_epi8(0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1);
+  const __m128i alpha = _mm_set1_epi32(0xFF000000);
+  int i = 0;
+  //each 16 byte load covers 4 pixels plus 4 bytes of the next
+  for (;i+6<=count;i+=4) {
+    __m128i p = _mm_loadu_si128((const __m128i*)(src+i*3));
+    _mm_storeu_si128((__m128i*)(dst+i),_mm_or_si128(_mm_shuffle_epi8(p,shuffle),alpha));
+  }
+  if (i < count)
+    Scanout24Scalar(dst+i,src+i*3,count-i);
+}
+
+static void Scanout15AVX2(uint32_t* dst,const uint16_t* src,int count) {
+  const __m256i k1F = _mm256_set1_epi32(0x1F);
+  const __m256i k07 = _mm256_set1_epi32(0x070707);
+  const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+  int i = 0;
+  for (;i+8<=count;i+=8) {
+    __m256i p = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src+i)));
+    __m256i rgb = _mm256_and_si256(p,k1F);
+    rgb = _mm256_or_si256(rgb,_mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(p,5),k1F),8));
+    rgb = _mm256_or_si256(rgb,_mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(p,10),k1F),16));
+    rgb = _mm256_or_si256(_mm256_slli_epi32(rgb,3),_mm256_and_si256(_mm256_srli_epi32(rgb,2),k07));
+    _mm256_storeu_si256((__m256i*)(dst+i),_mm256_or_si256(rgb,alpha));
+  }
+  _mm256_zeroupper();
+  if (i < count)
+    Scanout15Scalar(dst+i,src+i,count-i);
+}
+
+static void Scanout24AVX2(uint32_t* dst,const uint8_t* src,int count) {
+  const __m256i shuffle = _mm256_setr_epi8(0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1,
+                                           0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1);
+  const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+  int i = 0;
+  //two 16 byte loads 12 bytes apart, 4 pixels per lane
+  for (;i+10<=count;i+=8) {
+    const uint8_t* p = src+i*3;
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p)),
+                                        _mm_loadu_si128((const __m128i*)(p+12)),1);
+    _mm256_storeu_si256((__m256i*)(dst+i),_mm256_or_si256(_mm256_shuffle_epi8(v,shuffle),alpha));
+  }
+  _mm256_zeroupper();
+  if (i < count)
+    Scanout24SSE41(dst+i,src+i*3,count-i);
+}
+
+//row stores of the transfer commands, masked writes go pixel by pixel in order
+static void StorePixels(uint16_t* dst,const uint16_t* src,int count,uint16_t set_mask,bool check_mask) {
+  if (check_mask) {
+    for (int i=0;i<count;++i) {
+      if ((dst[i] & 0x8000) == 0)
+        dst[i] = src[i] | set_mask;
+    }
+  } else if (set_mask == 0) {
+    memcpy(dst,src,count*sizeof(uint16_t));
+  } else {
+    for (int i=0;i<count;++i)
+      dst[i] = src[i] | set_mask;
+  }
+}
+
+static void FillPixels(uint16_t* dst,uint16_t color,int count) {
+  __m128i value = _mm_set1_epi16((short)color);
+  int i = 0;
+  for (;i+8<=count;i+=8)
+    _mm_storeu_si128((__m128i*)(dst+i),value);
+  for (;i<count;++i)
+    dst[i] = color;
+}
+
+/*
+  Fill and copy on a width x height surface, the native VRAM or the upscaled copy
+  with everything scaled. Fill x and w are multiples of 16 so a row wraps at most once.
+*/
+static void FillRect(uint16_t* surface,int width,int height,int x,int y,int w,int h,uint16_t color) {
+  int run = Min(w,width - x);
+  for (int row=0;row<h;++row) {
+    uint16_t* line = &surface[((y + row) & (height-1)) * width];
+    FillPixels(&line[x],color,run);
+    FillPixels(line,color,w - run);
+  }
+}
+
+static void CopyRect(uint16_t* surface,int width,int height,int src_x,int src_y,int dst_x,int dst_y,
+                     int w,int h,uint16_t set_mask,bool check_mask) {
+  for (int row=0;row<h;++row) {
+    const uint16_t* src = &surface[((src_y + row) & (height-1)) * width];
+    uint16_t* dst = &surface[((dst_y + row) & (height-1)) * width];
+    //within one row the copy runs left to right pixel by pixel, overlaps included
+    if (src == dst) {
+      for (int col=0;col<w;++col) {
+        uint16_t& d = dst[(dst_x + col) & (width-1)];
+        if (check_mask && (d & 0x8000))
+          continue;
+        d = src[(src_x + col) & (width-1)] | set_mask;
+      }
+      continue;
+    }
+    int sx = src_x, dx = dst_x;
+    for (int left=w;left>0;) {
+      int run = Min(left,Min(width - sx,width - dx));
+      StorePixels(&dst[dx],&src[sx],run,set_mask,check_mask);
+      left -= run;
+      sx = (sx + run) & (width-1);
+      dx = (dx + run) & (width-1);
+    }
+  }
+}
+
+static int CommandSize(uint8_t command) {
+  switch (command >> 5) {
+    case 0:
+      return command == 0x02 ? 3 : 1;
+    case 1: {
+      int vertices = (command & 0x08) ? 4 : 3;
+      int words = 1 + ((command & 0x04) ? 1 : 0) + ((command & 0x10) ? 1 : 0);
+      return 1 + vertices * words - ((command & 0x10) ? 1 : 0);
+    }
+    case 2:
+      return (command & 0x10) ? 4 : 3;
+    case 3:
+      return 2 + ((command & 0x04) ? 1 : 0) + ((command & 0x18) == 0 ? 1 : 0);
+    case 4:
+      return 4;
+    case 5:
+    case 6:
+      return 3;
+    default:
+      return 1;
+  }
+}
+
+GpuSoft::Command GpuSoft::commands_[8] = {
+  &GpuSoft::CommandMisc,      &GpuSoft::CommandPolygon,    &GpuSoft::CommandLine,       &GpuSoft::CommandRectangle,
+  &GpuSoft::CommandCopy,      &GpuSoft::CommandImageLoad,  &GpuSoft::CommandImageStore, &GpuSoft::CommandEnvironment
+};
+
+uint8_t GpuSoft::command_size_[256];
+
+static uint32_t ReadGpuData(void* param,uint32_t address) {
+  return ((GpuSoft*)param)->GpuSoft::ReadData();
+}
+
+static uint32_t ReadGpuStatus(void* param,uint32_t address) {
+  return ((GpuSoft*)param)->GpuSoft::ReadStatus();
+}
+
+static void WriteGpuData(void* param,uint32_t address,uint32_t data) {
+  ((GpuSoft*)param)->GpuSoft::WriteData(data);
+}
+
+static void WriteGpuStatus(void* param,uint32_t address,uint32_t data) {
+  ((GpuSoft*)param)->GpuSoft::WriteStatus(data);
+}
+
+GpuSoft::GpuSoft() : GpuCore(),threaded_(false),ring_(nullptr),worker_(nullptr),
+  render_threads_(1),pool_(nullptr),render_contexts_(nullptr),binned_(nullptr),
+  binned_count_(0),epochs_(nullptr),epoch_count_(0),epoch_dirty_(true),active_tile_count_(0),
+  texture_cache_enabled_(true),texture_stamp_(0),texture_last_(0),vram_written_any_(false),
+  scanout_x_(0),scanout_y_(0),scanout_valid_(false),resolution_shift_(0),hires_contexts_(nullptr),
+  hires_primitives_(nullptr),hires_count_(0),hires_epochs_(nullptr),hires_epoch_count_(0),
+  hires_band_count_(0),caption_fps_(0) {
+  memset(&vram_,0,sizeof(vram_));
+  memset(&hires_,0,sizeof(hires_));
+  memset(hires_read_tiles_,0,sizeof(hires_read_tiles_));
+  memset(&texture_cache_texels_,0,sizeof(texture_cache_texels_));
+  memset(&scanout_shadow_,0,sizeof(scanout_shadow_));
+  memset(&picture_,0,sizeof(picture_));
+  memset(display_written_,0,sizeof(display_written_));
+  memset(&scanout_state_,0,sizeof(scanout_state_));
+  memset(texture_cache_,0,sizeof(texture_cache_));
+  memset(vram_written_,0,sizeof(vram_written_));
+  memset(&texture_cache_stats_,0,sizeof(texture_cache_stats_));
+  worker_exit_ = false;
+  worker_sleeping_ = false;
+  irq_pending_ = false;
+  status_shadow_ = 0;
+  memset(dirty_tiles_,0,sizeof(dirty_tiles_));
+  memset(read_tiles_,0,sizeof(read_tiles_));
+  context_.draw = &draw_;
+  context_.prim = &prim_;
+  context_.target = nullptr;
+  context_.pitch = kVramWidth;
+  context_.shift = 0;
+  context_.pixels = 0;
+  primitive_count_ = 0;
+  for (int i=0;i<256;++i)
+    command_size_[i] = (uint8_t)CommandSize((uint8_t)i);
+}
+
+GpuSoft::~GpuSoft() {
+  Deinitialize();
+}
+
+int GpuSoft::Initialize() {
+  Deinitialize();
+  vram_.Alloc(kVramWidth*kVramHeight*sizeof(uint16_t));
+  memset(vram_.u8,0,kVramWidth*kVramHeight*sizeof(uint16_t));
+  context_.target = vram_.u16;
+  texture_cache_texels_.Alloc(kTextureCacheSize*256*256*sizeof(uint16_t));
+  ResetTextureCache();
+  memset(display_written_,0,sizeof(display_written_));
+  simd_support_ = DetectSimdLevel();
+  simd_level_ = simd_support_;
+  WriteStatus(0x00000000);
+  context_.pixels = 0;
+  primitive_count_ = 0;
+
+  //headless users drive GP0/GP1 directly without a system
+  if (system_ != nullptr) {
+    system_->io().MapPort(kM32,0x1F801810,this,ReadGpuData,WriteGpuData);
+    system_->io().MapPort(kM32,0x1F801814,this,ReadGpuStatus,WriteGpuStatus);
+  }
+  if (render_threads_ > 1)
+    set_render_threads(render_threads_);
+  AllocHires();
+  if (threaded_)
+    StartWorker();
+  StartPresenter();
+  return S_OK;
+}
+
+int GpuSoft::Deinitialize() {
+  presenter_.Deinitialize();
+  if (picture_.u8 != nullptr)
+    picture_.Dealloc();
+  StopWorker();
+  StopRenderPool();
+  FreeHires();
+  if (vram_.u8 != nullptr)
+    vram_.Dealloc();
+  if (texture_cache_texels_.u8 != nullptr)
+    texture_cache_texels_.Dealloc();
+  return S_OK;
+}
+
+void GpuSoft::set_texture_cache(bool enabled) {
+  Sync();
+  texture_cache_enabled_ = enabled;
+  if (texture_cache_texels_.u8 != nullptr)
+    ResetTextureCache();
+}
+
+/*
+  The upscaled copy starts out as the current VRAM with every pixel repeated, the
+  scanout buffers and the presenter frames are sized for the new scale.
+*/
+void GpuSoft::set_resolution_scale(int scale) {
+  Sync();
+  resolution_shift_ = scale >= 4 ? 2 : (scale >= 2 ? 1 : 0);
+  if (vram_.u8 == nullptr)
+    return;
+  AllocHires();
+  StartPresenter();
+}
+
+void GpuSoft::AllocHires() {
+  FreeHires();
+  int shift = resolution_shift_;
+  scanout_shadow_.Alloc((kVramWidth << shift)*(kMaxDisplayLines << shift)*sizeof(uint16_t));
+  scanout_valid_ = false;
+  if (shift == 0)
+    return;
+  hires_.Alloc((kVramWidth << shift)*(kVramHeight << shift)*sizeof(uint16_t));
+  for (int y=0;y<kVramHeight;++y)
+    UpscaleSpan(0,y,kVramWidth);
+  hires_contexts_ = new RenderContext[WorkPool::kMaxThreads];
+  for (int i=0;i<WorkPool::kMaxThreads;++i) {
+    hires_contexts_[i].target = hires_.u16;
+    hires_contexts_[i].pitch = kVramWidth << shift;
+    hires_contexts_[i].shift = shift;
+    hires_contexts_[i].pixels = 0;
+  }
+  hires_primitives_ = new BinnedPrimitive[kMaxBinned];
+  hires_epochs_ = new DrawState[kMaxEpochs];
+  hires_count_ = 0;
+  hires_epoch_count_ = 0;
+  hires_band_count_ = 0;
+  memset(hires_read_tiles_,0,sizeof(hires_read_tiles_));
+}
+
+void GpuSoft::FreeHires() {
+  if (scanout_shadow_.u8 != nullptr)
+    scanout_shadow_.Dealloc();
+  if (hires_.u8 == nullptr)
+    return;
+  for (int i=0;i<hires_band_count_;++i)
+    hires_bins_[hires_bands_[i]].clear();
+  hires_band_count_ = 0;
+  hires_count_ = 0;
+  hires_.Dealloc();
+  delete [] hires_contexts_;
+  delete [] hires_primitives_;
+  delete [] hires_epochs_;
+  hires_contexts_ = nullptr;
+  hires_primitives_ = nullptr;
+  hires_epochs_ = nullptr;
+}
+
+void GpuSoft::StartPresenter() {
+  if (handle_ == nullptr)
+    return;
+  presenter_.Deinitialize();
+  if (picture_.u8 != nullptr)
+    picture_.Dealloc();
+  int width = FramePresenter::kMaxWidth << resolution_shift_;
+  int height = FramePresenter::kMaxHeight << resolution_shift_;
+  picture_.Alloc(width*height*sizeof(uint32_t));
+  scanout_valid_ = false;
+  caption_fps_ = 0;
+  presenter_.Initialize([this](const FramePresenter::Frame& frame) { PresentFrame(frame); },width,height);
+}
+
+void GpuSoft::set_simd_level(SimdLevel level) {
+  Sync();
+  simd_level_ = level < simd_support_ ? level : simd_support_;
+}
+
+void GpuSoft::set_threaded(bool threaded) {
+  threaded_ = threaded;
+  if (vram_.u8 == nullptr)
+    return;
+  if (threaded_)
+    StartWorker();
+  else
+    StopWorker();
+}
+
+/*
+  Render threads include the thread running the GP0 commands, 1 draws directly.
+*/
+void GpuSoft::set_render_threads(int count) {
+  Sync();
+  StopRenderPool();
+  render_threads_ = Clamp(count,1,WorkPool::kMaxThreads);
+  if (render_threads_ == 1 || vram_.u8 == nullptr)
+    return;
+  render_contexts_ = new RenderContext[render_threads_];
+  for (int i=0;i<render_threads_;++i) {
+    render_contexts_[i].target = vram_.u16;
+    render_contexts_[i].pitch = kVramWidth;
+    render_contexts_[i].shift = 0;
+    render_contexts_[i].pixels = 0;
+  }
+  binned_ = new BinnedPrimitive[kMaxBinned];
+  epochs_ = new DrawState[kMaxEpochs];
+  binned_count_ = 0;
+  epoch_count_ = 0;
+  active_tile_count_ = 0;
+  pool_ = new WorkPool();
+  pool_->Initialize(render_threads_);
+}
+
+void GpuSoft::StopRenderPool() {
+  if (pool_ == nullptr)
+    return;
+  FlushBins();
+  SafeDelete(&pool_);
+  for (int i=0;i<render_threads_;++i)
+    context_.pixels += render_contexts_[i].pixels;
+  delete [] render_contexts_;
+  delete [] binned_;
+  delete [] epochs_;
+  render_contexts_ = nullptr;
+  binned_ = nullptr;
+  epochs_ = nullptr;
+}
+
+void GpuSoft::StartWorker() {
+  if (worker_ != nullptr)
+    return;
+  ring_ = new SpscRing<uint32_t,kRingSize>();
+  status_shadow_ = status_.raw;
+  worker_exit_ = false;
+  worker_ = new std::thread(GpuSoft::worker_func,this);
+}
+
+void GpuSoft::StopWorker() {
+  if (worker_ == nullptr)
+    return;
+  Sync();
+  worker_exit_ = true;
+  {
+    std::lock_guard<std::mutex> lock(worker_mutex_);
+    worker_wake_.notify_one();
+  }
+  worker_->join();
+  SafeDelete(&worker_);
+  SafeDelete(&ring_);
+}
+
+void GpuSoft::WakeWorker() {
+  if (worker_sleeping_.load(std::memory_order_relaxed))
+    worker_wake_.notify_one();
+}
+
+/*
+  Waits until the worker has executed everything queued so far, after that the
+  CPU thread can touch the GPU state directly until it queues more words. Binned
+  and upscaled primitives are drawn too.
+*/
+void GpuSoft::Sync() {
+  if (worker_ != nullptr) {
+    if (!ring_->empty()) {
+      worker_wake_.notify_one();
+      while (!ring_->empty())
+        std::this_thread::yield();
+    }
+    if (irq_pending_.exchange(false) && system_ != nullptr)
+      system_->io().SetInterrupt(kInterruptGPU);
+  }
+  FlushHires();
+}
+
+/*
+  Spins for a while after running dry since the CPU usually queues the next packet
+  soon, then sleeps. A missed wakeup only costs the wait timeout, Sync always wakes it.
+*/
+void GpuSoft::worker_func(GpuSoft* gpu) {
+  auto ring = gpu->ring_;
+  int idle = 0;
+  while (!gpu->worker_exit_.load(std::memory_order_acquire)) {
+    const uint32_t* words;
+    uint32_t count = ring->Peek(&words);
+    if (count == 0) {
+      if (++idle < 4096) {
+        std::this_thread::yield();
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(gpu->worker_mutex_);
+      gpu->worker_sleeping_ = true;
+      if (ring->empty() && !gpu->worker_exit_)
+        gpu->worker_wake_.wait_for(lock,std::chrono::milliseconds(1));
+      gpu->worker_sleeping_ = false;
+      idle = 0;
+      continue;
+    }
+    gpu->ProcessSpan(words,count);
+    gpu->status_shadow_.store(gpu->status_.raw,std::memory_order_release);
+    ring->Consume(count);
+    idle = 0;
+  }
+}
+
+int GpuSoft::Render() {
+  Sync();
+  status_.lcf = status_.isinter ? !status_.lcf : 0;
+  status_shadow_.store(status_.raw,std::memory_order_release);
+  if (system_ == nullptr)
+    return S_OK;
+  auto& timing = system_->timing();
+  ++timing.fps_counter;
+  bool fps_updated = false;
+  if (timing.fps_time_span >= 1000.0) {
+    timing.fps = timing.fps_counter * (1000.0/timing.fps_time_span);
+    timing.fps_counter = 0;
+    timing.fps_time_span = 0;
+    fps_updated = true;
+  }
+  if (picture_.u8 == nullptr)
+    return S_OK;
+  //an unchanged picture is not published, the presenter keeps showing the last one
+  ScanoutRegion region;
+  int pitch = FramePresenter::kMaxWidth << resolution_shift_;
+  if (Scanout(picture_.u32,pitch,&region) || fps_updated) {
+    FramePresenter::Frame& frame = presenter_.back();
+    frame.width = region.width;
+    frame.height = region.height;
+    frame.fps = timing.fps;
+    for (int y=0;y<region.height;++y)
+      memcpy(&frame.pixels[y*frame.pitch],&picture_.u32[y*pitch],region.width*sizeof(uint32_t));
+    presenter_.Publish();
+  }
+  return S_OK;
+}
+
+//presenter thread, the picture is stretched over the client area with GDI
+void GpuSoft::PresentFrame(const FramePresenter::Frame& frame) {
+  if (frame.width != 0 && frame.height != 0) {
+    struct {
+      BITMAPINFOHEADER header;
+      DWORD masks[3];
+    } info;
+    memset(&info,0,sizeof(info));
+    info.header.biSize = sizeof(info.header);
+    info.header.biWidth = frame.pitch;
+    info.header.biHeight = -frame.height;
+    info.header.biPlanes = 1;
+    info.header.biBitCount = 32;
+    info.header.biCompression = BI_BITFIELDS;
+    info.masks[0] = 0x000000FF;
+    info.masks[1] = 0x0000FF00;
+    info.masks[2] = 0x00FF0000;
+    RECT rect;
+    GetClientRect(handle_,&rect);
+    HDC dc = GetDC(handle_);
+    StretchDIBits(dc,0,0,rect.right,rect.bottom,0,0,frame.width,frame.height,
+                  frame.pixels,(BITMAPINFO*)&info,DIB_RGB_COLORS,SRCCOPY);
+    ReleaseDC(handle_,dc);
+  }
+  if (frame.fps != caption_fps_) {
+    caption_fps_ = frame.fps;
+    PostFps(frame.fps);
+  }
+}
+
+/*
+  The horizontal range is in GPU clocks, a pixel takes 10/7/8/5/4 of them depending
+  on the mode, the result is rounded to 4 pixels like the hardware does.
+*/
+void GpuSoft::GetDisplaySize(int* width,int* height) const {
+  static const int widths[8] = { 256,368,320,368,512,368,640,368 };
+  static const int dividers[8] = { 10,7,8,7,5,7,4,7 };
+  int mode_width = widths[status_.width];
+  int w = mode_width;
+  if (display_.x2 > display_.x1)
+    w = Min(((display_.x2 - display_.x1) / dividers[status_.width] + 2) & ~3,mode_width);
+  int h = display_.y2 > display_.y1 ? display_.y2 - display_.y1 : 240;
+  h = Min(h,status_.video ? 288 : 240);
+  if (status_.height && status_.isinter)
+    h *= 2;
+  *width = w;
+  *height = h;
+}
+
+/*
+  The converted picture is kept in step with a copy of the VRAM words behind it.
+  With the same buffer and display mode only lines in 64x16 blocks written since
+  the last call are looked at, a moved display start compares every line, and
+  only the parts that differ from the copy are converted. 15bit lines compare
+  per block, 24bit lines as a whole. Upscaled 15bit lines come from the upscaled
+  copy a VRAM line is scale lines of, 24bit lines are converted from the native
+  VRAM and the pixels repeated since the upscaled copy can't hold packed bytes.
+*/
+bool GpuSoft::Scanout(uint32_t* pixels,int pitch,ScanoutRegion* region) {
+  Sync();
+  ScanoutState state;
+  memset(&state,0,sizeof(state));
+  state.pixels = pixels;
+  state.pitch = pitch;
+  GetDisplaySize(&state.width,&state.height);
+  state.shift = resolution_shift_;
+  state.rgb24 = status_.isrgb24 != 0;
+  state.blank = status_.den != 0;
+  bool full = !scanout_valid_ || memcmp(&state,&scanout_state_,sizeof(state)) != 0;
+  bool moved = display_.x != scanout_x_ || display_.y != scanout_y_;
+  int shift = state.shift;
+  int scale = 1 << shift;
+  int width = state.width, height = state.height;
+  int x0 = width, y0 = height, x1 = 0, y1 = 0;
+  if (state.blank) {
+    if (full) {
+      for (int y=0;y<(height << shift);++y) {
+        for (int x=0;x<(width << shift);++x)
+          pixels[y*pitch + x] = 0xFF000000;
+      }
+      x0 = y0 = 0;
+      x1 = width;
+      y1 = height;
+    }
+  } else {
+    const uint16_t* surface = shift != 0 ? hires_.u16 : vram_.u16;
+    int surface_width = kVramWidth << shift;
+    int words = state.rgb24 ? (width*3 + 1) / 2 : width;
+    uint32_t columns = TileColumns(display_.x,words,kDisplayShiftX,kDisplayColumns);
+    for (int y=0;y<height;++y) {
+      int line = (display_.y + y) & (kVramHeight-1);
+      uint32_t written = full || moved ? 0xFFFF : display_written_[line >> kDisplayShiftY];
+      if ((written & columns) == 0)
+        continue;
+      uint16_t* shadow = &scanout_shadow_.u16[(y << shift) * surface_width];
+      uint32_t* dst = pixels + (y << shift)*pitch;
+      bool changed = false;
+      if (state.rgb24) {
+        const uint16_t* src = &vram_.u16[line * kVramWidth];
+        int head = Min(words,kVramWidth - display_.x);
+        if (full || memcmp(shadow,src + display_.x,head*2) != 0 || memcmp(shadow + head,src,(words - head)*2) != 0) {
+          memcpy(shadow,src + display_.x,head*2);
+          memcpy(shadow + head,src,(words - head)*2);
+          ScanoutLine(dst,line,width);
+          if (shift != 0) {
+            //in place from the right, a pixel only moves right
+            for (int x=width-1;x>=0;--x) {
+              for (int i=scale-1;i>=0;--i)
+                dst[(x << shift) + i] = dst[x];
+            }
+            for (int row=1;row<scale;++row)
+              memcpy(dst + row*pitch,dst,(width << shift)*sizeof(uint32_t));
+          }
+          x0 = 0;
+          x1 = width;
+          changed = true;
+        }
+      } else {
+        //segments end on block boundaries so they never wrap
+        for (int first=0;first<width;) {
+          int x = (display_.x + first) & (kVramWidth-1);
+          int count = Min(width - first,(1 << kDisplayShiftX) - (x & ((1 << kDisplayShiftX) - 1)));
+          if ((written & (1 << (x >> kDisplayShiftX))) != 0) {
+            for (int row=0;row<scale;++row) {
+              const uint16_t* src = &surface[((line << shift) + row) * surface_width + (x << shift)];
+              uint16_t* copy = shadow + row*surface_width + (first << shift);
+              if (full || memcmp(copy,src,(count << shift)*2) != 0) {
+                memcpy(copy,src,(count << shift)*2);
+                Scanout15(dst + row*pitch + (first << shift),src,count << shift);
+                x0 = Min(x0,first);
+                x1 = Max(x1,first + count);
+                changed = true;
+              }
+            }
+          }
+          first += count;
+        }
+      }
+      if (changed) {
+        y0 = Min(y0,y);
+        y1 = y + 1;
+      }
+    }
+  }
+  memset(display_written_,0,sizeof(display_written_));
+  memcpy(&scanout_state_,&state,sizeof(state));
+  scanout_x_ = display_.x;
+  scanout_y_ = display_.y;
+  scanout_valid_ = true;
+  bool changed = x0 < x1;
+  if (region != nullptr) {
+    region->width = width << shift;
+    region->height = height << shift;
+    region->x0 = changed ? x0 << shift : 0;
+    region->y0 = changed ? y0 << shift : 0;
+    region->x1 = changed ? x1 << shift : 0;
+    region->y1 = changed ? y1 << shift : 0;
+  }
+  return changed;
+}
+
+void GpuSoft::InvalidateScanout() {
+  scanout_valid_ = false;
+}
+
+void GpuSoft::Scanout15(uint32_t* dst,const uint16_t* src,int count) {
+  if (simd_level_ >= kSimdAVX2)
+    Scanout15AVX2(dst,src,count);
+  else if (simd_level_ >= kSimdSSE41)
+    Scanout15SSE41(dst,src,count);
+  else
+    Scanout15Scalar(dst,src,count);
+}
+
+//lines wrap around the right edge of VRAM, 24bit lines are unwrapped into a copy first
+void GpuSoft::ScanoutLine(uint32_t* dst,int line,int width) {
+  const uint16_t* src = &vram_.u16[line * kVramWidth];
+  int x = display_.x;
+  if (status_.isrgb24) {
+    const uint8_t* bytes = (const uint8_t*)src + x*2;
+    uint8_t unwrapped[kVramWidth*2];
+    if (x*2 + width*3 > kVramWidth*2) {
+      int head = kVramWidth*2 - x*2;
+      memcpy(unwrapped,bytes,head);
+      memcpy(unwrapped + head,src,width*3 - head);
+      bytes = unwrapped;
+    }
+    if (simd_level_ >= kSimdAVX2)
+      Scanout24AVX2(dst,bytes,width);
+    else if (simd_level_ >= kSimdSSE41)
+      Scanout24SSE41(dst,bytes,width);
+    else
+      Scanout24Scalar(dst,bytes,width);
+    return;
+  }
+  int run = Min(width,kVramWidth - x);
+  Scanout15(dst,src + x,run);
+  Scanout15(dst + run,src,width - run);
+}
+
+const uint16_t* GpuSoft::ReadVram() {
+  Sync();
+  return vram_.u16;
+}
+
+void GpuSoft::GetStateWords(std::vector<uint32_t>* gp0,std::vector<uint32_t>* gp1) {
+  Sync();
+  uint32_t texpage = (status_.raw & 0x7FF) | (status_.texdisable << 11) | (draw_.flip_x ? 0x1000 : 0) | (draw_.flip_y ? 0x2000 : 0);
+  gp0->push_back(0xE1000000 | texpage);
+  gp0->push_back(0xE2000000 | draw_.texture_window);
+  gp0->push_back(0xE3000000 | draw_.area_start);
+  gp0->push_back(0xE4000000 | draw_.area_end);
+  gp0->push_back(0xE5000000 | draw_.offset);
+  gp0->push_back(0xE6000000 | status_.md | (status_.me << 1));
+  gp1->push_back(0x03000000 | status_.den);
+  gp1->push_back(0x04000000 | status_.dmadir);
+  gp1->push_back(0x05000000 | display_.x | (display_.y << 10));
+  gp1->push_back(0x06000000 | display_.x1 | (display_.x2 << 12));
+  gp1->push_back(0x07000000 | display_.y1 | (display_.y2 << 10));
+  gp1->push_back(0x08000000 | (status_.width >> 1) | (status_.height << 2) | (status_.video << 3) |
+                 (status_.isrgb24 << 4) | (status_.isinter << 5) | ((status_.width & 1) << 6) | (status_.revflag << 7));
+}
+
+void GpuSoft::GetStats(GpuStats* stats) {
+  Sync();
+  stats->primitives = primitive_count_;
+  stats->pixels = context_.pixels;
+  if (pool_ != nullptr) {
+    for (int i=0;i<render_threads_;++i)
+      stats->pixels += render_contexts_[i].pixels;
+  }
+}
+
+uint32_t GpuSoft::ReadData() {
+  uint32_t data;
+  ReadDataSpan(&data,1);
+  return data;
+}
+
+void GpuSoft::ReadDataSpan(uint32_t* data,size_t count) {
+  Sync();
+  if (store_.words != 0 && count != 0) {
+    uint32_t words = count < store_.words ? (uint32_t)count : store_.words;
+    ReadTransferSpan((uint16_t*)data,words*2);
+    data += words;
+    count -= words;
+    gpuread_ = data[-1];
+    store_.words -= words;
+    if (store_.words == 0)
+      status_.img = 0;
+  }
+  //past the end of the transfer GPUREAD keeps the last word
+  for (size_t i=0;i<count;++i)
+    data[i] = gpuread_;
+}
+
+uint32_t GpuSoft::ReadStatus() {
+  if (worker_ != nullptr) {
+    //state bits as of the last executed batch, ready bits from the queue
+    if (irq_pending_.exchange(false) && system_ != nullptr)
+      system_->io().SetInterrupt(kInterruptGPU);
+    GpuStatus status;
+    status.raw = status_shadow_.load(std::memory_order_acquire);
+    status.busy = ring_->empty() ? 1 : 0;
+    status.com = ring_->free_space() >= 16 ? 1 : 0;
+    switch (status.dmadir) {
+      case 0: status.dmareq = 0; break;
+      case 1: status.dmareq = status.com; break;
+      case 2: status.dmareq = status.com; break;
+      case 3: status.dmareq = status.img; break;
+    }
+    return status.raw;
+  }
+  status_.busy = 1;
+  status_.com = 1;
+  switch (status_.dmadir) {
+    case 0: status_.dmareq = 0; break;
+    case 1: status_.dmareq = 1; break;
+    case 2: status_.dmareq = status_.com; break;
+    case 3: status_.dmareq = status_.img; break;
+  }
+  return status_.raw;
+}
+
+void GpuSoft::WriteData(uint32_t data) {
+  if (worker_ != nullptr) {
+    while (!ring_->Push(data)) {
+      worker_wake_.notify_one();
+      std::this_thread::yield();
+    }
+    WakeWorker();
+    return;
+  }
+  ProcessData(data);
+}
+
+void GpuSoft::WriteDataSpan(const uint32_t* data,size_t count) {
+  if (worker_ != nullptr) {
+    while (count != 0) {
+      uint32_t chunk = count < kRingSize ? (uint32_t)count : kRingSize;
+      uint32_t pushed = ring_->Push(data,chunk);
+      data += pushed;
+      count -= pushed;
+      if (count != 0) {
+        worker_wake_.notify_one();
+        std::this_thread::yield();
+      }
+    }
+    WakeWorker();
+    return;
+  }
+  ProcessSpan(data,(uint32_t)count);
+}
+
+/*
+  Image data runs go to VRAM a row at a time, packets that are whole in the span
+  are executed straight from it, everything else goes word by word.
+*/
+void GpuSoft::ProcessSpan(const uint32_t* data,uint32_t count) {
+  while (count != 0) {
+    if (gp0_mode_ == kGp0ImageLoad) {
+      uint32_t words = count < load_.words ? count : load_.words;
+      WriteTransferSpan((const uint16_t*)data,words*2);
+      data += words;
+      count -= words;
+      load_.words -= words;
+      if (load_.words == 0)
+        gp0_mode_ = kGp0Command;
+      continue;
+    }
+    if (gp0_mode_ == kGp0Command && fifo_.count == 0) {
+      uint32_t size = command_size_[data[0] >> 24];
+      if (size <= count) {
+        memcpy(fifo_.buffer,data,size*sizeof(uint32_t));
+        fifo_.size = size;
+        ExecuteCommand();
+        data += size;
+        count -= size;
+        continue;
+      }
+    }
+    ProcessData(*data++);
+    --count;
+  }
+}
+
+void GpuSoft::ProcessData(uint32_t data) {
+  switch (gp0_mode_) {
+    case kGp0ImageLoad:
+      WriteTransferSpan((const uint16_t*)&data,2);
+      if (--load_.words == 0)
+        gp0_mode_ = kGp0Command;
+      return;
+    case kGp0Polyline: {
+      if ((data & 0xF000F000) == 0x50005000) {
+        gp0_mode_ = kGp0Command;
+        return;
+      }
+      if (polyline_.expect_color) {
+        polyline_.color = data;
+        polyline_.expect_color = false;
+        return;
+      }
+      Vertex next = polyline_.last;
+      if (polyline_.gouraud)
+        DecodeColor(polyline_.color,next);
+      DecodeVertex(data,next);
+      SubmitLine(polyline_.last,next);
+      polyline_.last = next;
+      polyline_.expect_color = polyline_.gouraud;
+      return;
+    }
+    default:
+      break;
+  }
+
+  if (fifo_.count == 0)
+    fifo_.size = command_size_[data >> 24];
+  fifo_.buffer[fifo_.count++] = data;
+  if (fifo_.count == fifo_.size) {
+    fifo_.count = 0;
+    ExecuteCommand();
+  }
+}
+
+void GpuSoft::WriteStatus(uint32_t data) {
+  Sync();
+  //40h-FFh mirror 00h-3Fh
+  uint32_t command = (data >> 24) & 0x3F;
+  switch (command) {
+    case 0x00:
+      status_.raw = 0x14802000;
+      fifo_.count = 0;
+      gp0_mode_ = kGp0Command;
+      gpuread_ = 0;
+      memset(&load_,0,sizeof(load_));
+      memset(&store_,0,sizeof(store_));
+      memset(&draw_,0,sizeof(draw_));
+      memset(&prim_,0,sizeof(prim_));
+      draw_.tw_and_u = draw_.tw_and_v = 0xFF;
+      context_.clip_x1 = context_.clip_y1 = context_.clip_x2 = context_.clip_y2 = 0;
+      epoch_dirty_ = true;
+      display_.x = display_.y = 0;
+      display_.x1 = 0x200;
+      display_.x2 = 0x200 + 256*10;
+      display_.y1 = 0x010;
+      display_.y2 = 0x010 + 240;
+      break;
+    case 0x01:
+      fifo_.count = 0;
+      load_.words = 0;
+      gp0_mode_ = kGp0Command;
+      break;
+    case 0x02:
+      status_.irq1 = 0;
+      break;
+    case 0x03:
+      status_.den = data & 0x1;
+      break;
+    case 0x04:
+      status_.dmadir = data & 0x3;
+      break;
+    case 0x05:
+      display_.x = data & 0x3FF;
+      display_.y = (data >> 10) & 0x1FF;
+      break;
+    case 0x06:
+      display_.x1 = data & 0xFFF;
+      display_.x2 = (data >> 12) & 0xFFF;
+      break;
+    case 0x07:
+      display_.y1 = data & 0x3FF;
+      display_.y2 = (data >> 10) & 0x3FF;
+      break;
+    case 0x08:
+      status_.width = ((data & 0x3) << 1) | ((data >> 6) & 0x1);
+      status_.height = (data >> 2) & 0x1;
+      status_.video = (data >> 3) & 0x1;
+      status_.isrgb24 = (data >> 4) & 0x1;
+      status_.isinter = (data >> 5) & 0x1;
+      status_.revflag = (data >> 7) & 0x1;
+      break;
+    case 0x09:
+      break;
+    default:
+      if (command >= 0x10 && command <= 0x1F) {
+        switch (data & 0x7) {
+          case 2: gpuread_ = draw_.texture_window; break;
+          case 3: gpuread_ = draw_.area_start; break;
+          case 4: gpuread_ = draw_.area_end; break;
+          case 5: gpuread_ = draw_.offset; break;
+          case 7: gpuread_ = 2; break;
+        }
+      }
+      //the unused commands do nothing
+      break;
+  }
+  status_shadow_.store(status_.raw,std::memory_order_release);
+}
+
+void GpuSoft::ExecuteCommand() {
+  #if defined(GPU_DEBUG) && defined(_DEBUG)
+  fprintf(system_->csvlog.fp,",,gpu command,0x%x,size,%d\n",fifo_.buffer[0]>>24,fifo_.size);
+  #endif
+  (this->*(commands_[fifo_.buffer[0] >> 29]))();
+}
+
+void GpuSoft::SetTexpage(uint32_t texpage) {
+  status_.raw = (status_.raw & ~0x1FF) | (texpage & 0x1FF);
+  status_.texdisable = (texpage >> 11) & 0x1;
+  uint32_t texpage_x = (texpage & 0xF) << 6;
+  uint32_t texpage_y = ((texpage >> 4) & 0x1) << 8;
+  int semi_mode = (texpage >> 5) & 0x3;
+  int tex_depth = (texpage >> 7) & 0x3;
+  if (texpage_x != draw_.texpage_x || texpage_y != draw_.texpage_y || semi_mode != draw_.semi_mode || tex_depth != draw_.tex_depth) {
+    draw_.texpage_x = texpage_x;
+    draw_.texpage_y = texpage_y;
+    draw_.semi_mode = semi_mode;
+    draw_.tex_depth = tex_depth;
+    epoch_dirty_ = true;
+  }
+}
+
+void GpuSoft::DecodeVertex(uint32_t position,Vertex& v) {
+  v.x = SignExtend11(position) + draw_.offset_x;
+  v.y = SignExtend11(position >> 16) + draw_.offset_y;
+}
+
+void GpuSoft::DecodeColor(uint32_t color,Vertex& v) {
+  v.r = color & 0xFF;
+  v.g = (color >> 8) & 0xFF;
+  v.b = (color >> 16) & 0xFF;
+}
+
+void GpuSoft::FetchTexels(RenderContext& rc,int count,int32_t u,int32_t v,int32_t du,int32_t dv) {
+  const uint16_t* vram = vram_.u16;
+  const uint16_t* clut = &vram[((rc.prim->clut >> 6) & 0x1FF) * kVramWidth];
+  uint32_t clut_x = (rc.prim->clut & 0x3F) << 4;
+  uint32_t base_x = rc.draw->texpage_x;
+  uint16_t* out = rc.span_texel;
+  if (rc.prim->texels != nullptr) {
+    const uint16_t* page = rc.prim->texels;
+    for (int i=0;i<count;++i,u+=du,v+=dv) {
+      uint32_t tu = ((u >> 12) & rc.draw->tw_and_u) | rc.draw->tw_or_u;
+      uint32_t tv = ((v >> 12) & rc.draw->tw_and_v) | rc.draw->tw_or_v;
+      out[i] = page[((tv & 0xF8) << 8) | ((tu & 0xF8) << 3) | ((tv & 7) << 3) | (tu & 7)];
+    }
+    return;
+  }
+  switch (rc.draw->tex_depth) {
+    case 0:
+      for (int i=0;i<count;++i,u+=du,v+=dv) {
+        uint32_t tu = ((u >> 12) & rc.draw->tw_and_u) | rc.draw->tw_or_u;
+        uint32_t tv = ((v >> 12) & rc.draw->tw_and_v) | rc.draw->tw_or_v;
+        uint16_t word = vram[((rc.draw->texpage_y + tv) & (kVramHeight-1)) * kVramWidth + ((base_x + (tu >> 2)) & (kVramWidth-1))];
+        out[i] = clut[(clut_x + ((word >> ((tu & 3) << 2)) & 0xF)) & (kVramWidth-1)];
+      }
+      break;
+    case 1:
+      for (int i=0;i<count;++i,u+=du,v+=dv) {
+        uint32_t tu = ((u >> 12) & rc.draw->tw_and_u) | rc.draw->tw_or_u;
+        uint32_t tv = ((v >> 12) & rc.draw->tw_and_v) | rc.draw->tw_or_v;
+        uint16_t word = vram[((rc.draw->texpage_y + tv) & (kVramHeight-1)) * kVramWidth + ((base_x + (tu >> 1)) & (kVramWidth-1))];
+        out[i] = clut[(clut_x + ((word >> ((tu & 1) << 3)) & 0xFF)) & (kVramWidth-1)];
+      }
+      break;
+    default:
+      for (int i=0;i<count;++i,u+=du,v+=dv) {
+        uint32_t tu = ((u >> 12) & rc.draw->tw_and_u) | rc.draw->tw_or_u;
+        uint32_t tv = ((v >> 12) & rc.draw->tw_and_v) | rc.draw->tw_or_v;
+        out[i] = vram[((rc.draw->texpage_y + tv) & (kVramHeight-1)) * kVramWidth + ((base_x + tu) & (kVramWidth-1))];
+      }
+      break;
+  }
+}
+
+/*
+  Draws [x0,x1) of line y, the span is already clipped to the drawing area
+*/
+void GpuSoft::DrawSpan(RenderContext& rc,int y,int x0,int x1,const Span& span) {
+  int count = x1 - x0;
+  if (count <= 0)
+    return;
+  rc.pixels += count;
+  uint16_t* dst = &rc.target[y*rc.pitch+x0];
+  const uint16_t* texels = nullptr;
+  const uint16_t* colors = rc.span_color;
+  int8_t dither[4];
+  const int8_t* dither_row = kNoDither;
+  if (rc.prim->dither) {
+    for (int i=0;i<4;++i)
+      dither[i] = kDitherTable[y&3][(x0+i)&3];
+    dither_row = dither;
+  }
+
+  if (rc.prim->textured) {
+    FetchTexels(rc,count,span.u,span.v,span.du,span.dv);
+    texels = rc.span_texel;
+  }
+  if (rc.prim->textured && rc.prim->raw) {
+    colors = rc.span_texel;
+  } else if (!rc.prim->textured && !rc.prim->gouraud) {
+    uint16_t color = (uint16_t)(((span.r >> 15) & 0x1F) | (((span.g >> 15) & 0x1F) << 5) | (((span.b >> 15) & 0x1F) << 10));
+    for (int i=0;i<count;++i)
+      rc.span_color[i] = color;
+  } else if (simd_level_ >= kSimdAVX2) {
+    ShadeSpanAVX2(rc.span_color,texels,count,span,dither_row);
+  } else if (simd_level_ >= kSimdSSE41) {
+    ShadeSpanSSE41(rc.span_color,texels,count,span,dither_row);
+  } else {
+    ShadeSpanScalar(rc.span_color,texels,count,span,dither_row);
+  }
+
+  BlendState state = { rc.prim->semi ? rc.draw->semi_mode : -1, rc.prim->textured, rc.draw->check_mask, rc.draw->set_mask };
+  if (simd_level_ >= kSimdAVX2)
+    WriteSpanAVX2(dst,colors,texels,count,state);
+  else if (simd_level_ >= kSimdSSE41)
+    WriteSpanSSE41(dst,colors,texels,count,state);
+  else
+    WriteSpanScalar(dst,colors,texels,count,state);
+}
+
+/*
+  Edge walking triangle fill, the right and bottom edges are not drawn like on the hardware.
+  Attributes are planes in 20.12 fixed point evaluated at the start of each span.
+*/
+void GpuSoft::DrawTriangle(RenderContext& rc,const Vertex* v0,const Vertex* v1,const Vertex* v2) {
+  int max_dx = kVramWidth << rc.shift, max_dy = kVramHeight << rc.shift;
+  if (abs(v0->x - v1->x) >= max_dx || abs(v1->x - v2->x) >= max_dx || abs(v2->x - v0->x) >= max_dx ||
+      abs(v0->y - v1->y) >= max_dy || abs(v1->y - v2->y) >= max_dy || abs(v2->y - v0->y) >= max_dy)
+    return;
+  int64_t area = (int64_t)(v1->x - v0->x) * (v2->y - v0->y) - (int64_t)(v2->x - v0->x) * (v1->y - v0->y);
+  if (area == 0)
+    return;
+
+  int32_t ex1 = v1->x - v0->x, ey1 = v1->y - v0->y;
+  int32_t ex2 = v2->x - v0->x, ey2 = v2->y - v0->y;
+  auto gradient = [&](int32_t a0,int32_t a1,int32_t a2,int32_t& dx,int32_t& dy) {
+    int64_t d1 = a1 - a0, d2 = a2 - a0;
+    dx = (int32_t)((d1 * ey2 - d2 * ey1) * 4096 / area);
+    dy = (int32_t)((d2 * ex1 - d1 * ex2) * 4096 / area);
+  };
+  Span step;
+  int32_t dry = 0, dgy = 0, dby = 0, duy = 0, dvy = 0;
+  memset(&step,0,sizeof(step));
+  if (rc.prim->gouraud) {
+    gradient(v0->r,v1->r,v2->r,step.dr,dry);
+    gradient(v0->g,v1->g,v2->g,step.dg,dgy);
+    gradient(v0->b,v1->b,v2->b,step.db,dby);
+  }
+  if (rc.prim->textured) {
+    gradient(v0->u,v1->u,v2->u,step.du,duy);
+    gradient(v0->v,v1->v,v2->v,step.dv,dvy);
+  }
+
+  //sort by y
+  const Vertex* top = v0;
+  const Vertex* mid = v1;
+  const Vertex* bottom = v2;
+  if (mid->y < top->y) std::swap(mid,top);
+  if (bottom->y < top->y) std::swap(bottom,top);
+  if (bottom->y < mid->y) std::swap(bottom,mid);
+
+  int y_start = Max(top->y,rc.clip_y1);
+  int y_end = Min(bottom->y,rc.clip_y2+1);
+  if (y_start >= y_end)
+    return;
+
+  //x edges in 16.16
+  int64_t long_step = (int64_t)(bottom->x - top->x) * 0x10000 / (bottom->y - top->y);
+  int64_t upper_step = mid->y != top->y ? (int64_t)(mid->x - top->x) * 0x10000 / (mid->y - top->y) : 0;
+  int64_t lower_step = bottom->y != mid->y ? (int64_t)(bottom->x - mid->x) * 0x10000 / (bottom->y - mid->y) : 0;
+  bool short_left = (int64_t)mid->x * 0x10000 < (int64_t)top->x * 0x10000 + long_step * (mid->y - top->y);
+
+  for (int y=y_start;y<y_end;++y) {
+    int64_t long_x = (int64_t)top->x * 0x10000 + long_step * (y - top->y);
+    int64_t short_x = y < mid->y ? (int64_t)top->x * 0x10000 + upper_step * (y - top->y)
+                                 : (int64_t)mid->x * 0x10000 + lower_step * (y - mid->y);
+    int64_t left = short_left ? short_x : long_x;
+    int64_t right = short_left ? long_x : short_x;
+    int x0 = Max((int)((left + 0xFFFF) >> 16),rc.clip_x1);
+    int x1 = Min((int)((right + 0xFFFF) >> 16),rc.clip_x2+1);
+    if (x0 >= x1)
+      continue;
+    int64_t dx = x0 - v0->x, dy = y - v0->y;
+    Span span = step;
+    span.r = (int32_t)((int64_t)v0->r * 0x1000 + 0x800 + step.dr * dx + dry * dy);
+    span.g = (int32_t)((int64_t)v0->g * 0x1000 + 0x800 + step.dg * dx + dgy * dy);
+    span.b = (int32_t)((int64_t)v0->b * 0x1000 + 0x800 + step.db * dx + dby * dy);
+    span.u = (int32_t)((int64_t)v0->u * 0x1000 + 0x800 + step.du * dx + duy * dy);
+    span.v = (int32_t)((int64_t)v0->v * 0x1000 + 0x800 + step.dv * dx + dvy * dy);
+    DrawSpan(rc,y,x0,x1,span);
+  }
+}
+
+void GpuSoft::DrawLine(RenderContext& rc,const Vertex& v0,const Vertex& v1) {
+  int dx = v1.x - v0.x;
+  int dy = v1.y - v0.y;
+  if (abs(dx) >= (kVramWidth << rc.shift) || abs(dy) >= (kVramHeight << rc.shift))
+    return;
+  int steps = Max(abs(dx),abs(dy));
+  int64_t x = (int64_t)v0.x * 0x10000 + 0x8000;
+  int64_t y = (int64_t)v0.y * 0x10000 + 0x8000;
+  int64_t sx = steps ? (int64_t)dx * 0x10000 / steps : 0;
+  int64_t sy = steps ? (int64_t)dy * 0x10000 / steps : 0;
+  Span span;
+  memset(&span,0,sizeof(span));
+  span.r = (v0.r << 12) + 0x800;
+  span.g = (v0.g << 12) + 0x800;
+  span.b = (v0.b << 12) + 0x800;
+  if (rc.prim->gouraud && steps) {
+    span.dr = (v1.r - v0.r) * 0x1000 / steps;
+    span.dg = (v1.g - v0.g) * 0x1000 / steps;
+    span.db = (v1.b - v0.b) * 0x1000 / steps;
+  }
+  //skip the steps that can't be inside the clip rectangle, the per pixel test stays exact
+  int64_t first = 0, last = steps;
+  auto limit = [&](int64_t pos,int64_t step,int lo,int hi) {
+    int64_t a = (int64_t)lo * 0x10000 - pos, b = (int64_t)(hi + 1) * 0x10000 - pos;
+    if (step > 0) {
+      first = Max(first,a / step - 1);
+      last = Min(last,b / step + 1);
+    } else if (step < 0) {
+      first = Max(first,b / step - 1);
+      last = Min(last,a / step + 1);
+    } else if (a > 0 || b <= 0) {
+      last = -1;
+    }
+  };
+  limit(x,sx,rc.clip_x1,rc.clip_x2);
+  limit(y,sy,rc.clip_y1,rc.clip_y2);
+  if (first > last)
+    return;
+  x += sx * first;
+  y += sy * first;
+  span.r += span.dr * (int32_t)first;
+  span.g += span.dg * (int32_t)first;
+  span.b += span.db * (int32_t)first;
+
+  BlendState state = { rc.prim->semi ? rc.draw->semi_mode : -1, false, rc.draw->check_mask, rc.draw->set_mask };
+  for (int64_t i=first;i<=last;++i,x+=sx,y+=sy,span.r+=span.dr,span.g+=span.dg,span.b+=span.db) {
+    int px = (int)(x >> 16);
+    int py = (int)(y >> 16);
+    if (px < rc.clip_x1 || px > rc.clip_x2 || py < rc.clip_y1 || py > rc.clip_y2)
+      continue;
+    ++rc.pixels;
+    uint16_t color;
+    int8_t dither = rc.prim->dither ? kDitherTable[py&3][px&3] : 0;
+    int8_t dither_row[4] = { dither, dither, dither, dither };
+    ShadeSpanScalar(&color,nullptr,1,span,dither_row);
+    WriteSpanScalar(&rc.target[py*rc.pitch+px],&color,nullptr,1,state);
+  }
+}
+
+void GpuSoft::DrawRectangle(RenderContext& rc,const Vertex& v,int w,int h) {
+  int x0 = Max(v.x,rc.clip_x1);
+  int x1 = Min(v.x + w,rc.clip_x2+1);
+  int y0 = Max(v.y,rc.clip_y1);
+  int y1 = Min(v.y + h,rc.clip_y2+1);
+  if (x0 >= x1 || y0 >= y1)
+    return;
+
+  Span span;
+  memset(&span,0,sizeof(span));
+  span.r = (v.r << 12) + 0x800;
+  span.g = (v.g << 12) + 0x800;
+  span.b = (v.b << 12) + 0x800;
+  //upscaled a texel covers 1 << shift pixels, sampled at the pixel centers
+  int32_t step = 0x1000 >> rc.shift;
+  int32_t center = 0x800 >> rc.shift;
+  span.du = rc.draw->flip_x ? -step : step;
+  int32_t u = v.u * 0x1000 + (rc.draw->flip_x ? 0x1000 - center : center) + span.du * (x0 - v.x);
+  for (int y=y0;y<y1;++y) {
+    int row = (y - v.y) >> rc.shift;
+    int tv = rc.draw->flip_y ? v.v - row : v.v + row;
+    span.u = u;
+    span.v = tv * 0x1000 + 0x800;
+    DrawSpan(rc,y,x0,x1,span);
+  }
+}
+
+/*
+  Primitives are drawn right away with the own context unless there is a render
+  pool, then they are binned by their bounding box and drawn at the next flush.
+*/
+void GpuSoft::SubmitTriangle(const Vertex* v0,const Vertex* v1,const Vertex* v2) {
+  ++primitive_count_;
+  MarkWritten(Min(Min(v0->x,v1->x),v2->x),Min(Min(v0->y,v1->y),v2->y),
+              Max(Max(v0->x,v1->x),v2->x),Max(Max(v0->y,v1->y),v2->y));
+  Vertex v[3] = { *v0, *v1, *v2 };
+  if (resolution_shift_ != 0)
+    RecordHires(kPrimitiveTriangle,v,Min(Min(v0->x,v1->x),v2->x),Min(Min(v0->y,v1->y),v2->y),
+                                     Max(Max(v0->x,v1->x),v2->x),Max(Max(v0->y,v1->y),v2->y));
+  if (pool_ == nullptr) {
+    DrawTriangle(context_,v0,v1,v2);
+    return;
+  }
+  BinPrimitive(kPrimitiveTriangle,v,Min(Min(v0->x,v1->x),v2->x),Min(Min(v0->y,v1->y),v2->y),
+                                    Max(Max(v0->x,v1->x),v2->x),Max(Max(v0->y,v1->y),v2->y));
+}
+
+void GpuSoft::SubmitLine(const Vertex& v0,const Vertex& v1) {
+  ++primitive_count_;
+  MarkWritten(Min(v0.x,v1.x),Min(v0.y,v1.y),Max(v0.x,v1.x),Max(v0.y,v1.y));
+  Vertex v[2] = { v0, v1 };
+  if (resolution_shift_ != 0)
+    RecordHires(kPrimitiveLine,v,Min(v0.x,v1.x),Min(v0.y,v1.y),Max(v0.x,v1.x),Max(v0.y,v1.y));
+  if (pool_ == nullptr) {
+    DrawLine(context_,v0,v1);
+    return;
+  }
+  BinPrimitive(kPrimitiveLine,v,Min(v0.x,v1.x),Min(v0.y,v1.y),Max(v0.x,v1.x),Max(v0.y,v1.y));
+}
+
+void GpuSoft::SubmitRectangle(const Vertex& v,int w,int h) {
+  ++primitive_count_;
+  MarkWritten(v.x,v.y,v.x+w-1,v.y+h-1);
+  Vertex rect[2] = { v, v };
+  rect[1].x = w;
+  rect[1].y = h;
+  if (resolution_shift_ != 0)
+    RecordHires(kPrimitiveRectangle,rect,v.x,v.y,v.x+w-1,v.y+h-1);
+  if (pool_ == nullptr) {
+    DrawRectangle(context_,v,w,h);
+    return;
+  }
+  BinPrimitive(kPrimitiveRectangle,rect,v.x,v.y,v.x+w-1,v.y+h-1);
+}
+
+/*
+  The batch is flushed before a primitive that samples a tile written by the batch
+  or writes a tile sampled by it, so every texel read sees the serial VRAM state.
+*/
+void GpuSoft::BinPrimitive(PrimitiveKind kind,const Vertex* v,int x0,int y0,int x1,int y1) {
+  x0 = Max(x0,draw_.clip_x1);
+  y0 = Max(y0,draw_.clip_y1);
+  x1 = Min(x1,draw_.clip_x2);
+  y1 = Min(y1,draw_.clip_y2);
+  if (x0 > x1 || y0 > y1)
+    return;
+  int w = x1 - x0 + 1, h = y1 - y0 + 1;
+  if (prim_.textured) {
+    //sampling its own output depends on the span order, draw it the serial way
+    uint32_t own[kTileRows];
+    memset(own,0,sizeof(own));
+    MarkRegion(own,x0,y0,w,h);
+    if (TextureOverlaps(own)) {
+      FlushBins();
+      switch (kind) {
+        case kPrimitiveTriangle: DrawTriangle(context_,&v[0],&v[1],&v[2]); break;
+        case kPrimitiveLine: DrawLine(context_,v[0],v[1]); break;
+        case kPrimitiveRectangle: DrawRectangle(context_,v[0],v[1].x,v[1].y); break;
+      }
+      return;
+    }
+  }
+  if ((prim_.textured && TextureOverlaps(dirty_tiles_)) || RegionOverlaps(read_tiles_,x0,y0,w,h) ||
+      binned_count_ == kMaxBinned || (epoch_dirty_ && epoch_count_ == kMaxEpochs))
+    FlushBins();
+  if (epoch_dirty_ || epoch_count_ == 0) {
+    epochs_[epoch_count_++] = draw_;
+    epoch_dirty_ = false;
+  }
+
+  int index = binned_count_++;
+  BinnedPrimitive& p = binned_[index];
+  p.kind = kind;
+  p.epoch = epoch_count_ - 1;
+  p.prim = prim_;
+  memcpy(p.v,v,sizeof(Vertex) * (kind == kPrimitiveTriangle ? 3 : 2));
+
+  for (int row=y0>>kTileShiftY;row<=y1>>kTileShiftY;++row) {
+    for (int column=x0>>kTileShiftX;column<=x1>>kTileShiftX;++column) {
+      int tile = row * kTileColumns + column;
+      if (bins_[tile].empty())
+        active_tiles_[active_tile_count_++] = (uint16_t)tile;
+      bins_[tile].push_back(index);
+    }
+  }
+  MarkRegion(dirty_tiles_,x0,y0,w,h);
+  if (prim_.textured)
+    MarkTexture(read_tiles_);
+}
+
+void GpuSoft::MarkRegion(uint32_t* tiles,int x,int y,int w,int h) {
+  uint32_t columns = TileColumns(x,w,kTileShiftX,kTileColumns);
+  for (int row=y>>kTileShiftY;row<=(y+h-1)>>kTileShiftY;++row)
+    tiles[row & (kTileRows-1)] |= columns;
+}
+
+bool GpuSoft::RegionOverlaps(const uint32_t* tiles,int x,int y,int w,int h) const {
+  uint32_t columns = TileColumns(x,w,kTileShiftX,kTileColumns);
+  for (int row=y>>kTileShiftY;row<=(y+h-1)>>kTileShiftY;++row) {
+    if (tiles[row & (kTileRows-1)] & columns)
+      return true;
+  }
+  return false;
+}
+
+//texture page and CLUT of the current primitive
+static const int kTexpageWidth[4] = { 64, 128, 256, 256 };
+
+void GpuSoft::MarkTexture(uint32_t* tiles) {
+  MarkRegion(tiles,draw_.texpage_x,draw_.texpage_y,kTexpageWidth[draw_.tex_depth],256);
+  if (draw_.tex_depth < 2)
+    MarkRegion(tiles,(prim_.clut & 0x3F) << 4,(prim_.clut >> 6) & 0x1FF,draw_.tex_depth == 0 ? 16 : 256,1);
+}
+
+bool GpuSoft::TextureOverlaps(const uint32_t* tiles) const {
+  if (RegionOverlaps(tiles,draw_.texpage_x,draw_.texpage_y,kTexpageWidth[draw_.tex_depth],256))
+    return true;
+  if (draw_.tex_depth < 2)
+    return RegionOverlaps(tiles,(prim_.clut & 0x3F) << 4,(prim_.clut >> 6) & 0x1FF,draw_.tex_depth == 0 ? 16 : 256,1);
+  return false;
+}
+
+//drawn bounding box, clipped to the drawing area. Pending upscaled primitives
+//sampling it are drawn first, they read their texels from the native VRAM
+void GpuSoft::MarkWritten(int x0,int y0,int x1,int y1) {
+  x0 = Max(x0,draw_.clip_x1);
+  y0 = Max(y0,draw_.clip_y1);
+  x1 = Min(x1,draw_.clip_x2);
+  y1 = Min(y1,draw_.clip_y2);
+  if (x0 > x1 || y0 > y1)
+    return;
+  if (hires_count_ != 0 && RegionOverlaps(hires_read_tiles_,x0,y0,x1-x0+1,y1-y0+1))
+    FlushHires();
+  MarkVramWritten(x0,y0,x1-x0+1,y1-y0+1);
+}
+
+//the texture cache cells and the display blocks have the same height
+void GpuSoft::MarkVramWritten(int x,int y,int w,int h) {
+  uint32_t columns = w >= kVramWidth ? 0xFFFFFFFF : TileColumns(x,w,kCellShiftX,kCellColumns);
+  uint16_t blocks = w >= kVramWidth ? 0xFFFF : (uint16_t)TileColumns(x,w,kDisplayShiftX,kDisplayColumns);
+  for (int row=y>>kCellShiftY;row<=(y+h-1)>>kCellShiftY;++row) {
+    vram_written_[row & (kCellRows-1)] |= columns;
+    display_written_[row & (kDisplayRows-1)] |= blocks;
+  }
+  vram_written_any_ = true;
+}
+
+static inline int CountBits(uint32_t bits) {
+  bits = bits - ((bits >> 1) & 0x55555555);
+  bits = (bits & 0x33333333) + ((bits >> 2) & 0x33333333);
+  return (((bits + (bits >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+void GpuSoft::ResetTextureCache() {
+  for (int i=0;i<kTextureCacheSize;++i) {
+    TextureCacheEntry& entry = texture_cache_[i];
+    memset(&entry,0,sizeof(entry));
+    entry.key = kNoTexture;
+    entry.texels = &texture_cache_texels_.u16[i*256*256];
+  }
+  texture_stamp_ = 0;
+  texture_last_ = 0;
+  memset(vram_written_,0,sizeof(vram_written_));
+  vram_written_any_ = false;
+  memset(&texture_cache_stats_,0,sizeof(texture_cache_stats_));
+}
+
+/*
+  Drops the blocks whose texels come from cells written since the last check, a
+  written CLUT drops the whole entry. A cell is 32 halfwords wide so it holds 16
+  block columns of a 4bpp page or 8 of an 8bpp one, and 2 block rows.
+*/
+void GpuSoft::InvalidateTextureCache() {
+  if (!vram_written_any_)
+    return;
+  for (int i=0;i<kTextureCacheSize;++i) {
+    TextureCacheEntry& entry = texture_cache_[i];
+    if (entry.key == kNoTexture)
+      continue;
+    int clut_width = entry.depth == 0 ? 16 : 256;
+    if (vram_written_[entry.clut_y >> kCellShiftY] & TileColumns(entry.clut_x,clut_width,kCellShiftX,kCellColumns)) {
+      for (int by=0;by<32;++by) {
+        texture_cache_stats_.blocks_invalidated += CountBits(entry.valid[by]);
+        entry.valid[by] = 0;
+      }
+      continue;
+    }
+    int page_cells = kTexpageWidth[entry.depth] >> kCellShiftX;
+    int cell_blocks = entry.depth == 0 ? 16 : 8;
+    uint32_t cell_mask = entry.depth == 0 ? 0xFFFF : 0xFF;
+    for (int row=entry.base_y>>kCellShiftY;row<(entry.base_y+256)>>kCellShiftY;++row) {
+      uint32_t written = vram_written_[row];
+      if (written == 0)
+        continue;
+      uint32_t blocks = 0;
+      for (int cell=0;cell<page_cells;++cell) {
+        if (written & (1 << (((entry.base_x >> kCellShiftX) + cell) & (kCellColumns-1))))
+          blocks |= cell_mask << (cell * cell_blocks);
+      }
+      int by = ((row << kCellShiftY) - entry.base_y) >> 3;
+      for (int half=0;half<2;++half) {
+        texture_cache_stats_.blocks_invalidated += CountBits(entry.valid[by+half] & blocks);
+        entry.valid[by+half] &= ~blocks;
+      }
+    }
+  }
+  memset(vram_written_,0,sizeof(vram_written_));
+  vram_written_any_ = false;
+}
+
+//block columns (or rows) covering texture coordinates lo..hi, which wrap at 256
+static uint32_t TextureBlocks(int lo,int hi) {
+  if (hi - lo >= 255)
+    return 0xFFFFFFFF;
+  int first = (lo & 0xFF) >> 3, last = (hi & 0xFF) >> 3;
+  uint32_t from_first = ~((1u << first) - 1);
+  uint32_t to_last = last == 31 ? 0xFFFFFFFF : (1u << (last + 1)) - 1;
+  return first <= last ? (from_first & to_last) : (from_first | to_last);
+}
+
+//[a0,a1] against [b,b+length) wrapping at the VRAM width
+static bool ColumnsOverlap(int a0,int a1,int b,int length) {
+  int b1 = b + length - 1;
+  if (b1 < GpuSoft::kVramWidth)
+    return a0 <= b1 && b <= a1;
+  return a0 <= b1 - GpuSoft::kVramWidth || b <= a1;
+}
+
+/*
+  Looks up the page of the current primitive and decodes the blocks its texture
+  coordinates can reach, u0-u1 and v0-v1 are the ranges before the texture window.
+  Interpolation can step a texel past the vertex range so there is a margin of 2.
+  A primitive that draws over its own texture or CLUT reads VRAM directly since it
+  sees its own writes, with pending binned primitives touching the texture the
+  bins are drawn first so the decode sees their output.
+*/
+void GpuSoft::PrepareTexture(int u0,int u1,int v0,int v1,int x0,int y0,int x1,int y1) {
+  prim_.texels = nullptr;
+  if (!texture_cache_enabled_ || draw_.tex_depth >= 2)
+    return;
+  int page_width = kTexpageWidth[draw_.tex_depth];
+  int clut_x = (prim_.clut & 0x3F) << 4;
+  int clut_y = (prim_.clut >> 6) & 0x1FF;
+  x0 = Max(x0,draw_.clip_x1);
+  y0 = Max(y0,draw_.clip_y1);
+  x1 = Min(x1,draw_.clip_x2);
+  y1 = Min(y1,draw_.clip_y2);
+  if (x0 <= x1 && y0 <= y1) {
+    bool page = y0 < (int)draw_.texpage_y + 256 && y1 >= (int)draw_.texpage_y && ColumnsOverlap(x0,x1,draw_.texpage_x,page_width);
+    bool clut = y0 <= clut_y && y1 >= clut_y && ColumnsOverlap(x0,x1,clut_x,draw_.tex_depth == 0 ? 16 : 256);
+    if (page || clut) {
+      ++texture_cache_stats_.bypasses;
+      return;
+    }
+  }
+  if (pool_ != nullptr && binned_count_ != 0 && TextureOverlaps(dirty_tiles_))
+    FlushBins();
+  InvalidateTextureCache();
+
+  uint32_t key = prim_.clut | ((draw_.texpage_x >> 6) << 16) | ((draw_.texpage_y >> 8) << 20) | (draw_.tex_depth << 21);
+  TextureCacheEntry* entry = &texture_cache_[texture_last_];
+  if (entry->key != key) {
+    int oldest = 0;
+    entry = nullptr;
+    for (int i=0;i<kTextureCacheSize;++i) {
+      if (texture_cache_[i].key == key) {
+        entry = &texture_cache_[i];
+        texture_last_ = i;
+        break;
+      }
+      if (texture_cache_[i].stamp < texture_cache_[oldest].stamp)
+        oldest = i;
+    }
+    if (entry == nullptr) {
+      //binned and upscaled primitives may still read the evicted page
+      if (hires_count_ != 0)
+        FlushHires();
+      else if (pool_ != nullptr && binned_count_ != 0)
+        FlushBins();
+      ++texture_cache_stats_.misses;
+      entry = &texture_cache_[oldest];
+      texture_last_ = oldest;
+      entry->key = key;
+      entry->base_x = draw_.texpage_x;
+      entry->base_y = draw_.texpage_y;
+      entry->depth = draw_.tex_depth;
+      entry->clut_x = clut_x;
+      entry->clut_y = clut_y;
+      memset(entry->valid,0,sizeof(entry->valid));
+    } else {
+      ++texture_cache_stats_.hits;
+    }
+  } else {
+    ++texture_cache_stats_.hits;
+  }
+  entry->stamp = ++texture_stamp_;
+
+  bool window_u = draw_.tw_and_u != 0xFF || draw_.tw_or_u != 0;
+  bool window_v = draw_.tw_and_v != 0xFF || draw_.tw_or_v != 0;
+  uint32_t columns = window_u ? 0xFFFFFFFF : TextureBlocks(u0 - 2,u1 + 2);
+  uint32_t rows = window_v ? 0xFFFFFFFF : TextureBlocks(v0 - 2,v1 + 2);
+  for (int by=0;by<32;++by) {
+    if ((rows & (1u << by)) == 0)
+      continue;
+    uint32_t missing = columns & ~entry->valid[by];
+    if (missing == 0)
+      continue;
+    for (int bx=0;bx<32;++bx) {
+      if (missing & (1u << bx))
+        DecodeTextureBlock(*entry,bx,by);
+    }
+    entry->valid[by] |= missing;
+    texture_cache_stats_.blocks_decoded += CountBits(missing);
+  }
+  prim_.texels = entry->texels;
+}
+
+void GpuSoft::DecodeTextureBlock(TextureCacheEntry& entry,int bx,int by) {
+  uint16_t* out = &entry.texels[(by * 32 + bx) * 64];
+  const uint16_t* clut = &vram_.u16[entry.clut_y * kVramWidth];
+  for (int row=0;row<8;++row) {
+    const uint16_t* line = &vram_.u16[(entry.base_y + by * 8 + row) * kVramWidth];
+    for (int col=0;col<8;++col) {
+      uint32_t tu = bx * 8 + col;
+      uint32_t index;
+      if (entry.depth == 0)
+        index = (line[(entry.base_x + (tu >> 2)) & (kVramWidth-1)] >> ((tu & 3) << 2)) & 0xF;
+      else
+        index = (line[(entry.base_x + (tu >> 1)) & (kVramWidth-1)] >> ((tu & 1) << 3)) & 0xFF;
+      out[row * 8 + col] = clut[(entry.clut_x + index) & (kVramWidth-1)];
+    }
+  }
+}
+
+void GpuSoft::FlushBins() {
+  if (binned_count_ == 0)
+    return;
+  pool_->Run(active_tile_count_,[this](int task,int thread) {
+    RenderTile(active_tiles_[task],render_contexts_[thread]);
+  });
+  for (int i=0;i<active_tile_count_;++i)
+    bins_[active_tiles_[i]].clear();
+  active_tile_count_ = 0;
+  binned_count_ = 0;
+  epoch_count_ = 0;
+  memset(dirty_tiles_,0,sizeof(dirty_tiles_));
+  memset(read_tiles_,0,sizeof(read_tiles_));
+}
+
+void GpuSoft::RenderTile(int tile,RenderContext& rc) {
+  int left = (tile % kTileColumns) << kTileShiftX;
+  int top = (tile / kTileColumns) << kTileShiftY;
+  uint32_t epoch = ~0u;
+  const std::vector<uint32_t>& bin = bins_[tile];
+  for (size_t i=0;i<bin.size();++i) {
+    const BinnedPrimitive& p = binned_[bin[i]];
+    if (p.epoch != epoch) {
+      epoch = p.epoch;
+      rc.draw = &epochs_[epoch];
+      rc.clip_x1 = Max(rc.draw->clip_x1,left);
+      rc.clip_y1 = Max(rc.draw->clip_y1,top);
+      rc.clip_x2 = Min(rc.draw->clip_x2,left + (1 << kTileShiftX) - 1);
+      rc.clip_y2 = Min(rc.draw->clip_y2,top + (1 << kTileShiftY) - 1);
+    }
+    rc.prim = &p.prim;
+    switch (p.kind) {
+      case kPrimitiveTriangle: DrawTriangle(rc,&p.v[0],&p.v[1],&p.v[2]); break;
+      case kPrimitiveLine: DrawLine(rc,p.v[0],p.v[1]); break;
+      case kPrimitiveRectangle: DrawRectangle(rc,p.v[0],p.v[1].x,p.v[1].y); break;
+    }
+  }
+}
+
+/*
+  Upscaled primitives keep their submission order with the vertices already scaled,
+  binned into bands of VRAM lines by their clipped bounding box. The draw state is
+  shared by the run of primitives it is the same for. Dithering is left out, its
+  pattern is per VRAM pixel.
+*/
+void GpuSoft::RecordHires(PrimitiveKind kind,const Vertex* v,int x0,int y0,int x1,int y1) {
+  x0 = Max(x0,draw_.clip_x1);
+  y0 = Max(y0,draw_.clip_y1);
+  x1 = Min(x1,draw_.clip_x2);
+  y1 = Min(y1,draw_.clip_y2);
+  if (x0 > x1 || y0 > y1)
+    return;
+  bool new_epoch = hires_epoch_count_ == 0 || memcmp(&hires_epochs_[hires_epoch_count_-1],&draw_,sizeof(draw_)) != 0;
+  if (hires_count_ == kMaxBinned || (new_epoch && hires_epoch_count_ == kMaxEpochs)) {
+    FlushHires();
+    new_epoch = true;
+  }
+  if (new_epoch)
+    hires_epochs_[hires_epoch_count_++] = draw_;
+
+  int index = hires_count_++;
+  BinnedPrimitive& p = hires_primitives_[index];
+  p.kind = kind;
+  p.epoch = hires_epoch_count_ - 1;
+  p.prim = prim_;
+  p.prim.dither = false;
+  int scale = 1 << resolution_shift_;
+  int count = kind == kPrimitiveTriangle ? 3 : 2;
+  for (int i=0;i<count;++i) {
+    p.v[i] = v[i];
+    p.v[i].x *= scale;
+    p.v[i].y *= scale;
+  }
+  for (int band=y0>>kBandShift;band<=y1>>kBandShift;++band) {
+    if (hires_bins_[band].empty())
+      hires_bands_[hires_band_count_++] = (uint16_t)band;
+    hires_bins_[band].push_back(index);
+  }
+  if (prim_.textured)
+    MarkTexture(hires_read_tiles_);
+}
+
+//the native primitives before them are drawn first, they may be textures of these
+void GpuSoft::FlushHires() {
+  FlushBins();
+  if (hires_count_ == 0)
+    return;
+  if (pool_ != nullptr) {
+    pool_->Run(hires_band_count_,[this](int task,int thread) {
+      RenderBand(hires_bands_[task],hires_contexts_[thread]);
+    });
+  } else {
+    for (int i=0;i<hires_band_count_;++i)
+      RenderBand(hires_bands_[i],hires_contexts_[0]);
+  }
+  for (int i=0;i<hires_band_count_;++i)
+    hires_bins_[hires_bands_[i]].clear();
+  hires_band_count_ = 0;
+  hires_count_ = 0;
+  hires_epoch_count_ = 0;
+  memset(hires_read_tiles_,0,sizeof(hires_read_tiles_));
+}
+
+void GpuSoft::RenderBand(int band,RenderContext& rc) {
+  int shift = rc.shift;
+  int top = (band << kBandShift) << shift;
+  int bottom = ((band + 1) << kBandShift << shift) - 1;
+  uint32_t epoch = ~0u;
+  const std::vector<uint32_t>& bin = hires_bins_[band];
+  for (size_t i=0;i<bin.size();++i) {
+    const BinnedPrimitive& p = hires_primitives_[bin[i]];
+    if (p.epoch != epoch) {
+      epoch = p.epoch;
+      rc.draw = &hires_epochs_[epoch];
+      rc.clip_x1 = rc.draw->clip_x1 << shift;
+      rc.clip_y1 = Max(rc.draw->clip_y1 << shift,top);
+      rc.clip_x2 = ((rc.draw->clip_x2 + 1) << shift) - 1;
+      rc.clip_y2 = Min(((rc.draw->clip_y2 + 1) << shift) - 1,bottom);
+    }
+    rc.prim = &p.prim;
+    switch (p.kind) {
+      case kPrimitiveTriangle: DrawTriangle(rc,&p.v[0],&p.v[1],&p.v[2]); break;
+      case kPrimitiveLine: DrawLine(rc,p.v[0],p.v[1]); break;
+      case kPrimitiveRectangle: DrawRectangle(rc,p.v[0],p.v[1].x,p.v[1].y); break;
+    }
+  }
+}
+
+//copies [x,x+count) of VRAM line y to the upscaled copy, every pixel repeated
+void GpuSoft::UpscaleSpan(int x,int y,int count) {
+  int shift = resolution_shift_;
+  int width = kVramWidth << shift;
+  const uint16_t* src = &vram_.u16[y*kVramWidth + x];
+  uint16_t* dst = &hires_.u16[(y << shift)*width + (x << shift)];
+  for (int i=0;i<count;++i) {
+    for (int j=0;j<(1 << shift);++j)
+      dst[(i << shift) + j] = src[i];
+  }
+  for (int row=1;row<(1 << shift);++row)
+    memcpy(dst + row*width,dst,(count << shift)*sizeof(uint16_t));
+}
+
+/*
+  The transfer rectangle is filled a row at a time, rows split where they wrap
+  around the right edge of VRAM. Pixels past the rectangle are dropped.
+*/
+void GpuSoft::WriteTransferSpan(const uint16_t* pixels,int count) {
+  while (count > 0 && load_.cy < load_.h) {
+    int n = Min(count,load_.w - load_.cx);
+    int y = (load_.y + load_.cy) & (kVramHeight-1);
+    uint16_t* line = &vram_.u16[y * kVramWidth];
+    int x = (load_.x + load_.cx) & (kVramWidth-1);
+    for (int left=n;left>0;) {
+      int run = Min(left,kVramWidth - x);
+      StorePixels(&line[x],pixels,run,draw_.set_mask,draw_.check_mask);
+      if (resolution_shift_ != 0)
+        UpscaleSpan(x,y,run);
+      pixels += run;
+      left -= run;
+      x = 0;
+    }
+    count -= n;
+    load_.cx += n;
+    if (load_.cx == load_.w) {
+      load_.cx = 0;
+      ++load_.cy;
+    }
+  }
+}
+
+//reads keep going past the rectangle like the hardware does
+void GpuSoft::ReadTransferSpan(uint16_t* pixels,int count) {
+  while (count > 0) {
+    int n = Min(count,store_.w - store_.cx);
+    const uint16_t* line = &vram_.u16[((store_.y + store_.cy) & (kVramHeight-1)) * kVramWidth];
+    int x = (store_.x + store_.cx) & (kVramWidth-1);
+    for (int left=n;left>0;) {
+      int run = Min(left,kVramWidth - x);
+      memcpy(pixels,&line[x],run*sizeof(uint16_t));
+      pixels += run;
+      left -= run;
+      x = 0;
+    }
+    count -= n;
+    store_.cx += n;
+    if (store_.cx == store_.w) {
+      store_.cx = 0;
+      ++store_.cy;
+    }
+  }
+}
+
+void GpuSoft::CommandMisc() {
+  uint32_t command = fifo_.buffer[0] >> 24;
+  switch (command) {
+    case 0x02: {
+      FlushHires();
+      uint32_t c = fifo_.buffer[0];
+      uint16_t color = (uint16_t)(((c >> 3) & 0x1F) | (((c >> 11) & 0x1F) << 5) | (((c >> 19) & 0x1F) << 10));
+      int x = fifo_.buffer[1] & 0x3F0;
+      int y = (fifo_.buffer[1] >> 16) & 0x1FF;
+      int w = ((fifo_.buffer[2] & 0x3FF) + 0xF) & ~0xF;
+      int h = (fifo_.buffer[2] >> 16) & 0x1FF;
+      if (w > 0 && h > 0)
+        MarkVramWritten(x,y,w,h);
+      FillRect(vram_.u16,kVramWidth,kVramHeight,x,y,w,h,color);
+      if (resolution_shift_ != 0) {
+        int shift = resolution_shift_;
+        FillRect(hires_.u16,kVramWidth << shift,kVramHeight << shift,x << shift,y << shift,w << shift,h << shift,color);
+      }
+      break;
+    }
+    case 0x1F:
+      status_.irq1 = 1;
+      //the worker can't touch the interrupt registers, the CPU thread raises it
+      if (worker_ != nullptr)
+        irq_pending_ = true;
+      else if (system_ != nullptr)
+        system_->io().SetInterrupt(kInterruptGPU);
+      break;
+    default:
+      //nop and cache clear
+      break;
+  }
+}
+
+void GpuSoft::CommandPolygon() {
+  uint32_t command = fifo_.buffer[0] >> 24;
+  bool quad = (command & 0x08) != 0;
+  prim_.gouraud = (command & 0x10) != 0;
+  prim_.textured = (command & 0x04) != 0;
+  prim_.semi = (command & 0x02) != 0;
+  prim_.raw = (command & 0x01) != 0;
+
+  Vertex v[4];
+  memset(v,0,sizeof(v));
+  const uint32_t* p = fifo_.buffer;
+  int vertices = quad ? 4 : 3;
+  uint32_t color = *p++;
+  for (int i=0;i<vertices;++i) {
+    if (prim_.gouraud && i > 0)
+      color = *p++;
+    DecodeColor(color,v[i]);
+    DecodeVertex(*p++,v[i]);
+    if (prim_.textured) {
+      uint32_t uv = *p++;
+      v[i].u = uv & 0xFF;
+      v[i].v = (uv >> 8) & 0xFF;
+      if (i == 0)
+        prim_.clut = uv >> 16;
+      else if (i == 1)
+        SetTexpage(uv >> 16);
+    }
+  }
+  prim_.dither = draw_.dither && (prim_.gouraud || (prim_.textured && !prim_.raw));
+  prim_.texels = nullptr;
+  if (prim_.textured) {
+    int u0 = 255, u1 = 0, v0 = 255, v1 = 0;
+    int x0 = v[0].x, y0 = v[0].y, x1 = v[0].x, y1 = v[0].y;
+    for (int i=0;i<vertices;++i) {
+      u0 = Min(u0,v[i].u);
+      u1 = Max(u1,v[i].u);
+      v0 = Min(v0,v[i].v);
+      v1 = Max(v1,v[i].v);
+      x0 = Min(x0,v[i].x);
+      x1 = Max(x1,v[i].x);
+      y0 = Min(y0,v[i].y);
+      y1 = Max(y1,v[i].y);
+    }
+    PrepareTexture(u0,u1,v0,v1,x0,y0,x1,y1);
+  }
+
+  SubmitTriangle(&v[0],&v[1],&v[2]);
+  if (quad)
+    SubmitTriangle(&v[1],&v[2],&v[3]);
+}
+
+void GpuSoft::CommandLine() {
+  uint32_t command = fifo_.buffer[0] >> 24;
+  prim_.gouraud = (command & 0x10) != 0;
+  prim_.textured = false;
+  prim_.texels = nullptr;
+  prim_.raw = false;
+  prim_.semi = (command & 0x02) != 0;
+  prim_.dither = draw_.dither && prim_.gouraud;
+
+  Vertex v0, v1;
+  memset(&v0,0,sizeof(v0));
+  DecodeColor(fifo_.buffer[0],v0);
+  DecodeVertex(fifo_.buffer[1],v0);
+  v1 = v0;
+  if (prim_.gouraud) {
+    DecodeColor(fifo_.buffer[2],v1);
+    DecodeVertex(fifo_.buffer[3],v1);
+  } else {
+    DecodeVertex(fifo_.buffer[2],v1);
+  }
+  SubmitLine(v0,v1);
+
+  if (command & 0x08) {
+    polyline_.last = v1;
+    polyline_.gouraud = prim_.gouraud;
+    polyline_.expect_color = prim_.gouraud;
+    gp0_mode_ = kGp0Polyline;
+  }
+}
+
+void GpuSoft::CommandRectangle() {
+  uint32_t command = fifo_.buffer[0] >> 24;
+  prim_.gouraud = false;
+  prim_.dither = false;
+  prim_.textured = (command & 0x04) != 0;
+  prim_.semi = (command & 0x02) != 0;
+  prim_.raw = (command & 0x01) != 0;
+
+  Vertex v;
+  memset(&v,0,sizeof(v));
+  DecodeColor(fifo_.buffer[0],v);
+  DecodeVertex(fifo_.buffer[1],v);
+  int index = 2;
+  if (prim_.textured) {
+    uint32_t uv = fifo_.buffer[index++];
+    v.u = uv & 0xFF;
+    v.v = (uv >> 8) & 0xFF;
+    prim_.clut = uv >> 16;
+  }
+  int w, h;
+  switch ((command >> 3) & 0x3) {
+    case 0:
+      w = fifo_.buffer[index] & 0x3FF;
+      h = (fifo_.buffer[index] >> 16) & 0x1FF;
+      break;
+    case 1: w = h = 1; break;
+    case 2: w = h = 8; break;
+    default: w = h = 16; break;
+  }
+  prim_.texels = nullptr;
+  if (prim_.textured) {
+    int u0 = draw_.flip_x ? v.u - w + 1 : v.u;
+    int v0 = draw_.flip_y ? v.v - h + 1 : v.v;
+    PrepareTexture(u0,u0 + w - 1,v0,v0 + h - 1,v.x,v.y,v.x + w - 1,v.y + h - 1);
+  }
+  SubmitRectangle(v,w,h);
+}
+
+void GpuSoft::CommandCopy() {
+  FlushHires();
+  int src_x = fifo_.buffer[1] & 0x3FF;
+  int src_y = (fifo_.buffer[1] >> 16) & 0x1FF;
+  int dst_x = fifo_.buffer[2] & 0x3FF;
+  int dst_y = (fifo_.buffer[2] >> 16) & 0x1FF;
+  int w = (((fifo_.buffer[3] & 0xFFFF) - 1) & 0x3FF) + 1;
+  int h = (((fifo_.buffer[3] >> 16) - 1) & 0x1FF) + 1;
+  MarkVramWritten(dst_x,dst_y,w,h);
+  CopyRect(vram_.u16,kVramWidth,kVramHeight,src_x,src_y,dst_x,dst_y,w,h,draw_.set_mask,draw_.check_mask);
+  //the upscaled copy keeps the detail of the copied area
+  if (resolution_shift_ != 0) {
+    int shift = resolution_shift_;
+    CopyRect(hires_.u16,kVramWidth << shift,kVramHeight << shift,src_x << shift,src_y << shift,
+             dst_x << shift,dst_y << shift,w << shift,h << shift,draw_.set_mask,draw_.check_mask);
+  }
+}
+
+void GpuSoft::CommandImageLoad() {
+  FlushHires();
+  load_.x = fifo_.buffer[1] & 0x3FF;
+  load_.y = (fifo_.buffer[1] >> 16) & 0x1FF;
+  load_.w = (((fifo_.buffer[2] & 0xFFFF) - 1) & 0x3FF) + 1;
+  load_.h = (((fifo_.buffer[2] >> 16) - 1) & 0x1FF) + 1;
+  load_.cx = load_.cy = 0;
+  load_.words = (load_.w * load_.h + 1) / 2;
+  MarkVramWritten(load_.x,load_.y,load_.w,load_.h);
+  gp0_mode_ = kGp0ImageLoad;
+}
+
+void GpuSoft::CommandImageStore() {
+  FlushBins();
+  store_.x = fifo_.buffer[1] & 0x3FF;
+  store_.y = (fifo_.buffer[1] >> 16) & 0x1FF;
+  store_.w = (((fifo_.buffer[2] & 0xFFFF) - 1) & 0x3FF) + 1;
+  store_.h = (((fifo_.buffer[2] >> 16) - 1) & 0x1FF) + 1;
+  store_.cx = store_.cy = 0;
+  store_.words = (store_.w * store_.h + 1) / 2;
+  status_.img = 1;
+}
+
+void GpuSoft::CommandEnvironment() {
+  uint32_t command = fifo_.buffer[0] >> 24;
+  uint32_t data = fifo_.buffer[0] & 0xFFFFFF;
+  switch (command) {
+    case 0xE1:
+      SetTexpage(data);
+      draw_.dither = ((data >> 9) & 0x1) != 0;
+      status_.dtd = (data >> 9) & 0x1;
+      status_.dfe = (data >> 10) & 0x1;
+      draw_.flip_x = ((data >> 12) & 0x1) != 0;
+      draw_.flip_y = ((data >> 13) & 0x1) != 0;
+      epoch_dirty_ = true;
+      break;
+    case 0xE2: {
+      uint32_t mask_x = data & 0x1F, mask_y = (data >> 5) & 0x1F;
+      uint32_t offset_x = (data >> 10) & 0x1F, offset_y = (data >> 15) & 0x1F;
+      draw_.texture_window = data & 0xFFFFF;
+      draw_.tw_and_u = (uint8_t)~(mask_x << 3);
+      draw_.tw_and_v = (uint8_t)~(mask_y << 3);
+      draw_.tw_or_u = (uint8_t)((offset_x & mask_x) << 3);
+      draw_.tw_or_v = (uint8_t)((offset_y & mask_y) << 3);
+      epoch_dirty_ = true;
+      break;
+    }
+    case 0xE3:
+      FlushBins();
+      draw_.area_start = data & 0xFFFFF;
+      draw_.clip_x1 = context_.clip_x1 = data & 0x3FF;
+      draw_.clip_y1 = context_.clip_y1 = (data >> 10) & 0x1FF;
+      epoch_dirty_ = true;
+      break;
+    case 0xE4:
+      FlushBins();
+      draw_.area_end = data & 0xFFFFF;
+      draw_.clip_x2 = context_.clip_x2 = data & 0x3FF;
+      draw_.clip_y2 = context_.clip_y2 = (data >> 10) & 0x1FF;
+      epoch_dirty_ = true;
+      break;
+    case 0xE5:
+      draw_.offset = data & 0x3FFFFF;
+      draw_.offset_x = SignExtend11(data);
+      draw_.offset_y = SignExtend11(data >> 11);
+      break;
+    case 0xE6:
+      draw_.set_mask = (data & 0x1) ? 0x8000 : 0;
+      draw_.check_mask = (data & 0x2) != 0;
+      status_.md = data & 0x1;
+      status_.me = (data >> 1) & 0x1;
+      epoch_dirty_ = true;
+      break;
+    default:
+      break;
+  }
+}
+
+}
+}
@@ -0,0 +1,344 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  Software rasteriser GPU core. Draws into a native 1024x512 16bpp VRAM with the
+  hardware pixel pipeline (texture/CLUT fetch, modulation, dithering, semi-transparency
+  and the mask bit), needs no graphics device so it also runs headless.
+  In threaded mode GP0 words are queued to a worker thread through a SPSC ring and
+  the CPU thread only waits for it on GPUREAD, GP1 writes and end of frame.
+  With a window the finished frames are drawn by a FramePresenter thread.
+  VRAM transfers, fills and copies work on whole rows, DMA block transfers hand
+  over the RAM span in one call.
+  4bpp and 8bpp textures are read from a cache of pages decoded through their
+  CLUT, decoded in 8x8 blocks on demand and invalidated by the VRAM writes.
+  The same writes mark 64x16 display blocks so the scanout only converts what
+  changed and reports frames that are the same as the last one.
+  With more than one render thread primitives are binned into 64x32 tiles and the
+  tiles are rasterised in parallel, each tile keeps the submission order.
+  At a resolution scale of 2 or 4 the primitives are drawn a second time into an
+  upscaled copy of VRAM, split into bands of lines over the render threads. The
+  native VRAM stays the one transfers, textures and CLUTs come from, the scanout
+  reads the upscaled copy.
+*/
+class GpuSoft : public GpuCore {
+ public:
+  typedef void (GpuSoft::*Command)();
+  static const int kVramWidth = 1024;
+  static const int kVramHeight = 512;
+  static const int kMaxResolutionScale = 4;
+  struct DisplayArea {
+    uint16_t x,y;
+    uint16_t x1,x2;
+    uint16_t y1,y2;
+  };
+  //attributes of a span in 20.12 fixed point, d* are the per pixel steps
+  struct Span {
+    int32_t r,g,b,u,v;
+    int32_t dr,dg,db,du,dv;
+  };
+  //size of the picture and the part of it the last Scanout converted
+  struct ScanoutRegion {
+    int width,height;
+    int x0,y0,x1,y1;
+  };
+  struct TextureCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bypasses;
+    uint64_t blocks_decoded;
+    uint64_t blocks_invalidated;
+  };
+  GpuSoft();
+  ~GpuSoft();
+  int Initialize();
+  int Deinitialize();
+  uint32_t  ReadData();
+  uint32_t  ReadStatus();
+  void WriteData(uint32_t data);
+  void WriteStatus(uint32_t data);
+  void WriteDataSpan(const uint32_t* data,size_t count);
+  void ReadDataSpan(uint32_t* data,size_t count);
+  const uint16_t* ReadVram();
+  void GetStateWords(std::vector<uint32_t>* gp0,std::vector<uint32_t>* gp1);
+  void GetStats(GpuStats* stats);
+  int Render();
+  uint16_t* vram() { return vram_.u16; }
+  const DisplayArea& display() const { return display_; }
+  const GpuStatus& status() const { return status_; }
+  SimdLevel simd_level() const { return simd_level_; }
+  void set_simd_level(SimdLevel level);
+  bool threaded() const { return threaded_; }
+  void set_threaded(bool threaded);
+  int render_threads() const { return render_threads_; }
+  void set_render_threads(int count);
+  int resolution_scale() const { return 1 << resolution_shift_; }
+  //1, 2 or 4, other values round down
+  void set_resolution_scale(int scale);
+  bool texture_cache() const { return texture_cache_enabled_; }
+  void set_texture_cache(bool enabled);
+  const TextureCacheStats& texture_cache_stats() const { return texture_cache_stats_; }
+  void Sync();
+  //size of the displayed picture from the GP1 display mode and ranges
+  void GetDisplaySize(int* width,int* height) const;
+  //converts the display area to 0xAABBGGRR pixels, pitch is in pixels. The picture
+  //is the display size times the resolution scale. Only what changed since the
+  //last call with the same buffer is converted, returns false when the picture is
+  //the same as last time
+  bool Scanout(uint32_t* pixels,int pitch,ScanoutRegion* region = nullptr);
+  //makes the next Scanout convert the whole picture
+  void InvalidateScanout();
+ private:
+  static const uint32_t kRingSize = 64*1024;
+  static const int kTileShiftX = 6;
+  static const int kTileShiftY = 5;
+  static const int kTileColumns = kVramWidth >> kTileShiftX;
+  static const int kTileRows = kVramHeight >> kTileShiftY;
+  static const int kTileCount = kTileColumns * kTileRows;
+  static const int kMaxBinned = 8192;
+  static const int kMaxEpochs = 1024;
+  static const int kTextureCacheSize = 32;
+  static const uint32_t kNoTexture = 0xFFFFFFFF;
+  //VRAM writes are tracked in 32x16 cells for the texture cache
+  static const int kCellShiftX = 5;
+  static const int kCellShiftY = 4;
+  static const int kCellColumns = kVramWidth >> kCellShiftX;
+  static const int kCellRows = kVramHeight >> kCellShiftY;
+  //and in 64x16 blocks for the scanout
+  static const int kDisplayShiftX = 6;
+  static const int kDisplayShiftY = 4;
+  static const int kDisplayColumns = kVramWidth >> kDisplayShiftX;
+  static const int kDisplayRows = kVramHeight >> kDisplayShiftY;
+  static const int kMaxDisplayLines = 576;
+  //upscaled primitives are binned into bands of 16 VRAM lines
+  static const int kBandShift = 4;
+  static const int kBandCount = kVramHeight >> kBandShift;
+  struct Vertex {
+    int32_t x,y;
+    int32_t r,g,b;
+    int32_t u,v;
+  };
+  enum Gp0Mode { kGp0Command, kGp0ImageLoad, kGp0Polyline };
+  static Command commands_[8];
+  static uint8_t command_size_[256];
+  GpuStatus status_;
+  Buffer vram_;
+  SimdLevel simd_level_;
+  SimdLevel simd_support_;
+  Gp0Mode gp0_mode_;
+  uint32_t gpuread_;
+  struct {
+    uint32_t buffer[16];
+    int count;
+    int size;
+  } fifo_;
+  struct DrawState {
+    uint32_t texpage_x,texpage_y;
+    int semi_mode;
+    int tex_depth;
+    bool dither;
+    bool flip_x,flip_y;
+    uint8_t tw_and_u,tw_or_u,tw_and_v,tw_or_v;
+    int clip_x1,clip_y1,clip_x2,clip_y2;
+    int offset_x,offset_y;
+    uint16_t set_mask;
+    bool check_mask;
+    uint32_t texture_window,area_start,area_end,offset;
+  } draw_;
+  //state of the primitive being drawn
+  struct PrimitiveState {
+    bool textured;
+    bool raw;
+    bool semi;
+    bool gouraud;
+    bool dither;
+    uint32_t clut;
+    //decoded texture page, null when the texels come straight from VRAM
+    const uint16_t* texels;
+  } prim_;
+  //rasteriser state of one thread, draw and prim are shared and read only.
+  //target is the native VRAM or the upscaled copy, shift the log2 of its scale
+  struct RenderContext {
+    const DrawState* draw;
+    const PrimitiveState* prim;
+    uint16_t* target;
+    int pitch;
+    int shift;
+    int clip_x1,clip_y1,clip_x2,clip_y2;
+    uint64_t pixels;
+    uint16_t span_color[kVramWidth*kMaxResolutionScale];
+    uint16_t span_texel[kVramWidth*kMaxResolutionScale];
+  };
+  enum PrimitiveKind { kPrimitiveTriangle, kPrimitiveLine, kPrimitiveRectangle };
+  //rectangles keep the size in v[1].x and v[1].y
+  struct BinnedPrimitive {
+    PrimitiveKind kind;
+    uint32_t epoch;
+    PrimitiveState prim;
+    Vertex v[3];
+  };
+  struct {
+    int x,y,w,h;
+    int cx,cy;
+    uint32_t words;
+  } load_,store_;
+  struct {
+    Vertex last;
+    bool gouraud;
+    bool expect_color;
+    uint32_t color;
+  } polyline_;
+  DisplayArea display_;
+  RenderContext context_;
+  uint64_t primitive_count_;
+  bool threaded_;
+  SpscRing<uint32_t,kRingSize>* ring_;
+  std::thread* worker_;
+  std::mutex worker_mutex_;
+  std::condition_variable worker_wake_;
+  std::atomic<bool> worker_exit_;
+  std::atomic<bool> worker_sleeping_;
+  std::atomic<bool> irq_pending_;
+  std::atomic<uint32_t> status_shadow_;
+  int render_threads_;
+  WorkPool* pool_;
+  RenderContext* render_contexts_;
+  BinnedPrimitive* binned_;
+  int binned_count_;
+  DrawState* epochs_;
+  int epoch_count_;
+  bool epoch_dirty_;
+  std::vector<uint32_t> bins_[kTileCount];
+  uint16_t active_tiles_[kTileCount];
+  int active_tile_count_;
+  //tiles written and sampled by the binned primitives, one bit per column
+  uint32_t dirty_tiles_[kTileRows];
+  uint32_t read_tiles_[kTileRows];
+  //a 256x256 page stored in 8x8 blocks, valid has a bit per block of each block row
+  struct TextureCacheEntry {
+    uint32_t key;
+    uint32_t stamp;
+    int base_x,base_y;
+    int depth;
+    int clut_x,clut_y;
+    uint32_t valid[32];
+    uint16_t* texels;
+  };
+  bool texture_cache_enabled_;
+  TextureCacheEntry texture_cache_[kTextureCacheSize];
+  Buffer texture_cache_texels_;
+  uint32_t texture_stamp_;
+  int texture_last_;
+  TextureCacheStats texture_cache_stats_;
+  //cells written since the cache was last checked, one bit per column
+  uint32_t vram_written_[kCellRows];
+  bool vram_written_any_;
+  //blocks written since the last scanout and what the last scanout was made from
+  struct ScanoutState {
+    uint32_t* pixels;
+    int pitch;
+    int width,height;
+    int shift;
+    bool rgb24;
+    bool blank;
+  };
+  uint16_t display_written_[kDisplayRows];
+  ScanoutState scanout_state_;
+  int scanout_x_,scanout_y_;
+  bool scanout_valid_;
+  Buffer scanout_shadow_;
+  //upscaled copy of VRAM and the primitives waiting to be drawn into it, the
+  //tiles sampled by those are in the native tile grid
+  int resolution_shift_;
+  Buffer hires_;
+  RenderContext* hires_contexts_;
+  BinnedPrimitive* hires_primitives_;
+  int hires_count_;
+  DrawState* hires_epochs_;
+  int hires_epoch_count_;
+  std::vector<uint32_t> hires_bins_[kBandCount];
+  uint16_t hires_bands_[kBandCount];
+  int hires_band_count_;
+  uint32_t hires_read_tiles_[kTileRows];
+  //with a window the picture is scanned out at end of frame and drawn by the presenter thread
+  FramePresenter presenter_;
+  Buffer picture_;
+  double caption_fps_;
+
+  static void worker_func(GpuSoft* gpu);
+  void StartWorker();
+  void StopWorker();
+  void StopRenderPool();
+  void StartPresenter();
+  void AllocHires();
+  void FreeHires();
+  void WakeWorker();
+  void ProcessData(uint32_t data);
+  void ProcessSpan(const uint32_t* data,uint32_t count);
+
+  void ExecuteCommand();
+  void SetTexpage(uint32_t texpage);
+  void DecodeVertex(uint32_t position,Vertex& v);
+  void DecodeColor(uint32_t color,Vertex& v);
+  void SubmitTriangle(const Vertex* v0,const Vertex* v1,const Vertex* v2);
+  void SubmitLine(const Vertex& v0,const Vertex& v1);
+  void SubmitRectangle(const Vertex& v,int w,int h);
+  void BinPrimitive(PrimitiveKind kind,const Vertex* v,int x0,int y0,int x1,int y1);
+  void MarkRegion(uint32_t* tiles,int x,int y,int w,int h);
+  void MarkTexture(uint32_t* tiles);
+  bool RegionOverlaps(const uint32_t* tiles,int x,int y,int w,int h) const;
+  bool TextureOverlaps(const uint32_t* tiles) const;
+  void MarkWritten(int x0,int y0,int x1,int y1);
+  void MarkVramWritten(int x,int y,int w,int h);
+  void ResetTextureCache();
+  void InvalidateTextureCache();
+  void PrepareTexture(int u0,int u1,int v0,int v1,int x0,int y0,int x1,int y1);
+  void DecodeTextureBlock(TextureCacheEntry& entry,int bx,int by);
+  void FlushBins();
+  void RenderTile(int tile,RenderContext& rc);
+  void RecordHires(PrimitiveKind kind,const Vertex* v,int x0,int y0,int x1,int y1);
+  void FlushHires();
+  void RenderBand(int band,RenderContext& rc);
+  void UpscaleSpan(int x,int y,int count);
+  void DrawTriangle(RenderContext& rc,const Vertex* v0,const Vertex* v1,const Vertex* v2);
+  void DrawRectangle(RenderContext& rc,const Vertex& v,int w,int h);
+  void DrawSpan(RenderContext& rc,int y,int x0,int x1,const Span& span);
+  void DrawLine(RenderContext& rc,const Vertex& v0,const Vertex& v1);
+  void FetchTexels(RenderContext& rc,int count,int32_t u,int32_t v,int32_t du,int32_t dv);
+  void WriteTransferSpan(const uint16_t* pixels,int count);
+  void ReadTransferSpan(uint16_t* pixels,int count);
+  void ScanoutLine(uint32_t* dst,int line,int width);
+  void Scanout15(uint32_t* dst,const uint16_t* src,int count);
+  void PresentFrame(const FramePresenter::Frame& frame);
+  void CommandMisc();
+  void CommandPolygon();
+  void CommandLine();
+  void CommandRectangle();
+  void CommandCopy();
+  void CommandImageLoad();
+  void CommandImageStore();
+  void CommandEnvironment();
+};
+
+}
+}
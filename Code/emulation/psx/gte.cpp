@@ -1,4 +1,4 @@
-/*****************************************************************************************************************
+﻿/*****************************************************************************************************************
 * Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
 *                                                                                                                *
 * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
@@ -21,9 +21,161 @@
 namespace emulation {
 namespace psx {
 
+/*
+  FLAG register bits, bit 31 is the OR of bits 30..23 and 18..13
+*/
+static const uint32_t kFlagError      = 0x80000000;
+static const uint32_t kFlagErrorMask  = 0x7F87E000;
+static const uint32_t kFlagMac1Pos    = 1<<30;
+static const uint32_t kFlagMac1Neg    = 1<<27;
+static const uint32_t kFlagIR1        = 1<<24;
+static const uint32_t kFlagColorR     = 1<<21;
+static const uint32_t kFlagSZ3        = 1<<18;
+static const uint32_t kFlagDivide     = 1<<17;
+static const uint32_t kFlagMac0Pos    = 1<<16;
+static const uint32_t kFlagMac0Neg    = 1<<15;
+static const uint32_t kFlagSX2        = 1<<14;
+static const uint32_t kFlagSY2        = 1<<13;
+static const uint32_t kFlagIR0        = 1<<12;
+
+static const int64_t kMac44Max = 0x7FFFFFFFFFFLL;
+static const int64_t kMac44Min = -0x80000000000LL;
+
+/*
+  Kinds of the logged flag events, the low bits hold the MAC/IR/color index
+*/
+enum FlagKind {
+  kFlagKindMac = 0x00,
+  kFlagKindIR = 0x04,
+  kFlagKindIRLm = 0x08,
+  kFlagKindColor = 0x0C,
+  kFlagKindMac0 = 0x10,
+  kFlagKindIR0,
+  kFlagKindSZ3,
+  kFlagKindSX2,
+  kFlagKindSY2,
+  kFlagKindDivide,
+};
+
+/*
+  Reciprocal table used by the unr division, max(0,(40000h/(i+100h)+1)/2-101h).
+  Evaluated by the compiler through the template below so the table is plain constant data.
+*/
+template<int i>
+struct UnrEntry {
+  enum { raw = (0x40000/(i+0x100)+1)/2-0x101, value = raw < 0 ? 0 : raw };
+};
+#define UNR1(i) UnrEntry<(i)>::value
+#define UNR4(i) UNR1(i),UNR1(i+1),UNR1(i+2),UNR1(i+3)
+#define UNR16(i) UNR4(i),UNR4(i+4),UNR4(i+8),UNR4(i+12)
+#define UNR64(i) UNR16(i),UNR16(i+16),UNR16(i+32),UNR16(i+48)
+static const uint8_t unr_table[0x101] = {
+  UNR64(0x00),UNR64(0x40),UNR64(0x80),UNR64(0xC0),UNR1(0x100)
+};
+#undef UNR64
+#undef UNR16
+#undef UNR4
+#undef UNR1
+
+static inline int32_t Clamp(int32_t value,int32_t min,int32_t max) {
+  return value < min ? min : (value > max ? max : value);
+}
+
+//maps a per row overflow mask to the MAC1..MAC3 flag bits
+static inline uint32_t MacFlags(int pos,int neg) {
+  uint32_t flag = 0;
+  for (int i=0;i<3;++i) {
+    if (pos & (1<<i)) flag |= kFlagMac1Pos >> i;
+    if (neg & (1<<i)) flag |= kFlagMac1Neg >> i;
+  }
+  return flag;
+}
+
+/*
+  SIMD kernels for the matrix * vector (+ translation) products.
+  Each step of the sum is wrapped to 44 bits exactly like the hardware accumulator,
+  an overflowing lane is detected by comparing the wrapped value with the original one.
+*/
+static inline __m128i Wrap44(__m128i value,int& pos,int& neg) {
+  const __m128i bias = _mm_setr_epi32(0,0x800,0,0x800);
+  const __m128i mask = _mm_setr_epi32(-1,0xFFF,-1,0xFFF);
+  __m128i wrapped = _mm_sub_epi64(_mm_and_si128(_mm_add_epi64(value,bias),mask),bias);
+  int overflow = ~_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(wrapped,value))) & 3;
+  int sign = _mm_movemask_pd(_mm_castsi128_pd(value));
+  pos |= overflow & ~sign;
+  neg |= overflow & sign;
+  return wrapped;
+}
+
+static inline __m256i Wrap44(__m256i value,int& pos,int& neg) {
+  const __m256i bias = _mm256_setr_epi32(0,0x800,0,0x800,0,0x800,0,0x800);
+  const __m256i mask = _mm256_setr_epi32(-1,0xFFF,-1,0xFFF,-1,0xFFF,-1,0xFFF);
+  __m256i wrapped = _mm256_sub_epi64(_mm256_and_si256(_mm256_add_epi64(value,bias),mask),bias);
+  int overflow = ~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(wrapped,value))) & 7;
+  int sign = _mm256_movemask_pd(_mm256_castsi256_pd(value));
+  pos |= overflow & ~sign;
+  neg |= overflow & sign;
+  return wrapped;
+}
+
+//one vector, lanes hold the matrix rows {row1,row2} and {row3,-}
+static uint32_t TransformSSE41(const int16_t* m,const int32_t* t,int16_t x,int16_t y,int16_t z,int64_t result[3]) {
+  const __m128i vx = _mm_set1_epi32(x);
+  const __m128i vy = _mm_set1_epi32(y);
+  const __m128i vz = _mm_set1_epi32(z);
+  __m128i acc01 = _mm_setzero_si128();
+  __m128i acc2 = _mm_setzero_si128();
+  int pos01 = 0, neg01 = 0, pos2 = 0, neg2 = 0;
+  if (t != nullptr) {
+    acc01 = _mm_slli_epi64(_mm_cvtepi32_epi64(_mm_setr_epi32(t[0],t[1],0,0)),12);
+    acc2 = _mm_slli_epi64(_mm_cvtepi32_epi64(_mm_setr_epi32(t[2],0,0,0)),12);
+  }
+  acc01 = Wrap44(_mm_add_epi64(acc01,_mm_mul_epi32(_mm_setr_epi32(m[0],0,m[3],0),vx)),pos01,neg01);
+  acc2 = Wrap44(_mm_add_epi64(acc2,_mm_mul_epi32(_mm_setr_epi32(m[6],0,0,0),vx)),pos2,neg2);
+  acc01 = Wrap44(_mm_add_epi64(acc01,_mm_mul_epi32(_mm_setr_epi32(m[1],0,m[4],0),vy)),pos01,neg01);
+  acc2 = Wrap44(_mm_add_epi64(acc2,_mm_mul_epi32(_mm_setr_epi32(m[7],0,0,0),vy)),pos2,neg2);
+  acc01 = Wrap44(_mm_add_epi64(acc01,_mm_mul_epi32(_mm_setr_epi32(m[2],0,m[5],0),vz)),pos01,neg01);
+  acc2 = Wrap44(_mm_add_epi64(acc2,_mm_mul_epi32(_mm_setr_epi32(m[8],0,0,0),vz)),pos2,neg2);
+  _mm_storeu_si128((__m128i*)&result[0],acc01);
+  int64_t last[2];
+  _mm_storeu_si128((__m128i*)last,acc2);
+  result[2] = last[0];
+  return MacFlags(pos01 | ((pos2&1)<<2),neg01 | ((neg2&1)<<2));
+}
+
+//three vectors, lanes hold the vectors and each matrix row is a separate pass
+static uint32_t TransformAVX2(const int16_t* m,const int32_t* t,const int16_t v[3][3],int64_t result[3][3]) {
+  const __m256i vx = _mm256_setr_epi32(v[0][0],0,v[1][0],0,v[2][0],0,0,0);
+  const __m256i vy = _mm256_setr_epi32(v[0][1],0,v[1][1],0,v[2][1],0,0,0);
+  const __m256i vz = _mm256_setr_epi32(v[0][2],0,v[1][2],0,v[2][2],0,0,0);
+  int64_t out[4];
+  int pos = 0, neg = 0;
+  for (int i=0;i<3;++i,m+=3) {
+    int row_pos = 0, row_neg = 0;
+    __m256i acc = _mm256_setzero_si256();
+    if (t != nullptr)
+      acc = _mm256_slli_epi64(_mm256_cvtepi32_epi64(_mm_set1_epi32(t[i])),12);
+    acc = Wrap44(_mm256_add_epi64(acc,_mm256_mul_epi32(_mm256_set1_epi32(m[0]),vx)),row_pos,row_neg);
+    acc = Wrap44(_mm256_add_epi64(acc,_mm256_mul_epi32(_mm256_set1_epi32(m[1]),vy)),row_pos,row_neg);
+    acc = Wrap44(_mm256_add_epi64(acc,_mm256_mul_epi32(_mm256_set1_epi32(m[2]),vz)),row_pos,row_neg);
+    _mm256_storeu_si256((__m256i*)out,acc);
+    result[0][i] = out[0];
+    result[1][i] = out[1];
+    result[2][i] = out[2];
+    if (row_pos) pos |= 1<<i;
+    if (row_neg) neg |= 1<<i;
+  }
+  _mm256_zeroupper();
+  return MacFlags(pos,neg);
+}
+
 
 int GTE::Initialize() {
   memset(&context_,0,sizeof(context_));
+  flag_bits_ = 0;
+  flag_log_count_ = 0;
+  simd_support_ = DetectSimdLevel();
+  simd_level_ = simd_support_;
   return S_OK;
 }
 
@@ -31,22 +183,580 @@ int GTE::Deinitialize() {
   return S_OK;
 }
 
+void GTE::set_simd_level(SimdLevel level) {
+  simd_level_ = level < simd_support_ ? level : simd_support_;
+}
+
 void GTE::ExecuteCommand(uint32_t code) {
   uint8_t command = code & 0x3F;
   sf = (uint8_t)BIT(code,19);
+  shift_ = sf * 12;
+  lm_ = BIT(code,10) != 0;
+  flag_bits_ = 0;
+  flag_log_count_ = 0;
 
   switch (command) {
-    case 0x01:
-      RTPS();
-    break;
+    case 0x01: RTPS(); break;
+    case 0x06: NCLIP(); break;
+    case 0x0C: OP(); break;
+    case 0x10: DPCS(); break;
+    case 0x11: INTPL(); break;
+    case 0x12: MVMVA(code); break;
+    case 0x13: NCDS(); break;
+    case 0x14: CDP(); break;
+    case 0x16: NCDT(); break;
+    case 0x1B: NCCS(); break;
+    case 0x1C: CC(); break;
+    case 0x1E: NCS(); break;
+    case 0x20: NCT(); break;
+    case 0x28: SQR(); break;
+    case 0x29: DCPL(); break;
+    case 0x2A: DPCT(); break;
+    case 0x2D: AVSZ3(); break;
+    case 0x2E: AVSZ4(); break;
+    case 0x30: RTPT(); break;
+    case 0x3D: GPF(); break;
+    case 0x3E: GPL(); break;
+    case 0x3F: NCCT(); break;
+    default:
+      BREAKPOINT
+      break;
+  }
+}
+
+/*
+  FLAG is only materialised when CFC2 reads it, every saturating step of the last
+  command is recorded with its unsaturated value and checked here
+*/
+void GTE::ResolveFlag() {
+  uint32_t flag = flag_bits_;
+  for (int i=0;i<flag_log_count_;++i) {
+    const FlagEvent& e = flag_log_[i];
+    int index = e.kind & 3;
+    switch (e.kind & ~3) {
+      case kFlagKindMac:
+        if (e.value > kMac44Max) flag |= kFlagMac1Pos >> index;
+        else if (e.value < kMac44Min) flag |= kFlagMac1Neg >> index;
+        break;
+      case kFlagKindIR:
+        if (e.value < -0x8000 || e.value > 0x7FFF) flag |= kFlagIR1 >> index;
+        break;
+      case kFlagKindIRLm:
+        if (e.value < 0 || e.value > 0x7FFF) flag |= kFlagIR1 >> index;
+        break;
+      case kFlagKindColor:
+        if (e.value < 0 || e.value > 0xFF) flag |= kFlagColorR >> index;
+        break;
+      default:
+        switch (e.kind) {
+          case kFlagKindMac0:
+            if (e.value > 0x7FFFFFFFLL) flag |= kFlagMac0Pos;
+            else if (e.value < -0x80000000LL) flag |= kFlagMac0Neg;
+            break;
+          case kFlagKindIR0:
+            if (e.value < 0 || e.value > 0x1000) flag |= kFlagIR0;
+            break;
+          case kFlagKindSZ3:
+            if (e.value < 0 || e.value > 0xFFFF) flag |= kFlagSZ3;
+            break;
+          case kFlagKindSX2:
+            if (e.value < -0x400 || e.value > 0x3FF) flag |= kFlagSX2;
+            break;
+          case kFlagKindSY2:
+            if (e.value < -0x400 || e.value > 0x3FF) flag |= kFlagSY2;
+            break;
+          case kFlagKindDivide:
+            flag |= kFlagDivide;
+            break;
+        }
+    }
+  }
+  if (flag & kFlagErrorMask)
+    flag |= kFlagError;
+  context_.FLAG = flag;
+  flag_bits_ = flag;
+  flag_log_count_ = 0;
+}
+
+/*
+  MFC2/LWC2, a few registers are not plain storage
+*/
+uint32_t GTE::ReadData(int index) {
+  switch (index) {
+    case 1: case 3: case 5:
+    case 8: case 9: case 10: case 11:
+      return (uint32_t)(int32_t)(int16_t)context_.reg[index];
+    case 7: case 16: case 17: case 18: case 19:
+      return context_.reg[index] & 0xFFFF;
+    case 15:
+      return context_.reg[14];
+    case 28: case 29: {
+      uint32_t r = Clamp(ir(1)>>7,0,0x1F);
+      uint32_t g = Clamp(ir(2)>>7,0,0x1F);
+      uint32_t b = Clamp(ir(3)>>7,0,0x1F);
+      return r | (g<<5) | (b<<10);
+    }
+    default:
+      return context_.reg[index];
+  }
+}
+
+/*
+  MTC2/SWC2
+*/
+void GTE::WriteData(int index,uint32_t data) {
+  switch (index) {
+    case 15:
+      context_.reg[12] = context_.reg[13];
+      context_.reg[13] = context_.reg[14];
+      context_.reg[14] = data;
+      context_.reg[15] = data;
+      break;
+    case 28:
+      context_.IRGB = data & 0x7FFF;
+      ir(1) = (int16_t)((data & 0x1F) << 7);
+      ir(2) = (int16_t)(((data >> 5) & 0x1F) << 7);
+      ir(3) = (int16_t)(((data >> 10) & 0x1F) << 7);
+      break;
+    case 29: case 31:
+      break;
+    case 30: {
+      context_.LZCS = data;
+      uint32_t value = (data & 0x80000000) ? ~data : data;
+      unsigned long bit;
+      context_.LZCR = _BitScanReverse(&bit,value) ? 31 - bit : 32;
+      break;
+    }
+    default:
+      context_.reg[index] = data;
+  }
+}
+
+/*
+  CFC2, H is unsigned but the hardware sign expands it on read
+*/
+uint32_t GTE::ReadControl(int index) {
+  switch (index) {
+    case 31:
+      ResolveFlag();
+      return context_.FLAG;
+    case 4: case 12: case 20:
+    case 26: case 27: case 29: case 30:
+      return (uint32_t)(int32_t)(int16_t)context_.reg[32+index];
+    default:
+      return context_.reg[32+index];
+  }
+}
+
+/*
+  CTC2
+*/
+void GTE::WriteControl(int index,uint32_t data) {
+  if (index == 31) {
+    flag_bits_ = data & 0x7FFFF000;
+    flag_log_count_ = 0;
+    ResolveFlag();
+    return;
+  }
+  context_.reg[32+index] = data;
+}
+
+int64_t GTE::WrapMAC(int index,int64_t value) {
+  LogFlag(kFlagKindMac + index - 1,value);
+  return (int64_t)((uint64_t)value << 20) >> 20;
+}
+
+void GTE::CheckMAC0(int64_t value) {
+  LogFlag(kFlagKindMac0,value);
+}
+
+void GTE::SetMAC(int index,int64_t value,int shift) {
+  LogFlag(kFlagKindMac + index - 1,value);
+  mac(index) = (int32_t)(value >> shift);
+}
+
+void GTE::SetIR(int index,int32_t value,bool lm) {
+  LogFlag((lm ? kFlagKindIRLm : kFlagKindIR) + index - 1,value);
+  ir(index) = (int16_t)Clamp(value,lm ? 0 : -0x8000,0x7FFF);
+}
+
+void GTE::SetMACAndIR(int index,int64_t value,int shift,bool lm) {
+  SetMAC(index,value,shift);
+  SetIR(index,mac(index),lm);
+}
+
+void GTE::SetIR0(int32_t value) {
+  LogFlag(kFlagKindIR0,value);
+  context_.IR0 = (int16_t)Clamp(value,0,0x1000);
+}
+
+void GTE::PushSZ(int32_t value) {
+  LogFlag(kFlagKindSZ3,value);
+  context_.SZ0 = context_.SZ1;
+  context_.SZ1 = context_.SZ2;
+  context_.SZ2 = context_.SZ3;
+  context_.SZ3 = (uint16_t)Clamp(value,0,0xFFFF);
+}
+
+void GTE::PushSXY(int32_t x,int32_t y) {
+  LogFlag(kFlagKindSX2,x);
+  LogFlag(kFlagKindSY2,y);
+  context_.reg[12] = context_.reg[13];
+  context_.reg[13] = context_.reg[14];
+  context_.SX2 = (int16_t)Clamp(x,-0x400,0x3FF);
+  context_.SY2 = (int16_t)Clamp(y,-0x400,0x3FF);
+}
+
+void GTE::PushRGBFromMAC() {
+  int32_t r = context_.MAC1 >> 4;
+  int32_t g = context_.MAC2 >> 4;
+  int32_t b = context_.MAC3 >> 4;
+  LogFlag(kFlagKindColor + 0,r);
+  LogFlag(kFlagKindColor + 1,g);
+  LogFlag(kFlagKindColor + 2,b);
+  context_.RGB0 = context_.RGB1;
+  context_.RGB1 = context_.RGB2;
+  context_.RGB2.R = (uint8_t)Clamp(r,0,0xFF);
+  context_.RGB2.G = (uint8_t)Clamp(g,0,0xFF);
+  context_.RGB2.B = (uint8_t)Clamp(b,0,0xFF);
+  context_.RGB2.C = context_.RGBC.C;
+}
+
+/*
+  Unsigned Newton-Raphson division (H*20000h/SZ3+1)/2, bit exact with the hardware
+*/
+uint32_t GTE::Divide(uint32_t h,uint32_t sz3) {
+  if (sz3*2 <= h) {
+    LogFlag(kFlagKindDivide,1);
+    return 0x1FFFF;
+  }
+  unsigned long bit;
+  _BitScanReverse(&bit,sz3);
+  uint32_t shift = 15 - bit;
+  h <<= shift;
+  sz3 <<= shift;
+  int32_t d = (int32_t)(sz3 | 0x8000);
+  int32_t u = 0x101 + unr_table[((d & 0x7FFF) + 0x40) >> 7];
+  d = ((d * -u) + 0x80) >> 8;
+  uint32_t recip = (uint32_t)(((u * (0x20000 + d)) + 0x80) >> 8);
+  uint32_t result = (uint32_t)(((uint64_t)h * recip + 0x8000) >> 16);
+  return result < 0x1FFFF ? result : 0x1FFFF;
+}
+
+/*
+  result = t*1000h + m*v with the 44bit accumulator wrap and MAC1..MAC3 overflow flags
+  t may be null
+*/
+void GTE::Transform(const int16_t* m,const int32_t* t,int16_t x,int16_t y,int16_t z,int64_t result[3]) {
+  if (simd_level_ >= kSimdSSE41) {
+    flag_bits_ |= TransformSSE41(m,t,x,y,z,result);
+    return;
+  }
+  for (int i=0;i<3;++i,m+=3) {
+    int64_t value = t != nullptr ? (int64_t)t[i] * 0x1000 : 0;
+    value = WrapMAC(i+1,value + m[0]*x);
+    value = WrapMAC(i+1,value + m[1]*y);
+    result[i] = WrapMAC(i+1,value + m[2]*z);
+  }
+}
+
+void GTE::Transform3(const int16_t* m,const int32_t* t,const int16_t v[3][3],int64_t result[3][3]) {
+  if (simd_level_ >= kSimdAVX2) {
+    flag_bits_ |= TransformAVX2(m,t,v,result);
+    return;
+  }
+  for (int i=0;i<3;++i)
+    Transform(m,t,v[i][0],v[i][1],v[i][2],result[i]);
+}
+
+void GTE::ApplyMACAndIR(const int64_t result[3],int shift,bool lm) {
+  for (int i=0;i<3;++i) {
+    mac(i+1) = (int32_t)(result[i] >> shift);
+    SetIR(i+1,mac(i+1),lm);
   }
 }
 
+void GTE::MulMatVec(const int16_t* m,const int32_t* t,int16_t x,int16_t y,int16_t z,int shift,bool lm) {
+  int64_t result[3];
+  Transform(m,t,x,y,z,result);
+  ApplyMACAndIR(result,shift,lm);
+}
+
+/*
+  Perspective transformation of one transformed vertex, pushes the SZ and SXY fifos
+*/
+void GTE::Project(const int64_t result[3],int shift,bool lm,bool last) {
+  mac(1) = (int32_t)(result[0] >> shift);
+  mac(2) = (int32_t)(result[1] >> shift);
+  mac(3) = (int32_t)(result[2] >> shift);
+  SetIR(1,mac(1),lm);
+  SetIR(2,mac(2),lm);
+  //IR3 saturation flag is set from MAC3 SAR 12 regardless of sf
+  int32_t z = (int32_t)(result[2] >> 12);
+  SetIR(3,z,false);
+  ir(3) = (int16_t)Clamp(mac(3),lm ? 0 : -0x8000,0x7FFF);
+  PushSZ(z);
+
+  int64_t div = Divide(context_.H,context_.SZ3);
+  int64_t sx = div * ir(1) + context_.OFX;
+  int64_t sy = div * ir(2) + context_.OFY;
+  CheckMAC0(sx);
+  CheckMAC0(sy);
+  PushSXY((int32_t)(sx >> 16),(int32_t)(sy >> 16));
+  if (last) {
+    int64_t sz = div * context_.DQA + context_.DQB;
+    CheckMAC0(sz);
+    context_.MAC0 = (int32_t)sz;
+    SetIR0((int32_t)(sz >> 12));
+  }
+}
+
+/*
+  [MAC1,MAC2,MAC3] = MAC+(FC-MAC)*IR0
+*/
+void GTE::InterpolateColor(int64_t mac1,int64_t mac2,int64_t mac3,int shift,bool lm) {
+  SetMACAndIR(1,(int64_t)context_.FK.R * 0x1000 - mac1,shift,false);
+  SetMACAndIR(2,(int64_t)context_.FK.G * 0x1000 - mac2,shift,false);
+  SetMACAndIR(3,(int64_t)context_.FK.B * 0x1000 - mac3,shift,false);
+  SetMACAndIR(1,(int64_t)(ir(1) * ir(0)) + mac1,shift,lm);
+  SetMACAndIR(2,(int64_t)(ir(2) * ir(0)) + mac2,shift,lm);
+  SetMACAndIR(3,(int64_t)(ir(3) * ir(0)) + mac3,shift,lm);
+}
+
+/*
+  Color tails of the lighting commands, they run after IR holds the light color
+*/
+void GTE::PushColor(int shift,bool lm) {
+  PushRGBFromMAC();
+}
+
+//[MAC1,MAC2,MAC3] = [R*IR1,G*IR2,B*IR3] SHL 4, used by NCCx and CC
+void GTE::MultiplyColor(int shift,bool lm) {
+  SetMAC(1,(int64_t)context_.RGBC.R * ir(1) * 16,0);
+  SetMAC(2,(int64_t)context_.RGBC.G * ir(2) * 16,0);
+  SetMAC(3,(int64_t)context_.RGBC.B * ir(3) * 16,0);
+  SetMACAndIR(1,mac(1),shift,lm);
+  SetMACAndIR(2,mac(2),shift,lm);
+  SetMACAndIR(3,mac(3),shift,lm);
+  PushRGBFromMAC();
+}
+
+//[R*IR1,G*IR2,B*IR3] SHL 4 interpolated towards the far color, used by NCDx, CDP and DCPL
+void GTE::DepthCueColor(int shift,bool lm) {
+  InterpolateColor(context_.RGBC.R * ir(1) * 16,context_.RGBC.G * ir(2) * 16,context_.RGBC.B * ir(3) * 16,shift,lm);
+  PushRGBFromMAC();
+}
+
+/*
+  Normal to color, LLM*V then BK + LCM*IR followed by the command specific tail.
+  The three vertex variants transform all vertices at once, the light and color
+  matrices are constant over the command so only the fifo pushes are ordered.
+*/
+void GTE::NormalColor(int count,ColorTail tail) {
+  const int16_t v[3][3] = {
+    { context_.V0.X, context_.V0.Y, context_.V0.Z },
+    { context_.V1.X, context_.V1.Y, context_.V1.Z },
+    { context_.V2.X, context_.V2.Y, context_.V2.Z },
+  };
+  int16_t light[3][3];
+  int64_t result[3][3];
+
+  if (count == 3)
+    Transform3(&context_.LLM._11,nullptr,v,result);
+  else
+    Transform(&context_.LLM._11,nullptr,v[0][0],v[0][1],v[0][2],result[0]);
+  for (int i=0;i<count;++i) {
+    ApplyMACAndIR(result[i],shift_,lm_);
+    light[i][0] = ir(1);
+    light[i][1] = ir(2);
+    light[i][2] = ir(3);
+  }
+
+  if (count == 3)
+    Transform3(&context_.LCM._11,&context_.BK.R,light,result);
+  else
+    Transform(&context_.LCM._11,&context_.BK.R,light[0][0],light[0][1],light[0][2],result[0]);
+  for (int i=0;i<count;++i) {
+    ApplyMACAndIR(result[i],shift_,lm_);
+    (this->*tail)(shift_,lm_);
+  }
+}
 
 void GTE::RTPS() {
-  context_.IR1 = context_.MAC1 = (context_.TR.X*0x1000 + context_.RT._11*context_.V0.X + context_.RT._12*context_.V0.Y + context_.RT._13*context_.V0.Z);// SAR (sf*12)
-//  context_.IR2 = context_.MAC2 = (context_.TR.Y*0x1000 + RT21*VX0 + RT22*VY0 + RT23*VZ0) SAR (sf*12)
-//  context_.IR3 = context_.MAC3 = (context_.TR.Z*0x1000 + RT31*VX0 + RT32*VY0 + RT33*VZ0) SAR (sf*12)
+  int64_t result[3];
+  Transform(&context_.RT._11,&context_.TR.X,context_.V0.X,context_.V0.Y,context_.V0.Z,result);
+  Project(result,shift_,lm_,true);
+}
+
+void GTE::RTPT() {
+  const int16_t v[3][3] = {
+    { context_.V0.X, context_.V0.Y, context_.V0.Z },
+    { context_.V1.X, context_.V1.Y, context_.V1.Z },
+    { context_.V2.X, context_.V2.Y, context_.V2.Z },
+  };
+  int64_t result[3][3];
+  Transform3(&context_.RT._11,&context_.TR.X,v,result);
+  Project(result[0],shift_,lm_,false);
+  Project(result[1],shift_,lm_,false);
+  Project(result[2],shift_,lm_,true);
+}
+
+void GTE::NCLIP() {
+  int64_t value = (int64_t)(context_.SX0 * context_.SY1) + context_.SX1 * context_.SY2 + context_.SX2 * context_.SY0
+                - context_.SX0 * context_.SY2 - context_.SX1 * context_.SY0 - context_.SX2 * context_.SY1;
+  CheckMAC0(value);
+  context_.MAC0 = (int32_t)value;
+}
+
+//outer product of IR with the RT diagonal
+void GTE::OP() {
+  int32_t d1 = context_.RT._11, d2 = context_.RT._22, d3 = context_.RT._33;
+  int32_t ir1 = ir(1), ir2 = ir(2), ir3 = ir(3);
+  SetMAC(1,(int64_t)ir3 * d2 - (int64_t)ir2 * d3,shift_);
+  SetMAC(2,(int64_t)ir1 * d3 - (int64_t)ir3 * d1,shift_);
+  SetMAC(3,(int64_t)ir2 * d1 - (int64_t)ir1 * d2,shift_);
+  SetIR(1,mac(1),lm_);
+  SetIR(2,mac(2),lm_);
+  SetIR(3,mac(3),lm_);
+}
+
+void GTE::DPCS() {
+  InterpolateColor(context_.RGBC.R << 16,context_.RGBC.G << 16,context_.RGBC.B << 16,shift_,lm_);
+  PushRGBFromMAC();
+}
+
+void GTE::DPCT() {
+  for (int i=0;i<3;++i) {
+    InterpolateColor(context_.RGB0.R << 16,context_.RGB0.G << 16,context_.RGB0.B << 16,shift_,lm_);
+    PushRGBFromMAC();
+  }
+}
+
+void GTE::INTPL() {
+  InterpolateColor(ir(1) * 0x1000,ir(2) * 0x1000,ir(3) * 0x1000,shift_,lm_);
+  PushRGBFromMAC();
+}
+
+void GTE::MVMVA(uint32_t code) {
+  int mx = (code >> 17) & 3;
+  int vx = (code >> 15) & 3;
+  int cv = (code >> 13) & 3;
+  int16_t garbage[9];
+  const int16_t* m;
+  switch (mx) {
+    case 0: m = &context_.RT._11; break;
+    case 1: m = &context_.LLM._11; break;
+    case 2: m = &context_.LCM._11; break;
+    default:
+      //reserved matrix reads garbage
+      garbage[0] = -(int16_t)(context_.RGBC.R << 4);
+      garbage[1] = (int16_t)(context_.RGBC.R << 4);
+      garbage[2] = context_.IR0;
+      garbage[3] = garbage[4] = garbage[5] = context_.RT._13;
+      garbage[6] = garbage[7] = garbage[8] = context_.RT._22;
+      m = garbage;
+      break;
+  }
+
+  int16_t x, y, z;
+  switch (vx) {
+    case 0: x = context_.V0.X; y = context_.V0.Y; z = context_.V0.Z; break;
+    case 1: x = context_.V1.X; y = context_.V1.Y; z = context_.V1.Z; break;
+    case 2: x = context_.V2.X; y = context_.V2.Y; z = context_.V2.Z; break;
+    default: x = ir(1); y = ir(2); z = ir(3); break;
+  }
+
+  switch (cv) {
+    case 0: MulMatVec(m,&context_.TR.X,x,y,z,shift_,lm_); break;
+    case 1: MulMatVec(m,&context_.BK.R,x,y,z,shift_,lm_); break;
+    case 2: {
+      //far color translation is broken, the first column only affects the flags
+      const int32_t* t = &context_.FK.R;
+      for (int i=0;i<3;++i,m+=3) {
+        int64_t value = WrapMAC(i+1,(int64_t)t[i] * 0x1000 + m[0]*x);
+        SetIR(i+1,(int32_t)(value >> shift_),false);
+        SetMACAndIR(i+1,WrapMAC(i+1,WrapMAC(i+1,(int64_t)m[1]*y) + (int64_t)m[2]*z),shift_,lm_);
+      }
+      break;
+    }
+    default: MulMatVec(m,nullptr,x,y,z,shift_,lm_); break;
+  }
+}
+
+void GTE::NCDS() {
+  NormalColor(1,&GTE::DepthCueColor);
+}
+
+void GTE::NCDT() {
+  NormalColor(3,&GTE::DepthCueColor);
+}
+
+void GTE::NCCS() {
+  NormalColor(1,&GTE::MultiplyColor);
+}
+
+void GTE::NCCT() {
+  NormalColor(3,&GTE::MultiplyColor);
+}
+
+void GTE::NCS() {
+  NormalColor(1,&GTE::PushColor);
+}
+
+void GTE::NCT() {
+  NormalColor(3,&GTE::PushColor);
+}
+
+void GTE::CC() {
+  MulMatVec(&context_.LCM._11,&context_.BK.R,ir(1),ir(2),ir(3),shift_,lm_);
+  MultiplyColor(shift_,lm_);
+}
+
+void GTE::CDP() {
+  MulMatVec(&context_.LCM._11,&context_.BK.R,ir(1),ir(2),ir(3),shift_,lm_);
+  DepthCueColor(shift_,lm_);
+}
+
+void GTE::DCPL() {
+  DepthCueColor(shift_,lm_);
+}
+
+void GTE::SQR() {
+  SetMACAndIR(1,ir(1) * ir(1),shift_,lm_);
+  SetMACAndIR(2,ir(2) * ir(2),shift_,lm_);
+  SetMACAndIR(3,ir(3) * ir(3),shift_,lm_);
+}
+
+void GTE::AVSZ3() {
+  int64_t value = (int64_t)context_.ZSF3 * (context_.SZ1 + context_.SZ2 + context_.SZ3);
+  CheckMAC0(value);
+  context_.MAC0 = (int32_t)value;
+  int32_t otz = (int32_t)(value >> 12);
+  LogFlag(kFlagKindSZ3,otz);
+  context_.OTZ = (uint16_t)Clamp(otz,0,0xFFFF);
+}
+
+void GTE::AVSZ4() {
+  int64_t value = (int64_t)context_.ZSF4 * (context_.SZ0 + context_.SZ1 + context_.SZ2 + context_.SZ3);
+  CheckMAC0(value);
+  context_.MAC0 = (int32_t)value;
+  int32_t otz = (int32_t)(value >> 12);
+  LogFlag(kFlagKindSZ3,otz);
+  context_.OTZ = (uint16_t)Clamp(otz,0,0xFFFF);
+}
+
+void GTE::GPF() {
+  SetMACAndIR(1,ir(1) * ir(0),shift_,lm_);
+  SetMACAndIR(2,ir(2) * ir(0),shift_,lm_);
+  SetMACAndIR(3,ir(3) * ir(0),shift_,lm_);
+  PushRGBFromMAC();
+}
+
+void GTE::GPL() {
+  SetMACAndIR(1,(int64_t)(ir(1) * ir(0)) + ((int64_t)mac(1) << shift_),shift_,lm_);
+  SetMACAndIR(2,(int64_t)(ir(2) * ir(0)) + ((int64_t)mac(2) << shift_),shift_,lm_);
+  SetMACAndIR(3,(int64_t)(ir(3) * ir(0)) + ((int64_t)mac(3) << shift_),shift_,lm_);
+  PushRGBFromMAC();
 }
 
 }
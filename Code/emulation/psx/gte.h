@@ -58,10 +58,10 @@ struct GTEContext {
 
       int16_t SX0,SY0,SX1,SY1,SX2,SY2,SXP,SYP;
 
-      int16_t SZ0, _unused6;
-      int16_t SZ1, _unused7;
-      int16_t SZ2, _unused8;
-      int16_t SZ3, _unused9;
+      uint16_t SZ0, _unused6;
+      uint16_t SZ1, _unused7;
+      uint16_t SZ2, _unused8;
+      uint16_t SZ3, _unused9;
 
       struct {
         uint8_t R,G,B,C;
@@ -91,7 +91,7 @@ struct GTEContext {
         int32_t R,G,B;
       } FK;
 
-      uint32_t OFX,OFY;
+      int32_t OFX,OFY;
       uint16_t H,_unused10;
       int16_t DQA,_unused11;
       int32_t DQB;
@@ -108,10 +108,82 @@ class GTE : public Component {
   int Initialize();
   int Deinitialize();
   void ExecuteCommand(uint32_t code);
+  uint32_t ReadData(int index);
+  void WriteData(int index,uint32_t data);
+  uint32_t ReadControl(int index);
+  void WriteControl(int index,uint32_t data);
+  SimdLevel simd_level() const { return simd_level_; }
+  void set_simd_level(SimdLevel level);
  private:
+  typedef void (GTE::*ColorTail)(int shift,bool lm);
+  //pre-saturation value of one checked operation, replayed into FLAG on demand
+  struct FlagEvent {
+    int64_t value;
+    uint32_t kind;
+  };
+  static const int kFlagLogSize = 192;
   GTEContext context_;
   uint8_t sf;
+  uint8_t shift_;
+  bool lm_;
+  SimdLevel simd_level_;
+  SimdLevel simd_support_;
+  uint32_t flag_bits_;
+  int flag_log_count_;
+  FlagEvent flag_log_[kFlagLogSize];
+
+  void LogFlag(uint32_t kind,int64_t value) {
+    flag_log_[flag_log_count_].kind = kind;
+    flag_log_[flag_log_count_].value = value;
+    ++flag_log_count_;
+  }
+  void ResolveFlag();
+
+  int32_t& mac(int index) { return (&context_.MAC0)[index]; }
+  int16_t& ir(int index) { return (&context_.IR0)[index<<1]; }
+  int64_t WrapMAC(int index,int64_t value);
+  void CheckMAC0(int64_t value);
+  void SetMAC(int index,int64_t value,int shift);
+  void SetIR(int index,int32_t value,bool lm);
+  void SetMACAndIR(int index,int64_t value,int shift,bool lm);
+  void SetIR0(int32_t value);
+  void PushSZ(int32_t value);
+  void PushSXY(int32_t x,int32_t y);
+  void PushRGBFromMAC();
+  uint32_t Divide(uint32_t h,uint32_t sz3);
+  void Transform(const int16_t* m,const int32_t* t,int16_t x,int16_t y,int16_t z,int64_t result[3]);
+  void Transform3(const int16_t* m,const int32_t* t,const int16_t v[3][3],int64_t result[3][3]);
+  void ApplyMACAndIR(const int64_t result[3],int shift,bool lm);
+  void MulMatVec(const int16_t* m,const int32_t* t,int16_t x,int16_t y,int16_t z,int shift,bool lm);
+  void Project(const int64_t result[3],int shift,bool lm,bool last);
+  void InterpolateColor(int64_t mac1,int64_t mac2,int64_t mac3,int shift,bool lm);
+  void PushColor(int shift,bool lm);
+  void MultiplyColor(int shift,bool lm);
+  void DepthCueColor(int shift,bool lm);
+  void NormalColor(int count,ColorTail tail);
+
   void RTPS();
+  void RTPT();
+  void NCLIP();
+  void OP();
+  void DPCS();
+  void INTPL();
+  void MVMVA(uint32_t code);
+  void NCDS();
+  void CDP();
+  void NCDT();
+  void NCCS();
+  void CC();
+  void NCS();
+  void NCT();
+  void SQR();
+  void DCPL();
+  void DPCT();
+  void AVSZ3();
+  void AVSZ4();
+  void GPF();
+  void GPL();
+  void NCCT();
 };
 
 }
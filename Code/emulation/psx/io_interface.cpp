@@ -25,6 +25,49 @@ namespace psx {
 
 double video_clk;
 
+static uint32_t UnmappedRead(void* param,uint32_t address) {
+  BREAKPOINT
+  return 0;
+}
+
+static void UnmappedWrite(void* param,uint32_t address,uint32_t data) {
+  BREAKPOINT
+}
+
+static uint32_t ReadInterruptStat(void* param,uint32_t address) {
+  return ((IOInterface*)param)->io.interrupt_stat;
+}
+
+static uint32_t ReadInterruptMask(void* param,uint32_t address) {
+  return ((IOInterface*)param)->io.interrupt_mask;
+}
+
+static void WriteInterruptStat16(void* param,uint32_t address,uint32_t data) {
+  auto& io = ((IOInterface*)param)->io;
+  io.interrupt_stat = (io.interrupt_stat&0xFFFF0000)|(data & io.interrupt_mask & 0xFFFF);
+}
+
+static void WriteInterruptMask16(void* param,uint32_t address,uint32_t data) {
+  auto& io = ((IOInterface*)param)->io;
+  io.interrupt_mask = (io.interrupt_mask&0xFFFF0000)|(data & 0xFFFF);
+}
+
+static void WriteInterruptStat32(void* param,uint32_t address,uint32_t data) {
+  auto& io = ((IOInterface*)param)->io;
+  io.interrupt_stat = data & io.interrupt_mask;
+}
+
+static void WriteInterruptMask32(void* param,uint32_t address,uint32_t data) {
+  ((IOInterface*)param)->io.interrupt_mask = data;
+}
+
+static uint32_t ReadCounterValue(void* param,uint32_t address) { return ((RootCounter*)param)->ReadCounter(); }
+static uint32_t ReadCounterMode(void* param,uint32_t address) { return ((RootCounter*)param)->ReadMode(); }
+static uint32_t ReadCounterTarget(void* param,uint32_t address) { return ((RootCounter*)param)->ReadTarget(); }
+static void WriteCounterValue(void* param,uint32_t address,uint32_t data) { ((RootCounter*)param)->WriteCounter(data); }
+static void WriteCounterMode(void* param,uint32_t address,uint32_t data) { ((RootCounter*)param)->WriteMode(data); }
+static void WriteCounterTarget(void* param,uint32_t address,uint32_t data) { ((RootCounter*)param)->WriteTarget(data); }
+
 int IOInterface::Initialize() { 
   cpu_ = &system().cpu();
   bios_buffer.Alloc(0x80000);
@@ -53,6 +96,8 @@ int IOInterface::Initialize() {
   io.interrupt_mask = 0;
   io.cache_control = 0;
 
+  MapPorts();
+
   dma.set_system(system_);
   dma.Initialize();
 
@@ -95,6 +140,7 @@ void IOInterface::Tick(uint32_t cycles) {
   if (video_clk >= 887040.0) {
      //SetInterrupt(kInterruptVSYNC);
     system_->gpu_core()->Render();
+    system_->spu().Run(system_->cpu().context()->cycles);
     video_clk = 0;
   }
   
@@ -109,6 +155,10 @@ void IOInterface::Tick(uint32_t cycles) {
     SetInterrupt(kInterruptVSYNC);
     int a =1;
   }
+  if (system_->cpu().context()->cycles >= system_->spu().next_event())
+    system_->spu().Run(system_->cpu().context()->cycles);
+  if (system_->cpu().context()->cycles >= system_->cdrom().next_event())
+    system_->cdrom().Run(system_->cpu().context()->cycles);
   dma.Tick();
 }
 
@@ -126,31 +176,12 @@ uint8_t IOInterface::Read08(uint32_t address) {
     if (system_->csvlog.fp)
       fprintf(system_->csvlog.fp,"0x%08X,0x%08X,IO Read 8,0x%08X\n",system().cpu().index,system().cpu().context()->prev_pc,address);
   #endif
-  BREAKPOINT
-  /*if (IsValid(address,1) == false) {
-    cpu_->context()->ctrl.BadVaddr = address;
-    cpu_->RaiseException(cpu_->context()->prev_pc,kOtherException,kExceptionCodeAdEL);
-    return 0;
-  }*/
-
-  /*if (address >= 0xBFC00000 && address <= 0xBFC80000 ) {
-    //return *((uint32_t*)&system_->bios()[address & 0x0007FFFF]);
-    return bios_buffer.u8[(address & 0x0007FFFF)];
+  uint32_t offset = address - kIOBase;
+  if (offset < kIOSize) {
+    auto& port = ports08_[offset];
+    return (uint8_t)port.read(port.param,address);
   }
-
-  
-  if (address >= 0x1F000000 && address <= 0x1F00FFFF ) {
-    return parallel_port_buffer.u8[address&0xFFFF];
-  }
-  
-  
-  if ((address >= 0x00000000 && address <= 0x001FFFFF ) ||
-      (address >= 0x80000000 && address <= 0x801FFFFF ) ||
-      (address >= 0xA0000000 && address <= 0xA01FFFFF )) {
-    return ram_buffer.u8[(address & 0x001FFFFF)];
-  }*/
-
-  
+  BREAKPOINT
   return 0;
 }
 
@@ -168,37 +199,11 @@ uint16_t IOInterface::Read16(uint32_t address) {
     if (system_->csvlog.fp)
       fprintf(system_->csvlog.fp,"0x%08X,0x%08X,IO Read 16,0x%08X\n",system().cpu().index,system().cpu().context()->prev_pc,address);
   #endif
-
-  /*if (IsValid(address,2) == false) {
-    cpu_->context()->ctrl.BadVaddr = address;
-    cpu_->RaiseException(cpu_->context()->prev_pc,kOtherException,kExceptionCodeAdEL);
-    return 0;
-  }*/
-
-  switch (address) {
-    case 0x1F801070: return io.interrupt_stat&0xFFFF;
-    case 0x1F801074: return io.interrupt_mask&0xFFFF;
-    case 0x1F801100: return rootcounter_[0].ReadCounter();
-    case 0x1F801104: return rootcounter_[0].ReadMode(); 
-    case 0x1F801108: return rootcounter_[0].ReadTarget(); 
-    case 0x1F801110: return rootcounter_[1].ReadCounter();        
-    case 0x1F801114: return rootcounter_[1].ReadMode(); 
-    case 0x1F801118: return rootcounter_[1].ReadTarget(); 
-    case 0x1F801120: return rootcounter_[2].ReadCounter();
-    case 0x1F801124: return rootcounter_[2].ReadMode(); 
-    case 0x1F801128: return rootcounter_[2].ReadTarget(); 
-    /*case 0x1F801130: return;
-    case 0x1F801134: rootcounter_[3].WriteMode(data); return;
-    case 0x1F801138: rootcounter_[3].WriteTarget(data); return;*/
-  }
-
-  //SPU range
-  if (address >= 0x1F801C00 && address <= 0x1F801DFF) {
-    return system_->spu().Read(address);
+  uint32_t offset = address - kIOBase;
+  if (offset < kIOSize) {
+    auto& port = ports16_[offset>>1];
+    return (uint16_t)port.read(port.param,address);
   }
-
-
-  
   BREAKPOINT
   return 0;
 }
@@ -217,47 +222,17 @@ uint32_t IOInterface::Read32(uint32_t address) {
     if (system_->csvlog.fp && cpu_->current_stage != 1)
       fprintf(system_->csvlog.fp,"0x%08X,0x%08X,IO Read 32,0x%08X\n",system().cpu().index,system().cpu().context()->prev_pc,address);
   #endif
+  uint32_t offset = address - kIOBase;
+  if (offset < kIOSize) {
+    auto& port = ports32_[offset>>1];
+    return port.read(port.param,address);
+  }
 
   if (address == 0xFFFE0130) {
     BREAKPOINT
     return io.cache_control;
   }
 
-  if (address >= 0x1F801080 && address <= 0x1F8010F4) {
-    return dma.Read(address);
-  }
-
-  switch (address) {
-    case 0x1F801070: return io.interrupt_stat;
-    case 0x1F801074: return io.interrupt_mask;
-    case 0x1F801100: return rootcounter_[0].ReadCounter();
-    case 0x1F801104: return rootcounter_[0].ReadMode(); 
-    case 0x1F801108: return rootcounter_[0].ReadTarget(); 
-    case 0x1F801110: return rootcounter_[1].ReadCounter();        
-    case 0x1F801114: return rootcounter_[1].ReadMode(); 
-    case 0x1F801118: return rootcounter_[1].ReadTarget(); 
-    case 0x1F801120: return rootcounter_[2].ReadCounter();
-    case 0x1F801124: return rootcounter_[2].ReadMode(); 
-    case 0x1F801128: return rootcounter_[2].ReadTarget(); 
-    case 0x1F801810: return system_->gpu_core()->ReadData();
-    case 0x1F801814: return system_->gpu_core()->ReadStatus();
-    
-  }
-  BREAKPOINT
-  //todo: hardware io
-  if (address >= 0x1F801000 && address <= 0x1F802FFF ) {
-    BREAKPOINT
-    return 0;//io_buffer.u32[((address-0x1000)&0x1FFF)>>2];
-  }
-  
-  /*if (address >= 0xBFC00000 && address <= 0xBFC80000 ) {
-    return bios_buffer.u32[(address & 0x0007FFFF)>>2];
-    //return *((uint32_t*)&system_->bios()[address & 0x0007FFFF]);
-    //return ((uint32_t*)system_->bios())[(address & 0x0007FFFF)>>2];
-  }*/
-
-  
-
   BREAKPOINT
   return 0;
 }
@@ -276,40 +251,12 @@ void IOInterface::Write08(uint32_t address,uint8_t data) {
     if (system_->csvlog.fp)
       fprintf(system_->csvlog.fp,"0x%08X,0x%08X,IO Write 8,0x%08X,Data,0x%02X\n",system().cpu().index,system().cpu().context()->prev_pc,address,data);
   #endif
-  /*if (IsValid(address,1) == false) {
-    cpu_->context()->ctrl.BadVaddr = address;
-    cpu_->RaiseException(cpu_->context()->prev_pc,kOtherException,kExceptionCodeAdES);
-    return;
-  }*/
-
-  /*if ((address >= 0x00000000 && address <= 0x001FFFFF ) ||
-      (address >= 0x80000000 && address <= 0x801FFFFF ) ||
-      (address >= 0xA0000000 && address <= 0xA01FFFFF )) {
-    ram_buffer.u8[(address & 0x001FFFFF)] = data;
-    return;
-  }*/
-
-  switch (address) {
-    case 0x1F802041:
-      io.post = data;
-      return;
-  };
-    
-  if (address >= 0x1F802020 && address <= 0x1F8002F ) {
-    //io_buffer.u8[((address-0x1000)&0x1FFF)] = data;
-    BREAKPOINT
-    
-
-    return;
-  }
-
-
-  if (address >= 0x1F801000 && address <= 0x1F802FFF ) {
-    //io_buffer.u8[((address-0x1000)&0x1FFF)] = data;
-    BREAKPOINT
+  uint32_t offset = address - kIOBase;
+  if (offset < kIOSize) {
+    auto& port = ports08_[offset];
+    port.write(port.param,address,data);
     return;
   }
-
   BREAKPOINT
 }
 
@@ -327,26 +274,10 @@ void IOInterface::Write16(uint32_t address,uint16_t data) {
     if (system_->csvlog.fp)
       fprintf(system_->csvlog.fp,"0x%08X,0x%08X,IO Write 16,0x%08X,Data,0x%04X\n",system().cpu().index,system().cpu().context()->prev_pc,address,data);
   #endif
-    
-  switch (address) {
-    case 0x1F801070: io.interrupt_stat = (io.interrupt_stat&0xFFFF0000)|(data & io.interrupt_mask & 0xFFFF);  return;
-    case 0x1F801074: io.interrupt_mask = (io.interrupt_mask&0xFFFF0000)|(data & 0xFFFF);  return;
-    case 0x1F801100: rootcounter_[0].WriteCounter(data); return;
-    case 0x1F801104: rootcounter_[0].WriteMode(data); return;
-    case 0x1F801108: rootcounter_[0].WriteTarget(data); return;
-    case 0x1F801110: rootcounter_[1].WriteCounter(data); return;
-    case 0x1F801114: rootcounter_[1].WriteMode(data); return;
-    case 0x1F801118: rootcounter_[1].WriteTarget(data); return;
-    case 0x1F801120: rootcounter_[2].WriteCounter(data); return;
-    case 0x1F801124: rootcounter_[2].WriteMode(data); return;
-    case 0x1F801128: rootcounter_[2].WriteTarget(data); return;
-    /*case 0x1F801130: return;
-    case 0x1F801134: rootcounter_[3].WriteMode(data); return;
-    case 0x1F801138: rootcounter_[3].WriteTarget(data); return;*/
-  }
-
-  if (address >= 0x1F801C00 && address <= 0x1F801DFF) {
-    system_->spu().Write(address,data);
+  uint32_t offset = address - kIOBase;
+  if (offset < kIOSize) {
+    auto& port = ports16_[offset>>1];
+    port.write(port.param,address,data);
     return;
   }
   BREAKPOINT
@@ -366,52 +297,104 @@ void IOInterface::Write32(uint32_t address,uint32_t data) {
     if (system_->csvlog.fp)
       fprintf(system_->csvlog.fp,"0x%08X,0x%08X,IO Write 32,0x%08X,Data,0x%08X\n",system().cpu().index,system().cpu().context()->prev_pc,address,data);
   #endif
-
-
-  if (address >= 0x1F801080 && address <= 0x1F8010F4) {
-    dma.Write(address,data);
+  uint32_t offset = address - kIOBase;
+  if (offset < kIOSize) {
+    auto& port = ports32_[offset>>1];
+    port.write(port.param,address,data);
     return;
   }
 
-  switch (address) {
-    case 0x1F801000: io.exp1_base_addr = data; return;
-    case 0x1F801004: io.exp2_base_addr = data; return;
-    case 0x1F801008: io.exp1_delay = data; return;
-    case 0x1F80100C: io.exp3_delay = data; return;
-    case 0x1F801010: io.bios_rom = data; return;
-    case 0x1F801014: io.spu_delay = data; return;
-    case 0x1F801018: io.cdrom_delay = data; return;
-    case 0x1F80101C: io.exp2_delay = data; return;
-    case 0x1F801020: io.com_delay = data; return;
-    case 0x1F801060: io.ram_size = data; return;
-    case 0x1F801070: io.interrupt_stat = data & io.interrupt_mask;  return;
-    case 0x1F801074: io.interrupt_mask = data;  return;
-    case 0x1F801100: rootcounter_[0].WriteCounter(data); return;
-    case 0x1F801104: rootcounter_[0].WriteMode(data); return;
-    case 0x1F801108: rootcounter_[0].WriteTarget(data); return;
-    case 0x1F801110: rootcounter_[1].WriteCounter(data); return;
-    case 0x1F801114: rootcounter_[1].WriteMode(data); return;
-    case 0x1F801118: rootcounter_[1].WriteTarget(data); return;
-    case 0x1F801120: rootcounter_[2].WriteCounter(data); return;
-    case 0x1F801124: rootcounter_[2].WriteMode(data); return;
-    case 0x1F801128: rootcounter_[2].WriteTarget(data); return;
-    case 0x1F801810: system_->gpu_core()->WriteData(data); return;
-    case 0x1F801814: system_->gpu_core()->WriteStatus(data); return;
-    case 0xFFFE0130: 
-      io.cache_control = data; 
-      if ((data&0x800)==0x800) 
-        system_->cpu().icache.Invalidate(); 
-      return;
+  if (address == 0xFFFE0130) {
+    io.cache_control = data; 
+    if ((data&0x800)==0x800) 
+      system_->cpu().icache.Invalidate(); 
+    return;
   }
   BREAKPOINT
-  if (address >= 0x1F801000 && address <= 0x1F802FFF ) {
-    //io_buffer.u32[((address-0x1000)&0x1FFF)>>2] = data;
+}
+
+/******************************************************************************
+* Name        : MapPort
+* Description : route accesses of a given width at address to a device
+* Parameters  : size address param read write
+*
+* Notes : a null read or write handler leaves that direction unmapped.
+*         mapping the same address twice replaces the previous handlers.
+* 
+*******************************************************************************/
+void IOInterface::MapPort(MemorySize size,uint32_t address,void* param,IOReadHandler read,IOWriteHandler write) {
+  auto port = port_table(size,address);
+  if (port == nullptr) {
+    BREAKPOINT
     return;
   }
+  port->param = param;
+  port->read = read != nullptr ? read : UnmappedRead;
+  port->write = write != nullptr ? write : UnmappedWrite;
+}
 
-  BREAKPOINT
+void IOInterface::UnmapPort(MemorySize size,uint32_t address) {
+  MapPort(size,address,nullptr,nullptr,nullptr);
+}
+
+IOPort* IOInterface::port_table(MemorySize size,uint32_t address) {
+  uint32_t offset = address - kIOBase;
+  if (offset >= kIOSize)
+    return nullptr;
+  switch (size) {
+    case kM8: return &ports08_[offset];
+    case kM16: return &ports16_[offset>>1];
+    case kM32: return &ports32_[offset>>1];
+  }
+  return nullptr;
 }
 
+/******************************************************************************
+* Name        : MapPorts
+* Description : map the registers owned by the io interface itself
+* Parameters  : (none)
+*
+* Notes : memory control, interrupt control, root counters and the post
+*         register. dma, gpu, spu and cdrom map their own ports on initialization.
+* 
+*******************************************************************************/
+void IOInterface::MapPorts() {
+  for (uint32_t i=0;i<kIOSize;++i) {
+    UnmapPort(kM8,kIOBase+i);
+  }
+  for (uint32_t i=0;i<kIOSize;i+=2) {
+    UnmapPort(kM16,kIOBase+i);
+    UnmapPort(kM32,kIOBase+i);
+  }
+
+  MapPort(kM32,0x1F801000,&io.exp1_base_addr,ReadRegister32,WriteRegister32);
+  MapPort(kM32,0x1F801004,&io.exp2_base_addr,ReadRegister32,WriteRegister32);
+  MapPort(kM32,0x1F801008,&io.exp1_delay,ReadRegister32,WriteRegister32);
+  MapPort(kM32,0x1F80100C,&io.exp3_delay,ReadRegister32,WriteRegister32);
+  MapPort(kM32,0x1F801010,&io.bios_rom,ReadRegister32,WriteRegister32);
+  MapPort(kM32,0x1F801014,&io.spu_delay,ReadRegister32,WriteRegister32);
+  MapPort(kM32,0x1F801018,&io.cdrom_delay,ReadRegister32,WriteRegister32);
+  MapPort(kM32,0x1F80101C,&io.exp2_delay,ReadRegister32,WriteRegister32);
+  MapPort(kM32,0x1F801020,&io.com_delay,ReadRegister32,WriteRegister32);
+  MapPort(kM32,0x1F801060,&io.ram_size,ReadRegister32,WriteRegister32);
+
+  MapPort(kM16,0x1F801070,this,ReadInterruptStat,WriteInterruptStat16);
+  MapPort(kM16,0x1F801074,this,ReadInterruptMask,WriteInterruptMask16);
+  MapPort(kM32,0x1F801070,this,ReadInterruptStat,WriteInterruptStat32);
+  MapPort(kM32,0x1F801074,this,ReadInterruptMask,WriteInterruptMask32);
+
+  for (int i=0;i<3;++i) {
+    uint32_t base = 0x1F801100 + (i << 4);
+    MapPort(kM16,base+0,&rootcounter_[i],ReadCounterValue,WriteCounterValue);
+    MapPort(kM16,base+4,&rootcounter_[i],ReadCounterMode,WriteCounterMode);
+    MapPort(kM16,base+8,&rootcounter_[i],ReadCounterTarget,WriteCounterTarget);
+    MapPort(kM32,base+0,&rootcounter_[i],ReadCounterValue,WriteCounterValue);
+    MapPort(kM32,base+4,&rootcounter_[i],ReadCounterMode,WriteCounterMode);
+    MapPort(kM32,base+8,&rootcounter_[i],ReadCounterTarget,WriteCounterTarget);
+  }
+
+  MapPort(kM8,0x1F802041,&io.post,nullptr,WriteRegister08);
+}
 
 }
 }
\ No newline at end of file
@@ -21,8 +21,24 @@
 namespace emulation {
 namespace psx {
 
+typedef uint32_t (*IOReadHandler)(void* param, uint32_t address);
+typedef void (*IOWriteHandler)(void* param, uint32_t address, uint32_t data);
+
+/*
+  a single hardware register as seen by one access width. devices map their
+  registers at initialization, the io interface then dispatches each access
+  with one indexed indirect call.
+*/
+struct IOPort {
+  void* param;
+  IOReadHandler read;
+  IOWriteHandler write;
+};
+
 class IOInterface : public Component {
  public:
+  static const uint32_t kIOBase = 0x1F801000;
+  static const uint32_t kIOSize = 0x2000;
   struct {
     uint32_t exp1_base_addr;
     uint32_t exp2_base_addr;
@@ -56,7 +72,22 @@ class IOInterface : public Component {
   void Write08(uint32_t address,uint8_t data);
   void Write16(uint32_t address,uint16_t data);
   void Write32(uint32_t address,uint32_t data);
+  void MapPort(MemorySize size,uint32_t address,void* param,IOReadHandler read,IOWriteHandler write);
+  void UnmapPort(MemorySize size,uint32_t address);
 
+  static uint32_t ReadRegister08(void* param,uint32_t address) { return *(uint8_t*)param; }
+  static uint32_t ReadRegister16(void* param,uint32_t address) { return *(uint16_t*)param; }
+  static uint32_t ReadRegister32(void* param,uint32_t address) { return *(uint32_t*)param; }
+  static void WriteRegister08(void* param,uint32_t address,uint32_t data) { *(uint8_t*)param = (uint8_t)data; }
+  static void WriteRegister16(void* param,uint32_t address,uint32_t data) { *(uint16_t*)param = (uint16_t)data; }
+  static void WriteRegister32(void* param,uint32_t address,uint32_t data) { *(uint32_t*)param = data; }
+ private:
+  //8bit ports are indexed per byte, 16/32bit ports per halfword
+  IOPort ports08_[kIOSize];
+  IOPort ports16_[kIOSize>>1];
+  IOPort ports32_[kIOSize>>1];
+  IOPort* port_table(MemorySize size,uint32_t address);
+  void MapPorts();
 };
 
 }
@@ -0,0 +1,289 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+namespace emulation {
+namespace psx {
+
+static const uint32_t kNoBoot = 0xFFFFFFFF;
+
+static uint32_t ReadLE32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+IsoIndex::IsoIndex() : signature_(0),boot_(kNoBoot) {
+
+}
+
+void IsoIndex::Clear() {
+  entries_.clear();
+  names_.clear();
+  paths_.clear();
+  signature_ = 0;
+  boot_ = kNoBoot;
+}
+
+bool IsoIndex::ReadBlock(DiscImage* disc,uint32_t lba,uint8_t* block) {
+  const uint8_t* sector = disc->ReadSector(lba);
+  if (sector == nullptr)
+    return false;
+  memcpy(block,sector + (sector[15] == 1 ? 16 : 24),kBlockSize);
+  return true;
+}
+
+int IsoIndex::ReadFile(DiscImage* disc,const Entry& entry,std::vector<uint8_t>* data) {
+  data->resize(entry.size);
+  uint8_t block[kBlockSize];
+  for (uint32_t offset=0;offset<entry.size;offset+=kBlockSize) {
+    if (!ReadBlock(disc,entry.lba + offset / kBlockSize,block))
+      return E_FAIL;
+    uint32_t size = entry.size - offset < kBlockSize ? entry.size - offset : kBlockSize;
+    memcpy(data->data() + offset,block,size);
+  }
+  return S_OK;
+}
+
+//FNV-1a of the volume descriptor, the dates in it tell apart discs with the same label
+uint32_t IsoIndex::Signature(const uint8_t* pvd) {
+  uint32_t hash = 2166136261U;
+  for (uint32_t i=0;i<kBlockSize;++i)
+    hash = (hash ^ pvd[i]) * 16777619U;
+  return hash;
+}
+
+std::string IsoIndex::Normalize(const char* path) {
+  if (_strnicmp(path,"cdrom:",6) == 0)
+    path += 6;
+  else if (_strnicmp(path,"cdrom0:",7) == 0)
+    path += 7;
+  while (*path == '\\' || *path == '/')
+    ++path;
+  std::string result;
+  for (;*path != 0 && *path != ';';++path)
+    result += *path == '\\' ? '/' : (char)toupper((uint8_t)*path);
+  return result;
+}
+
+void IsoIndex::AddEntry(const std::string& path,uint32_t lba,uint32_t size,uint8_t flags,uint16_t xa_attributes) {
+  Entry entry;
+  entry.lba = lba;
+  entry.size = size;
+  entry.path = (uint32_t)names_.size();
+  entry.xa_attributes = xa_attributes;
+  entry.flags = flags;
+  entry.reserved = 0;
+  names_.insert(names_.end(),path.begin(),path.end());
+  names_.push_back(0);
+  paths_[path] = (uint32_t)entries_.size();
+  entries_.push_back(entry);
+}
+
+/*
+  The path table gives every directory with its parent, so the directories are
+  read in table order without following subdirectory records. A directory gets
+  its entry from its own "." record, the root has none.
+*/
+int IsoIndex::Build(DiscImage* disc) {
+  Clear();
+  uint8_t block[kBlockSize];
+  ISO9660_PVD_s pvd;
+  uint32_t lba = 16;
+  for (;;++lba) {
+    if (lba == 32 || !ReadBlock(disc,lba,block) || memcmp(block + 1,"CD001",5) != 0 || (uint8_t)block[0] == TypeCode_VolumeSetTerminator)
+      return E_FAIL;
+    if (block[0] == TypeCode_PrimaryVolume)
+      break;
+  }
+  memcpy(&pvd,block,sizeof(pvd) < kBlockSize ? sizeof(pvd) : kBlockSize);
+  if (pvd.LogicalBlockSize[0] != kBlockSize)
+    return E_FAIL;
+  signature_ = Signature(block);
+
+  uint32_t table_size = pvd.PathTableSize[0];
+  std::vector<uint8_t> table((table_size + kBlockSize - 1) & ~(kBlockSize - 1));
+  for (uint32_t offset=0;offset<table.size();offset+=kBlockSize) {
+    if (!ReadBlock(disc,pvd.LocationOfTypeLPathTable + offset / kBlockSize,&table[offset]))
+      return E_FAIL;
+  }
+  struct Directory {
+    std::string path;
+    uint32_t lba;
+  };
+  std::vector<Directory> directories;
+  for (uint32_t offset=0;offset + 8 <= table_size;) {
+    const uint8_t* record = &table[offset];
+    uint32_t name_length = record[0];
+    uint32_t parent = record[6] | (record[7] << 8);
+    if (name_length == 0 || offset + 8 + name_length > table_size)
+      break;
+    Directory directory;
+    directory.lba = ReadLE32(record + 2);
+    //the root is record 1 and its own parent
+    if (!directories.empty()) {
+      if (parent == 0 || parent > directories.size())
+        break;
+      const std::string& parent_path = directories[parent - 1].path;
+      std::string name = Normalize(std::string((const char*)record + 8,name_length).c_str());
+      directory.path = parent_path.empty() ? name : parent_path + "/" + name;
+    }
+    directories.push_back(directory);
+    offset += 8 + name_length + (name_length & 1);
+  }
+
+  for (size_t i=0;i<directories.size();++i) {
+    const Directory& directory = directories[i];
+    uint32_t blocks = 1;
+    for (uint32_t n=0;n<blocks;++n) {
+      if (!ReadBlock(disc,directory.lba + n,block))
+        break;
+      for (uint32_t offset=0;offset + 34 <= kBlockSize;) {
+        const uint8_t* record = block + offset;
+        uint32_t length = record[0];
+        uint32_t name_length = record[32];
+        //records don't cross blocks, the rest of the block is zeros
+        if (length < 34 || offset + length > kBlockSize || 33 + name_length > length)
+          break;
+        offset += length;
+        uint32_t file_lba = ReadLE32(record + 2);
+        uint32_t size = ReadLE32(record + 10);
+        uint8_t flags = record[25];
+        const char* name = (const char*)record + 33;
+        uint32_t system_use = 33 + name_length + ((name_length & 1) ? 0 : 1);
+        uint16_t xa_attributes = 0;
+        if (system_use + 14 <= length && record[system_use + 6] == 'X' && record[system_use + 7] == 'A')
+          xa_attributes = (uint16_t)((record[system_use + 4] << 8) | record[system_use + 5]);
+        if (name_length == 1 && (name[0] == 0 || name[0] == 1)) {
+          if (name[0] == 0 && n == 0) {
+            blocks = (size + kBlockSize - 1) / kBlockSize;
+            if (!directory.path.empty())
+              AddEntry(directory.path,file_lba,size,flags,xa_attributes);
+          }
+          continue;
+        }
+        if (flags & kFlagDirectory)
+          continue;
+        std::string file = Normalize(std::string(name,name_length).c_str());
+        AddEntry(directory.path.empty() ? file : directory.path + "/" + file,file_lba,size,flags,xa_attributes);
+      }
+    }
+  }
+  FindBoot(disc);
+  return S_OK;
+}
+
+void IsoIndex::FindBoot(DiscImage* disc) {
+  boot_ = kNoBoot;
+  const Entry* cnf = system_cnf();
+  std::vector<uint8_t> text;
+  if (cnf != nullptr && ReadFile(disc,*cnf,&text) == S_OK) {
+    text.push_back(0);
+    const char* line = (const char*)text.data();
+    while (line != nullptr && *line != 0) {
+      while (*line == ' ' || *line == '\t' || *line == '\r' || *line == '\n')
+        ++line;
+      if (_strnicmp(line,"BOOT",4) == 0 && strchr(line,'=') != nullptr) {
+        const char* value = strchr(line,'=') + 1;
+        while (*value == ' ' || *value == '\t')
+          ++value;
+        size_t length = strcspn(value," \t\r\n");
+        auto it = paths_.find(Normalize(std::string(value,length).c_str()));
+        if (it != paths_.end())
+          boot_ = it->second;
+        break;
+      }
+      line = strchr(line,'\n');
+    }
+  }
+  if (boot_ == kNoBoot) {
+    auto it = paths_.find("PSX.EXE");
+    if (it != paths_.end())
+      boot_ = it->second;
+  }
+}
+
+const IsoIndex::Entry* IsoIndex::Find(const char* path) const {
+  auto it = paths_.find(Normalize(path));
+  return it != paths_.end() ? &entries_[it->second] : nullptr;
+}
+
+int IsoIndex::Save(const char* filename) {
+  FILE* fp;
+  if (fopen_s(&fp,filename,"wb") != 0)
+    return E_FAIL;
+  SidecarHeader header;
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.signature = signature_;
+  header.entry_count = (uint32_t)entries_.size();
+  header.names_size = (uint32_t)names_.size();
+  header.boot = boot_;
+  fwrite(&header,sizeof(header),1,fp);
+  if (!entries_.empty())
+    fwrite(entries_.data(),sizeof(Entry),entries_.size(),fp);
+  if (!names_.empty())
+    fwrite(names_.data(),1,names_.size(),fp);
+  int result = ferror(fp) ? E_FAIL : S_OK;
+  fclose(fp);
+  return result;
+}
+
+//only the volume descriptor is read from the disc to check the sidecar belongs to it
+int IsoIndex::Load(const char* filename,DiscImage* disc) {
+  Clear();
+  FILE* fp;
+  if (fopen_s(&fp,filename,"rb") != 0)
+    return E_FAIL;
+  SidecarHeader header;
+  bool ok = fread(&header,sizeof(header),1,fp) == 1 && header.magic == kMagic && header.version == kVersion;
+  uint8_t block[kBlockSize];
+  ok = ok && ReadBlock(disc,16,block) && Signature(block) == header.signature;
+  if (ok) {
+    entries_.resize(header.entry_count);
+    names_.resize(header.names_size);
+    ok = (entries_.empty() || fread(entries_.data(),sizeof(Entry),entries_.size(),fp) == entries_.size()) &&
+         (names_.empty() || fread(names_.data(),1,names_.size(),fp) == names_.size()) &&
+         (names_.empty() || names_.back() == 0) && (header.boot == kNoBoot || header.boot < header.entry_count);
+  }
+  fclose(fp);
+  for (size_t i=0;ok && i<entries_.size();++i) {
+    if (entries_[i].path >= names_.size())
+      ok = false;
+    else
+      paths_[&names_[entries_[i].path]] = (uint32_t)i;
+  }
+  if (!ok) {
+    Clear();
+    return E_FAIL;
+  }
+  signature_ = header.signature;
+  boot_ = header.boot;
+  return S_OK;
+}
+
+int IsoIndex::Open(DiscImage* disc,const char* filename) {
+  if (Load(filename,disc) == S_OK)
+    return S_OK;
+  if (Build(disc) != S_OK)
+    return E_FAIL;
+  Save(filename);
+  return S_OK;
+}
+
+}
+}
@@ -0,0 +1,95 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  Every file and directory of the ISO9660 filesystem of a disc, looked up by path.
+  Build reads the primary volume descriptor and the type L path table, which
+  lists every directory, then each directory's records once. Paths are kept
+  uppercase with '/' separators and without the ";1" version, lookups take the
+  same with '\' separators, a leading separator or a "cdrom:" prefix too. The
+  index can be saved to a sidecar file next to the image, Load only takes it if
+  it was built from the same volume descriptor.
+*/
+class IsoIndex {
+ public:
+  static const uint32_t kMagic = 0x49585350; //PSXI
+  static const uint32_t kVersion = 1;
+  static const uint32_t kBlockSize = 2048;
+  //ISO9660 file flags
+  static const uint8_t kFlagDirectory = 0x02;
+  //CD-XA attributes
+  static const uint16_t kXaForm1 = 0x0800;
+  static const uint16_t kXaForm2 = 0x1000;
+  static const uint16_t kXaInterleaved = 0x2000;
+  static const uint16_t kXaCdda = 0x4000;
+  struct Entry {
+    uint32_t lba;
+    uint32_t size;
+    //offset of the null terminated path in the name pool
+    uint32_t path;
+    uint16_t xa_attributes;
+    uint8_t flags;
+    uint8_t reserved;
+  };
+  IsoIndex();
+  //E_FAIL when the disc has no ISO9660 volume
+  int Build(DiscImage* disc);
+  int Load(const char* filename,DiscImage* disc);
+  int Save(const char* filename);
+  //loads the sidecar, or builds the index and writes the sidecar
+  int Open(DiscImage* disc,const char* filename);
+  void Clear();
+  //null when there is no such file or directory
+  const Entry* Find(const char* path) const;
+  //the executable the BOOT line of SYSTEM.CNF names, PSX.EXE without one
+  const Entry* boot() const { return boot_ < entries_.size() ? &entries_[boot_] : nullptr; }
+  const Entry* system_cnf() const { return Find("SYSTEM.CNF"); }
+  const char* path(const Entry& entry) const { return &names_[entry.path]; }
+  size_t entry_count() const { return entries_.size(); }
+  const Entry& entry(size_t index) const { return entries_[index]; }
+  //the user data of a file in 2048 byte blocks
+  static int ReadFile(DiscImage* disc,const Entry& entry,std::vector<uint8_t>* data);
+  //the user data of the logical block at lba, mode 1 or mode 2 form 1
+  static bool ReadBlock(DiscImage* disc,uint32_t lba,uint8_t* block);
+ private:
+  struct SidecarHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t signature;
+    uint32_t entry_count;
+    uint32_t names_size;
+    uint32_t boot;
+  };
+  static uint32_t Signature(const uint8_t* pvd);
+  static std::string Normalize(const char* path);
+  void AddEntry(const std::string& path,uint32_t lba,uint32_t size,uint8_t flags,uint16_t xa_attributes);
+  void FindBoot(DiscImage* disc);
+  std::vector<Entry> entries_;
+  std::vector<char> names_;
+  std::unordered_map<std::string,uint32_t> paths_;
+  uint32_t signature_;
+  uint32_t boot_;
+};
+
+}
+}
@@ -0,0 +1,154 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+namespace emulation {
+namespace psx {
+
+PrefetchImage::PrefetchImage(DiscImage* image) : image_(image),pinned_(kNoSlot),hits_(0),stalls_(0),stall_ticks_(0),
+  prefetched_(0),hint_lba_(0),hint_count_(0),hint_generation_(0),exit_(false) {
+  for (int i=0;i<image->track_count();++i)
+    tracks_.push_back(image->track(i));
+  sector_count_ = image->sector_count();
+  ring_ = (uint8_t*)_aligned_malloc(kRingSectors * kSlotSize,4096);
+  for (uint32_t i=0;i<kRingSectors;++i)
+    tags_[i] = kEmpty;
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  tick_ms_ = 1000.0 / double(freq.QuadPart);
+  thread_ = new std::thread(PrefetchImage::thread_func,this);
+}
+
+PrefetchImage::~PrefetchImage() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exit_ = true;
+    wake_.notify_one();
+  }
+  thread_->join();
+  SafeDelete(&thread_);
+  _aligned_free(ring_);
+  SafeDelete(&image_);
+}
+
+/*
+  The slot is pinned before its tag is checked and the thread empties a tag
+  before it checks the pin, so either the thread skips the slot or the tag seen
+  here is no longer the LBA.
+*/
+const uint8_t* PrefetchImage::ReadSector(uint32_t lba) {
+  if (lba >= sector_count_)
+    return nullptr;
+  uint32_t index = lba % kRingSectors;
+  pinned_.store(index);
+  if (tags_[index].load() == lba) {
+    ++hits_;
+    return slot(index);
+  }
+  pinned_.store(kNoSlot);
+  LARGE_INTEGER pc1,pc2;
+  QueryPerformanceCounter(&pc1);
+  const uint8_t* sector;
+  {
+    std::lock_guard<std::mutex> lock(image_mutex_);
+    sector = image_->ReadSector(lba);
+    if (sector != nullptr)
+      memcpy(stall_sector_,sector,kSectorSize);
+  }
+  QueryPerformanceCounter(&pc2);
+  ++stalls_;
+  stall_ticks_ += pc2.QuadPart - pc1.QuadPart;
+  return sector != nullptr ? stall_sector_ : nullptr;
+}
+
+//called for every sector the drive passes, anything but the next one restarts the window
+void PrefetchImage::Hint(uint32_t lba,int speed) {
+  uint32_t count = 75 / 2 * (speed > 1 ? speed : 1);
+  count = count < kRingSectors - 8 ? count : kRingSectors - 8;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (lba != hint_lba_ + 1 || count != hint_count_)
+    ++hint_generation_;
+  hint_lba_ = lba;
+  hint_count_ = count;
+  wake_.notify_one();
+}
+
+PrefetchImage::Stats PrefetchImage::stats() const {
+  Stats stats;
+  stats.hits = hits_;
+  stats.stalls = stalls_;
+  stats.prefetched = prefetched_.load(std::memory_order_relaxed);
+  stats.stall_ms = stall_ticks_ * tick_ms_;
+  return stats;
+}
+
+//reads lba into its slot unless it is there already or pinned
+bool PrefetchImage::Fill(uint32_t lba) {
+  uint32_t index = lba % kRingSectors;
+  uint32_t tag = tags_[index].load();
+  if (tag == lba)
+    return true;
+  tags_[index].store(kEmpty);
+  if (pinned_.load() == index) {
+    tags_[index].store(tag);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(image_mutex_);
+  const uint8_t* sector = image_->ReadSector(lba);
+  if (sector == nullptr)
+    return false;
+  memcpy(slot(index),sector,kSectorSize);
+  tags_[index].store(lba,std::memory_order_release);
+  prefetched_.fetch_add(1,std::memory_order_relaxed);
+  return true;
+}
+
+/*
+  Fills the window of the last hint from its start, sectors the drive already
+  passed are not read again. A new hint restarts the walk.
+*/
+void PrefetchImage::thread_func(PrefetchImage* prefetch) {
+  uint32_t generation = 0;
+  uint32_t next = 0;
+  for (;;) {
+    uint32_t lba, end;
+    {
+      std::unique_lock<std::mutex> lock(prefetch->mutex_);
+      if (prefetch->exit_)
+        break;
+      if (generation != prefetch->hint_generation_) {
+        generation = prefetch->hint_generation_;
+        next = prefetch->hint_lba_;
+      }
+      if (next < prefetch->hint_lba_)
+        next = prefetch->hint_lba_;
+      end = prefetch->hint_lba_ + prefetch->hint_count_;
+      end = end < prefetch->sector_count_ ? end : prefetch->sector_count_;
+      if (next >= end) {
+        prefetch->wake_.wait(lock);
+        continue;
+      }
+      lba = next++;
+    }
+    prefetch->Fill(lba);
+  }
+}
+
+}
+}
@@ -0,0 +1,80 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  Reads another image ahead of the drive on a thread of its own. The drive
+  reports its position and speed with Hint, the thread keeps the sectors of the
+  next half second in a ring of cache line aligned slots, one slot per LBA modulo
+  the ring size. A sector found in its slot is returned from there, anything
+  else is a stall: the sector is read from the image on the calling thread.
+  The wrapped image is owned and only ever used under a lock.
+*/
+class PrefetchImage : public DiscImage {
+ public:
+  static const uint32_t kRingSectors = 128;
+  struct Stats {
+    uint64_t hits;
+    uint64_t stalls;
+    //sectors the thread read into the ring
+    uint64_t prefetched;
+    //time spent reading on the calling thread
+    double stall_ms;
+  };
+  explicit PrefetchImage(DiscImage* image);
+  ~PrefetchImage();
+  const uint8_t* ReadSector(uint32_t lba);
+  void Hint(uint32_t lba,int speed);
+  DiscImage* image() { return image_; }
+  Stats stats() const;
+ private:
+  static const uint32_t kSlotSize = (kSectorSize + 63) & ~63;
+  static const uint32_t kEmpty = 0xFFFFFFFF;
+  static const uint32_t kNoSlot = 0xFFFFFFFF;
+  static void thread_func(PrefetchImage* prefetch);
+  bool Fill(uint32_t lba);
+  uint8_t* slot(uint32_t index) { return ring_ + index * kSlotSize; }
+  DiscImage* image_;
+  std::mutex image_mutex_;
+  uint8_t* ring_;
+  //LBA each slot holds, kEmpty while the thread writes it
+  std::atomic<uint32_t> tags_[kRingSectors];
+  //slot the last returned sector is in, the thread leaves it alone
+  std::atomic<uint32_t> pinned_;
+  uint8_t stall_sector_[kSectorSize];
+  uint64_t hits_;
+  uint64_t stalls_;
+  uint64_t stall_ticks_;
+  double tick_ms_;
+  std::atomic<uint64_t> prefetched_;
+  std::thread* thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  //window the thread fills, changed by Hint
+  uint32_t hint_lba_;
+  uint32_t hint_count_;
+  uint32_t hint_generation_;
+  bool exit_;
+};
+
+}
+}
@@ -0,0 +1,87 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  Lock free single producer / single consumer ring. The producer owns head_, the
+  consumer owns tail_, each on its own cache line. The consumer reads items in place
+  with Peek and only releases them with Consume once it is done, so an empty ring
+  also means every pushed item has been processed.
+  capacity must be a power of two.
+*/
+template<typename T,uint32_t capacity>
+class SpscRing {
+ public:
+  SpscRing() : head_(0),tail_(0) {}
+
+  //producer side, returns how many items were pushed
+  uint32_t Push(const T* items,uint32_t count) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    uint32_t space = capacity - (head - tail);
+    if (count > space)
+      count = space;
+    for (uint32_t i=0;i<count;++i)
+      buffer_[(head + i) & (capacity-1)] = items[i];
+    head_.store(head + count,std::memory_order_release);
+    return count;
+  }
+
+  bool Push(const T& item) {
+    return Push(&item,1) == 1;
+  }
+
+  //consumer side, contiguous run of readable items starting at *items
+  uint32_t Peek(const T** items) const {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    uint32_t head = head_.load(std::memory_order_acquire);
+    uint32_t index = tail & (capacity-1);
+    uint32_t count = head - tail;
+    if (count > capacity - index)
+      count = capacity - index;
+    *items = &buffer_[index];
+    return count;
+  }
+
+  void Consume(uint32_t count) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + count,std::memory_order_release);
+  }
+
+  //either side
+  uint32_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+  uint32_t free_space() const { return capacity - size(); }
+
+ private:
+  SpscRing(const SpscRing&);
+  SpscRing& operator=(const SpscRing&);
+  std::atomic<uint32_t> head_;
+  uint8_t pad0_[64-sizeof(std::atomic<uint32_t>)];
+  std::atomic<uint32_t> tail_;
+  uint8_t pad1_[64-sizeof(std::atomic<uint32_t>)];
+  T buffer_[capacity];
+};
+
+}
+}
@@ -21,8 +21,114 @@
 namespace emulation {
 namespace psx {
 
-Spu::Spu() {
+//ADPCM prediction filters, the hardware treats 5-7 like 4
+static const int32_t kAdpcmPositive[5] = { 0, 60, 115, 98, 122 };
+static const int32_t kAdpcmNegative[5] = { 0, 0, -52, -55, -60 };
 
+/*
+  Gaussian interpolation weights of the hardware, 1/256 of a sample apart. The 4
+  weights of a position add up to just under 8000h.
+*/
+static const int32_t kGauss[512] = {
+  -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001,
+  -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001,
+  0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0001,
+  0x0001, 0x0001, 0x0001, 0x0002, 0x0002, 0x0002, 0x0003, 0x0003,
+  0x0003, 0x0004, 0x0004, 0x0005, 0x0005, 0x0006, 0x0007, 0x0007,
+  0x0008, 0x0009, 0x0009, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E,
+  0x000F, 0x0010, 0x0011, 0x0012, 0x0013, 0x0015, 0x0016, 0x0018,
+  0x0019, 0x001B, 0x001C, 0x001E, 0x0020, 0x0021, 0x0023, 0x0025,
+  0x0027, 0x0029, 0x002C, 0x002E, 0x0030, 0x0033, 0x0035, 0x0038,
+  0x003A, 0x003D, 0x0040, 0x0043, 0x0046, 0x0049, 0x004D, 0x0050,
+  0x0054, 0x0057, 0x005B, 0x005F, 0x0063, 0x0067, 0x006B, 0x006F,
+  0x0074, 0x0078, 0x007D, 0x0082, 0x0087, 0x008C, 0x0091, 0x0096,
+  0x009C, 0x00A1, 0x00A7, 0x00AD, 0x00B3, 0x00BA, 0x00C0, 0x00C7,
+  0x00CD, 0x00D4, 0x00DB, 0x00E3, 0x00EA, 0x00F2, 0x00FA, 0x0101,
+  0x010A, 0x0112, 0x011B, 0x0123, 0x012C, 0x0135, 0x013F, 0x0148,
+  0x0152, 0x015C, 0x0166, 0x0171, 0x017B, 0x0186, 0x0191, 0x019C,
+  0x01A8, 0x01B4, 0x01C0, 0x01CC, 0x01D9, 0x01E5, 0x01F2, 0x0200,
+  0x020D, 0x021B, 0x0229, 0x0237, 0x0246, 0x0255, 0x0264, 0x0273,
+  0x0283, 0x0293, 0x02A3, 0x02B4, 0x02C4, 0x02D6, 0x02E7, 0x02F9,
+  0x030B, 0x031D, 0x0330, 0x0343, 0x0356, 0x036A, 0x037E, 0x0392,
+  0x03A7, 0x03BC, 0x03D1, 0x03E7, 0x03FC, 0x0413, 0x042A, 0x0441,
+  0x0458, 0x0470, 0x0488, 0x04A0, 0x04B9, 0x04D2, 0x04EC, 0x0506,
+  0x0520, 0x053B, 0x0556, 0x0572, 0x058E, 0x05AA, 0x05C7, 0x05E4,
+  0x0601, 0x061F, 0x063E, 0x065C, 0x067C, 0x069B, 0x06BB, 0x06DC,
+  0x06FD, 0x071E, 0x0740, 0x0762, 0x0784, 0x07A7, 0x07CB, 0x07EF,
+  0x0813, 0x0838, 0x085D, 0x0883, 0x08A9, 0x08D0, 0x08F7, 0x091E,
+  0x0946, 0x096F, 0x0998, 0x09C1, 0x09EB, 0x0A16, 0x0A40, 0x0A6C,
+  0x0A98, 0x0AC4, 0x0AF1, 0x0B1E, 0x0B4C, 0x0B7A, 0x0BA9, 0x0BD8,
+  0x0C07, 0x0C38, 0x0C68, 0x0C99, 0x0CCB, 0x0CFD, 0x0D30, 0x0D63,
+  0x0D97, 0x0DCB, 0x0E00, 0x0E35, 0x0E6B, 0x0EA1, 0x0ED7, 0x0F0F,
+  0x0F46, 0x0F7F, 0x0FB7, 0x0FF1, 0x102A, 0x1065, 0x109F, 0x10DB,
+  0x1116, 0x1153, 0x118F, 0x11CD, 0x120B, 0x1249, 0x1288, 0x12C7,
+  0x1307, 0x1347, 0x1388, 0x13C9, 0x140B, 0x144D, 0x1490, 0x14D4,
+  0x1517, 0x155C, 0x15A0, 0x15E6, 0x162C, 0x1672, 0x16B9, 0x1700,
+  0x1747, 0x1790, 0x17D8, 0x1821, 0x186B, 0x18B5, 0x1900, 0x194B,
+  0x1996, 0x19E2, 0x1A2E, 0x1A7B, 0x1AC8, 0x1B16, 0x1B64, 0x1BB3,
+  0x1C02, 0x1C51, 0x1CA1, 0x1CF1, 0x1D42, 0x1D93, 0x1DE5, 0x1E37,
+  0x1E89, 0x1EDC, 0x1F2F, 0x1F82, 0x1FD6, 0x202A, 0x207F, 0x20D4,
+  0x2129, 0x217F, 0x21D5, 0x222C, 0x2282, 0x22DA, 0x2331, 0x2389,
+  0x23E1, 0x2439, 0x2492, 0x24EB, 0x2545, 0x259E, 0x25F8, 0x2653,
+  0x26AD, 0x2708, 0x2763, 0x27BE, 0x281A, 0x2876, 0x28D2, 0x292E,
+  0x298B, 0x29E7, 0x2A44, 0x2AA1, 0x2AFF, 0x2B5C, 0x2BBA, 0x2C18,
+  0x2C76, 0x2CD4, 0x2D33, 0x2D91, 0x2DF0, 0x2E4F, 0x2EAE, 0x2F0D,
+  0x2F6C, 0x2FCC, 0x302B, 0x308B, 0x30EA, 0x314A, 0x31AA, 0x3209,
+  0x3269, 0x32C9, 0x3329, 0x3389, 0x33E9, 0x3449, 0x34A9, 0x3509,
+  0x3569, 0x35C9, 0x3629, 0x3689, 0x36E8, 0x3748, 0x37A8, 0x3807,
+  0x3867, 0x38C6, 0x3926, 0x3985, 0x39E4, 0x3A43, 0x3AA2, 0x3B00,
+  0x3B5F, 0x3BBD, 0x3C1B, 0x3C79, 0x3CD7, 0x3D35, 0x3D92, 0x3DEF,
+  0x3E4C, 0x3EA9, 0x3F05, 0x3F62, 0x3FBD, 0x4019, 0x4074, 0x40D0,
+  0x412A, 0x4185, 0x41DF, 0x4239, 0x4292, 0x42EB, 0x4344, 0x439C,
+  0x43F4, 0x444C, 0x44A3, 0x44FA, 0x4550, 0x45A6, 0x45FC, 0x4651,
+  0x46A6, 0x46FA, 0x474E, 0x47A1, 0x47F4, 0x4846, 0x4898, 0x48E9,
+  0x493A, 0x498A, 0x49D9, 0x4A29, 0x4A77, 0x4AC5, 0x4B13, 0x4B5F,
+  0x4BAC, 0x4BF7, 0x4C42, 0x4C8D, 0x4CD7, 0x4D20, 0x4D68, 0x4DB0,
+  0x4DF7, 0x4E3E, 0x4E84, 0x4EC9, 0x4F0E, 0x4F52, 0x4F95, 0x4FD7,
+  0x5019, 0x505A, 0x509A, 0x50DA, 0x5118, 0x5156, 0x5194, 0x51D0,
+  0x520C, 0x5247, 0x5281, 0x52BA, 0x52F3, 0x532A, 0x5361, 0x5397,
+  0x53CC, 0x5401, 0x5434, 0x5467, 0x5499, 0x54CA, 0x54FA, 0x5529,
+  0x5558, 0x5585, 0x55B2, 0x55DE, 0x5609, 0x5632, 0x565B, 0x5684,
+  0x56AB, 0x56D1, 0x56F6, 0x571B, 0x573E, 0x5761, 0x5782, 0x57A3,
+  0x57C3, 0x57E2, 0x57FF, 0x581C, 0x5838, 0x5853, 0x586D, 0x5886,
+  0x589E, 0x58B5, 0x58CB, 0x58E0, 0x58F4, 0x5907, 0x5919, 0x592A,
+  0x593A, 0x5949, 0x5958, 0x5965, 0x5971, 0x597C, 0x5986, 0x598F,
+  0x5997, 0x599E, 0x59A4, 0x59A9, 0x59AD, 0x59B0, 0x59B2, 0x59B3
+};
+
+static inline int32_t Clamp16(int32_t value) {
+  return value < -0x8000 ? -0x8000 : (value > 0x7FFF ? 0x7FFF : value);
+}
+
+/*
+  One envelope step every cycles samples, rates are 7 bits of shift and step like
+  the hardware. Exponential decreases scale the step by the level, exponential
+  increases slow down to a quarter above 6000h.
+*/
+static inline void SetEnvelope(int32_t* cycles,int32_t* step,int32_t* flags,int rate,bool decrease,bool exponential) {
+  int shift = rate >> 2;
+  int32_t base = decrease ? -8 + (rate & 3) : 7 - (rate & 3);
+  *cycles = 1 << (shift > 11 ? shift - 11 : 0);
+  *step = base * (1 << (shift < 11 ? 11 - shift : 0));
+  *flags = (decrease ? 2 : 0) | (exponential ? 1 : 0);
+}
+
+static inline void TickEnvelope(int32_t& level,int32_t& counter,int32_t cycles,int32_t step,int32_t flags) {
+  if (--counter > 0)
+    return;
+  if (flags == 3)
+    step = (step * level) >> 15;
+  level = level + step;
+  level = level < 0 ? 0 : (level > 0x7FFF ? 0x7FFF : level);
+  counter = flags == 1 && level > 0x6000 ? cycles * 4 : cycles;
+}
+
+Spu::Spu() : simd_level_(kSimdNone),simd_support_(kSimdNone),active_(0),fm_(0),noise_(0),reverb_voices_(0),endx_(0),
+  noise_timer_(0),noise_level_(0),parity_(0),transfer_address_(0),output_(nullptr),
+  cycles_(0),next_event_(0),irq_flag_(false),fifo_count_(0),block_cache_size_(kBlockCacheSize) {
+  memset(&sound_buffer_,0,sizeof(sound_buffer_));
+  memset(&block_cache_stats_,0,sizeof(block_cache_stats_));
+  sweeping_[0] = sweeping_[1] = 0;
 }
 
 Spu::~Spu() {
@@ -30,187 +136,736 @@ Spu::~Spu() {
 }
 
 int Spu::Initialize() {
-  sound_buffer_.Alloc(512*1024);
-  memset(&voices,0,sizeof(voices));
-  spu_control.raw = 0;
-  spu_status2.raw = 0;
-  cd_vol_left.raw = 0;
-  cd_vol_right.raw = 0;
-  external_vol_left.raw = 0;
-  external_vol_right.raw = 0;
-  spu_control2 = 0;
-  voice_on1 = 0;
-  voice_on2 = 0;
-  voice_off1 = 0;
-  voice_off2 = 0;
-  channel_fm_mode1 = 0;
-  channel_fm_mode2 = 0;
-  noise_mode1 = 0;
-  noise_mode2 = 0;
-  reverb_mode1 = 0;
-  reverb_mode2 = 0;
-  main_volume_left = 0;
-  main_volume_right = 0;
-  reverb_depth_left = 0;
-  reverb_depth_right = 0;
-  reverb_workarea_start = 0;
-  soundbuffer_irq_address1 = 0;
-  soundbuffer_irq_address2 = 0;
-  spu_data = 0;
+  sound_buffer_.Alloc(kSoundRamSize);
+  memset(sound_buffer_.u8,0,kSoundRamSize);
+  memset(voice_regs_,0,sizeof(voice_regs_));
+  memset(control_regs_,0,sizeof(control_regs_));
+  memset(&voices_,0,sizeof(voices_));
+  memset(&adsr_,0,sizeof(adsr_));
+  memset(sweep_,0,sizeof(sweep_));
+  memset(decoded_,0,sizeof(decoded_));
+  active_ = fm_ = noise_ = endx_ = reverb_voices_ = 0;
+  reverb_.Initialize(sound_buffer_.u16,control_regs_);
+  sweeping_[0] = sweeping_[1] = 0;
+  noise_timer_ = 0;
+  noise_level_ = 1;
+  parity_ = 0;
+  transfer_address_ = 0;
+  cycles_ = 0;
+  next_event_ = kIrqHorizon * kCyclesPerSample;
+  irq_flag_ = false;
+  fifo_count_ = 0;
+  ResetBlockCache();
+  simd_support_ = DetectSimdLevel();
+  simd_level_ = simd_support_;
+  //headless users drive the registers directly without a system
+  if (system_ != nullptr)
+    MapPorts();
   return 0;
 }
 
 int Spu::Deinitialize() {
-  sound_buffer_.Dealloc();
+  if (sound_buffer_.u8 != nullptr)
+    sound_buffer_.Dealloc();
+  std::vector<BlockCacheEntry>().swap(block_cache_);
   return 0;
 }
 
-uint16_t  Spu::Read(uint32_t address) {
-
-  if (address >= 0x1F801C00 && address <= 0x1F801D7F) {
-    int voice_index = ((address & 0xFF0) >> 4) - 0xC0;
-    auto& voice = voices[voice_index];
-    switch (address & 0xF ) {
-      case 0x0: return voice.vol_left.raw;
-      case 0x2: return voice.vol_right.raw;
-      case 0x4: return voice.pitch.raw;
-      case 0x6: return voice.start_address;
-      case 0x8: return voice.ads_levels.raw;
-      case 0xA: return voice.sr_rates.raw;
-      case 0xC: return voice.current_adsr_volume;
-      case 0xE: return voice.repeat_address;
+//the CPU sees the SPU as it is at the current cycle
+uint32_t Spu::ReadPort(void* param,uint32_t address) {
+  Spu* spu = (Spu*)param;
+  spu->Run(spu->system_->cpu().context()->cycles);
+  return spu->ReadRegister(address);
+}
+
+void Spu::WritePort(void* param,uint32_t address,uint32_t data) {
+  Spu* spu = (Spu*)param;
+  spu->Run(spu->system_->cpu().context()->cycles);
+  spu->WriteRegister(address,(uint16_t)data);
+  spu->ScheduleIrq();
+}
+
+void Spu::set_simd_level(SimdLevel level) {
+  simd_level_ = level < simd_support_ ? level : simd_support_;
+  reverb_.set_simd_level(level);
+}
+
+void Spu::set_block_cache_size(uint32_t size) {
+  block_cache_size_ = size;
+  ResetBlockCache();
+}
+
+//a power of two number of entries that fits the cap, direct mapped
+void Spu::ResetBlockCache() {
+  uint32_t entries = 0;
+  while ((entries ? entries * 2 : 1) * sizeof(BlockCacheEntry) <= block_cache_size_)
+    entries = entries ? entries * 2 : 1;
+  BlockCacheEntry empty;
+  memset(&empty,0,sizeof(empty));
+  empty.block = 0xFFFF;
+  block_cache_.assign(entries,empty);
+  memset(block_generation_,0,sizeof(block_generation_));
+  memset(&block_cache_stats_,0,sizeof(block_cache_stats_));
+}
+
+void Spu::InvalidateBlocks(uint32_t address,uint32_t size) {
+  if (block_cache_.empty() || size == 0)
+    return;
+  uint32_t first = (address & (kSoundRamSize-1)) >> 4;
+  uint32_t count = ((address & 15) + size + 15) >> 4;
+  count = count > kBlockCount ? kBlockCount : count;
+  for (uint32_t i=0;i<count;++i) {
+    uint32_t block = (first + i) & (kBlockCount-1);
+    //a wrapped generation could match an old entry again
+    if (++block_generation_[block] == 0) {
+      for (size_t n=0;n<block_cache_.size();++n)
+        block_cache_[n].block = 0xFFFF;
     }
   }
-  switch (address) {
-    case 0x1F801D80: return main_volume_left;
-    case 0x1F801D82: return main_volume_right;
-    case 0x1F801D84: return reverb_depth_left;
-    case 0x1F801D86: return reverb_depth_right;
-    case 0x1F801D88: return voice_on1;
-    case 0x1F801D8A: return voice_on2;
-    case 0x1F801D8C: return voice_off1;
-    case 0x1F801D8E: return voice_off2;
-    case 0x1F801D90: return channel_fm_mode1;
-    case 0x1F801D92: return channel_fm_mode2;
-    case 0x1F801D94: return noise_mode1;
-    case 0x1F801D96: return noise_mode2;
-    case 0x1F801D98: return reverb_mode1;
-    case 0x1F801D9A: return reverb_mode2;
-    case 0x1F801DAA: return spu_control.raw;
-    case 0x1F801DAC: return spu_control2;
-    case 0x1F801DAE: return spu_status2.raw;
-  }
-  BREAKPOINT
-  return 0;
+  block_cache_stats_.blocks_invalidated += count;
 }
 
-void Spu::Write(uint32_t address,uint16_t data) {
-
-  if (address >= 0x1F801C00 && address <= 0x1F801D7F) {
-    int voice_index = ((address & 0xFF0) >> 4) - 0xC0;
-    auto& voice = voices[voice_index];
-    switch (address & 0xF ) {
-      case 0x0:voice.vol_left.raw = data; return;
-      case 0x2:voice.vol_right.raw = data; return;
-      case 0x4:voice.pitch.raw = data; return;
-      case 0x6:voice.start_address = data; return;
-      case 0x8:voice.ads_levels.raw = data; return;
-      case 0xA:voice.sr_rates.raw = data; return;
-      case 0xC:voice.current_adsr_volume = data; return;
-      case 0xE:voice.repeat_address = data; return;
-    }
+void Spu::MapPorts() {
+  auto& io = system_->io();
+  for (uint32_t address=0x1F801C00;address<0x1F801E00;address+=2)
+    io.MapPort(kM16,address,this,ReadPort,WritePort);
+}
+
+uint16_t Spu::ReadRegister(uint32_t address) {
+  uint32_t offset = (address - 0x1F801C00) >> 1;
+  if (offset < 0xC0) {
+    int voice = offset >> 3;
+    if (voice >= kVoiceCount)
+      return 0;
+    if ((offset & 7) == kAdsrVolume)
+      return (uint16_t)adsr_.level[voice];
+    return voice_regs_[offset & 7][voice];
+  }
+  int reg = offset - 0xC0;
+  switch (reg) {
+    case kEndx:
+      return (uint16_t)endx_;
+    case kEndx + 1:
+      return (uint16_t)(endx_ >> 16);
+    case kStatus:
+      return (control_regs_[kControl] & 0x3F) | (irq_flag_ ? 0x40 : 0);
   }
+  return control_regs_[reg & 0x3F];
+}
 
-  switch (address) {
-    case 0x1F801D80: main_volume_left = data; return;
-    case 0x1F801D82: main_volume_right = data; return;
-    case 0x1F801D84: reverb_depth_left = data; return;
-    case 0x1F801D86: reverb_depth_right = data; return;
-      //voice on
-    case 0x1F801D88: 
-      voice_on1 = data;
-      for (int i=0;i<16;++i) {
-        voices[i].voice_on = (data & (1 << i)) == 1;
-      }
+/*
+  Voice flag registers come in pairs, the low register covers voices 0-15
+  and the high one voices 16-23.
+*/
+void Spu::WriteRegister(uint32_t address,uint16_t data) {
+  uint32_t offset = (address - 0x1F801C00) >> 1;
+  if (offset < 0xC0) {
+    int voice = offset >> 3;
+    if (voice >= kVoiceCount)
       return;
-    case 0x1F801D8A: 
-      voice_on2 = data;
-      for (int i=0;i<8;++i) {
-        voices[16+i].voice_on = (data & (1 << i)) == 1;
-      }
+    voice_regs_[offset & 7][voice] = data;
+    switch (offset & 7) {
+      case kVolumeLeft: SetVolume(voice,0); break;
+      case kVolumeRight: SetVolume(voice,1); break;
+      case kAdsrVolume: adsr_.level[voice] = data & 0x7FFF; break;
+    }
+    return;
+  }
+  int reg = (offset - 0xC0) & 0x3F;
+  switch (reg) {
+    case kEndx:
+    case kEndx + 1:
+    case kStatus:
       return;
-      //voice off
-    case 0x1F801D8C: 
-      voice_off1 = data;
-      for (int i=0;i<16;++i) {
-        voices[i].voice_on = (data & (1 << i)) == 0;
-      }
+  }
+  uint16_t previous = control_regs_[reg];
+  control_regs_[reg] = data;
+  switch (reg) {
+    case kReverbBase:
+      reverb_.set_base(data);
+      InvalidateBlocks(reverb_.base(),kSoundRamSize - reverb_.base());
       return;
-    case 0x1F801D8E: 
-      voice_off2 = data;
-      for (int i=0;i<8;++i) {
-        voices[16+i].voice_on = (data & (1 << i)) == 0;
-      }
+    case kControl:
+      //clearing the IRQ enable acknowledges the IRQ
+      if ((data & 0x40) == 0)
+        irq_flag_ = false;
+      //blocks decoded while the reverb didn't write its work area
+      if ((data & ~previous) & 0x80)
+        InvalidateBlocks(reverb_.base(),kSoundRamSize - reverb_.base());
+      //manual write mode writes out the FIFO
+      if (((data >> 4) & 3) == 1)
+        FlushFifo();
       return;
-      //channel fm
-    case 0x1F801D90: 
-      channel_fm_mode1 = data;
-      for (int i=0;i<16;++i) {
-        voices[i].fm = (data & (1 << i)) == 1;
-      }
+    case kTransferAddress:
+      transfer_address_ = ((uint32_t)data << 3) & (kSoundRamSize-1);
       return;
-    case 0x1F801D92: 
-      channel_fm_mode2 = data;
-      for (int i=0;i<8;++i) {
-        voices[16+i].fm = (data & (1 << i)) == 1;
-      }
+    case kDataPort:
+      if (fifo_count_ == kFifoSize)
+        FlushFifo();
+      fifo_[fifo_count_++] = data;
       return;
-      //noise
-    case 0x1F801D94: 
-      noise_mode1 = data;
-      for (int i=0;i<16;++i) {
-        voices[i].noise = (data & (1 << i)) == 1;
+  }
+  switch (reg & ~1) {
+    case kKeyOn:
+    case kKeyOff:
+    case kFmMode:
+    case kNoiseMode:
+    case kReverbMode:
+      WriteVoiceFlags(reg,data);
+      break;
+  }
+}
+
+void Spu::WriteVoiceFlags(int reg,uint16_t data) {
+  int first = (reg & 1) ? 16 : 0;
+  int count = (reg & 1) ? 8 : 16;
+  uint32_t mask = ((1u << count) - 1) << first;
+  uint32_t bits = ((uint32_t)data << first) & mask;
+  switch (reg & ~1) {
+    case kKeyOn:
+      for (int i=first;i<first+count;++i) {
+        if (bits & (1 << i))
+          KeyOn(i);
       }
-      return;
-    case 0x1F801D96: 
-      noise_mode2 = data;
-      for (int i=0;i<8;++i) {
-        voices[16+i].noise = (data & (1 << i)) == 1;
+      break;
+    case kKeyOff:
+      for (int i=first;i<first+count;++i) {
+        if (bits & (1 << i))
+          KeyOff(i);
       }
-      return;
-      //reverb
-    case 0x1F801D98: 
-      reverb_mode1 = data;
-      for (int i=0;i<16;++i) {
-        voices[i].reverb = (data & (1 << i)) == 1;
+      break;
+    case kFmMode:
+      //voice 0 has no voice before it to modulate it
+      fm_ = ((fm_ & ~mask) | bits) & ~1u;
+      break;
+    case kNoiseMode:
+      noise_ = (noise_ & ~mask) | bits;
+      break;
+    case kReverbMode:
+      reverb_voices_ = (reverb_voices_ & ~mask) | bits;
+      break;
+  }
+}
+
+void Spu::KeyOn(int voice) {
+  int32_t* decoded = &decoded_[voice*kDecodedSize];
+  decoded[kBlockSamples] = decoded[kBlockSamples+1] = decoded[kBlockSamples+2] = 0;
+  voices_.counter[voice] = 0;
+  voices_.address[voice] = voice_regs_[kStartAddress][voice] << 3;
+  StartBlock(voice);
+  adsr_.level[voice] = 0;
+  SetPhase(voice,kPhaseAttack);
+  endx_ &= ~(1u << voice);
+  active_ |= 1u << voice;
+}
+
+void Spu::KeyOff(int voice) {
+  if (voices_.phase[voice] != kPhaseOff)
+    SetPhase(voice,kPhaseRelease);
+}
+
+void Spu::SetPhase(int voice,int phase) {
+  uint16_t low = voice_regs_[kAdsrLow][voice];
+  uint16_t high = voice_regs_[kAdsrHigh][voice];
+  int32_t* cycles = &adsr_.cycles[voice];
+  int32_t* step = &adsr_.step[voice];
+  int32_t* flags = &adsr_.flags[voice];
+  voices_.phase[voice] = phase;
+  adsr_.counter[voice] = 1;
+  switch (phase) {
+    case kPhaseAttack:
+      SetEnvelope(cycles,step,flags,(low >> 8) & 0x7F,false,(low & 0x8000) != 0);
+      adsr_.target[voice] = 0x7FFF;
+      break;
+    case kPhaseDecay:
+      SetEnvelope(cycles,step,flags,((low >> 4) & 0xF) << 2,true,true);
+      adsr_.target[voice] = ((low & 0xF) + 1) * 0x800;
+      break;
+    case kPhaseSustain:
+      SetEnvelope(cycles,step,flags,(high >> 6) & 0x7F,(high & 0x4000) != 0,(high & 0x8000) != 0);
+      adsr_.target[voice] = (high & 0x4000) ? -1 : 0x8000;
+      break;
+    case kPhaseRelease:
+      SetEnvelope(cycles,step,flags,(high & 0x1F) << 2,true,(high & 0x20) != 0);
+      adsr_.target[voice] = 0;
+      break;
+    default:
+      active_ &= ~(1u << voice);
+      adsr_.level[voice] = 0;
+      *step = 0;
+      *flags = 0;
+      adsr_.target[voice] = 0x8000;
+      break;
+  }
+}
+
+/*
+  Bit 15 clear is a fixed volume of bits 0-14 times 2, set is a sweep from the
+  current level with the rate in bits 0-6. Bit 12 makes the sweep negative.
+*/
+void Spu::SetVolume(int voice,int side) {
+  uint16_t data = voice_regs_[kVolumeLeft + side][voice];
+  int32_t* volume = side == 0 ? voices_.volume_left : voices_.volume_right;
+  Envelopes& sweep = sweep_[side];
+  if ((data & 0x8000) == 0) {
+    volume[voice] = (int16_t)(data << 1);
+    sweeping_[side] &= ~(1u << voice);
+    return;
+  }
+  sweep.level[voice] = volume[voice] < 0 ? -volume[voice] : volume[voice];
+  sweep.level[voice] = sweep.level[voice] > 0x7FFF ? 0x7FFF : sweep.level[voice];
+  sweep.counter[voice] = 1;
+  sweep.target[voice] = (data >> 12) & 1;
+  SetEnvelope(&sweep.cycles[voice],&sweep.step[voice],&sweep.flags[voice],data & 0x7F,(data & 0x2000) != 0,(data & 0x4000) != 0);
+  sweeping_[side] |= 1u << voice;
+}
+
+void Spu::DecodeBlock(const uint8_t* block,int32_t* out) {
+  int shift = block[0] & 0xF;
+  if (shift > 12)
+    shift = 9;
+  int filter = (block[0] >> 4) & 7;
+  if (filter > 4)
+    filter = 4;
+  int32_t older = out[1], old = out[2];
+  for (int i=0;i<kBlockSamples;++i) {
+    int32_t nibble = (block[2 + (i >> 1)] >> ((i & 1) << 2)) & 0xF;
+    int32_t sample = (int16_t)(nibble << 12) >> shift;
+    sample = Clamp16(sample + ((old * kAdpcmPositive[filter] + older * kAdpcmNegative[filter] + 32) >> 6));
+    out[3 + i] = sample;
+    older = old;
+    old = sample;
+  }
+}
+
+/*
+  Decodes the block at the voice address after keeping the last 3 samples of the
+  previous one for the interpolation, or copies it from the cache when the block
+  was decoded before from the same 2 previous samples. A loop start flag makes the
+  block the repeat address.
+*/
+void Spu::StartBlock(int voice) {
+  int32_t* out = &decoded_[voice*kDecodedSize];
+  out[0] = out[kBlockSamples];
+  out[1] = out[kBlockSamples+1];
+  out[2] = out[kBlockSamples+2];
+  uint32_t address = voices_.address[voice] & (kSoundRamSize-1) & ~15u;
+  const uint8_t* block = &sound_buffer_.u8[address];
+  //the reverb work area changes all the time while the reverb writes it
+  bool reverb_area = (control_regs_[kControl] & 0x80) && address >= reverb_.base();
+  if (block_cache_.empty() || reverb_area) {
+    DecodeBlock(block,out);
+  } else {
+    uint32_t index = address >> 4;
+    int16_t older = 0, old = 0;
+    if (block[0] & 0x70) {
+      older = (int16_t)out[1];
+      old = (int16_t)out[2];
+    }
+    uint32_t hash = index * 0x9E3779B1u + (uint16_t)old * 0x85EBCA6Bu + (uint16_t)older * 0xC2B2AE35u;
+    BlockCacheEntry& entry = block_cache_[(hash ^ (hash >> 15)) & (block_cache_.size()-1)];
+    if (entry.block == index && entry.generation == block_generation_[index] && entry.old == old && entry.older == older) {
+      for (int i=0;i<kBlockSamples;++i)
+        out[3 + i] = entry.samples[i];
+      ++block_cache_stats_.hits;
+    } else {
+      DecodeBlock(block,out);
+      entry.block = (uint16_t)index;
+      entry.generation = block_generation_[index];
+      entry.old = old;
+      entry.older = older;
+      for (int i=0;i<kBlockSamples;++i)
+        entry.samples[i] = (int16_t)out[3 + i];
+      ++block_cache_stats_.misses;
+    }
+  }
+  voices_.block_flags[voice] = block[1];
+  if (block[1] & 0x4)
+    voice_regs_[kRepeatAddress][voice] = (uint16_t)(address >> 3);
+  CheckIrq(address,16);
+}
+
+//raises the IRQ when the IRQ address is in size bytes of sound RAM from address
+void Spu::CheckIrq(uint32_t address,uint32_t size) {
+  if ((control_regs_[kControl] & 0x40) == 0 || irq_flag_)
+    return;
+  uint32_t irq = ((uint32_t)control_regs_[kIrqAddress] << 3) & (kSoundRamSize-1);
+  if (((irq - address) & (kSoundRamSize-1)) < size) {
+    irq_flag_ = true;
+    if (system_ != nullptr)
+      system_->io().SetInterrupt(kInterruptSPU);
+  }
+}
+
+/*
+  Transfers run at the transfer address and wrap at the end of sound RAM, one
+  copy for each side of the wrap.
+*/
+void Spu::WriteSoundRam(const uint16_t* data,uint32_t count) {
+  uint32_t size = count * 2;
+  uint32_t address = transfer_address_;
+  while (count != 0) {
+    uint32_t run = (kSoundRamSize - address) >> 1;
+    run = run < count ? run : count;
+    memcpy(&sound_buffer_.u16[address >> 1],data,run * 2);
+    data += run;
+    count -= run;
+    address = (address + run * 2) & (kSoundRamSize-1);
+  }
+  InvalidateBlocks(transfer_address_,size);
+  CheckIrq(transfer_address_,size);
+  transfer_address_ = address;
+}
+
+void Spu::ReadSoundRam(uint16_t* data,uint32_t count) {
+  uint32_t size = count * 2;
+  uint32_t address = transfer_address_;
+  while (count != 0) {
+    uint32_t run = (kSoundRamSize - address) >> 1;
+    run = run < count ? run : count;
+    memcpy(data,&sound_buffer_.u16[address >> 1],run * 2);
+    data += run;
+    count -= run;
+    address = (address + run * 2) & (kSoundRamSize-1);
+  }
+  CheckIrq(transfer_address_,size);
+  transfer_address_ = address;
+}
+
+void Spu::FlushFifo() {
+  if (fifo_count_ == 0)
+    return;
+  WriteSoundRam(fifo_,fifo_count_);
+  fifo_count_ = 0;
+}
+
+/*
+  DMA channel 4, count words. The SPU is caught up first so the voices see sound
+  RAM change at the cycle of the transfer.
+*/
+void Spu::DmaWrite(const uint32_t* words,uint32_t count) {
+  if (system_ != nullptr)
+    Run(system_->cpu().context()->cycles);
+  FlushFifo();
+  WriteSoundRam((const uint16_t*)words,count * 2);
+  ScheduleIrq();
+}
+
+void Spu::DmaRead(uint32_t* words,uint32_t count) {
+  if (system_ != nullptr)
+    Run(system_->cpu().context()->cycles);
+  ReadSoundRam((uint16_t*)words,count * 2);
+  ScheduleIrq();
+}
+
+/*
+  A block with the loop end flag sets ENDX and continues at the repeat address,
+  without the repeat flag the voice is also silenced.
+*/
+void Spu::NextBlock(int voice) {
+  int32_t flags = voices_.block_flags[voice];
+  if (flags & 0x1) {
+    endx_ |= 1u << voice;
+    voices_.address[voice] = voice_regs_[kRepeatAddress][voice] << 3;
+    if ((flags & 0x2) == 0) {
+      adsr_.level[voice] = 0;
+      SetPhase(voice,kPhaseRelease);
+    }
+  } else {
+    voices_.address[voice] += 16;
+  }
+  StartBlock(voice);
+}
+
+void Spu::TickNoise() {
+  uint16_t control = control_regs_[kControl];
+  int shift = (control >> 10) & 0xF;
+  noise_timer_ -= ((control >> 8) & 3) + 4;
+  if (noise_timer_ < 0) {
+    uint16_t parity = ((noise_level_ >> 15) ^ (noise_level_ >> 12) ^ (noise_level_ >> 11) ^ (noise_level_ >> 10) ^ 1) & 1;
+    noise_level_ = (uint16_t)((noise_level_ << 1) | parity);
+    noise_timer_ += 0x20000 >> shift;
+    if (noise_timer_ < 0)
+      noise_timer_ += 0x20000 >> shift;
+  }
+}
+
+//the sweep target holds the negative phase flag instead
+void Spu::TickSweeps() {
+  for (int side=0;side<2;++side) {
+    Envelopes& sweep = sweep_[side];
+    int32_t* volume = side == 0 ? voices_.volume_left : voices_.volume_right;
+    for (uint32_t bits=sweeping_[side];bits!=0;bits&=bits-1) {
+      unsigned long v;
+      _BitScanForward(&v,bits);
+      TickEnvelope(sweep.level[v],sweep.counter[v],sweep.cycles[v],sweep.step[v],sweep.flags[v]);
+      volume[v] = sweep.target[v] ? -sweep.level[v] : sweep.level[v];
+    }
+  }
+}
+
+//the reverb only runs while it is enabled in the control register
+void Spu::AddReverb(int32_t* left,int32_t* right,int32_t reverb_left,int32_t reverb_right) {
+  if ((control_regs_[kControl] & 0x80) == 0)
+    return;
+  int32_t out_left, out_right;
+  reverb_.Process(reverb_left,reverb_right,true,&out_left,&out_right);
+  *left += out_left;
+  *right += out_right;
+}
+
+//main volume, SPU enable and unmute
+int16_t Spu::FinishSample(int32_t sum,int reg) {
+  uint16_t control = control_regs_[kControl];
+  if ((control & 0xC000) != 0xC000)
+    return 0;
+  uint16_t data = control_regs_[reg];
+  int32_t volume = (data & 0x8000) ? 0x7FFF : (int16_t)(data << 1);
+  return (int16_t)Clamp16((Clamp16(sum) * volume) >> 15);
+}
+
+void Spu::Mix(int16_t* samples,int count) {
+  if (simd_level_ >= kSimdAVX2)
+    MixAVX2(samples,count);
+  else
+    MixScalar(samples,count);
+}
+
+void Spu::Run(uint64_t cycles) {
+  while (cycles >= cycles_ + kCyclesPerSample) {
+    uint64_t due = (cycles - cycles_) / kCyclesPerSample;
+    int count = due < kMixChunk ? (int)due : kMixChunk;
+    Mix(mix_buffer_,count);
+    if (output_ != nullptr)
+      output_->Push(mix_buffer_,count);
+    cycles_ += count * kCyclesPerSample;
+  }
+  ScheduleIrq();
+}
+
+/*
+  Finds the first sample a voice starts the block with the IRQ address, from the
+  pitch and the block flags in sound RAM as they are now. FM voices are assumed
+  to run at the highest pitch so the prediction is never late for them. Without a
+  hit within kIrqHorizon samples the SPU still catches up after that many.
+*/
+void Spu::ScheduleIrq() {
+  int best = kIrqHorizon;
+  if ((control_regs_[kControl] & 0x40) && !irq_flag_) {
+    uint32_t irq_block = ((uint32_t)control_regs_[kIrqAddress] << 3) & (kSoundRamSize-1) & ~15u;
+    for (uint32_t bits=active_;bits!=0;bits&=bits-1) {
+      unsigned long v;
+      _BitScanForward(&v,bits);
+      int32_t step = (fm_ & (1u << v)) ? 0x4000 : voice_regs_[kPitch][v];
+      step = step > 0x4000 ? 0x4000 : step;
+      if (step == 0)
+        continue;
+      int32_t counter = voices_.counter[v];
+      uint32_t address = voices_.address[v] & (kSoundRamSize-1) & ~15u;
+      uint32_t repeat = (uint32_t)voice_regs_[kRepeatAddress][v] << 3;
+      int32_t flags = voices_.block_flags[v];
+      int samples = 0;
+      while (samples < best) {
+        //the voice is silenced after an end block without repeat
+        if ((flags & 0x3) == 0x1)
+          break;
+        int32_t due = ((kBlockSamples << 12) - counter + step - 1) / step;
+        samples += due;
+        counter += due * step - (kBlockSamples << 12);
+        address = (flags & 0x1) ? repeat & (kSoundRamSize-1) & ~15u : (address + 16) & (kSoundRamSize-1);
+        if (address == irq_block) {
+          best = samples < best ? samples : best;
+          break;
+        }
+        flags = sound_buffer_.u8[address + 1];
+        if (flags & 0x4)
+          repeat = address;
       }
-      return;
-    case 0x1F801D9A: 
-      reverb_mode2 = data;
-      for (int i=0;i<8;++i) {
-        voices[16+i].reverb = (data & (1 << i)) == 1;
+    }
+  }
+  next_event_ = cycles_ + (uint64_t)best * kCyclesPerSample;
+}
+
+/*
+  The reference mixer, one voice at a time.
+*/
+void Spu::MixScalar(int16_t* samples,int count) {
+  for (int n=0;n<count;++n) {
+    TickNoise();
+    const int32_t* fm_in = voices_.output[parity_ ^ 1];
+    int32_t* out = voices_.output[parity_];
+    int32_t left = 0, right = 0, reverb_left = 0, reverb_right = 0;
+    for (int v=0;v<kVoiceCount;++v) {
+      uint32_t bit = 1u << v;
+      if ((active_ & bit) == 0) {
+        out[v+1] = 0;
+        continue;
       }
-      return;
-    case 0x1F801DA2: reverb_workarea_start = data; return;
-    case 0x1F801DA4: soundbuffer_irq_address1 = data; return;
-    case 0x1F801DA6: soundbuffer_irq_address2 = data; return;
-    case 0x1F801DA8: spu_data = data; return;
-    case 0x1F801DAA: spu_control.raw = data; return;
-    case 0x1F801DAC: spu_control2 = data; return;
-    case 0x1F801DB0: cd_vol_left.raw = data; return;
-    case 0x1F801DB2: cd_vol_right.raw = data; return;
-    case 0x1F801DB4: external_vol_left.raw = data; return;
-    case 0x1F801DB6: external_vol_right.raw = data; return;
-  }
-
-  if (address >= 0x1F801DC0 && address <= 0X1F801DFE) {
-    effects[((address&0xFF)>>1)-0x60] = data;
-    return;
+      int32_t step = voice_regs_[kPitch][v];
+      if (fm_ & bit)
+        step = (int32_t)(((uint32_t)step * (uint32_t)(Clamp16(fm_in[v]) + 0x8000)) >> 15);
+      step = step > 0x4000 ? 0x4000 : step;
+      voices_.counter[v] += step;
+      if (voices_.counter[v] >= (kBlockSamples << 12)) {
+        voices_.counter[v] -= kBlockSamples << 12;
+        NextBlock(v);
+      }
+      int32_t counter = voices_.counter[v];
+      int g = (counter >> 4) & 0xFF;
+      const int32_t* s = &decoded_[v*kDecodedSize + (counter >> 12)];
+      int32_t sample = (kGauss[0xFF - g] * s[0] + kGauss[0x1FF - g] * s[1] + kGauss[0x100 + g] * s[2] + kGauss[g] * s[3]) >> 15;
+      if (noise_ & bit)
+        sample = (int16_t)noise_level_;
+      TickEnvelope(adsr_.level[v],adsr_.counter[v],adsr_.cycles[v],adsr_.step[v],adsr_.flags[v]);
+      int32_t level = adsr_.level[v];
+      if ((adsr_.flags[v] & kEnvelopeDecrease) ? level <= adsr_.target[v] : level >= adsr_.target[v])
+        SetPhase(v,voices_.phase[v] == kPhaseRelease ? kPhaseOff : voices_.phase[v] + 1);
+      int32_t voice_out = (sample * level) >> 15;
+      out[v+1] = voice_out;
+      int32_t voice_left = (voice_out * voices_.volume_left[v]) >> 15;
+      int32_t voice_right = (voice_out * voices_.volume_right[v]) >> 15;
+      left += voice_left;
+      right += voice_right;
+      if (reverb_voices_ & bit) {
+        reverb_left += voice_left;
+        reverb_right += voice_right;
+      }
+    }
+    TickSweeps();
+    AddReverb(&left,&right,reverb_left,reverb_right);
+    samples[n*2] = FinishSample(left,kMainVolumeLeft);
+    samples[n*2+1] = FinishSample(right,kMainVolumeRight);
+    parity_ ^= 1;
   }
+}
 
+/*
+  8 voices per iteration, the 4 samples and 4 weights of the interpolation are
+  gathered. Block changes and ADSR phase changes are rare and done per voice.
+*/
+void Spu::MixAVX2(int16_t* samples,int count) {
+  const __m256i lane_bits = _mm256_setr_epi32(1,2,4,8,16,32,64,128);
+  const __m256i lane_base = _mm256_setr_epi32(0,kDecodedSize,kDecodedSize*2,kDecodedSize*3,kDecodedSize*4,
+                                              kDecodedSize*5,kDecodedSize*6,kDecodedSize*7);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi32(1);
+  auto lanes = [&](uint32_t bits) {
+    return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits & 0xFF),lane_bits),lane_bits);
+  };
+  for (int n=0;n<count;++n) {
+    TickNoise();
+    const int32_t* fm_in = voices_.output[parity_ ^ 1];
+    int32_t* out = voices_.output[parity_];
+    __m256i left = zero, right = zero, reverb_left = zero, reverb_right = zero;
+    for (int first=0;first<kVoiceCount;first+=8) {
+      uint32_t group = (active_ >> first) & 0xFF;
+      if (group == 0) {
+        _mm256_storeu_si256((__m256i*)&out[first+1],zero);
+        continue;
+      }
+      __m256i active = lanes(group);
+      __m256i step = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&voice_regs_[kPitch][first]));
+      uint32_t fm = (fm_ >> first) & 0xFF;
+      if (fm != 0) {
+        __m256i factor = _mm256_loadu_si256((const __m256i*)&fm_in[first]);
+        factor = _mm256_min_epi32(_mm256_max_epi32(factor,_mm256_set1_epi32(-0x8000)),_mm256_set1_epi32(0x7FFF));
+        factor = _mm256_add_epi32(factor,_mm256_set1_epi32(0x8000));
+        __m256i modulated = _mm256_srli_epi32(_mm256_mullo_epi32(step,factor),15);
+        step = _mm256_blendv_epi8(step,modulated,lanes(fm));
+      }
+      step = _mm256_and_si256(_mm256_min_epi32(step,_mm256_set1_epi32(0x4000)),active);
+      __m256i counter = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)&voices_.counter[first]),step);
+      _mm256_storeu_si256((__m256i*)&voices_.counter[first],counter);
+      uint32_t wrapped = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(counter,_mm256_set1_epi32((kBlockSamples << 12) - 1))));
+      if (wrapped != 0) {
+        for (int i=0;i<8;++i) {
+          if (wrapped & (1 << i)) {
+            voices_.counter[first+i] -= kBlockSamples << 12;
+            NextBlock(first+i);
+          }
+        }
+        counter = _mm256_loadu_si256((const __m256i*)&voices_.counter[first]);
+      }
 
-  BREAKPOINT
+      //gaussian interpolation
+      __m256i index = _mm256_add_epi32(_mm256_set1_epi32(first*kDecodedSize),_mm256_add_epi32(lane_base,_mm256_srli_epi32(counter,12)));
+      __m256i g = _mm256_and_si256(_mm256_srli_epi32(counter,4),_mm256_set1_epi32(0xFF));
+      __m256i s0 = _mm256_i32gather_epi32((const int*)decoded_,index,4);
+      __m256i s1 = _mm256_i32gather_epi32((const int*)decoded_ + 1,index,4);
+      __m256i s2 = _mm256_i32gather_epi32((const int*)decoded_ + 2,index,4);
+      __m256i s3 = _mm256_i32gather_epi32((const int*)decoded_ + 3,index,4);
+      __m256i w0 = _mm256_i32gather_epi32((const int*)kGauss,_mm256_sub_epi32(_mm256_set1_epi32(0xFF),g),4);
+      __m256i w1 = _mm256_i32gather_epi32((const int*)kGauss,_mm256_sub_epi32(_mm256_set1_epi32(0x1FF),g),4);
+      __m256i w2 = _mm256_i32gather_epi32((const int*)kGauss,_mm256_add_epi32(_mm256_set1_epi32(0x100),g),4);
+      __m256i w3 = _mm256_i32gather_epi32((const int*)kGauss,g,4);
+      __m256i sample = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(w0,s0),_mm256_mullo_epi32(w1,s1)),
+                                        _mm256_add_epi32(_mm256_mullo_epi32(w2,s2),_mm256_mullo_epi32(w3,s3)));
+      sample = _mm256_srai_epi32(sample,15);
+      uint32_t noise = (noise_ >> first) & 0xFF;
+      if (noise != 0)
+        sample = _mm256_blendv_epi8(sample,_mm256_set1_epi32((int16_t)noise_level_),lanes(noise));
+
+      //ADSR envelope step where the counter runs out
+      __m256i level = _mm256_loadu_si256((const __m256i*)&adsr_.level[first]);
+      __m256i env_counter = _mm256_loadu_si256((const __m256i*)&adsr_.counter[first]);
+      __m256i cycles = _mm256_loadu_si256((const __m256i*)&adsr_.cycles[first]);
+      __m256i env_step = _mm256_loadu_si256((const __m256i*)&adsr_.step[first]);
+      __m256i flags = _mm256_loadu_si256((const __m256i*)&adsr_.flags[first]);
+      env_counter = _mm256_blendv_epi8(env_counter,_mm256_sub_epi32(env_counter,one),active);
+      __m256i fire = _mm256_and_si256(_mm256_cmpgt_epi32(one,env_counter),active);
+      __m256i exp_decrease = _mm256_cmpeq_epi32(flags,_mm256_set1_epi32(3));
+      env_step = _mm256_blendv_epi8(env_step,_mm256_srai_epi32(_mm256_mullo_epi32(env_step,level),15),exp_decrease);
+      __m256i next = _mm256_add_epi32(level,env_step);
+      next = _mm256_min_epi32(_mm256_max_epi32(next,zero),_mm256_set1_epi32(0x7FFF));
+      __m256i slow = _mm256_and_si256(_mm256_cmpeq_epi32(flags,one),_mm256_cmpgt_epi32(next,_mm256_set1_epi32(0x6000)));
+      cycles = _mm256_blendv_epi8(cycles,_mm256_slli_epi32(cycles,2),slow);
+      level = _mm256_blendv_epi8(level,next,fire);
+      env_counter = _mm256_blendv_epi8(env_counter,cycles,fire);
+      _mm256_storeu_si256((__m256i*)&adsr_.level[first],level);
+      _mm256_storeu_si256((__m256i*)&adsr_.counter[first],env_counter);
+      __m256i target = _mm256_loadu_si256((const __m256i*)&adsr_.target[first]);
+      __m256i decrease = _mm256_cmpeq_epi32(_mm256_and_si256(flags,_mm256_set1_epi32(kEnvelopeDecrease)),_mm256_set1_epi32(kEnvelopeDecrease));
+      __m256i above = _mm256_cmpgt_epi32(level,target);
+      __m256i below = _mm256_cmpgt_epi32(target,level);
+      __m256i reached = _mm256_andnot_si256(_mm256_blendv_epi8(below,above,decrease),active);
+      uint32_t phases = _mm256_movemask_ps(_mm256_castsi256_ps(reached));
+      if (phases != 0) {
+        for (int i=0;i<8;++i) {
+          if (phases & (1 << i)) {
+            int v = first + i;
+            SetPhase(v,voices_.phase[v] == kPhaseRelease ? kPhaseOff : voices_.phase[v] + 1);
+          }
+        }
+      }
+
+      __m256i voice_out = _mm256_and_si256(_mm256_srai_epi32(_mm256_mullo_epi32(sample,level),15),active);
+      _mm256_storeu_si256((__m256i*)&out[first+1],voice_out);
+      __m256i volume_left = _mm256_loadu_si256((const __m256i*)&voices_.volume_left[first]);
+      __m256i volume_right = _mm256_loadu_si256((const __m256i*)&voices_.volume_right[first]);
+      __m256i voice_left = _mm256_srai_epi32(_mm256_mullo_epi32(voice_out,volume_left),15);
+      __m256i voice_right = _mm256_srai_epi32(_mm256_mullo_epi32(voice_out,volume_right),15);
+      left = _mm256_add_epi32(left,voice_left);
+      right = _mm256_add_epi32(right,voice_right);
+      uint32_t reverb = (reverb_voices_ >> first) & 0xFF;
+      if (reverb != 0) {
+        __m256i mask = lanes(reverb);
+        reverb_left = _mm256_add_epi32(reverb_left,_mm256_and_si256(voice_left,mask));
+        reverb_right = _mm256_add_epi32(reverb_right,_mm256_and_si256(voice_right,mask));
+      }
+    }
+    //left, right, reverb left and reverb right totals
+    __m256i sums = _mm256_hadd_epi32(_mm256_hadd_epi32(left,right),_mm256_hadd_epi32(reverb_left,reverb_right));
+    __m128i total = _mm_add_epi32(_mm256_castsi256_si128(sums),_mm256_extracti128_si256(sums,1));
+    int32_t total_left = _mm_cvtsi128_si32(total);
+    int32_t total_right = _mm_extract_epi32(total,1);
+    TickSweeps();
+    AddReverb(&total_left,&total_right,_mm_extract_epi32(total,2),_mm_extract_epi32(total,3));
+    samples[n*2] = FinishSample(total_left,kMainVolumeLeft);
+    samples[n*2+1] = FinishSample(total_right,kMainVolumeRight);
+    parity_ ^= 1;
+  }
+  _mm256_zeroupper();
 }
 
 }
-}
\ No newline at end of file
+}
@@ -21,116 +21,162 @@
 namespace emulation {
 namespace psx {
 
+/*
+  Sound processing unit. Every register from 0x1F801C00 to 0x1F801DFF goes through
+  ReadRegister/WriteRegister. The voice registers are kept one array per register
+  and the state the mixer runs on the same way, a structure of arrays, so the AVX2
+  mixer works on 8 voices per iteration. Mix produces 44.1kHz stereo, the rate the
+  SPU runs at: ADPCM decoding, pitch stepping with FM, gaussian interpolation,
+  noise, ADSR envelopes and fixed or sweeping volumes for all 24 voices.
+*/
 class Spu : public Component {
  public:
+  static const int kVoiceCount = 24;
+  static const int kSampleRate = 44100;
+  static const uint32_t kSoundRamSize = 512*1024;
+  static const int kCyclesPerSample = 768;
+  //default memory cap of the decoded block cache
+  static const uint32_t kBlockCacheSize = 256*1024;
+  struct BlockCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t blocks_invalidated;
+  };
   Spu();
   ~Spu();
   int Initialize();
   int Deinitialize();
-  uint16_t  Read(uint32_t address);
-  void Write(uint32_t address,uint16_t data);
+  uint16_t ReadRegister(uint32_t address);
+  void WriteRegister(uint32_t address,uint16_t data);
+  //count stereo frames of 16bit samples, left first
+  void Mix(int16_t* samples,int count);
+  //mixes the samples due by CPU cycle cycles and pushes them to the output if there is one
+  void Run(uint64_t cycles);
+  //CPU cycle of the next predicted IRQ address hit, the SPU has to be run there
+  uint64_t next_event() const { return next_event_; }
+  void set_output(AudioOutput* output) { output_ = output; }
+  SpuReverb& reverb() { return reverb_; }
+  uint8_t* sound_ram() { return sound_buffer_.u8; }
+  //one bit per voice, a voice is active from key on to the end of its release
+  uint32_t active_voices() const { return active_; }
+  SimdLevel simd_level() const { return simd_level_; }
+  void set_simd_level(SimdLevel level);
+  uint32_t block_cache_size() const { return block_cache_size_; }
+  //cap in bytes, 0 decodes every block each time a voice reaches it
+  void set_block_cache_size(uint32_t size);
+  const BlockCacheStats& block_cache_stats() const { return block_cache_stats_; }
+  //has to be called for every write to sound RAM other than the data port and DMA
+  void InvalidateBlocks(uint32_t address,uint32_t size);
+  //DMA channel 4 transfers at the transfer address
+  void DmaWrite(const uint32_t* words,uint32_t count);
+  void DmaRead(uint32_t* words,uint32_t count);
  private:
-  Buffer sound_buffer_;
-  uint16_t effects[32];
-  struct {
-    bool voice_on,fm,noise,reverb;
-    struct {
-      union {
-        struct {
-          uint16_t volume:14;
-          uint16_t phase:1;
-          uint16_t unused:1;
-        }volume;
-        struct {
-          uint16_t volume:7;
-          uint16_t unused1:5;
-          uint16_t phase:1;
-          uint16_t decay:1;
-          uint16_t slope:1;
-          uint16_t unused2:1;
-        }sweep;
-        uint16_t raw;
-      };
-    } vol_left, vol_right; 
-    union {
-      struct {
-        uint16_t shift:14;
-        uint16_t unused:2;
-      };
-      uint16_t raw;
-    } pitch;
-    uint16_t start_address;
-    union {
-      struct {
-        uint16_t sustain:4;
-        uint16_t decay:4;
-        uint16_t attack:7;
-        uint16_t mode:1;
-      };
-      uint16_t raw;
-    } ads_levels;
-    union {
-      struct {
-        uint16_t release_rate:5;
-        uint16_t decrease_mode:1;
-        uint16_t sustain_rate:7;
-        uint16_t unused:1;
-        uint16_t sustain_rate_mode_incdec:1;
-        uint16_t sustain_rate_mode_linexp:1;
-      };
-      uint16_t raw;
-    } sr_rates;
-    uint16_t current_adsr_volume;
-    uint16_t repeat_address;
-  } voices[24];
-  union {
-    struct {
-      uint16_t cd_audio:1;
-      uint16_t external_audio:1;
-      uint16_t cd_reverb:1;
-      uint16_t external_reverb:1;
-      uint16_t dma:2;
-      uint16_t irq:1;
-      uint16_t reverb:1;
-      uint16_t noise_frequency:6;
-      uint16_t spu_unmute:1;
-      uint16_t spu_on:1;
-    };
-    uint16_t raw;
-  }spu_control;
-  union {
-    struct {
-      uint16_t volume:15;
-      uint16_t phase:1;
-    }volume;
-    uint16_t raw;
-  }cd_vol_left, cd_vol_right,external_vol_left,external_vol_right; 
-  union {
-    struct {
-      uint16_t unused1:10;
-      uint16_t spu_not_ready:1;
-      uint16_t decoding:1;
-      uint16_t unused2:4;
-    };
-    uint16_t raw;
-  }spu_status2;
-  uint16_t main_volume_left;
-  uint16_t main_volume_right;
-  uint16_t reverb_depth_left;
-  uint16_t reverb_depth_right;
-  uint16_t reverb_workarea_start;
-  uint16_t soundbuffer_irq_address1;
-  uint16_t soundbuffer_irq_address2;
-  uint16_t spu_data;
-  uint16_t spu_control2;
-  uint16_t voice_on1,voice_on2;
-  uint16_t voice_off1,voice_off2;
-  uint16_t channel_fm_mode1,channel_fm_mode2;
-  uint16_t noise_mode1,noise_mode2;
-  uint16_t reverb_mode1,reverb_mode2;
+  enum VoiceRegister { kVolumeLeft, kVolumeRight, kPitch, kStartAddress, kAdsrLow, kAdsrHigh, kAdsrVolume, kRepeatAddress };
+  enum EnvelopePhase { kPhaseOff, kPhaseAttack, kPhaseDecay, kPhaseSustain, kPhaseRelease };
+  static const int32_t kEnvelopeExponential = 1;
+  static const int32_t kEnvelopeDecrease = 2;
+  //decoded samples of a voice, the last 3 of the previous block then the 28 of the current one
+  static const int kDecodedSize = 32;
+  static const int32_t kBlockSamples = 28;
+  static const uint32_t kBlockCount = kSoundRamSize / 16;
+  static const int kMixChunk = 256;
+  static const int kIrqHorizon = 2048;
+  static const int kFifoSize = 32;
+  //offsets of the registers after the voices, in halfwords from 0x1F801D80
+  enum ControlRegister {
+    kMainVolumeLeft = 0x00, kMainVolumeRight = 0x01, kKeyOn = 0x04, kKeyOff = 0x06, kFmMode = 0x08,
+    kNoiseMode = 0x0A, kReverbMode = 0x0C, kEndx = 0x0E, kReverbBase = 0x11, kIrqAddress = 0x12, kTransferAddress = 0x13, kDataPort = 0x14,
+    kControl = 0x15, kStatus = 0x17
+  };
+  //envelopes ticked once per sample, level is 0-7FFFh. The ADSR phase ends when the
+  //level reaches target, from below or from above for decreasing phases
+  struct Envelopes {
+    int32_t level[kVoiceCount];
+    int32_t counter[kVoiceCount];
+    int32_t cycles[kVoiceCount];
+    int32_t step[kVoiceCount];
+    int32_t flags[kVoiceCount];
+    int32_t target[kVoiceCount];
+  };
+  struct Voices {
+    //pitch counter, the sample index in the block with a 12bit fraction
+    int32_t counter[kVoiceCount];
+    uint32_t address[kVoiceCount];
+    int32_t block_flags[kVoiceCount];
+    int32_t phase[kVoiceCount];
+    int32_t volume_left[kVoiceCount];
+    int32_t volume_right[kVoiceCount];
+    //outputs of the last two samples, output[n][v+1] is voice v. FM takes voice v-1
+    //of the previous sample so all voices of one sample are independent
+    int32_t output[2][kVoiceCount+1];
+  };
+  //the 28 samples a block decodes to from the last 2 samples of the previous block,
+  //filter 0 blocks don't depend on them and are keyed with zeros
+  struct BlockCacheEntry {
+    uint16_t block;
+    uint16_t generation;
+    int16_t old;
+    int16_t older;
+    int16_t samples[kBlockSamples];
+  };
+  static uint32_t ReadPort(void* param,uint32_t address);
+  static void WritePort(void* param,uint32_t address,uint32_t data);
+  void MapPorts();
+  void WriteVoiceFlags(int reg,uint16_t data);
+  void KeyOn(int voice);
+  void KeyOff(int voice);
+  void SetPhase(int voice,int phase);
+  void SetVolume(int voice,int side);
+  void ScheduleIrq();
+  void CheckIrq(uint32_t address,uint32_t size);
+  void WriteSoundRam(const uint16_t* data,uint32_t count);
+  void ReadSoundRam(uint16_t* data,uint32_t count);
+  void FlushFifo();
+  void StartBlock(int voice);
+  void DecodeBlock(const uint8_t* block,int32_t* out);
+  void ResetBlockCache();
+  void NextBlock(int voice);
+  void TickNoise();
+  void TickSweeps();
+  void MixScalar(int16_t* samples,int count);
+  void MixAVX2(int16_t* samples,int count);
+  void AddReverb(int32_t* left,int32_t* right,int32_t reverb_left,int32_t reverb_right);
+  int16_t FinishSample(int32_t sum,int reg);
 
+  Buffer sound_buffer_;
+  SimdLevel simd_level_;
+  SimdLevel simd_support_;
+  uint16_t voice_regs_[8][kVoiceCount];
+  uint16_t control_regs_[0x40];
+  Voices voices_;
+  Envelopes adsr_;
+  Envelopes sweep_[2];
+  SpuReverb reverb_;
+  int32_t decoded_[kVoiceCount*kDecodedSize];
+  uint32_t active_;
+  uint32_t fm_;
+  uint32_t noise_;
+  uint32_t reverb_voices_;
+  uint32_t sweeping_[2];
+  uint32_t endx_;
+  int32_t noise_timer_;
+  uint16_t noise_level_;
+  int parity_;
+  uint32_t transfer_address_;
+  AudioOutput* output_;
+  uint64_t cycles_;
+  uint64_t next_event_;
+  bool irq_flag_;
+  //data port writes wait here until manual write mode or a full FIFO
+  uint16_t fifo_[kFifoSize];
+  int fifo_count_;
+  int16_t mix_buffer_[kMixChunk*2];
+  //a cached block is stale when its generation differs from the one of its address
+  std::vector<BlockCacheEntry> block_cache_;
+  uint32_t block_cache_size_;
+  uint16_t block_generation_[kBlockCount];
+  BlockCacheStats block_cache_stats_;
 };
 
 }
 }
-
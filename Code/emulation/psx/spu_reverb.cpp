@@ -0,0 +1,234 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+namespace emulation {
+namespace psx {
+
+//the non zero taps of one side of the half band filter, the middle tap is 4000h
+static const int16_t kResampleTaps[20] = {
+  -0x0001, 0x0002, -0x000A, 0x0023, -0x0067, 0x010A, -0x0268, 0x0534, -0x0B90, 0x2806,
+  0x2806, -0x0B90, 0x0534, -0x0268, 0x010A, -0x0067, 0x0023, -0x000A, 0x0002, -0x0001
+};
+
+static inline int32_t Clamp16(int32_t value) {
+  return value < -0x8000 ? -0x8000 : (value > 0x7FFF ? 0x7FFF : value);
+}
+
+SpuReverb::SpuReverb() : ram_(nullptr),regs_(nullptr),quality_(kQualityAccurate),simd_level_(kSimdNone),
+  simd_support_(kSimdNone),base_(0),current_(0),position_(0),output_position_(0),odd_(0) {
+  memset(input_,0,sizeof(input_));
+  memset(output_,0,sizeof(output_));
+}
+
+SpuReverb::~SpuReverb() {
+
+}
+
+/*
+  The input filter runs over the last 40 inputs with the 39 taps in the last 39,
+  the output filter over the last 24 outputs with its 20 taps in the last 20.
+*/
+void SpuReverb::Initialize(uint16_t* ram,const uint16_t* regs) {
+  ram_ = ram;
+  regs_ = regs;
+  memset(down_taps_,0,sizeof(down_taps_));
+  memset(up_taps_,0,sizeof(up_taps_));
+  for (int i=0;i<20;++i) {
+    down_taps_[1 + i*2] = kResampleTaps[i];
+    up_taps_[kUpTaps - 20 + i] = kResampleTaps[i];
+  }
+  down_taps_[20] = 0x4000;
+  simd_support_ = DetectSimdLevel();
+  simd_level_ = simd_support_;
+  Reset();
+}
+
+void SpuReverb::Reset() {
+  memset(input_,0,sizeof(input_));
+  memset(output_,0,sizeof(output_));
+  position_ = 0;
+  output_position_ = 0;
+  odd_ = 0;
+  set_base(regs_ != nullptr ? regs_[kBase] : 0);
+}
+
+void SpuReverb::set_base(uint16_t base) {
+  base_ = (uint32_t)base << 2;
+  current_ = base_;
+}
+
+void SpuReverb::set_simd_level(SimdLevel level) {
+  simd_level_ = level < simd_support_ ? level : simd_support_;
+}
+
+//offsets wrap around inside the work area
+uint32_t SpuReverb::Address(int32_t offset) const {
+  int32_t size = 0x40000 - base_;
+  int32_t index = ((int32_t)(current_ - base_) + offset) % size;
+  if (index < 0)
+    index += size;
+  return base_ + index;
+}
+
+int32_t SpuReverb::Filter(const int16_t* history,const int16_t* taps,int count) const {
+  if (simd_level_ >= kSimdSSE41) {
+    __m128i sum = _mm_setzero_si128();
+    for (int i=0;i<count;i+=8)
+      sum = _mm_add_epi32(sum,_mm_madd_epi16(_mm_loadu_si128((const __m128i*)&history[i]),_mm_loadu_si128((const __m128i*)&taps[i])));
+    sum = _mm_hadd_epi32(sum,sum);
+    sum = _mm_hadd_epi32(sum,sum);
+    return _mm_cvtsi128_si32(sum);
+  }
+  int32_t sum = 0;
+  for (int i=0;i<count;++i)
+    sum += history[i] * taps[i];
+  return sum;
+}
+
+int32_t SpuReverb::AllPass(int32_t input,int reg,int offset_reg,int volume_reg,bool write) {
+  int32_t volume = Volume(volume_reg);
+  int32_t delayed = Read(Offset(reg) - Offset(offset_reg));
+  int32_t value = Clamp16(input - ((volume * delayed) >> 15));
+  if (write)
+    ram_[Address(Offset(reg))] = (uint16_t)value;
+  return ((value * volume) >> 15) + delayed;
+}
+
+/*
+  One 22.05kHz step. All the reads of the IIR stage are done before its writes, in
+  both versions, so overlapping buffers give the same result.
+*/
+void SpuReverb::Step(int32_t in_left,int32_t in_right,bool write,int32_t* out_left,int32_t* out_right) {
+  int32_t left = (in_left * Volume(kInputVolumeLeft)) >> 15;
+  int32_t right = (in_right * Volume(kInputVolumeRight)) >> 15;
+  int32_t wall = Volume(kWallVolume);
+  int32_t iir = Volume(kIirVolume);
+  static const int dst[4] = { kSameLeft, kSameRight, kDiffLeft, kDiffRight };
+  static const int src[4] = { kSameLeftSource, kSameRightSource, kDiffRightSource, kDiffLeftSource };
+  int32_t value[4];
+  for (int i=0;i<4;++i) {
+    int32_t in = (i & 1) ? right : left;
+    int32_t previous = Read(Offset(dst[i]) - 1);
+    int32_t reflected = (Read(Offset(src[i])) * wall) >> 15;
+    //saturated before the IIR volume like the hardware, the product would overflow
+    value[i] = Clamp16(((Clamp16(in + reflected - previous) * iir) >> 15) + previous);
+  }
+  if (write) {
+    for (int i=0;i<4;++i)
+      ram_[Address(Offset(dst[i]))] = (uint16_t)value[i];
+  }
+  int32_t comb_left = 0, comb_right = 0;
+  static const int comb_left_regs[4] = { kCombLeft1, kCombLeft2, kCombLeft3, kCombLeft4 };
+  static const int comb_right_regs[4] = { kCombRight1, kCombRight2, kCombRight3, kCombRight4 };
+  for (int i=0;i<4;++i) {
+    comb_left += (Volume(kCombVolume1 + i) * Read(Offset(comb_left_regs[i]))) >> 15;
+    comb_right += (Volume(kCombVolume1 + i) * Read(Offset(comb_right_regs[i]))) >> 15;
+  }
+  left = AllPass(comb_left,kApfLeft1,kApfOffset1,kApfVolume1,write);
+  right = AllPass(comb_right,kApfRight1,kApfOffset1,kApfVolume1,write);
+  left = AllPass(left,kApfLeft2,kApfOffset2,kApfVolume2,write);
+  right = AllPass(right,kApfRight2,kApfOffset2,kApfVolume2,write);
+  *out_left = (Clamp16(left) * (int16_t)regs_[kOutputVolume]) >> 15;
+  *out_right = (Clamp16(right) * (int16_t)regs_[kOutputVolume+1]) >> 15;
+  current_ = current_ + 1 >= 0x40000 ? base_ : current_ + 1;
+}
+
+//the 4 IIR filters side by side, then the left and right comb taps
+void SpuReverb::StepSSE41(int32_t in_left,int32_t in_right,bool write,int32_t* out_left,int32_t* out_right) {
+  int32_t left = (in_left * Volume(kInputVolumeLeft)) >> 15;
+  int32_t right = (in_right * Volume(kInputVolumeRight)) >> 15;
+  __m128i in = _mm_setr_epi32(left,right,left,right);
+  __m128i previous = _mm_setr_epi32(Read(Offset(kSameLeft) - 1),Read(Offset(kSameRight) - 1),
+                                    Read(Offset(kDiffLeft) - 1),Read(Offset(kDiffRight) - 1));
+  __m128i source = _mm_setr_epi32(Read(Offset(kSameLeftSource)),Read(Offset(kSameRightSource)),
+                                  Read(Offset(kDiffRightSource)),Read(Offset(kDiffLeftSource)));
+  __m128i reflected = _mm_srai_epi32(_mm_mullo_epi32(source,_mm_set1_epi32(Volume(kWallVolume))),15);
+  __m128i value = _mm_sub_epi32(_mm_add_epi32(in,reflected),previous);
+  value = _mm_cvtepi16_epi32(_mm_packs_epi32(value,value));
+  value = _mm_add_epi32(_mm_srai_epi32(_mm_mullo_epi32(value,_mm_set1_epi32(Volume(kIirVolume))),15),previous);
+  value = _mm_packs_epi32(value,value);
+  if (write) {
+    ram_[Address(Offset(kSameLeft))] = (uint16_t)_mm_extract_epi16(value,0);
+    ram_[Address(Offset(kSameRight))] = (uint16_t)_mm_extract_epi16(value,1);
+    ram_[Address(Offset(kDiffLeft))] = (uint16_t)_mm_extract_epi16(value,2);
+    ram_[Address(Offset(kDiffRight))] = (uint16_t)_mm_extract_epi16(value,3);
+  }
+  __m128i volume = _mm_setr_epi32(Volume(kCombVolume1),Volume(kCombVolume2),Volume(kCombVolume3),Volume(kCombVolume4));
+  __m128i comb_left = _mm_setr_epi32(Read(Offset(kCombLeft1)),Read(Offset(kCombLeft2)),
+                                     Read(Offset(kCombLeft3)),Read(Offset(kCombLeft4)));
+  __m128i comb_right = _mm_setr_epi32(Read(Offset(kCombRight1)),Read(Offset(kCombRight2)),
+                                      Read(Offset(kCombRight3)),Read(Offset(kCombRight4)));
+  comb_left = _mm_srai_epi32(_mm_mullo_epi32(comb_left,volume),15);
+  comb_right = _mm_srai_epi32(_mm_mullo_epi32(comb_right,volume),15);
+  __m128i sums = _mm_hadd_epi32(comb_left,comb_right);
+  sums = _mm_hadd_epi32(sums,sums);
+  left = AllPass(_mm_cvtsi128_si32(sums),kApfLeft1,kApfOffset1,kApfVolume1,write);
+  right = AllPass(_mm_extract_epi32(sums,1),kApfRight1,kApfOffset1,kApfVolume1,write);
+  left = AllPass(left,kApfLeft2,kApfOffset2,kApfVolume2,write);
+  right = AllPass(right,kApfRight2,kApfOffset2,kApfVolume2,write);
+  *out_left = (Clamp16(left) * (int16_t)regs_[kOutputVolume]) >> 15;
+  *out_right = (Clamp16(right) * (int16_t)regs_[kOutputVolume+1]) >> 15;
+  current_ = current_ + 1 >= 0x40000 ? base_ : current_ + 1;
+}
+
+/*
+  Every other input sample runs a step. The output alternates between a point
+  half way between two steps, from the filter or an average, and a step output.
+*/
+void SpuReverb::Process(int32_t in_left,int32_t in_right,bool write,int32_t* out_left,int32_t* out_right) {
+  position_ = (position_ + 1) & (kHistory-1);
+  input_[0][position_] = input_[0][position_ + kHistory] = (int16_t)Clamp16(in_left);
+  input_[1][position_] = input_[1][position_ + kHistory] = (int16_t)Clamp16(in_right);
+  odd_ ^= 1;
+  const int first_input = position_ + kHistory + 1 - kDownTaps;
+  if (odd_) {
+    int32_t left, right;
+    if (quality_ == kQualityAccurate) {
+      left = Filter(&input_[0][first_input],down_taps_,kDownTaps) >> 15;
+      right = Filter(&input_[1][first_input],down_taps_,kDownTaps) >> 15;
+    } else {
+      left = (input_[0][position_ + kHistory] + input_[0][position_ + kHistory - 1]) >> 1;
+      right = (input_[1][position_ + kHistory] + input_[1][position_ + kHistory - 1]) >> 1;
+    }
+    if (simd_level_ >= kSimdSSE41)
+      StepSSE41(left,right,write,&left,&right);
+    else
+      Step(left,right,write,&left,&right);
+    output_position_ = (output_position_ + 1) & (kHistory-1);
+    output_[0][output_position_] = output_[0][output_position_ + kHistory] = (int16_t)Clamp16(left);
+    output_[1][output_position_] = output_[1][output_position_ + kHistory] = (int16_t)Clamp16(right);
+    int last = output_position_ + kHistory;
+    if (quality_ == kQualityAccurate) {
+      *out_left = Clamp16(Filter(&output_[0][last + 1 - kUpTaps],up_taps_,kUpTaps) >> 14);
+      *out_right = Clamp16(Filter(&output_[1][last + 1 - kUpTaps],up_taps_,kUpTaps) >> 14);
+    } else {
+      *out_left = (output_[0][last] + output_[0][last - 1]) >> 1;
+      *out_right = (output_[1][last] + output_[1][last - 1]) >> 1;
+    }
+  } else {
+    //the output 9 steps back is the newer of the two the filter was centered on
+    int delay = quality_ == kQualityAccurate ? 9 : 0;
+    *out_left = output_[0][output_position_ + kHistory - delay];
+    *out_right = output_[1][output_position_ + kHistory - delay];
+  }
+}
+
+}
+}
@@ -0,0 +1,94 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  The reverb unit of the SPU. It runs at 22.05kHz on a work area from mBASE to the
+  end of sound RAM: the input goes through the same side and different side IIR
+  filters, 4 comb taps and 2 all pass filters. 44.1kHz input and output are
+  resampled with the 39 tap half band filter of the hardware, the fast quality
+  averages the input pairs and interpolates the output linearly instead.
+  The registers are the ones of the SPU, read directly from its register array.
+*/
+class SpuReverb {
+ public:
+  enum Quality { kQualityAccurate, kQualityFast };
+  SpuReverb();
+  ~SpuReverb();
+  //ram is the sound RAM, regs the SPU registers from 1F801D80h
+  void Initialize(uint16_t* ram,const uint16_t* regs);
+  void Reset();
+  //mBASE, in 8 byte units. Also restarts the work area at it
+  void set_base(uint16_t base);
+  //start of the work area in bytes
+  uint32_t base() const { return base_ << 1; }
+  //one 44.1kHz sample, the work area is only written when write is set
+  void Process(int32_t in_left,int32_t in_right,bool write,int32_t* out_left,int32_t* out_right);
+  Quality quality() const { return quality_; }
+  void set_quality(Quality quality) { quality_ = quality; }
+  SimdLevel simd_level() const { return simd_level_; }
+  void set_simd_level(SimdLevel level);
+ private:
+  //halfword offsets of the SPU registers the reverb uses
+  static const int kOutputVolume = 0x02;
+  static const int kBase = 0x11;
+  static const int kConfig = 0x20;
+  enum ConfigRegister {
+    kApfOffset1, kApfOffset2, kIirVolume, kCombVolume1, kCombVolume2, kCombVolume3, kCombVolume4,
+    kWallVolume, kApfVolume1, kApfVolume2, kSameLeft, kSameRight, kCombLeft1, kCombRight1,
+    kCombLeft2, kCombRight2, kSameLeftSource, kSameRightSource, kDiffLeft, kDiffRight,
+    kCombLeft3, kCombRight3, kCombLeft4, kCombRight4, kDiffLeftSource, kDiffRightSource,
+    kApfLeft1, kApfRight1, kApfLeft2, kApfRight2, kInputVolumeLeft, kInputVolumeRight
+  };
+  //samples kept of the input and of the output, each history is stored twice so
+  //the last kHistory samples are always contiguous
+  static const int kHistory = 64;
+  static const int kDownTaps = 40;
+  static const int kUpTaps = 24;
+  uint32_t Address(int32_t offset) const;
+  int32_t Read(int32_t offset) const { return (int16_t)ram_[Address(offset)]; }
+  int32_t Volume(int reg) const { return (int16_t)regs_[kConfig + reg]; }
+  int32_t Offset(int reg) const { return regs_[kConfig + reg] << 2; }
+  int32_t Filter(const int16_t* history,const int16_t* taps,int count) const;
+  void Step(int32_t in_left,int32_t in_right,bool write,int32_t* out_left,int32_t* out_right);
+  void StepSSE41(int32_t in_left,int32_t in_right,bool write,int32_t* out_left,int32_t* out_right);
+  int32_t AllPass(int32_t input,int reg,int offset_reg,int volume_reg,bool write);
+
+  uint16_t* ram_;
+  const uint16_t* regs_;
+  Quality quality_;
+  SimdLevel simd_level_;
+  SimdLevel simd_support_;
+  //work area start and current address, in halfwords
+  uint32_t base_;
+  uint32_t current_;
+  int16_t input_[2][kHistory*2];
+  int16_t output_[2][kHistory*2];
+  int position_;
+  int output_position_;
+  int odd_;
+  int16_t down_taps_[kDownTaps];
+  int16_t up_taps_[kUpTaps];
+};
+
+}
+}
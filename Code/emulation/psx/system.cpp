@@ -44,6 +44,7 @@ int System::Initialize() {
   cpu_.set_system(this);
   gpu_core_->set_system(this);
   spu_.set_system(this);
+  cdrom_.set_system(this);
   mc_.set_system(this);
   kernel_.set_system(this);
   gte_.set_system(this);
@@ -62,6 +63,7 @@ int System::Initialize() {
   cpu_.Reset();
   gpu_core_->Initialize();
   spu_.Initialize();
+  cdrom_.Initialize();
   mc_.Initialize();
   kernel_.Initialize();
   gte_.Initialize();
@@ -81,6 +83,7 @@ int System::Deinitialize() {
   gte_.Deinitialize();
   //kernel_.De
   mc_.Deinitialize();
+  cdrom_.Deinitialize();
   spu_.Deinitialize();
   gpu_core_->Deinitialize();
   cpu_.Deinitialize();
@@ -38,6 +38,7 @@ class System {
   void LoadPsExe(char* filename);
   Cpu& cpu() { return cpu_; };
   Spu& spu() { return spu_; };
+  Cdrom& cdrom() { return cdrom_; };
   IOInterface& io() { return io_; };
   MC& mc() { return mc_; };
   Kernel& kernel() { return kernel_; };
@@ -70,6 +71,7 @@ class System {
   CpuContext cpu_context_;
   Cpu cpu_;
   Spu spu_;
+  Cdrom cdrom_;
   IOInterface io_;
   MC mc_;
   Kernel kernel_;
@@ -83,6 +83,29 @@ struct TimingInfo {
     double time_span;
 };
 
+enum SimdLevel { kSimdNone, kSimdSSE41, kSimdAVX2 };
+
+/*
+  Highest vector instruction set usable by the hand written kernels,
+  AVX2 also needs the OS to save the ymm state
+*/
+inline SimdLevel DetectSimdLevel() {
+  int info[4];
+  __cpuid(info,0);
+  int max_leaf = info[0];
+  __cpuid(info,1);
+  if ((info[2] & (1<<19)) == 0)
+    return kSimdNone;
+  bool osxsave = (info[2] & (1<<27)) != 0;
+  bool avx = (info[2] & (1<<28)) != 0;
+  if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+    __cpuidex(info,7,0);
+    if (info[1] & (1<<5))
+      return kSimdAVX2;
+  }
+  return kSimdSSE41;
+}
+
 struct Buffer {
   uint8_t* u8;
   uint16_t* u16;
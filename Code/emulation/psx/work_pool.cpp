@@ -0,0 +1,115 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "global.h"
+
+namespace emulation {
+namespace psx {
+
+WorkPool::WorkPool() : thread_count_(1),task_(nullptr),generation_(0),exit_(false) {
+  memset(threads_,0,sizeof(threads_));
+  active_ = 0;
+}
+
+WorkPool::~WorkPool() {
+  Deinitialize();
+}
+
+int WorkPool::Initialize(int thread_count) {
+  Deinitialize();
+  if (thread_count < 1)
+    thread_count = 1;
+  if (thread_count > kMaxThreads)
+    thread_count = kMaxThreads;
+  thread_count_ = thread_count;
+  exit_ = false;
+  for (int i=1;i<thread_count_;++i)
+    threads_[i] = new std::thread(WorkPool::thread_func,this,i,generation_);
+  return S_OK;
+}
+
+int WorkPool::Deinitialize() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exit_ = true;
+  }
+  start_.notify_all();
+  for (int i=1;i<thread_count_;++i) {
+    if (threads_[i] != nullptr) {
+      threads_[i]->join();
+      SafeDelete(&threads_[i]);
+    }
+  }
+  thread_count_ = 1;
+  return S_OK;
+}
+
+void WorkPool::Run(int task_count,const Task& task) {
+  if (thread_count_ == 1 || task_count <= 1) {
+    for (int i=0;i<task_count;++i)
+      task(i,0);
+    return;
+  }
+  int start = 0;
+  for (int i=0;i<thread_count_;++i) {
+    int count = task_count / thread_count_ + (i < task_count % thread_count_ ? 1 : 0);
+    queues_[i].next = start;
+    queues_[i].end = start + count;
+    start += count;
+  }
+  task_ = &task;
+  active_ = thread_count_;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++generation_;
+  }
+  start_.notify_all();
+  Work(0);
+  while (active_.load(std::memory_order_acquire) != 0)
+    std::this_thread::yield();
+  task_ = nullptr;
+}
+
+void WorkPool::Work(int index) {
+  for (int i=0;i<thread_count_;++i) {
+    Queue& queue = queues_[(index + i) % thread_count_];
+    for (;;) {
+      int task = queue.next.fetch_add(1,std::memory_order_relaxed);
+      if (task >= queue.end)
+        break;
+      (*task_)(task,index);
+    }
+  }
+  active_.fetch_sub(1,std::memory_order_release);
+}
+
+void WorkPool::thread_func(WorkPool* pool,int index,uint32_t generation) {
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(pool->mutex_);
+      pool->start_.wait(lock,[&] { return pool->exit_ || pool->generation_ != generation; });
+      if (pool->exit_)
+        return;
+      generation = pool->generation_;
+    }
+    pool->Work(index);
+  }
+}
+
+}
+}
@@ -0,0 +1,60 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#pragma once
+
+namespace emulation {
+namespace psx {
+
+/*
+  Fixed set of threads running batches of independent tasks. A batch is split into
+  one contiguous run of tasks per thread and a thread that finished its own run
+  steals from the others. The calling thread takes part as thread 0 and Run
+  returns once every task of the batch is done.
+*/
+class WorkPool {
+ public:
+  typedef std::function<void(int task,int thread)> Task;
+  static const int kMaxThreads = 16;
+  WorkPool();
+  ~WorkPool();
+  int Initialize(int thread_count);
+  int Deinitialize();
+  void Run(int task_count,const Task& task);
+  int thread_count() const { return thread_count_; }
+ private:
+  struct Queue {
+    std::atomic<int> next;
+    int end;
+    uint8_t pad[64-sizeof(std::atomic<int>)-sizeof(int)];
+  };
+  static void thread_func(WorkPool* pool,int index,uint32_t generation);
+  void Work(int index);
+  std::thread* threads_[kMaxThreads];
+  Queue queues_[kMaxThreads];
+  int thread_count_;
+  const Task* task_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  uint32_t generation_;
+  bool exit_;
+  std::atomic<int> active_;
+};
+
+}
+}
@@ -1,4 +1,5 @@
 #include <Windows.h>
+#include "draw_list.h"
 
 namespace minive {
 
@@ -10,6 +11,8 @@ class Context {
   virtual int Deinitialize() = 0;
   virtual int Clear() = 0;
   virtual int Present() = 0;
+  //draws the batches of the list in order
+  virtual int Draw(const DrawList& list) = 0;
 };
 
 }
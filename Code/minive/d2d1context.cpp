@@ -69,4 +69,9 @@ int D2D1Context::Present() {
   return m_pRenderTarget->EndDraw();
 }
 
+//no triangle drawing in Direct2D
+int D2D1Context::Draw(const DrawList& list) {
+  return S_OK;
+}
+
 }
\ No newline at end of file
@@ -36,6 +36,7 @@ class D2D1Context : public Context {
   int Deinitialize();
   int Clear();
   int Present();
+  int Draw(const DrawList& list);
  private:
   ID2D1Factory* m_pDirect2dFactory;
   ID2D1HwndRenderTarget* m_pRenderTarget;
@@ -16,7 +16,9 @@ void  D3D11Context::operator delete (void* p)  {
 
 ID3D11Buffer* vsbuf;
 
-D3D11Context::D3D11Context() : vs(nullptr),ps(nullptr),ps_tex(nullptr),ia(nullptr),matrixBuffer(nullptr) {
+D3D11Context::D3D11Context() : vs(nullptr),ps(nullptr),ps_tex(nullptr),ia(nullptr),matrixBuffer(nullptr),
+  ia_batch(nullptr),scissorstate(nullptr),batchbuffer(nullptr),batchbuffer_vertices(0) {
+  ZeroMemory(blendstates,sizeof(blendstates));
 
 }
 
@@ -355,6 +357,12 @@ int D3D11Context::Initialize(int width, int height, bool vsync, HWND hwnd, bool
 		return S_FALSE;
 	}
 
+  result = CreateBatchStates();
+	if(result != S_OK) {
+		Deinitialize();
+		return S_FALSE;
+	}
+
   matrixBufferData.world = XMMatrixTranspose(XMMatrixIdentity());
   matrixBufferData.view = XMMatrixTranspose(XMMatrixIdentity());
   matrixBufferData.projection = XMMatrixTranspose(XMMatrixOrthographicOffCenterLH(0.0f,(FLOAT)width,(FLOAT)height,0.0f,-10000.0f,10000.0f));
@@ -406,6 +414,12 @@ int D3D11Context::Deinitialize() {
 	{
 		swapchain->SetFullscreenState(false, NULL);
 	}
+  SafeRelease(&batchbuffer);
+  batchbuffer_vertices = 0;
+  for (int i=0;i<DrawList::kBlendCount;++i)
+    SafeRelease(&blendstates[i]);
+  SafeRelease(&scissorstate);
+  SafeRelease(&ia_batch);
   SafeRelease(&matrixBuffer);
   SafeRelease(&ps_tex);
   SafeRelease(&ps);
@@ -458,6 +472,111 @@ int D3D11Context::Present() {
 
 
 
+/*
+  The whole list goes into one dynamic vertex buffer, then there is one Draw per
+  batch after setting its blend state, scissor rectangle and offset.
+*/
+int D3D11Context::Draw(const DrawList& list) {
+  HRESULT result;
+  if (list.vertex_count() == 0)
+    return S_OK;
+  if (list.vertex_count() > batchbuffer_vertices) {
+    SafeRelease(&batchbuffer);
+    batchbuffer_vertices = batchbuffer_vertices * 2 > list.vertex_count() ? batchbuffer_vertices * 2 : list.vertex_count();
+    D3D11_BUFFER_DESC bd;
+    ZeroMemory(&bd,sizeof(bd));
+    bd.Usage = D3D11_USAGE_DYNAMIC;
+    bd.ByteWidth = batchbuffer_vertices * sizeof(DrawVertex);
+    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    result = device->CreateBuffer(&bd,NULL,&batchbuffer);
+    if (result != S_OK) {
+      batchbuffer_vertices = 0;
+      return S_FALSE;
+    }
+  }
+  D3D11_MAPPED_SUBRESOURCE mapped;
+  result = devicecontext->Map(batchbuffer,0,D3D11_MAP_WRITE_DISCARD,0,&mapped);
+  if (result != S_OK)
+    return S_FALSE;
+  memcpy(mapped.pData,list.vertices(),list.vertex_count() * sizeof(DrawVertex));
+  devicecontext->Unmap(batchbuffer,0);
+
+  UINT stride = sizeof(DrawVertex);
+  UINT offset = 0;
+  devicecontext->IASetInputLayout(ia_batch);
+  devicecontext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+  devicecontext->IASetVertexBuffers(0,1,&batchbuffer,&stride,&offset);
+  devicecontext->RSSetState(scissorstate);
+  //source weights of the average and quarter add modes
+  static const float factors[DrawList::kBlendCount] = { 1.0f,0.5f,1.0f,1.0f,0.25f };
+  int32_t offset_x = 0, offset_y = 0;
+  for (uint32_t i=0;i<list.batch_count();++i) {
+    const DrawBatch& batch = list.batches()[i];
+    uint32_t blend = batch.state.blend < DrawList::kBlendCount ? batch.state.blend : DrawList::kBlendOpaque;
+    float factor[4] = { factors[blend],factors[blend],factors[blend],factors[blend] };
+    devicecontext->OMSetBlendState(blendstates[blend],factor,0xFFFFFFFF);
+    D3D11_RECT rect = { batch.state.clip_x1,batch.state.clip_y1,batch.state.clip_x2 + 1,batch.state.clip_y2 + 1 };
+    devicecontext->RSSetScissorRects(1,&rect);
+    if (i == 0 || batch.state.offset_x != offset_x || batch.state.offset_y != offset_y) {
+      offset_x = batch.state.offset_x;
+      offset_y = batch.state.offset_y;
+      matrixBufferData.world = XMMatrixTranspose(XMMatrixTranslation((float)offset_x,(float)offset_y,0.0f));
+      devicecontext->UpdateSubresource(matrixBuffer,0,NULL,&matrixBufferData,0,0);
+    }
+    devicecontext->Draw(batch.count,batch.first);
+  }
+  matrixBufferData.world = XMMatrixTranspose(XMMatrixIdentity());
+  devicecontext->UpdateSubresource(matrixBuffer,0,NULL,&matrixBufferData,0,0);
+  devicecontext->OMSetBlendState(NULL,NULL,0xFFFFFFFF);
+  devicecontext->RSSetState(rasterstate);
+  devicecontext->IASetInputLayout(ia);
+  return S_OK;
+}
+
+int D3D11Context::CreateBatchStates() {
+  HRESULT result;
+  D3D11_RASTERIZER_DESC rasterDesc;
+  ZeroMemory(&rasterDesc,sizeof(rasterDesc));
+  rasterDesc.CullMode = D3D11_CULL_NONE;
+  rasterDesc.FillMode = D3D11_FILL_SOLID;
+  rasterDesc.DepthClipEnable = true;
+  rasterDesc.ScissorEnable = true;
+  result = device->CreateRasterizerState(&rasterDesc,&scissorstate);
+  if (result != S_OK)
+    return S_FALSE;
+
+  //opaque, B/2+F/2, B+F, B-F and B+F/4
+  static const struct {
+    BOOL enable;
+    D3D11_BLEND source;
+    D3D11_BLEND dest;
+    D3D11_BLEND_OP op;
+  } modes[DrawList::kBlendCount] = {
+    { FALSE, D3D11_BLEND_ONE,          D3D11_BLEND_ZERO,             D3D11_BLEND_OP_ADD },
+    { TRUE,  D3D11_BLEND_BLEND_FACTOR, D3D11_BLEND_INV_BLEND_FACTOR, D3D11_BLEND_OP_ADD },
+    { TRUE,  D3D11_BLEND_ONE,          D3D11_BLEND_ONE,              D3D11_BLEND_OP_ADD },
+    { TRUE,  D3D11_BLEND_ONE,          D3D11_BLEND_ONE,              D3D11_BLEND_OP_REV_SUBTRACT },
+    { TRUE,  D3D11_BLEND_BLEND_FACTOR, D3D11_BLEND_ONE,              D3D11_BLEND_OP_ADD },
+  };
+  for (int i=0;i<DrawList::kBlendCount;++i) {
+    D3D11_BLEND_DESC blendDesc;
+    ZeroMemory(&blendDesc,sizeof(blendDesc));
+    blendDesc.RenderTarget[0].BlendEnable = modes[i].enable;
+    blendDesc.RenderTarget[0].SrcBlend = modes[i].source;
+    blendDesc.RenderTarget[0].DestBlend = modes[i].dest;
+    blendDesc.RenderTarget[0].BlendOp = modes[i].op;
+    blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+    blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ZERO;
+    blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+    blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+    result = device->CreateBlendState(&blendDesc,&blendstates[i]);
+    if (result != S_OK)
+      return S_FALSE;
+  }
+  return S_OK;
+}
+
 int D3D11Context::CreateShaders() {
   HRESULT result;
 	//D3D11_INPUT_ELEMENT_DESC polygonLayout[2];
@@ -492,6 +611,18 @@ int D3D11Context::CreateShaders() {
 	{
 		return S_FALSE;
 	}
+
+  //same shader, the packed color is expanded to a float4 by the input assembler
+  D3D11_INPUT_ELEMENT_DESC batchLayout[3] = {
+    {"POSITION",0,DXGI_FORMAT_R32G32B32_FLOAT    ,0,0,D3D11_INPUT_PER_VERTEX_DATA,0},
+    {"COLOR"   ,0,DXGI_FORMAT_R8G8B8A8_UNORM     ,0,12,D3D11_INPUT_PER_VERTEX_DATA,0},
+    {"TEXCOORD",0,DXGI_FORMAT_R32G32_FLOAT       ,0,16,D3D11_INPUT_PER_VERTEX_DATA,0}
+  };
+	result = device->CreateInputLayout(batchLayout, ARRAYSIZE(batchLayout), data,length,  &ia_batch);
+	if(result != S_OK)
+	{
+		return S_FALSE;
+	}
   core::io::DestroyFileBuffer(&data);
 
 
@@ -47,6 +47,7 @@ class D3D11Context : public Context {
   int Deinitialize();
   int Clear();
   int Present();
+  int Draw(const DrawList& list);
  private:
   bool vsync_enabled_;
 	size_t vc_mem_;
@@ -63,6 +64,12 @@ class D3D11Context : public Context {
   ID3D11PixelShader* ps_tex;
   ID3D11VertexShader* vs;
   ID3D11InputLayout* ia;
+  //draw lists, packed colors and no culling, one blend state per DrawList::Blend
+  ID3D11InputLayout* ia_batch;
+  ID3D11RasterizerState* scissorstate;
+  ID3D11BlendState* blendstates[DrawList::kBlendCount];
+  ID3D11Buffer* batchbuffer;
+  uint32_t batchbuffer_vertices;
   struct {
 	  XMMATRIX world;
 	  XMMATRIX view;
@@ -71,6 +78,7 @@ class D3D11Context : public Context {
   ID3D11Buffer* matrixBuffer;
 	ID3D11DepthStencilState* depthdisabledstencilstate;
   int CreateShaders();
+  int CreateBatchStates();
 };
 
 }
@@ -0,0 +1,62 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "draw_list.h"
+
+namespace minive {
+
+DrawList::DrawList() : vertex_count_(0) {
+  vertices_.resize(kArenaVertices);
+  batches_.reserve(1024);
+  memset(&state_,0,sizeof(state_));
+  state_.texture = kNoTexture;
+}
+
+void DrawList::Reset() {
+  vertex_count_ = 0;
+  batches_.clear();
+}
+
+DrawVertex* DrawList::AddTriangles(uint32_t count) {
+  if (batches_.empty() || memcmp(&batches_.back().state,&state_,sizeof(state_)) != 0) {
+    DrawBatch batch;
+    batch.state = state_;
+    batch.first = vertex_count_;
+    batch.count = 0;
+    batches_.push_back(batch);
+  }
+  uint32_t vertices = count * 3;
+  if (vertex_count_ + vertices > vertices_.size())
+    vertices_.resize(vertices_.size() * 2 + vertices);
+  DrawVertex* result = &vertices_[vertex_count_];
+  vertex_count_ += vertices;
+  batches_.back().count += vertices;
+  return result;
+}
+
+void DrawList::AddQuad(const DrawVertex* v) {
+  DrawVertex* out = AddTriangles(2);
+  out[0] = v[0];
+  out[1] = v[1];
+  out[2] = v[2];
+  out[3] = v[1];
+  out[4] = v[2];
+  out[5] = v[3];
+}
+
+}
@@ -0,0 +1,80 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#ifndef MINIVE_DRAW_LIST_H
+#define MINIVE_DRAW_LIST_H
+
+#include <string.h>
+#include <vector>
+#include <WinCore/types.h>
+
+namespace minive {
+
+//render state of a batch, a change in any of it starts a new batch
+struct DrawState {
+  uint32_t blend;
+  uint32_t texture;
+  int32_t clip_x1,clip_y1,clip_x2,clip_y2;
+  int32_t offset_x,offset_y;
+};
+
+struct DrawVertex {
+  float x,y,z;
+  uint32_t color;
+  float u,v;
+};
+
+//triangle list vertices [first,first+count) of the arena
+struct DrawBatch {
+  DrawState state;
+  uint32_t first;
+  uint32_t count;
+};
+
+/*
+  Triangles of one frame. The vertices go into a single arena that keeps its
+  capacity from frame to frame, consecutive triangles with the same state share
+  a batch so a backend issues one draw call per batch.
+*/
+class DrawList {
+ public:
+  enum Blend { kBlendOpaque, kBlendAverage, kBlendAdd, kBlendSubtract, kBlendAddQuarter, kBlendCount };
+  static const uint32_t kNoTexture = 0xFFFFFFFF;
+  static const uint32_t kArenaVertices = 64*1024;
+  DrawList();
+  void Reset();
+  const DrawState& state() const { return state_; }
+  void set_state(const DrawState& state) { state_ = state; }
+  //room for count triangles drawn with the current state
+  DrawVertex* AddTriangles(uint32_t count);
+  //v0 v1 v2 and v1 v2 v3
+  void AddQuad(const DrawVertex* v);
+  const DrawVertex* vertices() const { return vertices_.data(); }
+  uint32_t vertex_count() const { return vertex_count_; }
+  const DrawBatch* batches() const { return batches_.data(); }
+  uint32_t batch_count() const { return (uint32_t)batches_.size(); }
+ private:
+  std::vector<DrawVertex> vertices_;
+  std::vector<DrawBatch> batches_;
+  uint32_t vertex_count_;
+  DrawState state_;
+};
+
+}
+
+#endif
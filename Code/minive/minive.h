@@ -20,4 +20,5 @@
 
 #include "context.h"
 #include "d3d11context.h"
+#include "null_context.h"
 //#include "d2d1context.h"
@@ -0,0 +1,60 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#include "context.h"
+#include "null_context.h"
+
+namespace minive {
+
+NullContext::NullContext() {
+  memset(&stats_,0,sizeof(stats_));
+}
+
+NullContext::~NullContext() {
+  Deinitialize();
+}
+
+int NullContext::Initialize(int width, int height, bool vsync, HWND hwnd, bool fullscreen, float depth, float near) {
+  memset(&stats_,0,sizeof(stats_));
+  return S_OK;
+}
+
+int NullContext::Deinitialize() {
+  return S_OK;
+}
+
+int NullContext::Clear() {
+  stats_.frame_batches = 0;
+  stats_.frame_vertices = 0;
+  return S_OK;
+}
+
+int NullContext::Present() {
+  ++stats_.frames;
+  return S_OK;
+}
+
+int NullContext::Draw(const DrawList& list) {
+  stats_.batches += list.batch_count();
+  stats_.vertices += list.vertex_count();
+  stats_.frame_batches += list.batch_count();
+  stats_.frame_vertices += list.vertex_count();
+  return S_OK;
+}
+
+}
@@ -0,0 +1,52 @@
+/*****************************************************************************************************************
+* Copyright (c) 2015 Khalid Ali Al-Kooheji                                                                       *
+*                                                                                                                *
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and              *
+* associated documentation files (the "Software"), to deal in the Software without restriction, including        *
+* without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell        *
+* copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the       *
+* following conditions:                                                                                          *
+*                                                                                                                *
+* The above copyright notice and this permission notice shall be included in all copies or substantial           *
+* portions of the Software.                                                                                      *
+*                                                                                                                *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT          *
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.          *
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, * DAMAGES OR OTHER LIABILITY,      *
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            *
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                                         *
+*****************************************************************************************************************/
+#ifndef MINIVE_NULL_CONTEXT_H
+#define MINIVE_NULL_CONTEXT_H
+
+namespace minive {
+
+/*
+  Backend without a device. Draw only counts the batches and vertices a hardware
+  backend would have been given, so batching can be measured headless.
+*/
+class NullContext : public Context {
+ public:
+  struct Stats {
+    uint64_t frames;
+    uint64_t batches;
+    uint64_t vertices;
+    //of the frame since the last Clear
+    uint32_t frame_batches;
+    uint32_t frame_vertices;
+  };
+  NullContext();
+  ~NullContext();
+  int Initialize(int width, int height, bool vsync, HWND hwnd, bool fullscreen, float depth, float near);
+  int Deinitialize();
+  int Clear();
+  int Present();
+  int Draw(const DrawList& list);
+  const Stats& stats() const { return stats_; }
+ private:
+  Stats stats_;
+};
+
+}
+
+#endif
@@ -57,6 +57,24 @@ int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdL
 {
   unsigned old_fp_state;
   _controlfp_s(&old_fp_state, _PC_53, _MCW_PC);
+#ifdef PSX_BENCHMARK
+  const char* replay = strstr(lpCmdLine,"-gpu-replay=");
+  if (replay != nullptr) {
+    char filename[MAX_PATH];
+    sscanf(replay + strlen("-gpu-replay="),"%259s",filename);
+    emulation::psx::BenchmarkGpuReplay(filename);
+    return 0;
+  }
+  const char* iso_index = strstr(lpCmdLine,"-cd-index=");
+  if (iso_index != nullptr) {
+    char filename[MAX_PATH];
+    sscanf(iso_index + strlen("-cd-index="),"%259s",filename);
+    emulation::psx::BenchmarkIsoIndex(filename);
+    return 0;
+  }
+  emulation::psx::RunBenchmarks();
+  return 0;
+#endif
   /*Array<int> test1;
   std::vector<int> test2;
   
@@ -92,8 +110,13 @@ int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdL
     display_window.Initialize();
     do {
       if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
+        //the gpu posts its frame rate from the presenter thread
+        if (msg.message == emulation::psx::GpuCore::kFpsMessage) {
+          display_window.ShowFps(msg.wParam / 1000.0);
+        } else {
+          TranslateMessage(&msg);
+          DispatchMessage(&msg);
+        }
       } else {
         //display_window.Step();
       }